@@ -125,6 +125,10 @@ case $ARCH in
 	cd "$SRCDIR"/voxind
 	DESTDIR=$DESTDIR_RFS32 IBMTTSDIR=$IBMTTSDIR make clean
 	DESTDIR=$DESTDIR_RFS32 IBMTTSDIR=$IBMTTSDIR make all
+	if [ "$ARCH" = "i686" ]; then
+	    # native engine: direct mode
+	    DESTDIR=$DESTDIR_RFS32 IBMTTSDIR=$IBMTTSDIR make libvoxind.so
+	fi
 	DESTDIR=$DESTDIR_RFS32 IBMTTSDIR=$IBMTTSDIR make install
 	;;
 esac
@@ -57,18 +57,58 @@ typedef enum {
   VOX_NUMBER_MODE = 10, /**< eciNumberMode */
   VOX_WANT_WORD_INDEX = 12, /**< eciWantWordIndex */
   VOX_CAPITALS = 17, /**< capitalization style; first param extending ECIParam  */
+  VOX_FIRST_CHUNK = 18, /**< number of samples of the first audio buffer of an utterance, 0 = disabled */
+  VOX_TEMPO = 19, /**< tempo of the audio in percent, 100 = unchanged */
+  VOX_TRIM_SILENCE = 20, /**< amplitude threshold of the leading and trailing silence to trim, 0 = disabled */
+  VOX_INCREMENTAL = 21, /**< 1: the text is synthesized sentence by sentence, 0 = disabled */
   VOX_NUM_PARAMS,
 } voxParam;
 
 typedef enum {voxFemale, voxMale} voxGender;
 typedef enum {voxAdult, voxChild, voxSenior} voxAge;
 typedef enum {voxCapitalNone=0, voxCapitalSoundIcon=1, voxCapitalSpell=2, voxCapitalPitch=3} voxCapitalMode;
+// from the highest priority (see voxSpeak)
+typedef enum {voxPriorityImportant=0, voxPriorityMessage, voxPriorityText, voxPriorityProgress, voxPriorityNotification} voxPriority;
 
 #define VOX_STR_MAX 128
 
 #define VOX_OK 0
 #define VOX_PARAM_OUT_OF_RANGE -1
 
+#define VOX_TEMPO_MIN 50
+#define VOX_TEMPO_DEFAULT 100
+#define VOX_TEMPO_MAX 300
+
+#define VOX_TRIM_SILENCE_MAX 32767
+
+/**
+   @brief Timeline of an utterance (see voxGetUtteranceTimeline).
+
+   The dates are in microseconds (CLOCK_MONOTONIC), 0 if the step has
+   not occurred.
+*/
+typedef struct {
+  uint64_t text_submitted; /**< first eciAddText() or eciInsertIndex() of the utterance */
+  uint64_t first_tlv_sent; /**< first converted text sent to voxind */
+  uint64_t synthesize; /**< eciSynthesize() */
+  uint64_t first_audio; /**< first samples received */
+  uint64_t last_audio; /**< last samples received */
+  uint64_t end; /**< all the callbacks delivered */
+  uint64_t stop_requested; /**< eciStop() called */
+  uint64_t stop_honored; /**< eciStop() acknowledged by voxind */
+  uint32_t nb_samples; /**< samples received */
+  uint32_t sample_rate; /**< in Hertz */
+  uint32_t nb_messages; /**< audio and event messages received from voxind */
+  uint64_t wait_duration; /**< time spent waiting for voxind (synthesis and IPC) */
+  uint64_t wait_max; /**< longest wait for a message */
+  uint64_t callback_duration; /**< time spent in the user callback */
+  uint64_t callback_max; /**< longest callback */
+  uint32_t ttfa; /**< time to first audio, from text_submitted, in microseconds */
+  float rtf; /**< real-time factor: duration of the synthesis (synthesize to end, callback excluded) divided by the audio duration */
+  uint32_t stop_latency; /**< from stop_requested to stop_honored, in microseconds */
+  uint32_t prefetched; /**< 1 if the audio is supplied by the prefetch (see voxPrefetch) */
+} voxUtteranceTimeline;
+
 /**
    @brief Describe a voice.
 
@@ -135,6 +175,33 @@ int voxGetVoices(vox_t *list, unsigned int *nbVoices);
    Expected value for VOX_CAPITALS: see enum voxCapitalMode.
    Value greater than voxCapitalPitch should be accepted and raise pitch.
 
+   * VOX_FIRST_CHUNK: number of samples of the first audio buffer
+   supplied to the callback for each utterance. The size of the next
+   buffers doubles up to the size set by eciSetOutputBuffer(): a
+   quick first sound, then few callbacks. 0 (default) disables it.
+
+   * VOX_TEMPO: tempo in percent applied by libvoxin to the samples,
+   from VOX_TEMPO_MIN to VOX_TEMPO_MAX, without changing the pitch
+   (e.g. 200: twice faster than the speed set by eciSpeed). 100
+   (default) leaves the samples unchanged. An index reply (or a
+   capital sound icon) is supplied once the time-stretched samples
+   preceding it have been supplied, up to an output buffer later.
+
+   * VOX_TRIM_SILENCE: amplitude (0 to VOX_TRIM_SILENCE_MAX) up to
+   which a sample is silent. The silence at the beginning and at the
+   end of each utterance is shortened to 10 ms before the callback
+   (and before VOX_TEMPO); the events keep their position in the
+   remaining samples, an event within a pause is supplied at the
+   beginning of the pause. 0 (default) disables it.
+
+   * VOX_INCREMENTAL: 1 to synthesize the input sentence by sentence.
+   The text and indices are kept by libvoxin; eciSynthesize() sends
+   and synthesizes the first sentence only, the next one is sent once
+   the previous one has been supplied to the callback (eciSynchronize()
+   or eciSpeaking()): the first audio does not wait for the whole
+   text. The indices are supplied in the same order. A text
+   containing markup (SSML) is not split. 0 (default) disables it.
+
    @param handle  instance created by eciNew() or eciNewEx()
    @param param
    @param value
@@ -142,6 +209,172 @@ int voxGetVoices(vox_t *list, unsigned int *nbVoices);
 */
 int voxSetParam(void *handle, voxParam param, int value);
 
+/**
+   @brief Set the number of idle engines prepared in advance.
+
+   The engines are created in the background; eciNew() or eciNewEx()
+   then supplies an engine already initialized. A deleted engine is
+   reset and returns to the idle engines if their number is below the
+   requested value.
+
+   This function concerns the IBM TTS voices; the default number is
+   read from voxin.ini (enginePool parameter).
+
+   @param[in] id  language (vox_t.id) of the idle engines; 0 for any
+   language (including the engines created by eciNew())
+   @param[in] number  number of idle engines (from 0 to 4); 0 to
+   release the idle engines
+   @return int  VOX_OK on success
+*/
+int voxSetEnginePool(uint32_t id, unsigned int number);
+
+/**
+   @brief Synthesize in advance the text likely to be spoken next.
+
+   The text is synthesized in the background, when the engine is
+   idle. If the next eciAddText() and eciSynthesize() supply the same
+   text with the same parameters, the prefetched audio is supplied to
+   the callback without waiting for the synthesis; otherwise the text
+   is synthesized as usual.
+
+   A new call replaces the previous prefetch; eciStop() cancels it.
+   The prefetched audio is only supplied to the callback (output
+   buffer) and the text must not switch the language.
+
+   The prefetched audio is bounded (1 MB), the synthesis of the rest
+   resumes when the text is spoken. There is no prefetch under a
+   real-time scheduling (realtime=rr or fifo in voxin.ini).
+   voxGetUtteranceTimeline() tells if an utterance was prefetched.
+
+   This function concerns the IBM TTS voices.
+
+   @param[in] handle  instance created by eciNew() or eciNewEx()
+   @param[in] text  null terminated text, as supplied to eciAddText()
+   @return int  VOX_OK if the prefetch is started,
+   VOX_PARAM_OUT_OF_RANGE otherwise
+*/
+int voxPrefetch(void *handle, const char *text);
+
+/**
+   @brief Queue an utterance with a priority.
+
+   The utterances are spoken by a thread of libvoxin in priority
+   order (first in, first out for a same priority), sentence by
+   sentence; the callback is called from this thread. An utterance of
+   higher priority preempts the current one at the next audio buffer:
+
+   * voxPriorityImportant: never preempted.
+
+   * voxPriorityMessage: once preempted, resumed after the utterances
+   of higher priority, from the start of the interrupted sentence (a
+   text with SSML or ECI annotations is spoken again from its
+   beginning).
+
+   * voxPriorityText: discarded if preempted.
+
+   * voxPriorityProgress: discarded if preempted; a new progress
+   replaces the queued one.
+
+   * voxPriorityNotification: discarded if another utterance is
+   queued or spoken, or if preempted.
+
+   eciStop() discards the queued utterances and stops the current
+   one; eciSpeaking() returns ECITrue while an utterance is queued or
+   spoken. Once voxSpeak() is used, the other functions of synthesis
+   (eciAddText(), eciSynthesize(), eciSynchronize()) must not be
+   called for this handle.
+
+   @param[in] handle  instance created by eciNew() or eciNewEx()
+   @param[in] text  null terminated text, as supplied to eciAddText()
+   @param[in] priority
+   @return int  VOX_OK on success
+*/
+int voxSpeak(void *handle, const char *text, voxPriority priority);
+
+/**
+   @brief Supply the timeline of the current or last utterance.
+
+   An utterance starts with the first eciAddText() or eciInsertIndex()
+   following the end of the previous one (eciSynchronize(),
+   eciSpeaking() returning ECIFalse, or eciStop()). The timeline is
+   updated as the utterance progresses; the derived values (ttfa,
+   rtf, stop_latency) are 0 until their steps have occurred.
+
+   The time spent waiting for voxind covers the synthesis by the
+   engine and the IPC; the time spent in the callback is the share of
+   the host.
+
+   @param[in] handle  instance created by eciNew() or eciNewEx()
+   @param[out] timeline  allocated by the caller
+   @return int  VOX_OK on success
+*/
+int voxGetUtteranceTimeline(void *handle, voxUtteranceTimeline *timeline);
+
+/**
+   @brief Memory allocated for an engine (see voxGetMemory), in bytes.
+*/
+typedef struct {
+  uint32_t libvoxin; /**< engine in libvoxin (structure, delayed events) */
+  uint32_t libvoxin_engines; /**< all the engines and the shared conversion buffers of libvoxin */
+  uint32_t voxind; /**< engine in voxind (structure, output and message buffers, prefetch) */
+  uint32_t voxind_engines; /**< all the engines of voxind */
+} voxMemory;
+
+/**
+   @brief Supply the memory allocated for an engine.
+
+   The engine of the other tts (voice switch) is included. The
+   voxind counters are 0 if voxind is older than libvoxin.
+
+   @param[in] handle  instance created by eciNew() or eciNewEx()
+   @param[out] memory  allocated by the caller
+   @return int  VOX_OK on success
+*/
+int voxGetMemory(void *handle, voxMemory *memory);
+
+/**
+   @brief Receives the samples of voxRenderDocument() in the order
+   of the document.
+
+   @param[in] samples  16 bits samples (host order)
+   @param[in] nb  number of samples
+   @param[in] data  as supplied to voxRenderDocument()
+   @return int  0 to go on, otherwise the rendering is aborted
+*/
+typedef int (*voxRenderSink)(const short *samples, unsigned int nb, void *data);
+
+/**
+   @brief Synthesize a long document using several engines in
+   parallel.
+
+   The text is split at the end of the sentences in chunks of a few
+   hundred bytes (a text containing markup is not split). Each job
+   synthesizes the next chunks with an engine and a voxind of its
+   own; the samples are supplied to the sink from the calling thread,
+   once per chunk, strictly in the order of the text. A job does not
+   synthesize more than two chunks per job ahead of the chunk being
+   supplied, which bounds the memory.
+
+   The function returns once the whole document has been supplied or
+   on error. The jobs do not use the direct mode (voxin.ini).
+
+   @param[in] text  text, as supplied to eciAddText()
+   @param[in] len  length of text in bytes (up to a null terminator)
+   @param[in] voice  vox_t.id of the voice (see voxGetVoices()), 0
+   for the default voice (as eciNew())
+   @param[in] params  NULL or an array of VOX_NUM_PARAMS values set by
+   voxSetParam() for each engine; a negative value leaves the
+   parameter unchanged
+   @param[in] sink  receives the samples
+   @param[in] data  supplied to sink
+   @param[in] jobs  number of engines (up to 32), 0 for the number of
+   processors
+   @return int  VOX_OK if the whole document has been supplied to
+   sink, VOX_PARAM_OUT_OF_RANGE otherwise
+*/
+int voxRenderDocument(const char *text, size_t len, uint32_t voice, const int *params,
+		      voxRenderSink sink, void *data, unsigned int jobs);
+
 /**
    @brief convert vox_t to string
 
@@ -0,0 +1,235 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "broker.h"
+#include "debug.h"
+
+#define BROKER_BACKLOG 8
+#define BROKER_LOCK_SUFFIX ".lock"
+
+// broker_get_address fills addr with path
+static int broker_get_address(struct sockaddr_un *addr, const char *path)
+{
+  if (!path || (strlen(path) >= sizeof(addr->sun_path)))
+    return EINVAL;
+
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  strcpy(addr->sun_path, path);
+  return 0;
+}
+
+// broker_get_peer returns the credentials of the peer
+static int broker_get_peer(int fd, struct ucred *cred)
+{
+  socklen_t len = sizeof(*cred);
+
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, cred, &len))
+    return errno;
+  return 0;
+}
+
+// broker_lock waits for the lock file of the socket path: the
+// startup and the exit of the brokers are serialized; returns 0 or an
+// errno, lock_fd is closed by broker_unlock
+static int broker_lock(const char *path, int *lock_fd)
+{
+  char lock[sizeof(((struct sockaddr_un*)0)->sun_path) + sizeof(BROKER_LOCK_SUFFIX)];
+  int fd;
+
+  snprintf(lock, sizeof(lock), "%s%s", path, BROKER_LOCK_SUFFIX);
+  fd = open(lock, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd == -1)
+    return errno;
+  while (flock(fd, LOCK_EX)) {
+    if (errno != EINTR) {
+      int res = errno;
+      close(fd);
+      return res;
+    }
+  }
+  *lock_fd = fd;
+  return 0;
+}
+
+static void broker_unlock(int lock_fd)
+{
+  close(lock_fd); // releases the lock
+}
+
+int broker_get_path(char *path, size_t len, const char *tts)
+{
+  const char *dir = getenv("XDG_RUNTIME_DIR");
+  size_t n;
+
+  if (!path || !tts)
+    return EINVAL;
+
+  if (dir && (*dir == '/'))
+    n = snprintf(path, len, "%s/voxin/voxind-%s", dir, tts);
+  else
+    n = snprintf(path, len, "/tmp/voxin-%u/voxind-%s", (unsigned int)getuid(), tts);
+  if (n >= len)
+    return ENAMETOOLONG;
+  return 0;
+}
+
+int broker_listen(const char *path, int *fd)
+{
+  struct sockaddr_un addr;
+  char dir[sizeof(addr.sun_path)];
+  char *s;
+  struct stat buf;
+  int lock_fd = -1;
+  int res;
+  int sd = -1;
+
+  ENTER();
+
+  if (!fd || broker_get_address(&addr, path))
+    return EINVAL;
+
+  // the directory is only accessible by the user
+  strcpy(dir, path);
+  s = strrchr(dir, '/');
+  if (!s || (s == dir))
+    return EINVAL;
+  *s = 0;
+  if (mkdir(dir, 0700) && (errno != EEXIST))
+    return errno;
+  if (lstat(dir, &buf))
+    return errno;
+  if (!S_ISDIR(buf.st_mode) || (buf.st_uid != getuid()) || (buf.st_mode & 0077)) {
+    err("unsafe directory %s", dir);
+    return EPERM;
+  }
+
+  res = broker_lock(path, &lock_fd);
+  if (res)
+    return res;
+
+  sd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (sd == -1) {
+    res = errno;
+    goto exit0;
+  }
+
+  // under the lock, a broker is either listening or gone: a socket
+  // nobody listens to is stale
+  if (bind(sd, (struct sockaddr*)&addr, sizeof(addr))) {
+    res = errno;
+    if (res == EADDRINUSE) {
+      int c = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+      if ((c != -1) && !connect(c, (struct sockaddr*)&addr, sizeof(addr))) {
+	close(c);
+	goto exit0;
+      }
+      if (c != -1)
+	close(c);
+      unlink(path);
+      res = bind(sd, (struct sockaddr*)&addr, sizeof(addr)) ? errno : 0;
+    }
+    if (res)
+      goto exit0;
+  }
+
+  if (listen(sd, BROKER_BACKLOG)) {
+    res = errno;
+    unlink(path);
+    goto exit0;
+  }
+
+  broker_unlock(lock_fd);
+  *fd = sd;
+  dbg("LEAVE, listen on %s", path);
+  return 0;
+
+ exit0:
+  if (sd != -1)
+    close(sd);
+  broker_unlock(lock_fd);
+  dbg("LEAVE, %s: %s", path, strerror(res));
+  return res;
+}
+
+void broker_close(const char *path, int listen_fd)
+{
+  int lock_fd = -1;
+  bool locked;
+
+  // a broker starting meanwhile must not find this socket unlinked
+  // after its bind
+  locked = !broker_lock(path, &lock_fd);
+  unlink(path);
+  close(listen_fd);
+  if (locked)
+    broker_unlock(lock_fd);
+}
+
+int broker_accept(int listen_fd, int *fd)
+{
+  struct ucred cred;
+  int sd;
+
+  if (!fd)
+    return EINVAL;
+
+  do {
+    sd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+  } while ((sd == -1) && (errno == EINTR));
+  if (sd == -1)
+    return errno;
+
+  if (broker_get_peer(sd, &cred) || (cred.uid != getuid())) {
+    err("connection refused (uid=%d)", cred.uid);
+    close(sd);
+    return EPERM;
+  }
+  dbg("client pid=%d", cred.pid);
+  *fd = sd;
+  return 0;
+}
+
+int broker_connect(const char *path, int *fd)
+{
+  struct sockaddr_un addr;
+  struct ucred cred;
+  int res;
+  int sd;
+
+  if (!fd || broker_get_address(&addr, path))
+    return EINVAL;
+
+  sd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (sd == -1)
+    return errno;
+
+  if (connect(sd, (struct sockaddr*)&addr, sizeof(addr))) {
+    res = errno;
+    goto exit0;
+  }
+
+  // the broker must belong to the user
+  res = broker_get_peer(sd, &cred);
+  if (!res && (cred.uid != getuid()))
+    res = EPERM;
+  if (res)
+    goto exit0;
+
+  *fd = sd;
+  return 0;
+
+ exit0:
+  close(sd);
+  dbg("%s: %s", path, strerror(res));
+  return res;
+}
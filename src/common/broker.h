@@ -0,0 +1,51 @@
+#ifndef BROKER_H
+#define BROKER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+  voxind broker: a per-user voxind listening on a Unix socket, started
+  on demand by libvoxin. For each connection, the broker forks a
+  voxind worker which serves this client only (its own engines); the
+  workers share the engine library and the idle engine already
+  initialized by the broker.
+
+  The worker sends its pid (struct broker_hello_t) and then processes
+  the messages as a spawned voxind.
+*/
+
+// argv[1] of voxind in broker mode, argv[2] is the socket path
+#define BROKER_ARG "--broker"
+
+// the broker exits after this delay without any worker
+#define BROKER_LINGER_IN_MS 60000
+
+struct broker_hello_t {
+  int32_t pid; // pid of the worker
+};
+
+// broker_get_path returns in path the socket of the broker of the
+// user for the tts (e.g. "eci"): $XDG_RUNTIME_DIR/voxin/voxind-<tts>
+// or /tmp/voxin-<uid>/voxind-<tts>; returns 0 or an errno
+extern int broker_get_path(char *path, size_t len, const char *tts);
+
+// broker_listen creates the socket (and its directory); a stale
+// socket is replaced, EADDRINUSE is returned if a broker is already
+// listening. The startups are serialized by a lock file (path.lock).
+extern int broker_listen(const char *path, int *fd);
+
+// broker_close removes the socket of the exiting broker (under the
+// lock file) and closes listen_fd
+extern void broker_close(const char *path, int listen_fd);
+
+// broker_accept returns in fd a connection from the same user;
+// returns 0 or an errno
+extern int broker_accept(int listen_fd, int *fd);
+
+// broker_connect connects to the broker of the user; returns 0 or an
+// errno (e.g. ENOENT, ECONNREFUSED if no broker)
+extern int broker_connect(const char *path, int *fd);
+
+#endif
@@ -18,6 +18,7 @@ static enum libvoxinDebugLevel myDebugLevel = LV_ERROR_LEVEL;
 FILE *libvoxinDebugText = NULL;
 static size_t debugTextCount = 0; // number of bytes written to libvoxinDebugText
 static int checkEnableCount = 0;
+static const char *debugTag = ""; // suffix of the filenames
 #define MAX_POS 1024*1024
 #define MIN_POS 10*1024
 
@@ -107,19 +108,24 @@ static void DebugFileInit()
   }
   fclose(fd);
 
-  if (snprintf(filename, MAX_FILENAME, LIBVOXINLOG, libvoxinDebugGetTid()) >= MAX_FILENAME)
+  if (snprintf(filename, MAX_FILENAME, LIBVOXINLOG "%s", libvoxinDebugGetTid(), debugTag) >= MAX_FILENAME)
 	return;
   
   if (createDebugFile(filename, &libvoxinDebugFile))
 	return;
   
-  if (snprintf(filename, MAX_FILENAME, LIBVOXINLOG ".txt", libvoxinDebugGetTid()) >= MAX_FILENAME)
+  if (snprintf(filename, MAX_FILENAME, LIBVOXINLOG "%s.txt", libvoxinDebugGetTid(), debugTag) >= MAX_FILENAME)
 	return;
   
   debugTextCount = 0;
   createDebugFile(filename, &libvoxinDebugText);
 }
 
+void libvoxinDebugSetTag(const char *tag)
+{
+  debugTag = tag ? tag : "";
+}
+
 void libvoxinDebugFinish()
 {
   deleteDebugFile(&libvoxinDebugFile);  
@@ -128,6 +134,22 @@ void libvoxinDebugFinish()
   checkEnableCount = 0;
 }
 
+// libvoxinDebugElapsed returns the microseconds elapsed since *t and
+// sets *t to the current time (monotonic clock)
+long libvoxinDebugElapsed(struct timespec *t)
+{
+  struct timespec now;
+  long us = 0;
+
+  if (!t || clock_gettime(CLOCK_MONOTONIC, &now))
+    return 0;
+
+  if (t->tv_sec || t->tv_nsec)
+    us = (now.tv_sec - t->tv_sec)*1000000 + (now.tv_nsec - t->tv_nsec)/1000;
+  *t = now;
+  return us;
+}
+
 int libvoxinDebugEnabled(enum libvoxinDebugLevel level)
 {
 	if (!libvoxinDebugFile) {
@@ -7,6 +7,7 @@ extern "C" {
 
 #include <stdint.h>
 #include <stdio.h>
+#include <time.h>
 #include "msg.h"
 
 
@@ -37,6 +38,11 @@ extern "C" {
   extern size_t libvoxinDebugTextWrite(const char *text, size_t len);
   extern void libvoxinDebugDump(const char *label, const uint8_t *buf, size_t size);
   extern void libvoxinDebugFinish();
+  // libvoxinDebugSetTag sets the suffix of the log filenames, e.g. to
+  // distinguish two components of the same process; to call before
+  // any log
+  extern void libvoxinDebugSetTag(const char *tag);
+  extern long libvoxinDebugElapsed(struct timespec *t);
   extern FILE *libvoxinDebugFile;  
   extern FILE *libvoxinDebugText;  
 
@@ -0,0 +1,34 @@
+#ifndef DIRECT_H
+#define DIRECT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "msg.h"
+
+/*
+  Direct mode: voxind built as a library (libvoxind.so) is loaded in
+  the process of libvoxin when the eci engine has the architecture of
+  this process. The messages are passed to unserialize without any pipe;
+  the callback messages are passed to libvoxin by app.
+*/
+
+// direct_app_cb processes the callback message m in libvoxin and
+// returns the value returned by the user callback
+typedef uint32_t (*direct_app_cb)(struct msg_t *m, void *data);
+
+// direct_create_t inits voxind; returns 0 or an errno
+typedef int (*direct_create_t)(direct_app_cb app, void *data);
+
+// direct_call_t processes msg (msg_length bytes) and replaces it by
+// the reply; returns 0 or an errno
+typedef int (*direct_call_t)(struct msg_t *msg, size_t *msg_length);
+
+// direct_delete_t deletes the engines
+typedef void (*direct_delete_t)();
+
+// symbols exported by libvoxind
+#define DIRECT_CREATE "voxind_direct_create"
+#define DIRECT_CALL "voxind_direct_call"
+#define DIRECT_DELETE "voxind_direct_delete"
+
+#endif
@@ -48,6 +48,12 @@ static const char *msg[] = {
   "vox_get_voices",  
   "vox_set_param",  
   "vox_get_versions",  
+  "vox_set_engine_pool",  
+  "vox_set_state",  
+  "vox_load_dictionaries",  
+  "vox_prefetch",
+  "vox_set_realtime",  
+  "vox_get_memory",
   "max",
 };
 
@@ -5,7 +5,18 @@
 #include <stddef.h>
 
 // MSG_API defines the version of msg.h
-#define MSG_API                0x00010000
+#define MSG_API                0x00010600
+// MSG_API_SET_STATE: first version supporting MSG_VOX_SET_STATE
+#define MSG_API_SET_STATE      0x00010100
+// MSG_API_EVENTS: first version attaching the events to the buffer
+// messages (see msg_event_t)
+#define MSG_API_EVENTS         0x00010300
+// MSG_API_PREFETCH: first version supporting MSG_VOX_PREFETCH
+#define MSG_API_PREFETCH       0x00010400
+// MSG_API_REALTIME: first version supporting MSG_VOX_SET_REALTIME
+#define MSG_API_REALTIME       0x00010500
+// MSG_API_MEMORY: first version supporting MSG_VOX_GET_MEMORY
+#define MSG_API_MEMORY         0x00010600
 #define MSG_GET_VERSIONS_MAGIC 0x12345678
 typedef enum {MSG_TTS_UNDEFINED=0, MSG_TTS_ECI, MSG_TTS_NVE, MSG_TTS_MAX} msg_tts_id;
 #define MSG_TO_APP_ID   0x110A0005
@@ -71,6 +82,12 @@ enum msg_type {
   MSG_VOX_GET_VOICES,
   MSG_VOX_SET_PARAM,
   MSG_GET_VERSIONS,
+  MSG_VOX_SET_ENGINE_POOL,
+  MSG_VOX_SET_STATE,
+  MSG_VOX_LOAD_DICTIONARIES,
+  MSG_VOX_PREFETCH,
+  MSG_VOX_SET_REALTIME,
+  MSG_VOX_GET_MEMORY,
   MSG_MAX
 };
 
@@ -148,6 +165,28 @@ struct msg_new_ex_t {
   uint32_t Value;
 } __attribute__ ((packed));
 
+// MSG_ENGINE_POOL_ANY: msg_set_engine_pool_t.Value for any language
+#define MSG_ENGINE_POOL_ANY 0xFFFFFFFF
+struct msg_set_engine_pool_t {
+  uint32_t Value; // language, 0 for eciNew() or MSG_ENGINE_POOL_ANY
+  uint32_t nb; // number of idle engines to keep
+} __attribute__ ((packed));
+
+// MSG_VOX_SET_STATE: data supplied in msg_t.data
+// the flags indicate the fields to apply
+#define MSG_STATE_CALLBACK        0x01 // callback
+#define MSG_STATE_OUTPUT_BUFFER   0x02 // nb_samples
+#define MSG_STATE_OUTPUT_FILENAME 0x04 // filename
+#define MSG_STATE_VOICE_PARAM_MAX 16
+struct msg_vox_set_state_t {
+  uint32_t flags;
+  uint32_t callback; // as msg_register_callback_t.Callback
+  uint32_t nb_samples; // as msg_set_output_buffer_t.nb_samples
+  uint32_t voice_param_mask; // bit i set: apply voice_param[i] to voice 0
+  uint32_t voice_param[MSG_STATE_VOICE_PARAM_MAX];
+  char filename[0]; // null terminated string
+} __attribute__ ((packed));
+
 struct msg_pause_t {
   uint32_t On;
 } __attribute__ ((packed));
@@ -174,8 +213,55 @@ struct msg_load_dict_t {
   uint32_t DictVol;
 } __attribute__ ((packed));
 
+// MSG_VOX_LOAD_DICTIONARIES: the directory is supplied in msg_t.data
+struct msg_load_dictionaries_t {
+  uint32_t deferred; // if set, load after the reply, before the next synthesis
+} __attribute__ ((packed));
+
+// MSG_VOX_SET_REALTIME: scheduling of the voxind command loop and
+// locking of its message buffers.
+// voxind replies the applied policy and priority (after fallback),
+// lock_memory=1 if the buffers are locked, and in msg_t.res the
+// worst scheduling latency measured in microseconds
+struct msg_set_realtime_t {
+  uint32_t policy; // realtime_policy_t
+  int32_t priority;
+  uint32_t lock_memory;
+} __attribute__ ((packed));
+
+// MSG_VOX_GET_MEMORY: voxind replies the bytes allocated for the
+// engine and for all its engines (see engine_account)
+struct msg_get_memory_t {
+  uint32_t engine;
+  uint32_t engines;
+} __attribute__ ((packed));
+
+// MSG_SYNTHESIZE: voxind replies prefetched=1 if the audio is
+// supplied by the prefetch of the engine (MSG_VOX_PREFETCH)
+struct msg_synthesize_t {
+  uint32_t prefetched;
+} __attribute__ ((packed));
+
 struct msg_callback_t {
   uint32_t lParam;
+  uint32_t nb_events; // number of msg_event_t after the data
+} __attribute__ ((packed));
+
+/*
+  Events (index replies, capital sound icons) do not get their own
+  round trip: voxind queues them and appends them to the data of the
+  next buffer message (MSG_CB_WAVEFORM_BUFFER or
+  MSG_CB_PHONEME_BUFFER). The events are dispatched in order, at
+  their offset in the samples of the waveform message (before the
+  data of a phoneme message).
+  The remaining events are sent in a buffer message without samples
+  when the queue is full and at the end of the synthesis.
+*/
+#define MSG_EVENT_MAX 64
+struct msg_event_t {
+  uint32_t msg; // ECIMessage; eciWaveformBuffer: capital sound icon
+  uint32_t lParam; // index or MSG_PREPEND_CAPITAL(S)
+  uint32_t offset; // position of the event in the samples of the message
 } __attribute__ ((packed));
 
 union args_t {
@@ -187,13 +273,18 @@ union args_t {
   struct msg_set_output_device_t sod;
   struct msg_register_callback_t rc;
   struct msg_new_ex_t ne;
+  struct msg_set_engine_pool_t ep;
   struct msg_pause_t p;
   struct msg_insert_index_t ii;
   struct msg_copy_voice_t cv;
   struct msg_set_dict_t sd;
   struct msg_delete_dict_t dd;
   struct msg_load_dict_t ld;
+  struct msg_load_dictionaries_t lds;
   struct msg_callback_t cb;
+  struct msg_set_realtime_t rt;
+  struct msg_synthesize_t sy;
+  struct msg_get_memory_t gm;
 } __attribute__ ((packed));
 
 struct msg_t {
@@ -116,6 +116,36 @@ int pipe_restore(struct pipe_t **px, int fd, unsigned int read_timeout_in_ms)
 }
 
 
+int pipe_connect(struct pipe_t **px, int fd, unsigned int read_timeout_in_ms)
+{
+  int res = 0;
+  
+  ENTER();
+
+  if (!px)
+    return EINVAL;
+
+  res = pipe_alloc(px);
+  if (res)
+    goto exit0;
+
+  (*px)->sv[PIPE_SOCKET_PARENT] = fd;
+  (*px)->sv[PIPE_SOCKET_CHILD_INDEX] = -1;
+  (*px)->ind = PIPE_SOCKET_PARENT;
+  (*px)->read_timeout_in_ms = read_timeout_in_ms;
+
+ exit0:
+  if (res) {
+    pipe_free(px);
+	dbg("[pid=%lu] LEAVE", libvoxinDebugGetTid());	
+  } else {
+	dbg("[pid=%lu] LEAVE (0:%d, 1:%d)", libvoxinDebugGetTid(), (*px)->sv[0], (*px)->sv[1]);	
+  }
+
+  return res;
+}
+
+
 int pipe_delete(struct pipe_t **px)
 {
   ENTER();
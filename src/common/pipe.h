@@ -21,6 +21,8 @@ struct pipe_t {
 extern int pipe_create(struct pipe_t **px, unsigned int read_timeout_in_ms);
 extern int pipe_delete(struct pipe_t **px);
 extern int pipe_restore(struct pipe_t **px, int fd, unsigned int read_timeout_in_ms);
+// pipe_connect: parent side on a connected socket (voxind broker)
+extern int pipe_connect(struct pipe_t **px, int fd, unsigned int read_timeout_in_ms);
 extern int pipe_dup2(struct pipe_t *p, int index, int new_fd);
 extern int pipe_close(struct pipe_t *p, int index);
 extern int pipe_read(struct pipe_t *p, void *buf, ssize_t *len);
@@ -0,0 +1,106 @@
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "realtime.h"
+#include "debug.h"
+
+#define ONE_MS_IN_NS 1000000
+
+// thread id (the nice value and the policy are per thread on Linux)
+static pid_t realtime_tid()
+{
+  return (pid_t)syscall(SYS_gettid);
+}
+
+static int realtime_set_nice(int value)
+{
+  if (setpriority(PRIO_PROCESS, realtime_tid(), value)) {
+    int res = errno;
+    dbg("nice %d denied (%d)", value, res);
+    return res;
+  }
+  return 0;
+}
+
+realtime_policy_t realtime_set_scheduling(realtime_policy_t policy, int *priority)
+{
+  struct sched_param param;
+  int sched_policy;
+
+  ENTER();
+
+  if (!priority)
+    return REALTIME_NONE;
+
+  switch (policy) {
+  case REALTIME_RR:
+  case REALTIME_FIFO:
+    sched_policy = (policy == REALTIME_RR) ? SCHED_RR : SCHED_FIFO;
+    if (*priority < sched_get_priority_min(sched_policy))
+      *priority = sched_get_priority_min(sched_policy);
+    else if (*priority > sched_get_priority_max(sched_policy))
+      *priority = sched_get_priority_max(sched_policy);
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = *priority;
+    if (!sched_setscheduler(realtime_tid(), sched_policy, &param)) {
+      msg("policy=%s, priority=%d", (policy == REALTIME_RR) ? "rr" : "fifo", *priority);
+      return policy;
+    }
+    msg("real-time policy denied (%d), fallback to nice", errno);
+    *priority = REALTIME_FALLBACK_NICE;
+    // fall through
+  case REALTIME_NICE:
+    if (!realtime_set_nice(*priority)) {
+      msg("nice=%d", *priority);
+      return REALTIME_NICE;
+    }
+    msg("nice denied, scheduling unchanged");
+    break;
+  default:
+    break;
+  }
+  *priority = 0;
+  return REALTIME_NONE;
+}
+
+int realtime_lock(const void *buf, size_t len)
+{
+  if (!buf || !len)
+    return EINVAL;
+  if (mlock(buf, len)) {
+    int res = errno;
+    msg("mlock denied (%d), len=%lu", res, (unsigned long)len);
+    return res;
+  }
+  return 0;
+}
+
+void realtime_unlock(const void *buf, size_t len)
+{
+  if (buf && len)
+    munlock(buf, len);
+}
+
+long realtime_measure_latency(int nb)
+{
+  long max = 0;
+  int i;
+
+  for (i=0; i<nb; i++) {
+    struct timespec t0, t1, req = {.tv_sec=0, .tv_nsec=ONE_MS_IN_NS};
+    long delay;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    nanosleep(&req, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    delay = ((t1.tv_sec - t0.tv_sec)*1000000000 + t1.tv_nsec - t0.tv_nsec - ONE_MS_IN_NS)/1000;
+    if (delay > max)
+      max = delay;
+  }
+  dbg("latency max=%ld us (%d sleeps)", max, nb);
+  return max;
+}
@@ -0,0 +1,33 @@
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include <stddef.h>
+
+// scheduling of the audio path (voxind command loop, libvoxin
+// threads)
+typedef enum {
+  REALTIME_NONE=0, // unchanged
+  REALTIME_NICE, // priority: nice value
+  REALTIME_RR, // priority: SCHED_RR priority
+  REALTIME_FIFO, // priority: SCHED_FIFO priority
+} realtime_policy_t;
+
+// nice value if the real-time policy is denied
+#define REALTIME_FALLBACK_NICE -10
+
+// realtime_set_scheduling applies the policy to the calling thread.
+// If it is denied (e.g. EPERM without CAP_SYS_NICE or RLIMIT_RTPRIO),
+// falls back to REALTIME_NICE with REALTIME_FALLBACK_NICE, and then to
+// REALTIME_NONE. Returns the applied policy, *priority is updated.
+extern realtime_policy_t realtime_set_scheduling(realtime_policy_t policy, int *priority);
+
+// realtime_lock locks the buffer in memory (no page fault); returns
+// 0 or an errno (e.g. ENOMEM over RLIMIT_MEMLOCK)
+extern int realtime_lock(const void *buf, size_t len);
+extern void realtime_unlock(const void *buf, size_t len);
+
+// realtime_measure_latency returns the worst wake up delay in
+// microseconds of nb sleeps of one millisecond
+extern long realtime_measure_latency(int nb);
+
+#endif
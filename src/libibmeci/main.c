@@ -192,6 +192,25 @@ enum ECIDictError eciLoadDict(ECIHand hEngine, ECIDictHand hDict, enum ECIDictVo
   return DictFileNotFound;
 }
 
+enum ECIDictError eciUpdateDict(ECIHand hEngine, ECIDictHand hDict, enum ECIDictVolume DictVol, ECIInputText pKey, ECIInputText pTranslationValue)
+{
+  ENTER();
+  return DictNoError;
+}
+
+// parenthesized: eci.h defines the macros of the same name
+enum ECIDictError (eciDictFindFirst)(ECIHand hEngine, ECIDictHand hDict, enum ECIDictVolume DictVol, ECIInputText *ppKey, ECIInputText *ppTranslationValue)
+{
+  ENTER();
+  return DictNoEntry;
+}
+
+enum ECIDictError (eciDictFindNext)(ECIHand hEngine, ECIDictHand hDict, enum ECIDictVolume DictVol, ECIInputText *ppKey, ECIInputText *ppTranslationValue)
+{
+  ENTER();
+  return DictNoEntry;
+}
+
 Boolean eciClearInput(ECIHand hEngine)
 {
   ENTER();
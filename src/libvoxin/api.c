@@ -5,16 +5,22 @@
 #include <stdbool.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <time.h>
 #include <endian.h>
 #include <ctype.h>
 #include <sys/types.h>
-#include <dirent.h>
+#include <sys/stat.h>
 #include "voxin.h"
 #include "debug.h"
 #include "libvoxin.h"
 #include "msg.h"
 #include "inote.h"
 #include "config.h"
+#include "queue.h"
+#include "stretch.h"
+#include "trim.h"
+#include "render.h"
+#include "realtime.h"
 
 #define FILTER_SSML 1
 #define FILTER_PUNC 2
@@ -29,6 +35,7 @@
 #define LOCAL_CONFIG_FILE  ".config/voxin/voxin.ini"
 #define INSTALL_CONFIG_FILE "var/opt/oralux/voxin/voxin.ini"
 #define VOX_INDEX_UNDEFINED UINT32_MAX
+#define REALTIME_DEFAULT_PRIORITY 10 // rr, fifo
 
 typedef struct {
   int major;
@@ -43,11 +50,41 @@ typedef struct {
   version_t tts;
 } voxind_version_t;
 
+// utterance_state_t: progress of the utterance of an engine, updated
+// by the calls and the callback stream; eciSpeaking asks voxind only
+// if callbacks may be pending
+typedef enum {
+  UTTERANCE_IDLE, // no input
+  UTTERANCE_QUEUED, // input added, not yet synthesized
+  UTTERANCE_SPEAKING, // synthesis in progress, callbacks pending
+  UTTERANCE_DRAINED, // the callbacks have been delivered
+  UTTERANCE_ABORTED, // stopped by eciStop or by the callback
+} utterance_state_t;
+
+// input_t: input of the incremental synthesis (VOX_INCREMENTAL) not
+// yet sent to voxind
+typedef enum {INPUT_TEXT, INPUT_INDEX, INPUT_SYNTHESIZE} input_type;
+struct input_t {
+  input_type type;
+  char *text; // INPUT_TEXT
+  size_t offset; // text already sent
+  bool whole; // text not split in sentences
+  int index; // INPUT_INDEX
+  struct input_t *next;
+};
+
+// a sentence of the incremental synthesis has at least this number of
+// bytes (shorter ones are sent with the next one)
+#define SENTENCE_LENGTH_MIN 16
+
 struct engine_t {
   uint32_t id; // structure identifier
   struct api_t *api; // parent api
   uint32_t handle;
   struct engine_t *current_engine;
+  // other_engine: engine of the other tts, kept until eciDelete; a
+  // switch to a voice of the same tts only changes the language of
+  // the current engine
   struct engine_t *other_engine; 
   msg_tts_id tts_id;
   void *cb; // user callback
@@ -70,14 +107,66 @@ struct engine_t {
   inote_charset_t to_charset; // charset expected by the tts engine
   uint32_t vox_index; // index of the voice in vox_list[tts_id][]
   uint32_t voice_param[eciNumVoiceParams];
+  uint32_t voice_param_dirty; // bit i set: voice_param[i] not yet copied to the other engine
+  // shadow of the engine values: bit i set in known: the value is
+  // answered locally, bit i set in pending: voice_param[i] not yet
+  // sent to voxind (see engine_flush_params)
+  uint32_t voice_param_known;
+  uint32_t voice_param_pending;
+  // annotated: the input of the utterance may change the params
+  // (ECI annotations, SSML); the shadow is not used until the next
+  // utterance
+  bool annotated;
+  // params of the preset voices (iVoice 1 to ECI_PRESET_VOICES), bit
+  // i set in preset_dirty[]: preset_param[][i] not yet copied to the
+  // other engine
+  uint32_t preset_param[ECI_PRESET_VOICES][eciNumVoiceParams];
+  uint32_t preset_dirty[ECI_PRESET_VOICES];
+  uint32_t param[VOX_NUM_PARAMS];
+  uint32_t param_known;
+  uint32_t param_set; // bit i set: param[i] set by the user, replayed by engine_replay
   uint32_t state_expected_lang[MAX_LANG]; // state internal buffer 
-  uint8_t tlv_message_buffer[TLV_MESSAGE_LENGTH_MAX]; // tlv internal buffer
-  inote_slice_t tlv_message;
+  inote_slice_t tlv_message; // in api->scratch
   inote_state_t state;
-  uint8_t text_buffer[TEXT_LENGTH_MAX];  
+  char *dictionary_dir; // dictionaries loaded by voxind
+  struct engine_t *next; // next engine in api->engines
+  queue_t *queue; // utterances supplied by voxSpeak, NULL otherwise
+  uint32_t preempt_required; // set by the queue to abort the current utterance
+  utterance_state_t utterance;
+  uint32_t pumping; // a thread delivers the callbacks in synchronize
+  voxUtteranceTimeline timeline; // current or last utterance
+  int tempo; // VOX_TEMPO
+  stretch_t *stretch; // time-stretch of the samples (VOX_TEMPO), created on first use
+  uint32_t stretch_rate; // sample rate of stretch
+  struct msg_event_t *delayed; // events waiting for the time-stretched samples preceding them
+  uint32_t nb_delayed;
+  uint32_t max_delayed;
+  int silence; // VOX_TRIM_SILENCE
+  trim_t *trim; // trimmer of the samples (VOX_TRIM_SILENCE), created on first use
+  uint32_t trim_rate; // sample rate of trim
+  int incremental; // VOX_INCREMENTAL
+  struct input_t *pending; // input not yet sent (incremental synthesis)
+  struct input_t *pending_last;
+  uint32_t pending_synth; // number of INPUT_SYNTHESIZE in pending
+  size_t memory; // bytes allocated for the engine (engine_t, delayed events)
 };
 
 #define ALLOCATED_MSG_LENGTH PIPE_MAX_BLOCK
+#define DELAYED_EVENTS_MIN 16 // first allocation of engine->delayed
+
+// engine_set_utterance updates the utterance state (mutex locked);
+// eciSpeaking reads it without the mutex
+static void engine_set_utterance(struct engine_t *engine, utterance_state_t state)
+{
+  __atomic_store_n(&engine->utterance, state, __ATOMIC_RELEASE);
+}
+
+// scratch_t: buffers of the text conversion (eciAddText, voxPrefetch)
+// shared by the engines, used with the api mutex locked
+struct scratch_t {
+  uint8_t tlv_message[TLV_MESSAGE_LENGTH_MAX];
+  uint8_t text[TEXT_LENGTH_MAX];
+};
 
 struct api_t {
   void *my_instance; // communication channel with voxind. my_api is fully created when my_instance is non NULL 
@@ -90,6 +179,13 @@ struct api_t {
   config_t *my_config;
   config_t *my_default_config;
   bool ssml_mode; // once set the ssml mode cannot be unset (single gfa1 annotation)
+  struct engine_t *engines; // created engines, replayed if their voxind fails
+  struct scratch_t *scratch; // allocated on first use
+  bool msg_locked; // msg locked in memory (lockMemory)
+  size_t memory; // bytes allocated for the engines and scratch (accounting)
+  struct engine_t *pumping_engine; // engine being synchronized (direct mode callbacks)
+  uint64_t call_date; // date of the last message sent to voxind (timeline)
+  bool worker; // private api of a job of voxRenderDocument (no direct mode, standby, engine pool)
 };
 
 static struct api_t my_api = {.stop_mutex=PTHREAD_MUTEX_INITIALIZER, .api_mutex=PTHREAD_MUTEX_INITIALIZER, NULL};
@@ -118,11 +214,21 @@ typedef struct {
 } sounds_t;
 
 static sounds_t sounds;
+static pthread_once_t sounds_once = PTHREAD_ONCE_INIT;
 
 static int frequence[MSG_TTS_MAX] = {0, 11025, 22050};
+// maximal value of each voice param (eciGender ... eciVolume)
+static const int voice_param_max[eciNumVoiceParams] = {1, 100, 100, 100, 100, 100, 250, 100};
 
 static int set_param(ECIHand hEngine, uint32_t msg_id, voxParam Param, int iValue);
+static int ttsSetEnginePool(struct api_t *api, uint32_t language, unsigned int number, int *eci_res);
+static int api_lock(struct api_t *api);
+static void api_replay(struct api_t *api, msg_tts_id tts_id);
+static int engine_flush_params(struct engine_t *engine);
 static bool _voxToCompositeName(vox_t *data, char *string, size_t size);
+static uint32_t api_direct_callback(struct msg_t *m, void *data);
+static void engine_clear_input(struct engine_t *engine, bool all);
+static struct engine_t *api_new_engine_ex(struct api_t *api, enum ECILanguageDialect Value);
 
 static void conv_int_to_version(int src, version_t *dst) {
   if (dst) {
@@ -185,16 +291,12 @@ static void _api_updateFromCharset(struct engine_t *engine) {
 }
 
 
+// sound_create is called once, when the sound icons are enabled
 static void sound_create() {
   ENTER();
-  static bool once = false;
   char *pathname = NULL;
   int i;
 
-  if (once)
-    return;
-
-  once = true;
   memset(&sounds, 0, sizeof(sounds));
 
   for (i=0; i<SOUND_MAX; i++) {
@@ -242,6 +344,8 @@ static void sound_create() {
 
 static int api_create(struct api_t *api) {
   int res = 0;
+  struct timespec t0 = {0};
+  struct timespec t = {0};
 
   ENTER();
   
@@ -275,15 +379,10 @@ static int api_create(struct api_t *api) {
 	goto exit0;
   }
   
+  libvoxinDebugElapsed(&t0);
+  libvoxinDebugElapsed(&t);
   api->my_instance = libvoxin_create(&api->my_instance);
-  res = libvoxin_list_tts(api->my_instance, NULL, &api->tts_len);
-  if (!res && api->tts_len) {
-	if (api->tts) {
-	  res = libvoxin_list_tts(api->my_instance, api->tts, &api->tts_len);
-	}
-  }
-
-  sound_create();
+  msg("startup: libvoxin created in %ld us", libvoxinDebugElapsed(&t));
 
   { // get user and default config
     char *home = getenv("HOME");
@@ -309,12 +408,42 @@ static int api_create(struct api_t *api) {
     // obtain the default config
     config_create(&api->my_default_config, NULL);
   }    
+  msg("startup: config read in %ld us", libvoxinDebugElapsed(&t));
+
+  // voxind of each tts
+  if (!api->worker && api->my_config) {
+	if (api->my_config->direct_mode)
+	  libvoxin_set_direct(api->my_instance, api_direct_callback, api);
+	libvoxin_set_standby(api->my_instance, api->my_config->standby);
+  }
+  libvoxin_start(api->my_instance, api->my_config && api->my_config->broker);
+  msg("startup: voxind started in %ld us", libvoxinDebugElapsed(&t));
+
+  res = libvoxin_list_tts(api->my_instance, NULL, &api->tts_len);
+  if (!res && api->tts_len) {
+	if (api->tts) {
+	  res = libvoxin_list_tts(api->my_instance, api->tts, &api->tts_len);
+	}
+  }
+  msg("startup: tts listed in %ld us", libvoxinDebugElapsed(&t));
+
+  if (!api->worker && api->my_config && api->my_config->eci && api->my_config->eci->engine_pool) {
+	int i;
+	for (i=0; i<api->tts_len; i++) {
+	  if (api->tts[i] == MSG_TTS_ECI) {
+		int eci_res;
+		ttsSetEnginePool(api, MSG_ENGINE_POOL_ANY, api->my_config->eci->engine_pool, &eci_res);
+		break;
+	  }
+	}
+  }
   
  exit0:
   if ((!api->my_instance) && api->msg) {
 	free(api->msg);
 	api->msg = NULL;
   }
+  msg("startup: total %ld us", libvoxinDebugElapsed(&t0));
   {
 	int res;
 	res = pthread_mutex_unlock(&api->api_mutex);
@@ -414,6 +543,44 @@ static int api_unlock(struct api_t *api)
   return res;
 }
 
+// api_call_eci sends the message to voxind; if voxind has failed,
+// its standby is used and the engines are created again (the message
+// is not replayed).
+// The caller must lock the mutex.
+static int api_call_eci(struct api_t *api, struct msg_t *msg)
+{
+  msg_tts_id tts_id = MSG_TTS(msg->id);
+  int res = libvoxin_call_eci(api->my_instance, msg);
+  if (res == ECHILD)
+	api_replay(api, tts_id);
+  return res;
+}
+
+// api_call_func1 sends header (and bytes) to voxind, eci_res is set
+// to the result; the mutex is kept locked (see process_func1)
+static int api_call_func1(struct api_t* api, struct msg_t *header, const struct msg_bytes_t *bytes,
+						  int *eci_res)
+{
+  int res = 0;
+  uint32_t c;
+
+  c = api->msg->count;
+  memcpy(api->msg, header, sizeof(*api->msg));
+  api->msg->count = c;
+  
+  if (bytes) {
+	res = msg_copy_bytes(api->msg, bytes);
+	if (res)
+	  return res;
+  }
+  api->msg->allocated_data_length = ALLOCATED_MSG_LENGTH;
+
+  res = api_call_eci(api, api->msg);
+  if (!res && eci_res)
+	*eci_res = api->msg->res;
+  return res;
+}
+
 // Notes:
 // The caller must lock the mutex if with_lock is set to false. 
 // If the returned value is not 0, the mutex is unlocked whichever the value of
@@ -422,7 +589,6 @@ static int process_func1(struct api_t* api, struct msg_t *header, const struct m
 						 int *eci_res, bool with_unlock, bool with_lock)
 {
   int res = EINVAL;  
-  uint32_t c;
   
   ENTER();
 
@@ -438,38 +604,267 @@ static int process_func1(struct api_t* api, struct msg_t *header, const struct m
 	usleep(1000);
   }
 
-  c = api->msg->count;
+  res = api_call_func1(api, header, bytes, eci_res);
+  if (res) {
+	api_unlock(api);
+  } else if (with_unlock) {
+	res = api_unlock(api);
+  }
+  
+  LEAVE();
+  return res;
+}
+
+// ttsSetEnginePool: the mutex is locked by the caller and kept locked
+// (see api_call_func1)
+static int ttsSetEnginePool(struct api_t *api, uint32_t language, unsigned int number, int *eci_res) {
+  struct msg_t header;
+
+  dbg("ENTER(language=0x%x, number=%d)", language, number);
+
+  if (msg_set_header(&header, MSG_DST(MSG_TTS_ECI), MSG_VOX_SET_ENGINE_POOL, 0))
+	return EINVAL;
+
+  header.args.ep.Value = language;
+  header.args.ep.nb = number;
+
+  return api_call_func1(api, &header, NULL, eci_res);
+}
+
+// replay_call sends a message to the voxind which has just replaced
+// a failed one (mutex already locked)
+static int replay_call(struct api_t *api, struct msg_t *header, const struct msg_bytes_t *bytes, int *eci_res)
+{
+  int res;
+  uint32_t c = api->msg->count;
+
   memcpy(api->msg, header, sizeof(*api->msg));
   api->msg->count = c;
-  
   if (bytes) {
 	res = msg_copy_bytes(api->msg, bytes);
 	if (res)
-	  goto exit0;
+	  return res;
   }
   api->msg->allocated_data_length = ALLOCATED_MSG_LENGTH;
-
   res = libvoxin_call_eci(api->my_instance, api->msg);
+  if (!res && eci_res)
+	*eci_res = api->msg->res;
+  return res;
+}
 
- exit0:
-  if (res) {
-	api_unlock(api);
-  } else {
-	if (eci_res)
-	  *eci_res = api->msg->res;
+// api_get_realtime returns the configured scheduling, the priority
+// set to the default of the policy if needed
+static realtime_policy_t api_get_realtime(struct api_t *api, int *priority) {
+  config_t *config = api->my_config;
+
+  *priority = 0;
+  if (!config || (config->realtime == REALTIME_NONE))
+	return REALTIME_NONE;
+
+  *priority = config->realtime_priority;
+  if (!*priority)
+	*priority = (config->realtime == REALTIME_NICE) ? REALTIME_FALLBACK_NICE : REALTIME_DEFAULT_PRIORITY;
+  return config->realtime;
+}
+
+static bool api_lock_memory(struct api_t *api) {
+  return api->my_config && api->my_config->lock_memory;
+}
+
+// ttsHasRealtime returns true if voxind processes MSG_VOX_SET_REALTIME
+static bool ttsHasRealtime(struct api_t *api, msg_tts_id tts_id) {
+  version_t *v = &api->voxind_version[tts_id].msg;
+  version_t min;
+  conv_int_to_version(MSG_API_REALTIME, &min);
+  return (v->major > min.major) || ((v->major == min.major) && (v->minor >= min.minor));
+}
+
+// ttsSetRealtime applies the configured scheduling and memory locking
+// to voxind, with replay_call if replay is set (mutex already locked)
+static int ttsSetRealtime(struct api_t *api, msg_tts_id tts_id, bool replay) {
+  struct msg_t header;
+  struct msg_set_realtime_t *rt = &api->msg->args.rt;
+  int priority;
+  realtime_policy_t policy = api_get_realtime(api, &priority);
+  int eci_res;
+  int res;
+
+  if (((policy == REALTIME_NONE) && !api_lock_memory(api))
+	  || !ttsHasRealtime(api, tts_id))
+	return 0;
+
+  if (api_lock_memory(api) && !api->msg_locked)
+	api->msg_locked = !realtime_lock(api->msg, PIPE_MAX_BLOCK);
 
-	if (with_unlock)
-	  res = api_unlock(api);
+  msg_set_header(&header, MSG_DST(tts_id), MSG_VOX_SET_REALTIME, 0);
+  header.args.rt.policy = policy;
+  header.args.rt.priority = priority;
+  header.args.rt.lock_memory = api_lock_memory(api);
+  if (replay) {
+	res = replay_call(api, &header, NULL, &eci_res);
+  } else {
+	res = api_call_func1(api, &header, NULL, &eci_res);
+  }
+  if (!res) {
+	msg("%s: policy=%d, priority=%d, lock_memory=%d, latency=%d us",
+		msg_tts_id_string(tts_id), rt->policy, rt->priority, rt->lock_memory, eci_res);
   }
-  
-  LEAVE();
   return res;
 }
+
+// engine_replay creates the engine again in the new voxind: voice,
+// voice params, callback, output buffer or filename, dictionaries
+static int engine_replay(struct engine_t *engine)
+{
+  struct api_t *api = engine->api;
+  struct msg_t header;
+  struct msg_bytes_t bytes;
+  int eci_res = 0;
+  int i;
+
+  dbg("ENTER(%p)", engine);
+
+  if (engine->vox_index != VOX_INDEX_UNDEFINED) {
+	msg_set_header(&header, MSG_DST(engine->tts_id), MSG_NEW_EX, 0);
+	header.args.ne.Value = vox_list[engine->vox_index].id;
+  } else {
+	msg_set_header(&header, MSG_DST(engine->tts_id), MSG_NEW, 0);
+  }
+  engine->handle = 0;
+  if (replay_call(api, &header, NULL, &eci_res) || !eci_res) {
+	err("LEAVE, engine not created");
+	return -1;
+  }
+  engine->handle = eci_res;
+  engine_set_utterance(engine, UTTERANCE_IDLE); // input lost with voxind
+  engine->voice_param_pending = 0; // replayed below
+  engine->voice_param_known = 0;
+  engine->param_known = 0;
+
+  // the params first: e.g. eciRealWorldUnits changes the unit of the
+  // voice params
+  for (i=0; i<VOX_NUM_PARAMS; i++) {
+	if (!(engine->param_set & (1<<i)))
+	  continue;
+	msg_set_header(&header, MSG_DST(engine->tts_id),
+				   (i < VOX_CAPITALS) ? MSG_SET_PARAM : MSG_VOX_SET_PARAM, engine->handle);
+	header.args.sp.Param = i;
+	header.args.sp.iValue = engine->param[i];
+	if (replay_call(api, &header, NULL, NULL))
+	  return -1;
+	if (i < VOX_CAPITALS)
+	  engine->param_known |= (1<<i);
+  }
+
+  for (i=0; i<eciNumVoiceParams; i++) {
+	if (engine->voice_param[i] == VOICE_PARAM_UNCHANGED)
+	  continue;
+	msg_set_header(&header, MSG_DST(engine->tts_id), MSG_SET_VOICE_PARAM, engine->handle);
+	header.args.svp.iVoice = 0;
+	header.args.svp.Param = i;
+	header.args.svp.iValue = engine->voice_param[i];
+	if (replay_call(api, &header, NULL, NULL))
+	  return -1;
+	engine->voice_param_known |= (1<<i);
+  }
+
+  if (engine->cb) {
+	msg_set_header(&header, MSG_DST(engine->tts_id), MSG_REGISTER_CALLBACK, engine->handle);
+	header.args.rc.Callback = 1;
+	if (replay_call(api, &header, NULL, NULL))
+	  return -1;
+  }
+
+  if (engine->samples) {
+	msg_set_header(&header, MSG_DST(engine->tts_id), MSG_SET_OUTPUT_BUFFER, engine->handle);
+	header.args.sob.nb_samples = engine->nb_samples;
+	if (replay_call(api, &header, NULL, NULL))
+	  return -1;
+  }
+
+  if (engine->output_filename) {
+	msg_set_header(&header, MSG_DST(engine->tts_id), MSG_SET_OUTPUT_FILENAME, engine->handle);
+	bytes.b = (uint8_t*)engine->output_filename;
+	bytes.len = strlen(engine->output_filename);
+	if (replay_call(api, &header, &bytes, NULL))
+	  return -1;
+  }
+
+  if (engine->dictionary_dir) {
+	msg_set_header(&header, MSG_DST(engine->tts_id), MSG_VOX_LOAD_DICTIONARIES, engine->handle);
+	header.args.lds.deferred = 1;
+	bytes.b = (uint8_t*)engine->dictionary_dir;
+	bytes.len = strlen(engine->dictionary_dir);
+	if (replay_call(api, &header, &bytes, NULL))
+	  return -1;
+  }
+
+  dbg("LEAVE, handle=0x%x", engine->handle);
+  return 0;
+}
+
+// api_replay creates again the engines of the failed voxind of
+// tts_id (mutex already locked)
+static void api_replay(struct api_t *api, msg_tts_id tts_id)
+{
+  struct engine_t *engine;
+  struct timespec t = {0};
+  int eci_res;
+
+  ENTER();
+  libvoxinDebugElapsed(&t);
+
+  if ((tts_id == MSG_TTS_ECI)
+	  && api->my_config && api->my_config->eci && api->my_config->eci->engine_pool) {
+	struct msg_t header;
+	msg_set_header(&header, MSG_DST(MSG_TTS_ECI), MSG_VOX_SET_ENGINE_POOL, 0);
+	header.args.ep.Value = MSG_ENGINE_POOL_ANY;
+	header.args.ep.nb = api->my_config->eci->engine_pool;
+	replay_call(api, &header, NULL, &eci_res);
+  }
+
+  ttsSetRealtime(api, tts_id, true);
+
+  for (engine = api->engines; engine; engine = engine->next) {
+	if (engine->tts_id == tts_id)
+	  engine_replay(engine);
+  }
+  msg("engines replayed in %ld us", libvoxinDebugElapsed(&t));
+}
   
+// api_account adds delta bytes to the memory allocated by libvoxin
+static void api_account(struct api_t *api, long delta) {
+  api->memory += delta;
+  dbg("memory=%lu bytes", (long unsigned int)api->memory);
+}
+
+// engine_account adds delta bytes to the memory allocated for the
+// engine (see voxGetMemory)
+static void engine_account(struct engine_t *engine, long delta) {
+  engine->memory += delta;
+  api_account(engine->api, delta);
+}
+
+// api_get_scratch returns the conversion buffers, allocated on first use
+static struct scratch_t *api_get_scratch(struct api_t *api) {
+  if (!api->scratch) {
+	api->scratch = malloc(sizeof(*api->scratch));
+	if (!api->scratch) {
+	  err("mem error (%d)", errno);
+	  return NULL;
+	}
+	api_account(api, sizeof(*api->scratch));
+  }
+  return api->scratch;
+}
+
+// engine_init_buffers points the tlv message of the engine to the
+// scratch buffer (NULL if not yet allocated)
 static void engine_init_buffers(struct engine_t *self) {
   if (self) {
-	self->tlv_message.buffer = self->tlv_message_buffer;
-	self->tlv_message.end_of_buffer = self->tlv_message_buffer + sizeof(self->tlv_message_buffer);	  
+	struct scratch_t *scratch = self->api ? self->api->scratch : NULL;
+	self->tlv_message.buffer = scratch ? scratch->tlv_message : NULL;
+	self->tlv_message.end_of_buffer = scratch ? scratch->tlv_message + sizeof(scratch->tlv_message) : NULL;
 	self->tlv_message.length = 0;
 	self->tlv_message.charset = self->to_charset;	
 	self->state.expected_lang = self->state_expected_lang;
@@ -488,6 +883,7 @@ static struct engine_t *engine_create(uint32_t handle, struct api_t *api, msg_tt
 	self->handle = handle;
 	self->current_engine = self;
 	self->api = api;
+	engine_account(self, sizeof(*self));
 	self->tts_id = tts_id;
 	self->inote = inote_create();
 	{
@@ -506,6 +902,9 @@ static struct engine_t *engine_create(uint32_t handle, struct api_t *api, msg_tt
 	self->state.ssml = api->ssml_mode;
 	self->from_charset = self->to_charset = INOTE_CHARSET_UTF_8;
 	self->vox_index = VOX_INDEX_UNDEFINED;
+	self->tempo = VOX_TEMPO_DEFAULT;
+	self->next = api->engines;
+	api->engines = self;
   } else {
 	err("mem error (%d)", errno);
   }
@@ -523,10 +922,28 @@ static struct engine_t *engine_delete(struct engine_t *self)
 	return NULL;
 
   inote_delete(self->inote);
+  stretch_delete(self->stretch);
+  free(self->delayed);
+  trim_delete(self->trim);
+  engine_clear_input(self, true);
   engine_delete(self->other_engine);
+  if (api_lock_memory(self->api))
+	realtime_unlock(self->samples, 2*self->nb_samples);
   if (self->output_filename)
 	free(self->output_filename);
+  if (self->dictionary_dir)
+	free(self->dictionary_dir);
+  {
+	struct engine_t **e;
+	for (e = &self->api->engines; *e; e = &(*e)->next) {
+	  if (*e == self) {
+		*e = self->next;
+		break;
+	  }
+	}
+  }
   
+  engine_account(self, -(long)self->memory);
   memset(self, 0, sizeof(*self));
   free(self);
   self = NULL;
@@ -616,20 +1033,8 @@ static void setPunctuationMode(struct engine_t *engine, inote_punct_mode_t mode,
 
 static bool is_directory(const char *pathname)
 {
-  DIR *d = opendir(pathname);
-  if (d) {
-    closedir(d);
-  }
-  return (d != NULL);
-}
-
-static bool is_file(const char *pathname)
-{
-  FILE *fd = fopen(pathname, "r");
-  if (fd) {
-    fclose(fd);
-  }
-  return (fd != NULL);
+  struct stat buf;
+  return (!stat(pathname, &buf) && S_ISDIR(buf.st_mode));
 }
 
 // *dir must be freed by the caller
@@ -685,55 +1090,34 @@ static void find_dictionary_dir_by_language(struct engine_t *engine, const char
   
 }
 
-static char *dictionaries[] = {
-  "main.dct",
-  "root.dct",
-  "abbreviation.dct",
-  "extension.dct"
-};
-
-static void  load_eci_dictionaries(struct engine_t *engine, const char *topdir)
+// load_eci_dictionaries requests voxind to load the dictionaries of
+// topdir (main.dct, root.dct, abbreviation.dct, extension.dct); the
+// files are parsed once by voxind and loaded after eciNew returns.
+static void load_eci_dictionaries(struct engine_t *engine, const char *topdir)
 {
   ENTER();
-  int i;
-  size_t size;
-  char *pathname = NULL;
-  bool dictionary_loaded = false;
-  ECIDictHand eciDict = NULL;
+  struct msg_t header;
+  struct msg_bytes_t bytes;
+  int eci_res = DictFileNotFound;
 
   if (!IS_ENGINE(engine)
       || !topdir || !*topdir) {
     err("LEAVE, args error");
     return;
   }    
+  engine = engine->current_engine;
 
-  eciDict = eciGetDict(engine);
-  if (eciDict) {
-    eciDeleteDict(engine, eciDict);
-  }
-
-  eciDict = eciNewDict(engine);
-  if (!eciDict) {
-    return;
-  }
-  
-  size = strlen("%s/%s") + strlen(topdir) + 20;
-  pathname = calloc(1, size);
-  if (!pathname)
-    return;
-
-  for (i=0; i<4; i++) {
-    snprintf(pathname, size, "%s/%s", topdir, dictionaries[i]);
-    if (is_file(pathname)) {
-      if (!eciLoadDict(engine, eciDict, i, pathname)) {
-	dictionary_loaded = true;
-      }
-    }
-  }
-  if (dictionary_loaded) {
-    eciSetDict(engine, eciDict);
+  msg_set_header(&header, MSG_DST(engine->tts_id), MSG_VOX_LOAD_DICTIONARIES, engine->handle);
+  header.args.lds.deferred = 1;
+  bytes.b = (uint8_t*)topdir;
+  bytes.len = strlen(topdir);
+  process_func1(engine->api, &header, &bytes, &eci_res, true, true);
+  if (eci_res == DictNoError) {
+	if (engine->dictionary_dir)
+	  free(engine->dictionary_dir);
+	engine->dictionary_dir = strdup(topdir);
   }
-  free(pathname);    
+  dbg("LEAVE, eci_res=%d", eci_res);
 }
 
 
@@ -793,12 +1177,12 @@ static void setConfiguredValues(struct engine_t *engine)
   }
 }
 
-ECIHand eciNew(void)
+// api_new_engine creates an engine of api (eciNew)
+static struct engine_t *api_new_engine(struct api_t *api)
 {
   int eci_res = 0;
   struct engine_t *engine = NULL;
   struct msg_t header;
-  struct api_t *api = &my_api;
   int res = 0;
  
   ENTER();
@@ -835,7 +1219,7 @@ ECIHand eciNew(void)
       }
       if (j != -1) {
 	dbg("default voice found (%s)", name);    
-	return eciNewEx(vox_list[i].id);
+	return api_new_engine_ex(api, vox_list[i].id);
       }
     }
   }
@@ -878,10 +1262,27 @@ ECIHand eciNew(void)
   setConfiguredValues(engine);
   
   dbg("LEAVE, engine=%p", engine);
-  return (ECIHand)engine;
+  return engine;
+}
+
+ECIHand eciNew(void)
+{
+  return (ECIHand)api_new_engine(&my_api);
 }
 
 
+// engine_delete_stretch deletes the time-stretch; the delayed events
+// are supplied after the next samples (mutex locked)
+static void engine_delete_stretch(struct engine_t *engine)
+{
+  uint32_t i;
+
+  stretch_delete(engine->stretch);
+  engine->stretch = NULL;
+  for (i=0; i<engine->nb_delayed; i++)
+	engine->delayed[i].offset = 0;
+}
+
 Boolean eciSetOutputBuffer(ECIHand hEngine, int iSize, short *psBuffer)
 {
   Boolean eci_res = ECIFalse;
@@ -903,6 +1304,13 @@ Boolean eciSetOutputBuffer(ECIHand hEngine, int iSize, short *psBuffer)
 
   if (!process_func1(engine->api, &header, NULL, &eci_res, false, true)) {  
 	if (eci_res == ECITrue) {
+	  if (api_lock_memory(engine->api)
+		  && ((engine->samples != psBuffer) || (engine->nb_samples != iSize))) {
+		realtime_unlock(engine->samples, 2*engine->nb_samples);
+		realtime_lock(psBuffer, 2*iSize);
+	  }
+	  if (engine->nb_samples != iSize)
+		engine_delete_stretch(engine);
 	  engine->samples = psBuffer;
 	  engine->nb_samples = iSize;
 	}
@@ -984,6 +1392,8 @@ static inote_error _api_convertText2TLV(struct engine_t *engine, inote_slice_t *
     return INOTE_ARGS_ERROR;
 
   old_ssml = engine->state.ssml;
+  if (!api_get_scratch(engine->api))
+    return INOTE_ARGS_ERROR;
   engine_init_buffers(engine);	
 
   libvoxinDebugDump("inote_convert_text_to_tlv:", text->buffer, text->length);
@@ -1022,7 +1432,7 @@ static int replayText(struct engine_t *engine, inote_slice_t *text, int skip_byt
 	--*text_left;
 	size_t len = text->length - *text_left;
 	t = &slice;
-	copySlice(text, t, engine->text_buffer, len);
+	copySlice(text, t, engine->api->scratch->text, len);
 	t->buffer[len-1] = ' ';
 	dbg("up to space (included) (text_left=%lu, skipped byte=0x%02x)", (long unsigned int)*text_left, text->buffer[len-1]);
   } else { // INOTE_INCOMPLETE_MULTIBYTE
@@ -1084,34 +1494,81 @@ static int switchLanguage(struct engine_t *engine, inote_slice_t *text, size_t *
 }
 
 
-Boolean eciAddText(ECIHand hEngine, ECIInputText pText)
+// timeline_now returns the date of the timeline in microseconds
+static uint64_t timeline_now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec*1000000 + t.tv_nsec/1000;
+}
+
+// timeline_add adds the duration since t0 to the total and max
+// durations, returns the current date
+static uint64_t timeline_add(uint64_t t0, uint64_t *total, uint64_t *max) {
+  uint64_t t = timeline_now();
+  *total += t - t0;
+  if (t - t0 > *max)
+	*max = t - t0;
+  return t;
+}
+
+// engine_begin_utterance starts a new timeline if the previous
+// utterance is over (mutex locked)
+static void engine_begin_utterance(struct engine_t *engine)
+{
+  if ((engine->utterance == UTTERANCE_QUEUED) || (engine->utterance == UTTERANCE_SPEAKING))
+	return;
+  memset(&engine->timeline, 0, sizeof(engine->timeline));
+  engine->timeline.text_submitted = timeline_now();
+  if (engine->annotated) {
+	engine->annotated = false;
+	engine->voice_param_known = 0;
+	engine->param_known = 0;
+  }
+  trim_reset(engine->trim);
+  stretch_reset(engine->stretch);
+  engine->nb_delayed = 0;
+}
+
+// engine_real_world_units returns true if the voice params are
+// expressed in real world units (eciRealWorldUnits set)
+static bool engine_real_world_units(struct engine_t *engine)
+{
+  return (engine->param_set & (1<<VOX_REAL_WORLD_UNITS)) && engine->param[VOX_REAL_WORLD_UNITS];
+}
+
+// engine_sample_rate returns the sample rate of the engine
+static uint32_t engine_sample_rate(struct engine_t *engine)
+{
+  static const uint32_t eci_rate[] = {8000, 11025, 22050}; // eciSampleRate
+  if ((engine->param_known & (1<<eciSampleRate))
+	  && (engine->param[eciSampleRate] < sizeof(eci_rate)/sizeof(*eci_rate)))
+	return eci_rate[engine->param[eciSampleRate]];
+  if (engine->vox_index != VOX_INDEX_UNDEFINED)
+	return vox_list[engine->vox_index].rate;
+  return frequence[engine->tts_id];
+}
+
+// engine_input_added updates the utterance state once some input is
+// accepted (mutex locked)
+static void engine_input_added(struct engine_t *engine)
+{
+  if (engine->utterance != UTTERANCE_SPEAKING)
+	engine_set_utterance(engine, UTTERANCE_QUEUED);
+}
+
+// engine_send_text converts the text and sends it to voxind, eci_res
+// is set to the result; returns 0 or an error (mutex locked)
+static int engine_send_text(struct engine_t *engine, ECIInputText pText, int *eci_res)
 {
-  Boolean eci_res = ECITrue;
-  struct engine_t *engine = (struct engine_t *)hEngine;
   struct msg_t header;
   inote_slice_t text;
-  struct api_t *api;
   int ret_process1 = 0;
-	
-  dbg("ENTER (%p,%p)", hEngine, pText);
-    
-  if (!IS_ENGINE(engine)) {
-	err("LEAVE, args error");
-	return ECIFalse;
-  }
-  engine = engine->current_engine;
-
-  api = engine->api;
-  if (api_lock(api))
-	return ECIFalse;
 
-  if (libvoxinDebugEnabled(LV_DEBUG_LEVEL)) {
-	size_t len = strlen(pText);    
-	dbgText(pText, len);
-	libvoxinDebugDump("pText:", pText, len);
-  }
-  
+  *eci_res = ECITrue;
   engine_init_buffers(engine);	
+  engine_flush_params(engine);
+  if (pText && (strchr((const char*)pText, '`') || engine->state.ssml))
+	engine->annotated = true;
 
   bool loop = true;
   size_t text_left = 0;
@@ -1153,44 +1610,612 @@ Boolean eciAddText(ECIHand hEngine, ECIInputText pText)
 	t0 = t - text_left;
 
 	if (loop && engine->tlv_message.length) {
+	  if (!engine->timeline.first_tlv_sent)
+		engine->timeline.first_tlv_sent = timeline_now();
 	  msg_set_header(&header, MSG_DST(engine->tts_id), MSG_ADD_TLV, engine->handle);
 	  struct msg_bytes_t bytes;
 	  bytes.b = engine->tlv_message.buffer;
 	  bytes.len = engine->tlv_message.length;
-	  ret_process1 = process_func1(engine->api, &header, &bytes, &eci_res, false, false);
-	  if (ret_process1) 
+	  ret_process1 = api_call_func1(engine->api, &header, &bytes, eci_res);
+	  if (ret_process1 || (*eci_res != ECITrue))
 		loop = false; 
 	}
   }
 
-  // api already unlocked if process_func1 return val != 0
-  if (!ret_process1) { 
-	api_unlock(api);
-  }
-  
   engine->tlv_message.length = 0;
-  return eci_res;
+  return ret_process1;
 }
 
-
-Boolean eciSynthesize(ECIHand hEngine)
+// engine_send_index sends the index to voxind (mutex locked)
+static int engine_send_index(struct engine_t *engine, int iIndex, int *eci_res)
 {
-  Boolean eci_res = ECIFalse;
-  struct engine_t *engine = (struct engine_t *)hEngine;
   struct msg_t header;
-  dbg("ENTER(%p)", hEngine);  
-
-  if (!IS_ENGINE(engine)) {
-	err("LEAVE, args error");
-	return ECIFalse;
-  }
-  engine = engine->current_engine;
 
-  msg_set_header(&header, MSG_DST(engine->tts_id), MSG_SYNTHESIZE, engine->handle);
-  process_func1(engine->api, &header, NULL, &eci_res, true, true);
-  return eci_res;
+  msg_set_header(&header, MSG_DST(engine->tts_id), MSG_INSERT_INDEX, engine->handle);
+  header.args.ii.iIndex = iIndex;
+  return api_call_func1(engine->api, &header, NULL, eci_res);
 }
 
+// engine_send_synthesize starts the synthesis of the input sent to
+// voxind (mutex locked)
+static int engine_send_synthesize(struct engine_t *engine, int *eci_res)
+{
+  struct msg_t header;
+  int res;
+
+  msg_set_header(&header, MSG_DST(engine->tts_id), MSG_SYNTHESIZE, engine->handle);
+  res = api_call_func1(engine->api, &header, NULL, eci_res);
+  if (!res && (*eci_res == ECITrue)) {
+	engine_set_utterance(engine, UTTERANCE_SPEAKING);
+	if (engine->api->msg->args.sy.prefetched)
+	  engine->timeline.prefetched = 1;
+  }
+  return res;
+}
+
+// input_delete frees the input and returns the next one
+static struct input_t *input_delete(struct input_t *self)
+{
+  struct input_t *next = self->next;
+  free(self->text);
+  free(self);
+  return next;
+}
+
+// engine_push_input appends an input to the pending input of the
+// incremental synthesis (mutex locked)
+static int engine_push_input(struct engine_t *engine, input_type type, const char *text, int iIndex)
+{
+  struct input_t *in = calloc(1, sizeof(*in));
+  if (in && text)
+	in->text = strdup(text);
+  if (!in || (text && !in->text)) {
+	err("mem error (%d)", errno);
+	free(in);
+	return ENOMEM;
+  }
+  in->type = type;
+  in->index = iIndex;
+  // a text with markup (SSML) is not split
+  in->whole = text && (engine->state.ssml || engine->api->ssml_mode || strchr(text, '<'));
+  if (engine->pending_last)
+	engine->pending_last->next = in;
+  else
+	engine->pending = in;
+  engine->pending_last = in;
+  if (type == INPUT_SYNTHESIZE)
+	engine->pending_synth++;
+  return 0;
+}
+
+// engine_clear_input discards the pending input; all=false: only the
+// input added after the last eciSynthesize (mutex locked)
+static void engine_clear_input(struct engine_t *engine, bool all)
+{
+  struct input_t **in = &engine->pending;
+  struct input_t *last = NULL;
+
+  if (!all) {
+	struct input_t *i;
+	for (i = engine->pending; i; i = i->next) {
+	  if (i->type == INPUT_SYNTHESIZE)
+		last = i;
+	}
+	if (last)
+	  in = &last->next;
+  }
+  while (*in)
+	*in = input_delete(*in);
+  engine->pending_last = last;
+  if (all)
+	engine->pending_synth = 0;
+}
+
+// text_get_sentence returns the length of the first sentence of text
+// (including the following spaces); end is set if the sentence ends
+// (punctuation followed by a space or the end of the text)
+static size_t text_get_sentence(const char *text, bool *end)
+{
+  const char *s = text;
+
+  *end = false;
+  for (; *s; s++) {
+	if (((*s == '.') || (*s == '!') || (*s == '?'))
+		&& (!s[1] || isspace((unsigned char)s[1]))
+		&& (s + 1 - text >= SENTENCE_LENGTH_MIN)) {
+	  *end = true;
+	  for (s++; *s && isspace((unsigned char)*s); s++) {}
+	  break;
+	}
+  }
+  return s - text;
+}
+
+// engine_feed sends the pending input up to the end of the next
+// sentence and synthesizes it; returns 0 or an error (mutex locked)
+static int engine_feed(struct engine_t *engine, int *eci_res)
+{
+  struct input_t *in;
+  bool end = false;
+  int res = 0;
+
+  *eci_res = ECITrue;
+  while (!res && (*eci_res == ECITrue) && (in = engine->pending) && (in->type != INPUT_SYNTHESIZE)) {
+	if (in->type == INPUT_INDEX) {
+	  res = engine_send_index(engine, in->index, eci_res);
+	} else if (end) {
+	  break; // next sentence
+	} else {
+	  char *text = in->text + in->offset;
+	  size_t len = in->whole ? strlen(text) : text_get_sentence(text, &end);
+	  char c = text[len];
+	  text[len] = 0;
+	  dbg("sentence=%s", text);
+	  res = engine_send_text(engine, text, eci_res);
+	  text[len] = c;
+	  if (c) {
+		in->offset += len;
+		break;
+	  }
+	}
+	engine->pending = input_delete(in);
+	if (!engine->pending)
+	  engine->pending_last = NULL;
+  }
+
+  if (!res && (*eci_res == ECITrue) && (in = engine->pending) && (in->type == INPUT_SYNTHESIZE)) {
+	engine->pending = input_delete(in);
+	if (!engine->pending)
+	  engine->pending_last = NULL;
+	engine->pending_synth--;
+  }
+
+  if (!res && (*eci_res == ECITrue))
+	res = engine_send_synthesize(engine, eci_res);
+  if (!res && (*eci_res != ECITrue))
+	engine_clear_input(engine, true);
+  return res;
+}
+
+Boolean eciAddText(ECIHand hEngine, ECIInputText pText)
+{
+  int eci_res = ECIFalse;
+  struct engine_t *engine = (struct engine_t *)hEngine;
+  struct api_t *api;
+	
+  dbg("ENTER (%p,%p)", hEngine, pText);
+    
+  if (!IS_ENGINE(engine)) {
+	err("LEAVE, args error");
+	return ECIFalse;
+  }
+  engine = engine->current_engine;
+
+  api = engine->api;
+  if (api_lock(api))
+	return ECIFalse;
+
+  if (libvoxinDebugEnabled(LV_DEBUG_LEVEL)) {
+	size_t len = strlen(pText);    
+	dbgText(pText, len);
+	libvoxinDebugDump("pText:", pText, len);
+  }
+  
+  engine_begin_utterance(engine);
+
+  if (engine->incremental) {
+	if (!pText || !engine_push_input(engine, INPUT_TEXT, pText, 0)) {
+	  eci_res = ECITrue;
+	  engine_input_added(engine);
+	}
+	api_unlock(api);
+	return eci_res;
+  }
+
+  if (!engine_send_text(engine, pText, &eci_res) && (eci_res == ECITrue))
+	engine_input_added(engine);
+  api_unlock(api);
+  return eci_res;
+}
+
+
+Boolean eciSynthesize(ECIHand hEngine)
+{
+  Boolean eci_res = ECIFalse;
+  struct engine_t *engine = (struct engine_t *)hEngine;
+  dbg("ENTER(%p)", hEngine);  
+
+  if (!IS_ENGINE(engine)) {
+	err("LEAVE, args error");
+	return ECIFalse;
+  }
+  engine = engine->current_engine;
+
+  if (api_lock(engine->api))
+	return ECIFalse;
+  engine_flush_params(engine);
+  engine->timeline.synthesize = timeline_now();
+  engine->timeline.sample_rate = engine_sample_rate(engine);
+
+  if (engine->pending) {
+	// the first sentence is synthesized now, the next ones by
+	// synchronize
+	if (!engine_push_input(engine, INPUT_SYNTHESIZE, NULL, 0)) {
+	  eci_res = ECITrue;
+	  if ((engine->utterance != UTTERANCE_SPEAKING) && engine_feed(engine, &eci_res))
+		eci_res = ECIFalse;
+	}
+	api_unlock(engine->api);
+	return eci_res;
+  }
+
+  engine_send_synthesize(engine, &eci_res);
+  api_unlock(engine->api);
+  return eci_res;
+}
+
+
+// ttsHasEvents returns true if voxind appends the events to the
+// buffer messages
+static bool ttsHasEvents(struct engine_t *engine) {
+  version_t *v = &engine->api->voxind_version[engine->tts_id].msg;
+  version_t min;
+  conv_int_to_version(MSG_API_EVENTS, &min);
+  return (v->major > min.major) || ((v->major == min.major) && (v->minor >= min.minor));
+}
+
+// engine_call_waveform calls the user callback for the nb samples
+// of engine->samples; they are supplied again while it returns
+// eciDataNotProcessed, as voxind does for the plain samples, unless
+// a stop is required (eciDataAbort)
+static enum ECICallbackReturn engine_call_waveform(struct engine_t *engine, uint32_t nb)
+{
+  ECICallback cb = (ECICallback)engine->cb;
+  enum ECICallbackReturn res;
+
+  do {
+	res = (enum ECICallbackReturn)cb((ECIHand)((char*)NULL+engine->handle),
+									 eciWaveformBuffer, nb, engine->data_cb);
+  } while ((res == eciDataNotProcessed) && !engine->stop_required && !engine->preempt_required);
+  return (res == eciDataNotProcessed) ? eciDataAbort : res;
+}
+
+// play_capital supplies the capital sound icon to the user callback
+static enum ECICallbackReturn play_capital(struct engine_t *engine, uint32_t prepend)
+{
+  sound_t *sound = &sounds.sound[(prepend == MSG_PREPEND_CAPITALS) ? SOUND_CAPITALS : SOUND_CAPITAL][engine->tts_id];
+  size_t sound_length = (sound->len <= 2*engine->nb_samples) ?
+	sound->len : 2*engine->nb_samples;
+
+  dbg("prepend %s, len audio[%d]=%lu", (prepend == MSG_PREPEND_CAPITALS) ? "capitals" : "capital",
+	  engine->tts_id, (unsigned long)sound_length/2);
+  memcpy(engine->samples, sound->buf, sound_length);
+  return engine_call_waveform(engine, sound_length/2);
+}
+
+// dispatch_events calls the user callback for each event, stops if
+// it returns eciDataAbort
+static enum ECICallbackReturn dispatch_events(struct engine_t *engine, const struct msg_event_t *events, uint32_t nb_events)
+{
+  ECICallback cb = (ECICallback)engine->cb;
+  enum ECICallbackReturn res = eciDataProcessed;
+  int i;
+
+  for (i=0; (i<nb_events) && (res != eciDataAbort); i++) {
+	const struct msg_event_t *e = events + i;
+	dbg("event msg=%d, lParam=0x%x, offset=%d", e->msg, e->lParam, e->offset);
+	if (e->msg == eciWaveformBuffer) {
+	  res = play_capital(engine, e->lParam);
+	} else if ((e->msg >= eciIndexReply) && (e->msg <= eciSynthesisBreak)) {
+	  res = (enum ECICallbackReturn)cb((ECIHand)((char*)NULL+engine->handle),
+									   (enum ECIMessage)e->msg, le32toh(e->lParam), engine->data_cb);
+	}
+  }
+  return res;
+}
+
+// engine_release_events calls the user callback for the delayed events
+// up to the input position of the time-stretch, stops if it returns
+// eciDataAbort
+static enum ECICallbackReturn engine_release_events(struct engine_t *engine, uint32_t position)
+{
+  enum ECICallbackReturn res = eciDataProcessed;
+  uint32_t i = 0;
+
+  while ((i < engine->nb_delayed) && (engine->delayed[i].offset <= position)
+		 && (res != eciDataAbort))
+	res = dispatch_events(engine, engine->delayed + i++, 1);
+  engine->nb_delayed -= i;
+  memmove(engine->delayed, engine->delayed + i, engine->nb_delayed*sizeof(*engine->delayed));
+  return res;
+}
+
+// engine_stretch_output supplies the time-stretched samples to the
+// user callback, then the events preceding them; returns 1 if aborted.
+// The input is already consumed: the samples not processed by the
+// callback are supplied again here, not by voxind
+static int engine_stretch_output(const int16_t *samples, uint32_t nb, void *data)
+{
+  struct engine_t *engine = data;
+  uint32_t supplied;
+
+  memcpy(engine->samples, samples, 2*nb);
+  if (engine_call_waveform(engine, nb) == eciDataAbort)
+	return 1;
+  stretch_position(engine->stretch, &supplied);
+  return (engine_release_events(engine, supplied) == eciDataAbort);
+}
+
+// engine_get_stretch returns the time-stretch of the samples, NULL if
+// the tempo is unchanged (mutex locked)
+static stretch_t *engine_get_stretch(struct engine_t *engine)
+{
+  uint32_t rate;
+
+  if (engine->tempo == VOX_TEMPO_DEFAULT)
+	return NULL;
+  rate = engine_sample_rate(engine);
+  if (engine->stretch && (engine->stretch_rate == rate))
+	return engine->stretch;
+  engine_delete_stretch(engine);
+  engine->stretch = stretch_create(rate, engine->tempo, engine->nb_samples, engine_stretch_output, engine);
+  engine->stretch_rate = rate;
+  return engine->stretch;
+}
+
+// engine_play_samples supplies nb samples to the time-stretch or to
+// the user callback, by output buffers (a buffer not processed is
+// supplied again: the trimmer has already consumed the samples)
+static enum ECICallbackReturn engine_play_samples(struct engine_t *engine, const void *samples, uint32_t nb)
+{
+  enum ECICallbackReturn res = eciDataProcessed;
+  const uint8_t *s = samples;
+
+  if (engine_get_stretch(engine))
+	return stretch_process(engine->stretch, samples, nb) ? eciDataAbort : eciDataProcessed;
+
+  do {
+	uint32_t n = (nb < engine->nb_samples) ? nb : engine->nb_samples;
+	memcpy(engine->samples, s, 2*n);
+	res = engine_call_waveform(engine, n);
+	s += 2*n;
+	nb -= n;
+  } while (nb && (res != eciDataAbort));
+  if ((res != eciDataAbort) && engine->nb_delayed)
+	res = engine_release_events(engine, UINT32_MAX); // tempo reset
+  return res;
+}
+
+// engine_trim_output plays the samples kept by the trimmer; returns 1
+// if aborted
+static int engine_trim_output(const int16_t *samples, uint32_t nb, void *data)
+{
+  return (engine_play_samples(data, samples, nb) == eciDataAbort);
+}
+
+// engine_get_trim returns the trimmer of the samples, NULL if
+// disabled (mutex locked)
+static trim_t *engine_get_trim(struct engine_t *engine)
+{
+  uint32_t rate;
+
+  if (!engine->silence)
+	return NULL;
+  rate = engine_sample_rate(engine);
+  if (engine->trim && (engine->trim_rate == rate))
+	return engine->trim;
+  trim_delete(engine->trim);
+  engine->trim = trim_create(rate, engine->silence, engine_trim_output, engine);
+  engine->trim_rate = rate;
+  return engine->trim;
+}
+
+// engine_waveform supplies the nb samples of the engine to the
+// trimmer, the time-stretch and the user callback
+static enum ECICallbackReturn engine_waveform(struct engine_t *engine, const void *samples, uint32_t nb)
+{
+  if (engine_get_trim(engine))
+	return trim_process(engine->trim, samples, nb) ? eciDataAbort : eciDataProcessed;
+  return engine_play_samples(engine, samples, nb);
+}
+
+// engine_dispatch_event calls the user callback for the event; with
+// the time-stretch, the event is delayed until the samples preceding
+// it have been supplied (mutex locked)
+static enum ECICallbackReturn engine_dispatch_event(struct engine_t *engine, const struct msg_event_t *e)
+{
+  uint32_t position;
+  uint32_t supplied;
+
+  if (!engine_get_stretch(engine))
+	return dispatch_events(engine, e, 1);
+
+  position = stretch_position(engine->stretch, &supplied);
+  if (!engine->nb_delayed && (position <= supplied))
+	return dispatch_events(engine, e, 1);
+
+  if (engine->nb_delayed == engine->max_delayed) {
+	uint32_t max = engine->max_delayed ? 2*engine->max_delayed : DELAYED_EVENTS_MIN;
+	struct msg_event_t *d = realloc(engine->delayed, max*sizeof(*d));
+	if (!d) {
+	  err("mem error (%d)", errno);
+	  return dispatch_events(engine, e, 1);
+	}
+	engine_account(engine, (long)(max - engine->max_delayed)*sizeof(*d));
+	engine->delayed = d;
+	engine->max_delayed = max;
+  }
+  engine->delayed[engine->nb_delayed] = *e;
+  engine->delayed[engine->nb_delayed++].offset = position;
+  return eciDataProcessed;
+}
+
+// engine_play_capital supplies the capital sound icon, delayed as an
+// event with the time-stretch
+static enum ECICallbackReturn engine_play_capital(struct engine_t *engine, uint32_t prepend)
+{
+  struct msg_event_t e = {.msg = eciWaveformBuffer, .lParam = prepend};
+  return engine_dispatch_event(engine, &e);
+}
+
+// dispatch_waveform calls the user callback for the samples and the
+// events, each event at its offset in the samples
+static enum ECICallbackReturn dispatch_waveform(struct engine_t *engine, const uint8_t *data, uint32_t nb,
+												const struct msg_event_t *events, uint32_t nb_events)
+{
+  enum ECICallbackReturn res = eciDataProcessed;
+  uint32_t pos = 0;
+  int i = 0;
+
+  while (1) {
+	uint32_t end = ((i < nb_events) && (events[i].offset < nb)) ? events[i].offset : nb;
+	if (end > pos) {
+	  res = engine_waveform(engine, data + 2*pos, end - pos);
+	  pos = end;
+	  if (res == eciDataAbort)
+		break;
+	}
+	if (i == nb_events)
+	  break;
+	res = engine_dispatch_event(engine, events + i++);
+	if (res == eciDataAbort)
+	  break;
+  }
+  return res;
+}
+
+// synchronize_callback passes the callback message m received at t to
+// the user callback; m->res is set to its returned value (mutex
+// locked)
+static void synchronize_callback(struct engine_t *engine, struct msg_t *m, uint64_t t)
+{
+  voxUtteranceTimeline *timeline = &engine->timeline;
+  struct msg_event_t *events = NULL;
+  uint32_t nb_events = 0;
+
+  if (ttsHasEvents(engine) && m->args.cb.nb_events
+	  && (m->args.cb.nb_events*sizeof(*events) <= m->effective_data_length)) {
+	nb_events = m->args.cb.nb_events;
+	m->effective_data_length -= nb_events*sizeof(*events);
+	events = (struct msg_event_t *)(m->data + m->effective_data_length);
+  }
+
+  timeline->nb_messages++;
+  if ((m->func == MSG_CB_WAVEFORM_BUFFER) && m->effective_data_length) {
+	if (!timeline->first_audio)
+	  timeline->first_audio = t;
+	timeline->last_audio = t;
+	timeline->nb_samples += m->effective_data_length/2;
+  }
+
+  m->res = eciDataAbort;
+
+  int lParam = -1;
+  if (engine->cb && engine->samples
+	  && (m->effective_data_length <= 2*engine->nb_samples)) {
+	ECICallback cb = (ECICallback)engine->cb;
+	enum ECIMessage Msg = (enum ECIMessage)(m->func - MSG_CB_WAVEFORM_BUFFER + eciWaveformBuffer);
+
+	if (nb_events && (Msg == eciWaveformBuffer)) {
+	  // the events are inserted in the samples at their offset
+	  m->res = eciDataProcessed;
+	  if ((m->args.cb.lParam == MSG_PREPEND_CAPITAL)
+		  || (m->args.cb.lParam == MSG_PREPEND_CAPITALS)) {
+		m->res = engine_play_capital(engine, m->args.cb.lParam);
+	  }
+	  if (m->res != eciDataAbort)
+		m->res = dispatch_waveform(engine, m->data, m->effective_data_length/2, events, nb_events);
+	  lParam = 0;
+	  goto next;
+	} else if (nb_events) {
+	  // the events precede the data
+	  uint32_t i;
+	  m->res = eciDataProcessed;
+	  for (i=0; (i<nb_events) && (m->res != eciDataAbort); i++)
+		m->res = engine_dispatch_event(engine, events + i);
+	  if ((m->res == eciDataAbort) || !m->effective_data_length) {
+		lParam = 0;
+		goto next;
+	  }
+	}
+
+	switch(Msg) {
+	case eciWaveformBuffer:
+	  dbg("lParam=0x%08x)", m->args.cb.lParam);	    
+	  if ((m->args.cb.lParam == MSG_PREPEND_CAPITAL)
+		  || (m->args.cb.lParam == MSG_PREPEND_CAPITALS)) {
+		m->res = engine_play_capital(engine, m->args.cb.lParam);
+	  }
+	  if (engine->silence || (engine->tempo != VOX_TEMPO_DEFAULT)) {
+		m->res = engine_waveform(engine, m->data, m->effective_data_length/2);
+		lParam = 0;
+		goto next;
+	  }
+	  lParam = m->effective_data_length/2;
+	  memcpy(engine->samples, m->data, m->effective_data_length);
+	  break;
+	case eciPhonemeBuffer:
+	  lParam = m->effective_data_length;
+	  memcpy(engine->samples, m->data, m->effective_data_length);
+	  break;
+	case eciIndexReply:
+	case eciPhonemeIndexReply:
+	case eciWordIndexReply:
+	case eciStringIndexReply:
+	case eciSynthesisBreak:
+	  lParam = le32toh(m->args.cb.lParam);
+	  if (engine->tempo != VOX_TEMPO_DEFAULT) {
+		struct msg_event_t e = {.msg = Msg, .lParam = m->args.cb.lParam};
+		m->res = engine_dispatch_event(engine, &e);
+		goto next;
+	  }
+	  break;
+	default:
+	  err("unknown eci message (%d)", Msg);
+	}
+	if (lParam != -1) {
+	  dbg("call user callback, handle=0x%x, msg=%s, lParam=%d",
+		  engine->handle, msg_string((enum msg_type)(m->func)), lParam);
+	  m->res = (enum ECICallbackReturn)cb((ECIHand)((char*)NULL+engine->handle), Msg, lParam, engine->data_cb);
+	}
+  }
+ next:
+  if(lParam == -1) {
+	err("error callback, handle=0x%x, msg=%s, #samples=%d",
+		engine->handle, msg_string((enum msg_type)(m->func)), m->effective_data_length/2);
+  }
+	
+  timeline_add(t, &timeline->callback_duration, &timeline->callback_max);
+  dbg("res user callback=%d", m->res);
+  if (engine->stop_required || engine->preempt_required) {
+	m->res = eciDataAbort;
+	dbg("stop required");
+  }
+  if (m->res == eciDataAbort) {
+	// no next sentence (incremental synthesis), no flush of the
+	// trimmed or time-stretched samples
+	engine_clear_input(engine, true);
+	if (engine->utterance == UTTERANCE_SPEAKING)
+	  engine_set_utterance(engine, UTTERANCE_ABORTED);
+  }
+}
+
+// api_direct_callback receives the callback messages in direct mode:
+// the engine is synchronized by the calling thread (mutex locked)
+static uint32_t api_direct_callback(struct msg_t *m, void *data)
+{
+  struct api_t *api = data;
+  struct engine_t *engine = api->pumping_engine;
+  uint64_t t;
+
+  if (!engine)
+	return eciDataAbort;
+
+  t = timeline_add(api->call_date, &engine->timeline.wait_duration, &engine->timeline.wait_max);
+  synchronize_callback(engine, m, t);
+  api->call_date = timeline_now();
+  return m->res;
+}
 
 static Boolean synchronize(struct engine_t *engine, enum msg_type type)
 {
@@ -1199,6 +2224,8 @@ static Boolean synchronize(struct engine_t *engine, enum msg_type type)
   struct msg_t *m = NULL;
   struct api_t *api;
   uint32_t c;
+  voxUtteranceTimeline *timeline;
+  uint64_t t;
   
   ENTER();
 
@@ -1209,6 +2236,7 @@ static Boolean synchronize(struct engine_t *engine, enum msg_type type)
   engine = engine->current_engine;
 
   api = engine->api;
+  timeline = &engine->timeline;
 
   res = pthread_mutex_lock(&api->api_mutex);
   if (res) {
@@ -1216,95 +2244,64 @@ static Boolean synchronize(struct engine_t *engine, enum msg_type type)
 	return eci_res;
   }
   
+  __atomic_store_n(&engine->pumping, 1, __ATOMIC_RELEASE);
+  api->pumping_engine = engine;
+ next_sentence:
   m = api->msg;
   c = m->count;
   msg_set_header(m, MSG_DST(engine->tts_id), type, engine->handle);
   m->count = c;
   m->allocated_data_length = ALLOCATED_MSG_LENGTH;
-  res = libvoxin_call_eci(api->my_instance, m);
+  api->call_date = timeline_now();
+  res = api_call_eci(api, m);
+  t = timeline_add(api->call_date, &timeline->wait_duration, &timeline->wait_max);
   if (res)
 	goto exit0;
 
-  while(1) {
-	if (m->func < MSG_CB_WAVEFORM_BUFFER)
-	  break;
-
-	m->res = eciDataAbort;
-
-	int lParam = -1;
-	if (engine->cb && engine->samples
-		&& (m->effective_data_length <= 2*engine->nb_samples)) {
-	  ECICallback cb = (ECICallback)engine->cb;
-	  enum ECIMessage Msg = (enum ECIMessage)(m->func - MSG_CB_WAVEFORM_BUFFER + eciWaveformBuffer);
-
-	  switch(Msg) {
-	  case eciWaveformBuffer:
-	    	dbg("lParam=0x%08x)", m->args.cb.lParam);	    
-		if (m->args.cb.lParam == MSG_PREPEND_CAPITAL) {		  
-		    dbg("prepend capital");
-		    sound_t *sound = &sounds.sound[SOUND_CAPITAL][engine->tts_id];
-		    size_t sound_length = (sound->len <= 2*engine->nb_samples) ?
-		      sound->len : 2*engine->nb_samples;
-		    lParam = sound_length/2;
-		    dbg("len audio[%d]=%d", engine->tts_id, lParam);
-		    memcpy(engine->samples, sound->buf, sound_length);
-		    m->res = (enum ECICallbackReturn)cb((ECIHand)((char*)NULL+engine->handle),
-							Msg, lParam, engine->data_cb);
-		} else if (m->args.cb.lParam == MSG_PREPEND_CAPITALS) {
-		    dbg("prepend capitals");
-		    sound_t *sound = &sounds.sound[SOUND_CAPITALS][engine->tts_id];
-		    size_t sound_length = (sound->len <= 2*engine->nb_samples) ?
-		      sound->len : 2*engine->nb_samples;
-		    lParam = sound_length/2;
-		    memcpy(engine->samples, sound->buf, sound_length);
-		    m->res = (enum ECICallbackReturn)cb((ECIHand)((char*)NULL+engine->handle), Msg, lParam, engine->data_cb);
-		}
-		
-		lParam = m->effective_data_length/2;
-		memcpy(engine->samples, m->data, m->effective_data_length);
-		break;
-	  case eciPhonemeBuffer:
-		lParam = m->effective_data_length;
-		memcpy(engine->samples, m->data, m->effective_data_length);
-		break;
-	  case eciIndexReply:
-	  case eciPhonemeIndexReply:
-	  case eciWordIndexReply:
-	  case eciStringIndexReply:
-	  case eciSynthesisBreak:
-		lParam = le32toh(m->args.cb.lParam);
-		break;
-	  default:
-		err("unknown eci message (%d)", Msg);
-	  }
-	  if (lParam != -1) {
-		dbg("call user callback, handle=0x%x, msg=%s, lParam=%d",
-			engine->handle, msg_string((enum msg_type)(m->func)), lParam);
-		m->res = (enum ECICallbackReturn)cb((ECIHand)((char*)NULL+engine->handle), Msg, lParam, engine->data_cb);
-	  }
-	}
-	if(lParam == -1) {
-	  err("error callback, handle=0x%x, msg=%s, #samples=%d",
-		  engine->handle, msg_string((enum msg_type)(m->func)), m->effective_data_length/2);
-	}
-	
-	dbg("res user callback=%d", m->res);
-	if (engine->stop_required) {
-	  m->res = eciDataAbort;
-	  dbg("stop required");
-	}
-
+  while (m->func >= MSG_CB_WAVEFORM_BUFFER) {
+	synchronize_callback(engine, m, t);
 	m->id = MSG_DST(engine->tts_id);
 	m->allocated_data_length = ALLOCATED_MSG_LENGTH;
-	res = libvoxin_call_eci(api->my_instance, m);
+	api->call_date = timeline_now();
+	res = api_call_eci(api, m);
+	t = timeline_add(api->call_date, &timeline->wait_duration, &timeline->wait_max);
 	if (res)
 	  goto exit0;
   }
 
+  // incremental synthesis: the next sentence once the previous one is
+  // synthesized
+  if (engine->pending_synth && !engine->stop_required && !engine->preempt_required
+	  && (engine->utterance == UTTERANCE_SPEAKING)
+	  && (((type == MSG_SYNCHRONIZE) && (m->res == ECITrue))
+		  || ((type == MSG_SPEAKING) && (m->res == ECIFalse)))) {
+	int feed_res;
+	res = engine_feed(engine, &feed_res);
+	if (!res && (feed_res == ECITrue)) {
+	  if (type == MSG_SYNCHRONIZE)
+		goto next_sentence;
+	  m->res = ECITrue; // still speaking
+	}
+  }
+
  exit0:
+  if (engine->stop_required || engine->preempt_required)
+	engine_clear_input(engine, true);
   if (!res) {
 	eci_res =  m->res;
+	// no more callbacks once synchronized or no longer speaking
+	if ((engine->utterance == UTTERANCE_SPEAKING)
+		&& ((type == MSG_SYNCHRONIZE) || (eci_res == ECIFalse))) {
+	  // end of the trimmed and time-stretched samples
+	  if (!engine->stop_required && !engine->preempt_required
+		  && !trim_flush(engine->trim) && !stretch_flush(engine->stretch))
+		engine_release_events(engine, UINT32_MAX);
+	  engine_set_utterance(engine, UTTERANCE_DRAINED);
+	  timeline->end = timeline_now();
+	}
   }
+  __atomic_store_n(&engine->pumping, 0, __ATOMIC_RELEASE);
+  api->pumping_engine = NULL;
   
   res = pthread_mutex_unlock(&api->api_mutex);
   if (res) {
@@ -1344,6 +2341,11 @@ ECIHand eciDelete(ECIHand hEngine)
 	return handle;
   }
 
+  if (engine->queue) {
+	queue_delete(engine->queue);
+	engine->queue = NULL;
+  }
+
   api = engine->api;
   if (api_lock(api))
 	return handle;
@@ -1392,9 +2394,35 @@ Boolean eciSpeaking(ECIHand hEngine)
 {
   Boolean eci_res = ECIFalse;
   struct engine_t *engine = (struct engine_t *)hEngine;
+  struct engine_t *current;
   
   dbg("ENTER(%p)", hEngine);  
 
+  if (!IS_ENGINE(engine)) {
+	err("LEAVE, args error");
+	return eci_res;
+  }
+
+  if (engine->queue)
+	return queue_is_busy(engine->queue) ? ECITrue : ECIFalse;
+
+  // answer from the utterance state if no callbacks are to be
+  // delivered by this call (read without the mutex, updated by the
+  // thread in synchronize)
+  current = __atomic_load_n(&engine->current_engine, __ATOMIC_ACQUIRE);
+  switch (__atomic_load_n(&current->utterance, __ATOMIC_ACQUIRE)) {
+  case UTTERANCE_IDLE:
+  case UTTERANCE_DRAINED:
+  case UTTERANCE_ABORTED:
+	return ECIFalse;
+  case UTTERANCE_SPEAKING:
+	if (__atomic_load_n(&current->pumping, __ATOMIC_ACQUIRE))
+	  return ECITrue; // another thread delivers the callbacks
+	break;
+  default:
+	break;
+  }
+
   eci_res = synchronize(engine, MSG_SPEAKING);  
 
   LEAVE();
@@ -1416,6 +2444,7 @@ Boolean eciStop(ECIHand hEngine)
 	err("LEAVE, args error");
 	return eci_res;
   }
+  queue_clear(engine->queue);
   engine = engine->current_engine;
     
   api = engine->api;
@@ -1431,9 +2460,17 @@ Boolean eciStop(ECIHand hEngine)
   }
 
   engine->stop_required = 1;
+  engine->timeline.stop_requested = timeline_now();
 
   msg_set_header(&header, MSG_DST(engine->tts_id), MSG_STOP, engine->handle);
-  process_func1(engine->api, &header, NULL, &eci_res, true, true);
+  if (!process_func1(engine->api, &header, NULL, &eci_res, false, true)) {
+	engine_clear_input(engine, true);
+	if (eci_res == ECITrue) {
+	  engine_set_utterance(engine, UTTERANCE_ABORTED);
+	  engine->timeline.stop_honored = timeline_now();
+	}
+	api_unlock(api);
+  }
 
   engine->stop_required = 0;
   res = pthread_mutex_unlock(&api->stop_mutex);
@@ -1479,12 +2516,12 @@ int eciGetAvailableLanguages(enum ECILanguageDialect *aLanguages, int *nLanguage
   return 0;
 }
 
-ECIHand eciNewEx(enum ECILanguageDialect Value)
+// api_new_engine_ex creates an engine of api (eciNewEx)
+static struct engine_t *api_new_engine_ex(struct api_t *api, enum ECILanguageDialect Value)
 {
   int eci_res;
   struct engine_t *engine = NULL;
   struct msg_t header;
-  struct api_t *api = &my_api;
   int res = 0;
  
   dbg("ENTER(0x%0x)", Value);
@@ -1544,7 +2581,12 @@ ECIHand eciNewEx(enum ECILanguageDialect Value)
   setConfiguredValues(engine);
   
   dbg("LEAVE, engine=%p", engine);
-  return (ECIHand)engine;
+  return engine;
+}
+
+ECIHand eciNewEx(enum ECILanguageDialect Value)
+{
+  return (ECIHand)api_new_engine_ex(&my_api, Value);
 }
 
 static bool ttsIsIdCompatible(uint32_t id, msg_tts_id tts_id) {
@@ -1555,14 +2597,134 @@ static bool ttsIsIdCompatible(uint32_t id, msg_tts_id tts_id) {
   return res;
 }
 
+// ttsHasSetState returns true if voxind processes MSG_VOX_SET_STATE
+static bool ttsHasSetState(struct engine_t *engine) {
+  version_t *v = &engine->api->voxind_version[engine->tts_id].msg;
+  version_t min;
+  conv_int_to_version(MSG_API_SET_STATE, &min);
+  return (v->major > min.major) || ((v->major == min.major) && (v->minor >= min.minor));
+}
+
+// engine_copy_state sends in a single message the state of src which
+// differs from dst
+static int engine_copy_state(struct engine_t *src, struct engine_t *dst) {
+  struct msg_vox_set_state_t *state = NULL;
+  struct msg_t header;
+  struct msg_bytes_t bytes;
+  size_t filename_len = 0;
+  int eci_res = ECIFalse;
+  int i;
+  int ret = -1;
+
+  if (src->output_filename &&
+	  (!dst->output_filename || strcmp(src->output_filename, dst->output_filename))) {
+	filename_len = strlen(src->output_filename) + 1;
+  }
+
+  bytes.len = sizeof(*state) + filename_len;
+  state = calloc(1, bytes.len);
+  if (!state)
+	return -1;
+  bytes.b = (uint8_t*)state;
+
+  if (filename_len) {
+	state->flags |= MSG_STATE_OUTPUT_FILENAME;
+	memcpy(state->filename, src->output_filename, filename_len);
+  }
+
+  if (src->samples
+	  && ((src->samples != dst->samples) || (src->nb_samples != dst->nb_samples))) {
+	state->flags |= MSG_STATE_OUTPUT_BUFFER;
+	state->nb_samples = src->nb_samples;
+  }
+
+  if ((src->cb != dst->cb) || (src->data_cb != dst->data_cb)) {
+	state->flags |= MSG_STATE_CALLBACK;
+	state->callback = !!src->cb;
+  }
+
+  for (i=0; (i<eciNumVoiceParams) && (i<MSG_STATE_VOICE_PARAM_MAX); i++) {
+	if (src->voice_param_dirty & (1<<i)) {
+	  state->voice_param_mask |= (1<<i);
+	  state->voice_param[i] = src->voice_param[i];
+	}
+  }
+
+  if (!state->flags && !state->voice_param_mask) {
+	ret = 0;
+	goto exit0;
+  }
+
+  dbg("flags=0x%x, voice_param_mask=0x%x", state->flags, state->voice_param_mask);
+  msg_set_header(&header, MSG_DST(dst->tts_id), MSG_VOX_SET_STATE, dst->handle);
+  if (process_func1(dst->api, &header, &bytes, &eci_res, true, true)
+	  || (eci_res != ECITrue)) {
+	err("LEAVE, error set state");
+	goto exit0;
+  }
+
+  if (filename_len) {
+	if (dst->output_filename)
+	  free(dst->output_filename);
+	dst->output_filename = strdup(src->output_filename);
+  }
+  if (state->flags & MSG_STATE_OUTPUT_BUFFER) {
+	dst->samples = src->samples;
+	dst->nb_samples = src->nb_samples;
+  }
+  if (state->flags & MSG_STATE_CALLBACK) {
+	dst->cb = src->cb;
+	dst->data_cb = src->data_cb;
+  }
+  for (i=0; i<eciNumVoiceParams; i++) {
+	if (state->voice_param_mask & (1<<i))
+	  dst->voice_param[i] = src->voice_param[i];
+  }
+  dst->voice_param_dirty &= ~state->voice_param_mask;
+  dst->voice_param_pending &= ~state->voice_param_mask;
+  dst->voice_param_known |= state->voice_param_mask;
+  src->voice_param_dirty = 0;
+  ret = 0;
+
+ exit0:
+  free(state);
+  return ret;
+}
+
+// engine_copy_presets sets the params of the preset voices of dst
+// which have changed in src
+static void engine_copy_presets(struct engine_t *src, struct engine_t *dst) {
+  int v, i;
+
+  for (v=0; v<ECI_PRESET_VOICES; v++) {
+	for (i=0; i<eciNumVoiceParams; i++) {
+	  if (src->preset_dirty[v] & (1<<i)) {
+		dbg("get engine=%p, preset_param[%d][%d] = %d)", src, v+1, i, src->preset_param[v][i]);
+		eciSetVoiceParam(dst, v+1, i, src->preset_param[v][i]);
+	  }
+	}
+	dst->preset_dirty[v] &= ~src->preset_dirty[v];
+	src->preset_dirty[v] = 0;
+  }
+}
+
+// engine_copy updates dst with the state of src which has changed
 static int engine_copy(struct engine_t *src, struct engine_t *dst) {
   int ret = 0;
+  int i;
 
   if (!src || !dst) {	
 	err("LEAVE, args error");
 	return -1;
   }
 
+  if (ttsHasSetState(dst)) {
+	ret = engine_copy_state(src, dst);
+	if (!ret)
+	  engine_copy_presets(src, dst);
+	return ret;
+  }
+
   if (src->output_filename &&
 	  (!dst->output_filename || strcmp(src->output_filename, dst->output_filename))) {
 	if (ECIFalse == eciSetOutputFilename(dst, src->output_filename))
@@ -1580,24 +2742,96 @@ static int engine_copy(struct engine_t *src, struct engine_t *dst) {
 	eciRegisterCallback(dst, src->cb, src->data_cb);
   }
 
-  int i;
+  // only the voice params set since the previous copy
   for (i=0; i<sizeof(src->voice_param)/sizeof(*src->voice_param); i++) {
-	dbg("get engine=%p, voice_param[%d] = %d)", src, i, src->voice_param[i]);  
-	//	if ((src->voice_param[i] != VOICE_PARAM_UNCHANGED) && (src->voice_param[i] != dst->voice_param[i])) {
-	if (src->voice_param[i] != VOICE_PARAM_UNCHANGED) {
+	if (src->voice_param_dirty & (1<<i)) {
+	  dbg("get engine=%p, voice_param[%d] = %d)", src, i, src->voice_param[i]);  
 	  eciSetVoiceParam(dst, 0, i, src->voice_param[i]);
 	}
   }
+  dst->voice_param_dirty &= ~src->voice_param_dirty;
+  src->voice_param_dirty = 0;
+  engine_copy_presets(src, dst);
+
+  return ret;
+}
+
+// engine_flush_params sends the pending voice params, in a single
+// message if voxind supports MSG_VOX_SET_STATE (mutex locked)
+static int engine_flush_params(struct engine_t *engine) {
+  struct msg_vox_set_state_t state;
+  struct msg_t header;
+  struct msg_bytes_t bytes;
+  uint32_t pending = engine->voice_param_pending;
+  int eci_res = ECIFalse;
+  int ret = 0;
+  int i;
+
+  if (!pending)
+	return 0;
+
+  dbg("ENTER(%p), pending=0x%x", engine, pending);
+
+  engine->voice_param_pending = 0;
+
+  if (ttsHasSetState(engine)) {
+	memset(&state, 0, sizeof(state));
+	state.voice_param_mask = pending;
+	for (i=0; (i<eciNumVoiceParams) && (i<MSG_STATE_VOICE_PARAM_MAX); i++) {
+	  if (pending & (1<<i))
+		state.voice_param[i] = engine->voice_param[i];
+	}
+	bytes.b = (uint8_t*)&state;
+	bytes.len = sizeof(state);
+	msg_set_header(&header, MSG_DST(engine->tts_id), MSG_VOX_SET_STATE, engine->handle);
+	if (api_call_func1(engine->api, &header, &bytes, &eci_res)) {
+	  ret = -1;
+	} else if (eci_res != ECITrue) {
+	  ret = -1;
+	}
+  } else {
+	for (i=0; i<eciNumVoiceParams; i++) {
+	  if (!(pending & (1<<i)))
+		continue;
+	  msg_set_header(&header, MSG_DST(engine->tts_id), MSG_SET_VOICE_PARAM, engine->handle);
+	  header.args.svp.iVoice = 0;
+	  header.args.svp.Param = i;
+	  header.args.svp.iValue = engine->voice_param[i];
+	  if (api_call_func1(engine->api, &header, NULL, &eci_res)) {
+		ret = -1;
+		break;
+	  }
+	  if (eci_res < 0)
+		ret = -1;
+	}
+  }
 
-  
-  
-  /* // update other_engine from self */
-  /* self->current_engine = self->other_engine; */
-  /* engine_copy(self, self->other_engine); */
-
+  if (ret) {
+	// values to read again
+	engine->voice_param_known &= ~pending;
+	err("LEAVE, error flush params");
+  }
   return ret;
 }
 
+// engine_set_local_param updates a param processed by libvoxin only
+// (mutex locked)
+static void engine_set_local_param(struct engine_t *engine, voxParam Param, int iValue)
+{
+  if (!engine)
+	return;
+  if ((Param == VOX_TEMPO) && (engine->tempo != iValue)) {
+	engine->tempo = iValue;
+	engine_delete_stretch(engine);
+  } else if ((Param == VOX_TRIM_SILENCE) && (engine->silence != iValue)) {
+	engine->silence = iValue;
+	trim_delete(engine->trim);
+	engine->trim = NULL;
+  } else if (Param == VOX_INCREMENTAL) {
+	engine->incremental = iValue;
+  }
+}
+
 static int set_param(ECIHand hEngine, uint32_t msg_id, voxParam Param, int iValue)
 {
   int eci_res = -1;
@@ -1612,39 +2846,84 @@ static int set_param(ECIHand hEngine, uint32_t msg_id, voxParam Param, int iValu
 	return eci_res;
   }
 
+  if ((Param == VOX_TEMPO) || (Param == VOX_TRIM_SILENCE) || (Param == VOX_INCREMENTAL)) {
+	// processed by libvoxin only
+	if (((Param == VOX_TEMPO) && ((iValue < VOX_TEMPO_MIN) || (iValue > VOX_TEMPO_MAX)))
+		|| ((Param == VOX_TRIM_SILENCE) && ((iValue < 0) || (iValue > VOX_TRIM_SILENCE_MAX)))
+		|| ((Param == VOX_INCREMENTAL) && (iValue != 0) && (iValue != 1)))
+	  return VOX_PARAM_OUT_OF_RANGE;
+	if (api_lock(self->api))
+	  return eci_res;
+	eci_res = (Param == VOX_TEMPO) ? self->tempo
+	  : (Param == VOX_TRIM_SILENCE) ? self->silence : self->incremental;
+	engine_set_local_param(self, Param, iValue);
+	engine_set_local_param(self->other_engine, Param, iValue);
+	api_unlock(self->api);
+	return eci_res;
+  }
+
   if (Param == VOX_LANGUAGE_DIALECT) {
 	if (!ttsIsIdCompatible(iValue, self->current_engine->tts_id)) {
 	  if (self->current_engine == self) {	  
 		if (!self->other_engine) {
-		  self->other_engine = eciNewEx(iValue);
+		  self->other_engine = api_new_engine_ex(self->api, iValue);
 		}
 		if (!self->other_engine)
 		  return -1;
 		dbg("update other_engine from self");
-		self->current_engine = self->other_engine;
+		__atomic_store_n(&self->current_engine, self->other_engine, __ATOMIC_RELEASE);
 		engine_copy(self, self->other_engine);
 	  } else {
 		dbg("update self from other_engine");
-		self->current_engine = self;
+		__atomic_store_n(&self->current_engine, self, __ATOMIC_RELEASE);
 		engine_copy(self->other_engine, self);
 	  }
 	}
   } else if (Param == VOX_CAPITALS) {
+    if (iValue == voxCapitalSoundIcon)
+      pthread_once(&sounds_once, sound_create);
     inote_enable_capital(self->inote, (iValue == voxCapitalSoundIcon));
     if (self->other_engine) 
       inote_enable_capital(self->other_engine->inote, (iValue == voxCapitalSoundIcon));
   }
 
   engine = self->current_engine;
-  
+
+  if (api_lock(engine->api))
+	return eci_res;
+
+  // the same value is not sent again
+  if ((Param < VOX_CAPITALS) && (Param != VOX_LANGUAGE_DIALECT) && !engine->annotated
+	  && (engine->param_known & (1<<Param)) && (engine->param[Param] == iValue)) {
+	api_unlock(engine->api);
+	dbg("LEAVE, unchanged param[%d]", Param);
+	return iValue;
+  }
+
+  // the pending voice params are in the units of the current language
+  if ((Param == VOX_LANGUAGE_DIALECT) || (Param == VOX_REAL_WORLD_UNITS))
+	engine_flush_params(engine);
+
   msg_set_header(&header, MSG_DST(engine->tts_id), msg_id, engine->handle);
   header.args.sp.Param = Param;
   header.args.sp.iValue = iValue;
-  if (!process_func1(engine->api, &header, NULL, &eci_res, false, true)) {
+  if (!process_func1(engine->api, &header, NULL, &eci_res, false, false)) {
 	if (Param == VOX_LANGUAGE_DIALECT) {
 	  engine->to_charset = getCharset(iValue);
 	  _api_updateFromCharset(engine);	  
 	  engine_set_vox_index(engine, iValue);	  
+	  // the language may change the other values
+	  engine->voice_param_known = 0;
+	  engine->param_known = 0;
+	} else if (Param == VOX_REAL_WORLD_UNITS) {
+	  engine->voice_param_known = 0; // other units
+	}
+	if (eci_res >= 0) {
+	  engine->param[Param] = iValue;
+	  if (Param < VOX_CAPITALS)
+		engine->param_known |= (1<<Param);
+	  if (Param != VOX_LANGUAGE_DIALECT) // set by engine_replay at creation
+		engine->param_set |= (1<<Param);
 	}
 	api_unlock(engine->api);	      
   }
@@ -1678,9 +2957,25 @@ int eciGetParam(ECIHand hEngine, enum ECIParam Param)
   }
   engine = engine->current_engine;
 
+  if (api_lock(engine->api))
+	return eci_res;
+
+  if (!engine->annotated && (engine->param_known & (1<<Param))) {
+	eci_res = engine->param[Param];
+	api_unlock(engine->api);
+	dbg("LEAVE, shadow param[%d]=%d", Param, eci_res);
+	return eci_res;
+  }
+
   msg_set_header(&header, MSG_DST(engine->tts_id), MSG_GET_PARAM, engine->handle);
   header.args.gp.Param = Param;
-  process_func1(engine->api, &header, NULL, &eci_res, true, true);
+  if (!process_func1(engine->api, &header, NULL, &eci_res, false, false)) {
+	if (eci_res >= 0) {
+	  engine->param[Param] = eci_res;
+	  engine->param_known |= (1<<Param);
+	}
+	api_unlock(engine->api);
+  }
   return eci_res;  
 }
 
@@ -1789,7 +3084,16 @@ Boolean eciReset(ECIHand hEngine)
   engine = engine->current_engine;
 
   msg_set_header(&header, MSG_DST(engine->tts_id), MSG_RESET, engine->handle);
-  process_func1(engine->api, &header, NULL, &eci_res, true, true);
+  if (!process_func1(engine->api, &header, NULL, &eci_res, false, true)) {
+	engine_clear_input(engine, true);
+	if (eci_res == ECITrue) {
+	  engine_set_utterance(engine, UTTERANCE_IDLE);
+	  engine->voice_param_pending = 0;
+	  engine->voice_param_known = 0;
+	  engine->param_known = 0;
+	}
+	api_unlock(engine->api);
+  }
   return eci_res;
 }
 
@@ -1816,6 +3120,7 @@ int eciGetVoiceParam(ECIHand hEngine, int iVoice, enum ECIVoiceParam Param)
   int eci_res = -1;
   struct engine_t *engine = (struct engine_t *)hEngine;
   struct msg_t header;
+  bool active;
    
   dbg("ENTER(%p,%d,%d)", hEngine, iVoice, Param);  
 
@@ -1824,11 +3129,28 @@ int eciGetVoiceParam(ECIHand hEngine, int iVoice, enum ECIVoiceParam Param)
 	return eci_res;
   }
   engine = engine->current_engine;
-    
+  active = (!iVoice && (Param >= 0) && (Param < eciNumVoiceParams));
+
+  if (api_lock(engine->api))
+	return eci_res;
+
+  if (active && !engine->annotated && (engine->voice_param_known & (1<<Param))) {
+	eci_res = engine->voice_param[Param];
+	api_unlock(engine->api);
+	dbg("LEAVE, shadow voice_param[%d]=%d", Param, eci_res);
+	return eci_res;
+  }
+
   msg_set_header(&header, MSG_DST(engine->tts_id), MSG_GET_VOICE_PARAM, engine->handle);
   header.args.gvp.iVoice = iVoice;
   header.args.gvp.Param = Param;
-  process_func1(engine->api, &header, NULL, &eci_res, true, true);
+  if (!process_func1(engine->api, &header, NULL, &eci_res, false, false)) {
+	if (active && (eci_res >= 0)) {
+	  engine->voice_param[Param] = eci_res;
+	  engine->voice_param_known |= (1<<Param);
+	}
+	api_unlock(engine->api);
+  }
   return eci_res;
 }
 
@@ -1841,20 +3163,48 @@ int eciSetVoiceParam(ECIHand hEngine, int iVoice, enum ECIVoiceParam Param, int
    
   dbg("ENTER(%p,%d,%d,%d)", hEngine, iVoice, Param, iValue);  
   
-  if (!IS_ENGINE(engine) || (Param >= eciNumVoiceParams)) {
+  if (!IS_ENGINE(engine) || (Param < 0) || (Param >= eciNumVoiceParams)) {
 	err("LEAVE, args error");
 	return eci_res;
   }
   engine = engine->current_engine;
 
+  if (api_lock(engine->api))
+	return eci_res;
+
+  // active voice, known and valid value in ECI units: deferred until
+  // the next input or synthesis
+  if (!iVoice && !engine->annotated && !engine_real_world_units(engine)
+	  && (engine->voice_param_known & (1<<Param))
+	  && (iValue >= 0) && (iValue <= voice_param_max[Param])) {
+	eci_res = engine->voice_param[Param];
+	if (iValue != eci_res) {
+	  engine->voice_param[Param] = iValue;
+	  engine->voice_param_dirty |= (1<<Param);
+	  engine->voice_param_pending |= (1<<Param);
+	}
+	api_unlock(engine->api);
+	dbg("LEAVE, shadow voice_param[%d]=%d, pending=0x%x", Param, iValue, engine->voice_param_pending);
+	return eci_res;
+  }
+
   msg_set_header(&header, MSG_DST(engine->tts_id), MSG_SET_VOICE_PARAM, engine->handle);
   header.args.svp.iVoice = iVoice;
   header.args.svp.Param = Param;
   header.args.svp.iValue = iValue;
-  process_func1(engine->api, &header, NULL, &eci_res, true, true);
-  if (eci_res >= 0) {
-	engine->voice_param[Param] = iValue;
-	dbg("set engine=%p, voice_param[%d] = %d)", engine, Param, iValue);  
+  if (!process_func1(engine->api, &header, NULL, &eci_res, false, false)) {
+	if ((eci_res >= 0) && !iVoice) { // active voice
+	  engine->voice_param[Param] = iValue;
+	  engine->voice_param_dirty |= (1<<Param);
+	  engine->voice_param_known |= (1<<Param);
+	  engine->voice_param_pending &= ~(1<<Param);
+	  dbg("set engine=%p, voice_param[%d] = %d)", engine, Param, iValue);  
+	} else if ((eci_res >= 0) && (iVoice > 0) && (iVoice <= ECI_PRESET_VOICES)) {
+	  engine->preset_param[iVoice-1][Param] = iValue;
+	  engine->preset_dirty[iVoice-1] |= (1<<Param);
+	  dbg("set engine=%p, preset_param[%d][%d] = %d)", engine, iVoice, Param, iValue);
+	}
+	api_unlock(engine->api);
   }
   return eci_res;
 }
@@ -1895,9 +3245,26 @@ Boolean eciInsertIndex(ECIHand hEngine, int iIndex)
   }
   engine = engine->current_engine;
     
+  if (api_lock(engine->api))
+	return eci_res;
+  engine_begin_utterance(engine);
+
+  if (engine->incremental) {
+	if (!engine_push_input(engine, INPUT_INDEX, NULL, iIndex)) {
+	  eci_res = ECITrue;
+	  engine_input_added(engine);
+	}
+	api_unlock(engine->api);
+	return eci_res;
+  }
+
   msg_set_header(&header, MSG_DST(engine->tts_id), MSG_INSERT_INDEX, engine->handle);
   header.args.ii.iIndex = iIndex;
-  process_func1(engine->api, &header, NULL, &eci_res, true, true);
+  if (!process_func1(engine->api, &header, NULL, &eci_res, false, false)) {
+	if (eci_res == ECITrue)
+	  engine_input_added(engine);
+	api_unlock(engine->api);
+  }
   return eci_res;  
 }
 
@@ -1915,10 +3282,18 @@ Boolean eciCopyVoice(ECIHand hEngine, int iVoiceFrom, int iVoiceTo)
   }
   engine = engine->current_engine;
     
+  if (api_lock(engine->api))
+	return eci_res;
+  engine_flush_params(engine);
+
   msg_set_header(&header, MSG_DST(engine->tts_id), MSG_COPY_VOICE, engine->handle);
   header.args.cv.iVoiceFrom = iVoiceFrom;
   header.args.cv.iVoiceTo = iVoiceTo;
-  process_func1(engine->api, &header, NULL, &eci_res, true, true);
+  if (!process_func1(engine->api, &header, NULL, &eci_res, false, false)) {
+	if (!iVoiceTo)
+	  engine->voice_param_known = 0;
+	api_unlock(engine->api);
+  }
 
   return eci_res;  
 }
@@ -2044,7 +3419,12 @@ Boolean eciClearInput(ECIHand hEngine)
   }
   engine = engine->current_engine;
   msg_set_header(&header, MSG_DST(engine->tts_id), MSG_CLEAR_INPUT, engine->handle);
-  process_func1(engine->api, &header, NULL, &eci_res, true, true);
+  if (!process_func1(engine->api, &header, NULL, &eci_res, false, true)) {
+	engine_clear_input(engine, false);
+	if ((eci_res == ECITrue) && (engine->utterance == UTTERANCE_QUEUED))
+	  engine_set_utterance(engine, UTTERANCE_IDLE);
+	api_unlock(engine->api);
+  }
   return eci_res;
 }
 
@@ -2129,10 +3509,10 @@ static int ttsGetVoices(msg_tts_id id, vox_t *list, unsigned int *nbVoices) {
   return 0;
 }
 
-static int ttsGetVersion(msg_tts_id id) {
+// ttsGetVersion fills api->voxind_version[id] (mutex already locked)
+static int ttsGetVersion(struct api_t *api, msg_tts_id id) {
   ENTER();
   struct msg_t header;
-  struct api_t *api = &my_api;
   int eci_res = 1;
 	
   if ((id <= MSG_TTS_UNDEFINED) || (id >= MSG_TTS_MAX)) {
@@ -2202,7 +3582,8 @@ int voxGetVoices(vox_t *list, unsigned int *nbVoices) {
 		vox_list_nb += n;
 	  }
 
-	  ttsGetVersion(api->tts[i]);
+	  if (!ttsGetVersion(api, api->tts[i]))
+		ttsSetRealtime(api, api->tts[i], false);
 	}
 	api_unlock(api);	
   }
@@ -2221,6 +3602,458 @@ int voxGetVoices(vox_t *list, unsigned int *nbVoices) {
   return 0;
 }
 
+int voxSetEnginePool(uint32_t id, unsigned int number) {
+  struct api_t *api = &my_api;
+  uint32_t language = MSG_ENGINE_POOL_ANY;
+  int eci_res = ECIFalse;
+  int res = 0;
+
+  dbg("ENTER(id=0x%x, number=%d)", id, number);
+
+  if (!IS_API(api)) {
+	err("LEAVE, api error");
+	return 1;
+  }
+
+  if (id) {
+	int i;
+	if (!vox_list_nb) {
+	  unsigned int n = MSG_VOX_LIST_MAX;
+	  if (voxGetVoices(NULL, &n))
+		return 1;
+	}
+	for (i=0; i < vox_list_nb; i++) {
+	  if (vox_list[i].id == id)
+		break;
+	}
+	if ((i == vox_list_nb) || (vox_list[i].tts_id != MSG_TTS_ECI)) {
+	  err("LEAVE, error: no IBM TTS voice (0x%x)", id);
+	  return 1;
+	}
+	language = id;
+  }
+
+  if (api_lock(api))
+	return 1;
+  res = ttsSetEnginePool(api, language, number, &eci_res);
+  api_unlock(api);
+  return (!res && (eci_res == ECITrue)) ? 0 : 1;
+}
+
+// engine_preempt sets or clears the preemption request of the engine
+// (see queue.h)
+static void engine_preempt(void *handle, bool on) {
+  struct engine_t *engine = (struct engine_t *)handle;
+  engine->preempt_required = on;
+  if (engine->other_engine)
+	engine->other_engine->preempt_required = on;
+}
+
+// engine_split returns the length of the sentence of text at offset;
+// a text with markup or ECI annotations is not split (see queue.h)
+static size_t engine_split(const char *text, size_t offset) {
+  bool end;
+  if (strchr(text, '<') || strchr(text, '`'))
+	return strlen(text + offset);
+  return text_get_sentence(text + offset, &end);
+}
+
+int voxSpeak(void *handle, const char *text, voxPriority priority) {
+  static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+  struct engine_t *engine = (struct engine_t *)handle;
+  int res;
+
+  dbg("ENTER(%p,%p,%d)", handle, text, priority);
+
+  if (!IS_ENGINE(engine) || !text) {
+	err("LEAVE, args error");
+	return VOX_PARAM_OUT_OF_RANGE;
+  }
+
+  // not the api mutex: locked while an utterance is spoken
+  pthread_mutex_lock(&queue_mutex);
+  if (!engine->queue) {
+	int rt_priority;
+	realtime_policy_t policy = api_get_realtime(engine->api, &rt_priority);
+	engine->queue = queue_create(engine, engine_preempt, engine_split, policy, rt_priority);
+  }
+  pthread_mutex_unlock(&queue_mutex);
+
+  res = queue_push(engine->queue, text, priority);
+  if (res) {
+	err("LEAVE, queue error (%d)", res);
+	return VOX_PARAM_OUT_OF_RANGE;
+  }
+  return VOX_OK;
+}
+
+// ttsHasPrefetch returns true if voxind processes MSG_VOX_PREFETCH
+static bool ttsHasPrefetch(struct engine_t *engine) {
+  version_t *v = &engine->api->voxind_version[engine->tts_id].msg;
+  version_t min;
+  conv_int_to_version(MSG_API_PREFETCH, &min);
+  return (v->major > min.major) || ((v->major == min.major) && (v->minor >= min.minor));
+}
+
+int voxPrefetch(void *handle, const char *text) {
+  struct engine_t *engine = (struct engine_t *)handle;
+  struct api_t *api;
+  struct msg_t header;
+  struct msg_bytes_t bytes;
+  inote_slice_t slice;
+  inote_state_t state;
+  uint32_t expected_lang[MAX_LANG];
+  inote_charset_t from_charset;
+  bool ssml_mode;
+  size_t text_left = 0;
+  size_t len;
+  inote_error ret;
+  int eci_res = ECIFalse;
+
+  dbg("ENTER(%p,%p)", handle, text);
+
+  if (!IS_ENGINE(engine) || !text) {
+	err("LEAVE, args error");
+	return VOX_PARAM_OUT_OF_RANGE;
+  }
+  engine = engine->current_engine;
+
+  len = strlen(text);
+  if (!len || (len > TEXT_LENGTH_MAX)
+	  || (engine->tts_id != MSG_TTS_ECI) || !ttsHasPrefetch(engine)) {
+	dbg("LEAVE, no prefetch");
+	return VOX_PARAM_OUT_OF_RANGE;
+  }
+
+  api = engine->api;
+  if (api_lock(api))
+	return VOX_PARAM_OUT_OF_RANGE;
+  engine_flush_params(engine);
+
+  // the conversion must not alter the state of the next eciAddText
+  state = engine->state;
+  memcpy(expected_lang, engine->state_expected_lang, sizeof(expected_lang));
+  from_charset = engine->from_charset;
+  ssml_mode = api->ssml_mode;
+
+  slice.buffer = (uint8_t*)text;
+  slice.length = len;
+  slice.charset = engine->from_charset;
+  slice.end_of_buffer = slice.buffer + len;
+  ret = _api_convertText2TLV(engine, &slice, &text_left);
+
+  engine->state = state;
+  memcpy(engine->state_expected_lang, expected_lang, sizeof(expected_lang));
+  engine->from_charset = from_charset;
+  api->ssml_mode = ssml_mode;
+
+  // a single tlv message (no language switching)
+  if ((ret != INOTE_OK) || text_left || !engine->tlv_message.length) {
+	dbg("LEAVE, no prefetch (ret=%d, text_left=%lu)", ret, (long unsigned int)text_left);
+	engine->tlv_message.length = 0;
+	api_unlock(api);
+	return VOX_PARAM_OUT_OF_RANGE;
+  }
+
+  msg_set_header(&header, MSG_DST(engine->tts_id), MSG_VOX_PREFETCH, engine->handle);
+  bytes.b = engine->tlv_message.buffer;
+  bytes.len = engine->tlv_message.length;
+  engine->tlv_message.length = 0;
+  process_func1(api, &header, &bytes, &eci_res, true, false);
+  return (eci_res == ECITrue) ? VOX_OK : VOX_PARAM_OUT_OF_RANGE;
+}
+
+int voxGetUtteranceTimeline(void *handle, voxUtteranceTimeline *timeline) {
+  struct engine_t *engine = (struct engine_t *)handle;
+  voxUtteranceTimeline *t = timeline;
+
+  dbg("ENTER(%p,%p)", handle, timeline);
+
+  if (!IS_ENGINE(engine) || !timeline) {
+	err("LEAVE, args error");
+	return VOX_PARAM_OUT_OF_RANGE;
+  }
+  engine = engine->current_engine;
+
+  if (api_lock(engine->api))
+	return VOX_PARAM_OUT_OF_RANGE;
+  *t = engine->timeline;
+  api_unlock(engine->api);
+
+  t->ttfa = (t->first_audio && t->text_submitted) ? t->first_audio - t->text_submitted : 0;
+  t->rtf = 0;
+  if (t->end && t->synthesize && t->nb_samples && t->sample_rate) {
+	float audio = (float)t->nb_samples*1000000/t->sample_rate;
+	t->rtf = (t->end - t->synthesize - t->callback_duration)/audio;
+  }
+  t->stop_latency = (t->stop_honored && t->stop_requested) ? t->stop_honored - t->stop_requested : 0;
+
+  dbg("LEAVE, ttfa=%u us, rtf=%.3f, stop_latency=%u us", t->ttfa, t->rtf, t->stop_latency);
+  return VOX_OK;
+}
+
+// ttsHasMemory returns true if voxind processes MSG_VOX_GET_MEMORY
+static bool ttsHasMemory(struct engine_t *engine) {
+  version_t *v = &engine->api->voxind_version[engine->tts_id].msg;
+  version_t min;
+  conv_int_to_version(MSG_API_MEMORY, &min);
+  return (v->major > min.major) || ((v->major == min.major) && (v->minor >= min.minor));
+}
+
+int voxGetMemory(void *handle, voxMemory *memory) {
+  struct engine_t *engine = (struct engine_t *)handle;
+  struct engine_t *e;
+  struct api_t *api;
+  struct msg_t header;
+  int eci_res;
+
+  dbg("ENTER(%p,%p)", handle, memory);
+
+  if (!IS_ENGINE(engine) || !memory) {
+	err("LEAVE, args error");
+	return VOX_PARAM_OUT_OF_RANGE;
+  }
+
+  api = engine->api;
+  memset(memory, 0, sizeof(*memory));
+  if (api_lock(api))
+	return VOX_PARAM_OUT_OF_RANGE;
+  // the engines of both tts
+  for (e = engine; e; e = (e == engine) ? engine->other_engine : NULL) {
+	memory->libvoxin += e->memory;
+	if (!ttsHasMemory(e))
+	  continue;
+	msg_set_header(&header, MSG_DST(e->tts_id), MSG_VOX_GET_MEMORY, e->handle);
+	if (!api_call_func1(api, &header, NULL, &eci_res) && (eci_res == ECITrue)) {
+	  memory->voxind += api->msg->args.gm.engine;
+	  memory->voxind_engines += api->msg->args.gm.engines;
+	}
+  }
+  memory->libvoxin_engines = api->memory;
+  api_unlock(api);
+
+  dbg("LEAVE, libvoxin=%u (%u), voxind=%u (%u) bytes", memory->libvoxin,
+	  memory->libvoxin_engines, memory->voxind, memory->voxind_engines);
+  return VOX_OK;
+}
+
+#define RENDER_JOBS_MAX 32
+#define RENDER_CHUNK_MIN 512 // bytes of text synthesized by a job at once
+
+// render_config_t: engine of each job of voxRenderDocument
+struct render_config_t {
+  uint32_t voice; // vox_t id, 0 for the default voice
+  const int *params; // VOX_NUM_PARAMS values (negative: unchanged) or NULL
+};
+
+// api_worker_delete deletes a private api, its engines and voxind
+static void api_worker_delete(struct api_t *api) {
+  ENTER();
+
+  if (!api)
+	return;
+
+  while (api->engines) {
+	struct engine_t *e;
+	for (e = api->engines; e; e = e->next) {
+	  if (e->other_engine == api->engines)
+		e->other_engine = NULL;
+	}
+	engine_delete(api->engines);
+  }
+  libvoxin_delete(&api->my_instance);
+  if (api->msg_locked)
+	realtime_unlock(api->msg, PIPE_MAX_BLOCK);
+  free(api->msg);
+  free(api->scratch);
+  if (api->my_config)
+	config_delete(&api->my_config);
+  if (api->my_default_config)
+	config_delete(&api->my_default_config);
+  pthread_mutex_destroy(&api->stop_mutex);
+  pthread_mutex_destroy(&api->api_mutex);
+  free(api);
+
+  LEAVE();
+}
+
+// api_worker_create returns a private api: its own mutexes and
+// voxind, the engines of the jobs are synthesized concurrently
+static struct api_t *api_worker_create() {
+  struct api_t *api;
+  int i;
+
+  ENTER();
+
+  api = calloc(1, sizeof(*api));
+  if (!api) {
+	err("mem error (%d)", errno);
+	return NULL;
+  }
+  pthread_mutex_init(&api->stop_mutex, NULL);
+  pthread_mutex_init(&api->api_mutex, NULL);
+  api->worker = true;
+  if (api_create(api) || !api->my_instance || !api->tts_len) {
+	err("LEAVE, api error");
+	api_worker_delete(api);
+	return NULL;
+  }
+
+  // the versions of its voxind (events, realtime...)
+  if (api_lock(api)) {
+	api_worker_delete(api);
+	return NULL;
+  }
+  for (i=0; i<api->tts_len; i++) {
+	if (!ttsGetVersion(api, api->tts[i]))
+	  ttsSetRealtime(api, api->tts[i], false);
+  }
+  api_unlock(api);
+
+  LEAVE();
+  return api;
+}
+
+// render_engine_create returns the engine of a job (see render.h)
+static void *render_engine_create(void *data) {
+  struct render_config_t *config = data;
+  struct api_t *api = api_worker_create();
+  struct engine_t *engine = NULL;
+  int i;
+
+  if (!api)
+	return NULL;
+
+  engine = config->voice ? api_new_engine_ex(api, config->voice) : api_new_engine(api);
+  if (!engine) {
+	api_worker_delete(api);
+	return NULL;
+  }
+
+  for (i=0; config->params && (i<VOX_NUM_PARAMS); i++) {
+	if ((config->params[i] >= 0)
+		&& (voxSetParam(engine, i, config->params[i]) == VOX_PARAM_OUT_OF_RANGE)) {
+	  err("param %d: error", i);
+	  eciDelete(engine);
+	  api_worker_delete(api);
+	  return NULL;
+	}
+  }
+  return engine;
+}
+
+static void render_engine_delete(void *handle, void *data) {
+  struct engine_t *engine = (struct engine_t *)handle;
+  struct api_t *api = engine->api;
+
+  eciDelete(engine);
+  api_worker_delete(api);
+}
+
+// render_split splits text in chunks of whole sentences (a text with
+// markup or ECI annotations is not split); returns the number of
+// chunks or 0 on error
+static size_t render_split(const char *text, size_t len, char ***chunk) {
+  char *buf = strndup(text, len);
+  const char *s = buf;
+  size_t nb = 0;
+  size_t max = 0;
+  bool whole;
+
+  *chunk = NULL;
+  if (!buf)
+	goto exit0;
+
+  whole = (strchr(buf, '<') != NULL) || (strchr(buf, '`') != NULL);
+  while (*s) {
+	size_t l = 0;
+	bool end = true;
+
+	while (s[l] && end && (whole || (l < RENDER_CHUNK_MIN))) {
+	  l += whole ? strlen(s) : text_get_sentence(s + l, &end);
+	}
+	if (nb == max) {
+	  char **c = realloc(*chunk, (max + 16)*sizeof(*c));
+	  if (!c)
+		goto exit0;
+	  *chunk = c;
+	  max += 16;
+	}
+	(*chunk)[nb] = strndup(s, l);
+	if (!(*chunk)[nb])
+	  goto exit0;
+	nb++;
+	s += l;
+  }
+  free(buf);
+  return nb;
+
+ exit0:
+  err("mem error (%d)", errno);
+  while (nb)
+	free((*chunk)[--nb]);
+  free(*chunk);
+  *chunk = NULL;
+  free(buf);
+  return 0;
+}
+
+int voxRenderDocument(const char *text, size_t len, uint32_t voice, const int *params,
+					  voxRenderSink sink, void *data, unsigned int jobs) {
+  struct render_config_t config = {.voice=voice, .params=params};
+  char **chunk = NULL;
+  size_t nb = 0;
+  size_t i;
+  int res;
+
+  dbg("ENTER(%p,%lu,0x%x,%p,%p,%p,%u)", text, (unsigned long)len, voice, params, sink, data, jobs);
+
+  if (!text || !sink || (jobs > RENDER_JOBS_MAX))
+	return VOX_PARAM_OUT_OF_RANGE;
+
+  // the list of voices is obtained once, before the jobs
+  if (!vox_list_nb) {
+	unsigned int n = MSG_VOX_LIST_MAX;
+	if (voxGetVoices(NULL, &n) || !vox_list_nb)
+	  return VOX_PARAM_OUT_OF_RANGE;
+  }
+  if (voice) {
+	for (i=0; i < vox_list_nb; i++) {
+	  if (vox_list[i].id == voice)
+		break;
+	}
+	if (i == vox_list_nb) {
+	  err("LEAVE, error voice not found");
+	  return VOX_PARAM_OUT_OF_RANGE;
+	}
+  }
+
+  if (!jobs) {
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	jobs = (n < 1) ? 1 : (n > RENDER_JOBS_MAX) ? RENDER_JOBS_MAX : n;
+  }
+
+  len = strnlen(text, len);
+  if (len) {
+	nb = render_split(text, len, &chunk);
+	if (!nb)
+	  return VOX_PARAM_OUT_OF_RANGE;
+  }
+  if (jobs > nb)
+	jobs = nb ? nb : 1;
+
+  res = !nb ? 0 : render_document((const char **)chunk, nb, jobs,
+								  render_engine_create, render_engine_delete, &config,
+								  sink, data);
+
+  for (i=0; i<nb; i++)
+	free(chunk[i]);
+  free(chunk);
+
+  dbg("LEAVE(res=%d)", res);
+  return res ? VOX_PARAM_OUT_OF_RANGE : VOX_OK;
+}
+
 /* convert the name to lower case and add quality */
 /* Zoe + embedded-compact = zoe-embedded-compact */
 static bool _voxToCompositeName(vox_t *data, char *string, size_t size) {
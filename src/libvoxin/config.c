@@ -1,5 +1,6 @@
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <sys/stat.h>
@@ -9,6 +10,9 @@
 
 #define SOME_DEFAULT_PUNCTUATION "(),?"
 #define DEFAULT_ECI_DICTIONARY_DIR "/var/opt/IBM/ibmtts/dict"
+#define MAX_ECI_ENGINE_POOL 4
+#define MIN_REALTIME_PRIORITY -20 // nice
+#define MAX_REALTIME_PRIORITY 99 // SCHED_RR, SCHED_FIFO
 
 static int config_cb(void *user, const char *section, const char *name, const char *value) {
   config_t *conf = user;
@@ -83,6 +87,77 @@ static int config_cb(void *user, const char *section, const char *name, const ch
       if (updated) {
 	dbg("voice_name=%s", conf->voice_name ? conf->voice_name : "NULL");
       }
+    } else if (!strcasecmp(name, "realtime")) {
+      bool updated = true;
+      if (!strcasecmp(value, "none")) {
+	conf->realtime = REALTIME_NONE;
+      } else if (!strcasecmp(value, "nice")) {
+	conf->realtime = REALTIME_NICE;
+      } else if (!strcasecmp(value, "rr")) {
+	conf->realtime = REALTIME_RR;
+      } else if (!strcasecmp(value, "fifo")) {
+	conf->realtime = REALTIME_FIFO;
+      } else {
+	updated = false;
+      }
+      if (updated) {
+	dbg("realtime=%d", conf->realtime);
+      }
+    } else if (!strcasecmp(name, "realtimePriority")) {
+      char *end = NULL;
+      long n = strtol(value, &end, 10);
+      if ((end != value) && !*end && (n >= MIN_REALTIME_PRIORITY) && (n <= MAX_REALTIME_PRIORITY)) {
+	conf->realtime_priority = n;
+	dbg("realtime_priority=%d", conf->realtime_priority);
+      }
+    } else if (!strcasecmp(name, "lockMemory")) {
+      bool updated = true;
+      if (!strcasecmp(value, "yes")) {
+	conf->lock_memory = true;
+      } else if (!strcasecmp(value, "no")) {
+	conf->lock_memory = false;
+      } else {
+	updated = false;
+      }
+      if (updated) {
+	dbg("lock_memory=%d", conf->lock_memory);
+      }
+    } else if (!strcasecmp(name, "directMode")) {
+      bool updated = true;
+      if (!strcasecmp(value, "yes")) {
+	conf->direct_mode = true;
+      } else if (!strcasecmp(value, "no")) {
+	conf->direct_mode = false;
+      } else {
+	updated = false;
+      }
+      if (updated) {
+	dbg("direct_mode=%d", conf->direct_mode);
+      }
+    } else if (!strcasecmp(name, "broker")) {
+      bool updated = true;
+      if (!strcasecmp(value, "yes")) {
+	conf->broker = true;
+      } else if (!strcasecmp(value, "no")) {
+	conf->broker = false;
+      } else {
+	updated = false;
+      }
+      if (updated) {
+	dbg("broker=%d", conf->broker);
+      }
+    } else if (!strcasecmp(name, "standby")) {
+      bool updated = true;
+      if (!strcasecmp(value, "yes")) {
+	conf->standby = true;
+      } else if (!strcasecmp(value, "no")) {
+	conf->standby = false;
+      } else {
+	updated = false;
+      }
+      if (updated) {
+	dbg("standby=%d", conf->standby);
+      }
     }
   } else if (!strcasecmp(section, "viavoice")) {
     config_eci_t *eci = conf->eci;
@@ -129,6 +204,13 @@ static int config_cb(void *user, const char *section, const char *name, const ch
       if (updated) {
 	dbg("use_abbreviation=%d", eci->use_abbreviation);
       }
+    } else if (!strcasecmp(name, "enginePool")) {
+      char *end = NULL;
+      long n = strtol(value, &end, 10);
+      if ((end != value) && !*end && (n >= 0)) {
+	eci->engine_pool = (n > MAX_ECI_ENGINE_POOL) ? MAX_ECI_ENGINE_POOL : n;
+	dbg("engine_pool=%u", eci->engine_pool);
+      }
     }
   }
   
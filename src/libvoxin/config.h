@@ -4,10 +4,12 @@
 #include <stdbool.h>
 #include "voxin.h"
 #include "inote.h"
+#include "realtime.h"
 
 typedef struct {
   char *dictionary_dir;
   bool use_abbreviation;
+  unsigned int engine_pool; // number of idle engines prepared per language
 } config_eci_t;
 
 typedef struct {
@@ -16,6 +18,12 @@ typedef struct {
   char *some_punctuation;
   char *voice_name;
   char *filename;
+  realtime_policy_t realtime; // scheduling of the audio path
+  int realtime_priority; // 0 = default of the policy
+  bool lock_memory; // mlock the message and sample buffers
+  bool direct_mode; // native engines loaded in the process (no voxind)
+  bool broker; // voxind broker shared by the processes of the user
+  bool standby; // spare voxind spawned in advance for each tts
   config_eci_t *eci;
 } config_t;
 
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,10 +10,15 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 #include <sys/types.h>
-#include <dirent.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <sys/syscall.h>
+#include <dlfcn.h>
 #include <stdbool.h>
 #include "libvoxin.h"
 #include "msg.h"
+#include "direct.h"
+#include "broker.h"
 #include "debug.h"
 
 #define RFS "/opt/oralux/voxin"
@@ -23,7 +29,26 @@
 // nve: relative to RFS
 #define VOXIND_NVE "bin/voxind-nve"
 
+// voxind library (direct mode, eci only), relative to rfsdir
+#define LIBVOXIND "usr/lib/libvoxind.so"
+// eci.ini, relative to rfsdir; ECIINI gives its path to the engine
+#define ECI_INI "eci.ini"
+#define ECI_INI_ENV "ECIINI"
+
+#ifndef __NR_close_range
+#define __NR_close_range 436
+#endif
+
 #define READ_TIMEOUT_IN_MS 5000
+// heartbeat: voxind is checked at each period while a reply is
+// expected; voxind is hung if it does not use any cpu time for
+// HANG_IN_MS, except during a request which may block the engine
+// (see msg_may_block).
+#define HEARTBEAT_IN_MS 100
+#define HANG_IN_MS 1000
+// a stopped voxind is killed if still running after this delay
+#define STOP_TIMEOUT_IN_MS 1000
+#define STOP_STEP_IN_MS 10
 #define MAXBUF 4096
 
 #define ECI_INSTALL_WITNESS "/opt/IBM/ibmtts/lib/libibmeci.so"
@@ -39,8 +64,14 @@ typedef struct {
   char bin[MAXBUF]; // path to the voxind binary (relative to rfsdir)
   char ld_library_path[MAXBUF]; // LD_LIBRARY_PATH if needed by voxind
   pid_t parent; // pid of the process which created voxind
-  pid_t child; // pid of voxind
+  pid_t child; // pid of voxind (broker: pid of the worker, not a child)
+  bool broker; // connected to a worker of the voxind broker
   struct pipe_t *pipe; // bi-directionnal pipe (between parent/child)
+  // direct mode: voxind loaded in the process (no child, no pipe)
+  void *direct; // handle of libvoxind or NULL
+  void *engine_lib; // handle of the engine library preloaded for libvoxind
+  direct_call_t direct_call;
+  direct_delete_t direct_delete;
 } voxind_t;
 
 typedef struct {
@@ -48,7 +79,12 @@ typedef struct {
   uint32_t msg_count;
   pid_t parent;
   voxind_t *voxind[MSG_TTS_MAX]; // Warning: index==0 is the first valid value (0 is not interpreted as MSG_TTS_UNDEFINED!)
+  voxind_t *standby[MSG_TTS_MAX]; // spare voxind of voxind[i], started in advance
   uint32_t stop_required;
+  direct_app_cb app; // direct mode if not NULL (see libvoxin_set_direct)
+  void *app_data;
+  bool broker; // voxind broker used instead of spawned voxind
+  bool standby_on; // see libvoxin_set_standby
   // rootdir: path to the root directory.
   // For example, rootdir could be "/",
   // "/home/user1/.oralux/voxin/rootdir"
@@ -69,80 +105,34 @@ static int voxind_write(voxind_t *self, void *buf, ssize_t *len) {
   return pipe_write(self->pipe, buf, len);
 }
 
-static void my_exit(voxind_t *self) {
-  struct msg_t msg;
-  ssize_t l = sizeof(struct msg_t);
-  int res;
-  unsigned long int tid = libvoxinDebugGetTid();
-
-  dbg("[pid=%lu] ENTER", tid);  
-  
-  memset(&msg, 0, MIN_MSG_SIZE);
-  msg.id = MSG_EXIT;
-  
-  dbg("[pid=%lu] send exit msg", tid);
-  res = pipe_write(self->pipe, &msg, &l);
-  if (res) {
-    dbg("[pid=%lu] write error (%d)", tid, res);
+// get_root_dir_from_path: s is the directory of libvoxin, possibly
+// preceded by other fields (line of /proc/self/maps)
+static int get_root_dir_from_path(char *dir, char *s) {
+  const char *path=RFS "/lib";
+  size_t len = strlen(s);
+  size_t ref = strlen(path);
+  char *basename;
+
+  dbg("s='%s', path='%s'\n", s, path);
+  if (len < ref) {
+    dbg("not match (2)\n");
+    return EINVAL;
   }
-}
-
-// fdwalk function from glib (GPLv2):
-// https://git.gnome.org/browse/glib/tree/glib/gspawn.c?h=2.50.0#n1027
-static int fdwalk (int (*cb)(void *data, int fd), void *data) {
-  int open_max;
-  int fd;
-  int res = 0;  
-  struct rlimit rl;
-  DIR *d;
-
-  if ((d = opendir("/proc/self/fd"))) {
-    struct dirent *de;
-
-    while ((de = readdir(d))) {
-      long int l;
-      char *e = NULL;
-
-      if (de->d_name[0] == '.')
-	continue;
-            
-      errno = 0;
-      l = strtol(de->d_name, &e, 10);
-      if (errno != 0 || !e || *e)
-	continue;
-
-      fd = (int) l;
-
-      if ((long int) fd != l)
-	continue;
-
-      if (fd == dirfd(d))
-	continue;
-
-      if ((res = cb (data, fd)) != 0)
-	break;
+  if (len == ref) {
+    strcpy(dir, "/");
+  } else {
+    s[len-ref+1] = 0;
+    basename = strchr(s, '/');
+    if (!basename) {
+      dbg("not match (3)\n");
+      return EINVAL;
     }
-      
-    closedir(d);
-    return res;
+    bcopy(basename, dir, strlen(basename)+1);
   }
-
-  /* If /proc is not mounted or not accessible we fall back to the old
-   * rlimit trick */
-  
-  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_max != RLIM_INFINITY)
-    open_max = rl.rlim_max;
-  else
-    open_max = sysconf (_SC_OPEN_MAX);
-
-  for (fd = 0; fd < open_max; fd++)
-    if ((res = cb (data, fd)) != 0)
-      break;
-
-  return res;
+  dbg("dir=%s\n", dir);
+  return 0;
 }
 
-
 // Return the root directory of the absolute pathname of libvoxin
 // linked to the running process.
 // For example, if the running process is linked to this library:
@@ -154,11 +144,23 @@ static int get_root_dir(char *dir, size_t len) {
   FILE *fd = NULL;
   char *basename = NULL;
   int err = EINVAL;
+  Dl_info info;
 
   if (!dir || (len < MAXBUF))
     return EINVAL;
 
   *dir = 0;
+
+  // pathname of the library, without reading the mappings
+  if (dladdr((void*)get_root_dir, &info) && info.dli_fname
+      && (*info.dli_fname == '/') && (strlen(info.dli_fname) < len)) {
+    strcpy(dir, info.dli_fname);
+    basename = strrchr(dir, '/');
+    *basename = 0;
+    if (!get_root_dir_from_path(dir, dir))
+      return 0;
+  }
+
   fd = fopen("/proc/self/maps", "r");
   if (!fd) {
     err = errno;
@@ -168,49 +170,22 @@ static int get_root_dir(char *dir, size_t len) {
 
   while(1) {
     char *s = fgets(dir, len, fd);
-    char *libname = NULL;
     if (!s) {
       dbg("Can't read maps\n");
       goto exit0;
     }
 
-    dbg("/proc/self/maps: %s\n", s);
     // $rfs/opt/oralux/voxin-$ver/lib/libvoxin.so.$ver
     basename = strrchr(s, '/');
     if (!basename || (strncmp(basename+1, "libvoxin.so.", strlen("libvoxin.so.")))) {
-      dbg("not match (1)\n");
       continue;
     }
-    libname = basename+1;
-    libname[strlen(libname)-1] = 0; // remove last char (cr)
     *basename = 0;
 
-    {
-      const char *path=RFS "/lib";
-      size_t len = strlen(s);
-      size_t ref = strlen(path);
-      dbg("len=%lu, ref=%lu\n", (long unsigned int)len, (long unsigned int)ref);
-      dbg("s='%s'\n", s);
-      dbg("path='%s'\n", path);
-      if (len < ref) {
-	dbg("not match (2)\n");
-	continue;
-      }
-      if (len == ref) {
-	strcpy(dir, "/");
-      } else {
-	s[len-ref+1] = 0;
-	basename = strchr(s, '/');
-	if (!basename) {
-	  dbg("not match (3)\n");
-	  continue;
-	}
-	bcopy(basename, dir, strlen(basename)+1);
-      }
+    if (!get_root_dir_from_path(dir, s)) {
       err = 0;
-      dbg("dir=%s\n", dir);
       break;
-    }	  
+    }
   }
 	
  exit0:
@@ -219,93 +194,264 @@ static int get_root_dir(char *dir, size_t len) {
   return err;
 }
   
+// voxind_exec runs in the vforked child: it shares the memory of the
+// parent and must only call async-signal-safe functions (no debug).
+// Without pipe, voxind is detached (broker).
+static void voxind_exec(voxind_t *self, char **argv, char **envp, sigset_t *mask, int open_max, volatile int *err) {
+  int sig;
+  int fd = self->pipe ? self->pipe->sv[PIPE_SOCKET_CHILD_INDEX] : -1;
+
+  // the handlers of the parent must not run in the child
+  for (sig=1; sig<_NSIG; sig++) {
+    struct sigaction sa;
+    if (!sigaction(sig, NULL, &sa)
+	&& (sa.sa_handler != SIG_IGN) && (sa.sa_handler != SIG_DFL)) {
+      memset(&sa, 0, sizeof(sa));
+      sa.sa_handler = SIG_DFL;
+      sigaction(sig, &sa, NULL);
+    }
+  }
+  sigprocmask(SIG_SETMASK, mask, NULL);
 
-static int close_cb(void *data, int fd) {
-  int res = 0;
-  if (((void*)fd != data) && (close(fd) == -1))
-    res = errno;
-  return res;
-}
+  if (!self->pipe) {
+    if (setsid() == -1)
+      goto exit0;
+  } else if (prctl(PR_SET_PDEATHSIG, SIGKILL) == -1) {
+    goto exit0;
+  } else if (getppid() != self->parent) {
+    _exit(0);
+  }
 
+  if (chdir(self->rfsdir))
+    goto exit0;
 
-static int voxind_routine(voxind_t *self) {
-  int res = 0;
-	
-  dbg("[pid=%lu] ENTER", libvoxinDebugGetTid());
+  if (!self->pipe) {
+    // no descriptor kept
+    if (syscall(__NR_close_range, 0, ~0U, 0)) {
+      for (fd=0; fd<open_max; fd++)
+	close(fd);
+    }
+  } else {
+    if ((fd != PIPE_COMMAND_FILENO) && (dup2(fd, PIPE_COMMAND_FILENO) == -1))
+      goto exit0;
 
-  if (self && self->ld_library_path && self->bin && self->rfsdir) 
-    dbg("[pid=%lu] LD_LIBRARY_PATH: %s, bin=%s, rfsdir=%s", libvoxinDebugGetTid(), self->ld_library_path, self->bin, self->rfsdir);
-  
-  if (chdir(self->rfsdir)) {
-    res = errno;
-    goto exit;
+    // only the command descriptor is kept
+    if (syscall(__NR_close_range, 0, PIPE_COMMAND_FILENO-1, 0)
+	|| syscall(__NR_close_range, PIPE_COMMAND_FILENO+1, ~0U, 0)) {
+      for (fd=0; fd<open_max; fd++) {
+	if (fd != PIPE_COMMAND_FILENO)
+	  close(fd);
+      }
+    }
   }
 
-  libvoxinDebugFinish();
-  close(PIPE_COMMAND_FILENO);
-  pipe_dup2(self->pipe, PIPE_SOCKET_CHILD_INDEX, PIPE_COMMAND_FILENO);
-  fdwalk (close_cb, (void*)PIPE_COMMAND_FILENO);
-  
-  if (self->ld_library_path[0] && setenv("LD_LIBRARY_PATH", self->ld_library_path, 1)) {
-    res = errno;
-    goto exit;
-  }
+  execve(self->bin, argv, envp);
 
-  if (execl(self->bin, self->bin, NULL) == -1) {
-    res = errno;
-  }
+ exit0:
+  *err = errno ? errno : EINVAL;
+  _exit(127);
+}
 
-  my_exit(self);
-  
- exit:
-  if (res)
-    dbg("%s\n", strerror(res));
+// voxind_get_env returns a copy of environ with LD_LIBRARY_PATH
+// overridden if needed by voxind
+static char **voxind_get_env(voxind_t *self) {
+  const char *name = "LD_LIBRARY_PATH=";
+  size_t len = strlen(name);
+  char **envp = NULL;
+  int i, j;
 
-  LEAVE();
-  return res;  
+  for (i=0; environ[i]; i++);
+
+  envp = calloc(i+2, sizeof(*envp));
+  if (!envp)
+    return NULL;
+
+  for (i=0, j=0; environ[i]; i++) {
+    if (self->ld_library_path[0] && !strncmp(environ[i], name, len))
+      continue;
+    envp[j++] = environ[i];
+  }
+  if (self->ld_library_path[0]) {
+    if (asprintf(&envp[j], "%s%s", name, self->ld_library_path) == -1) {
+      free(envp);
+      return NULL;
+    }
+  }
+  return envp;
 }
 
+static void voxind_free_env(voxind_t *self, char **envp) {
+  if (!envp)
+    return;
+  if (self->ld_library_path[0]) {
+    int i;
+    for (i=0; envp[i+1]; i++);
+    free(envp[i]);
+  }
+  free(envp);
+}
 
-static int voxind_start(voxind_t *self) {
+/* voxind_fork spawns voxind with vfork (no copy of the address space
+   of the client) and closes the inherited descriptors with close_range */
+static int voxind_fork(voxind_t *self, char **argv) {
   int err = 0;
+  volatile int child_err = 0;
+  char **envp = NULL;
+  sigset_t all, mask;
+  struct rlimit rl;
+  int open_max;
 
-  dbg("[pid=%lu] ENTER", libvoxinDebugGetTid());
-    
-  if (!self)
-    return EINVAL;
+  envp = voxind_get_env(self);
+  if (!envp)
+    return ENOMEM;
 
-  self->child = fork();
+  // fallback if close_range is not supported
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_max != RLIM_INFINITY)
+    open_max = rl.rlim_max;
+  else
+    open_max = sysconf(_SC_OPEN_MAX);
+
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &mask);
+
+  self->child = vfork();
   switch(self->child) {
   case 0:
-    if (prctl(PR_SET_PDEATHSIG, SIGKILL) == -1) {
-      exit(errno);
-    }
-    if (getppid() != self->parent) {
-      exit(0);
-    }
-    pipe_close(self->pipe, PIPE_SOCKET_PARENT);
-    exit(voxind_routine(self));	
+    voxind_exec(self, argv, envp, &mask, open_max, &child_err);
     break;
   case -1:
     err = errno;
     break;
   default:
-    pipe_close(self->pipe, PIPE_SOCKET_CHILD_INDEX);
+    if (child_err) {
+      err = child_err;
+      waitpid(self->child, NULL, 0);
+      self->child = 0;
+    }
     break;
   }
+
+  pthread_sigmask(SIG_SETMASK, &mask, NULL);
+  voxind_free_env(self, envp);
+
+  if (err) {
+    err("%s: %s", self->bin, strerror(err));
+  }
+  return err;
+}
+
+// voxind_start spawns voxind, connected by a new pipe
+static int voxind_start(voxind_t *self) {
+  int err;
+
+  dbg("[pid=%lu] ENTER", libvoxinDebugGetTid());
+    
+  if (!self)
+    return EINVAL;
+
+  err = pipe_create(&self->pipe, READ_TIMEOUT_IN_MS);  
+  if (err)
+    return err;
+
+  err = voxind_fork(self, (char*[]){self->bin, NULL});
+  if (!err) {
+    pipe_close(self->pipe, PIPE_SOCKET_CHILD_INDEX);
+  }
   
   dbg("[pid=%lu] LEAVE", libvoxinDebugGetTid());
   return err;
 }
 
+// voxind_start_broker starts the broker listening on path; returns
+// once the socket is ready
+static int voxind_start_broker(voxind_t *self, char *path) {
+  int status = 0;
+  int err;
+
+  ENTER();
+
+  err = voxind_fork(self, (char*[]){self->bin, BROKER_ARG, path, NULL});
+  if (err)
+    return err;
+
+  // the started voxind exits once listening (the broker is its child)
+  if ((waitpid(self->child, &status, 0) == -1) || !WIFEXITED(status))
+    err = ECHILD;
+  else if (WEXITSTATUS(status))
+    err = EADDRINUSE; // another broker started meanwhile
+  self->child = 0;
+  dbg("LEAVE (%d)", err);
+  return err;
+}
+
+// voxind_connect connects to a worker of the broker of the user, the
+// broker is started if needed
+static int voxind_connect(voxind_t *self) {
+  char path[MAXBUF];
+  struct broker_hello_t hello;
+  ssize_t len = sizeof(hello);
+  int fd = -1;
+  int err;
 
+  ENTER();
+
+  err = broker_get_path(path, sizeof(path), msg_tts_id_string(self->id));
+  if (err)
+    return err;
+
+  err = broker_connect(path, &fd);
+  if (err) {
+    voxind_start_broker(self, path);
+    err = broker_connect(path, &fd);
+  }
+  if (err)
+    return err;
+
+  err = pipe_connect(&self->pipe, fd, READ_TIMEOUT_IN_MS);
+  if (err) {
+    close(fd);
+    return err;
+  }
+
+  // pid of the worker forked for this connection
+  err = pipe_read(self->pipe, &hello, &len);
+  if (!err && ((len != sizeof(hello)) || (hello.pid <= 0)))
+    err = EPROTO;
+  if (err) {
+    pipe_close(self->pipe, PIPE_SOCKET_PARENT);
+    pipe_delete(&self->pipe);
+    return err;
+  }
+
+  self->child = hello.pid;
+  self->broker = true;
+  dbg("LEAVE, worker pid=%d", self->child);
+  return 0;
+}
+
+// voxind_stop terminates the spawned voxind and waits for its end
+// (datagram pipe: voxind is not notified of its closing)
 static int voxind_stop(voxind_t *self) {  
+  int ms;
+
   ENTER();
   if (!self)
     return EINVAL;
 
-  if (!self->child) { // TODO
+  if ((self->child > 0) && !self->broker) {
+    kill(self->child, SIGTERM);
+    for (ms=0; ms<STOP_TIMEOUT_IN_MS; ms+=STOP_STEP_IN_MS) {
+      if (waitpid(self->child, NULL, WNOHANG) != 0)
+	break;
+      usleep(STOP_STEP_IN_MS*1000);
+    }
+    if (ms >= STOP_TIMEOUT_IN_MS) {
+      msg("%s (pid=%d) killed", self->bin, self->child);
+      kill(self->child, SIGKILL);
+      waitpid(self->child, NULL, 0);
+    }
   }
+  self->child = 0;
   
   LEAVE();
   return 0;
@@ -314,10 +460,118 @@ static int voxind_stop(voxind_t *self) {
 static void voxind_delete(voxind_t *self) {
   ENTER();
   if (self) {
-    voxind_stop(self);
+    if (self->pipe)
+      pipe_close(self->pipe, PIPE_SOCKET_PARENT);
     pipe_delete(&self->pipe);
+    voxind_stop(self);
     // TODO stop thread
+    if (self->direct) {
+      self->direct_delete();
+      dlclose(self->direct);
+      self->direct = NULL;
+    }
+    if (self->engine_lib) {
+      dlclose(self->engine_lib);
+      self->engine_lib = NULL;
+    }
+  }
+}
+
+// voxind_kill terminates a dead or hung voxind
+static void voxind_kill(voxind_t *self) {
+  ENTER();
+  if (!self)
+    return;
+  if (self->child > 0) {
+    kill(self->child, SIGKILL);
+    waitpid(self->child, NULL, 0);
+    self->child = 0;
   }
+  voxind_delete(self);
+  free(self);
+}
+
+// voxind_get_cpu_time returns the cpu time (user + system, in clock
+// ticks) used by voxind
+static unsigned long voxind_get_cpu_time(voxind_t *self) {
+  char buf[MAXBUF];
+  unsigned long utime = 0, stime = 0;
+  FILE *fd;
+  char *s = NULL;
+
+  snprintf(buf, sizeof(buf), "/proc/%d/stat", self->child);
+  fd = fopen(buf, "r");
+  if (!fd)
+    return 0;
+  if (fgets(buf, sizeof(buf), fd))
+    s = strrchr(buf, ')'); // the process name may contain spaces
+  fclose(fd);
+  // fields after the name: state (3) ... utime (14), stime (15)
+  if (s)
+    sscanf(s+2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime);
+  return utime + stime;
+}
+
+// msg_may_block returns true if the engine may wait without using
+// cpu time to process this request: eciSynchronize or eciSpeaking
+// writing to the audio device, paused, or resumed by a callback reply
+static bool msg_may_block(uint32_t func) {
+  return (func == MSG_SYNCHRONIZE) || (func == MSG_SPEAKING)
+    || ((func >= MSG_CB_WAVEFORM_BUFFER) && (func <= MSG_CB_SYNTHESIS_BREAK));
+}
+
+// voxind_wait waits for the reply of voxind; returns ECHILD if voxind
+// died, ETIMEDOUT if it is hung. If may_block is true, the reply is
+// awaited as long as voxind is alive.
+static int voxind_wait(voxind_t *self, bool may_block) {
+  struct pollfd pfd;
+  unsigned long cpu_time = 0;
+  bool has_cpu_time = false;
+  int idle_ms = 0;
+  int ms = 0;
+
+  pfd.fd = self->pipe->sv[PIPE_SOCKET_PARENT];
+  pfd.events = POLLIN;
+
+  // no timeout if may_block: only the death of voxind ends the wait
+  for (;;) {
+    unsigned long t;
+    int res;
+
+    pfd.revents = 0;
+    res = poll(&pfd, 1, HEARTBEAT_IN_MS);
+    if (res > 0)
+      return 0; // reply or hangup (read by pipe_read)
+    if ((res == -1) && (errno != EINTR))
+      return errno;
+
+    if (waitpid(self->child, NULL, WNOHANG) == self->child) {
+      self->child = 0;
+      err("%s died", self->bin);
+      return ECHILD;
+    }
+
+    if (may_block)
+      continue;
+
+    ms += HEARTBEAT_IN_MS;
+    if (ms >= READ_TIMEOUT_IN_MS)
+      break;
+
+    // the cpu time is read once the reply is late
+    t = voxind_get_cpu_time(self);
+    if (!has_cpu_time || (t != cpu_time)) {
+      has_cpu_time = true;
+      cpu_time = t;
+      idle_ms = 0;
+    } else {
+      idle_ms += HEARTBEAT_IN_MS;
+      if (idle_ms >= HANG_IN_MS)
+	break;
+    }
+  }
+  err("%s hung", self->bin);
+  return ETIMEDOUT;
 }
 
 // check if the witness filename is present (proof of voice installed)
@@ -441,11 +695,6 @@ static voxind_t *voxind_create(msg_tts_id id, char *rootdir) {
       self->rfsdir, self->bin, self->ld_library_path);
 
   self->parent = getpid();
-
-  int err = pipe_create(&self->pipe, READ_TIMEOUT_IN_MS);  
-  if (err)    
-    goto exit;
-  
   return self;
   
  exit:
@@ -456,12 +705,106 @@ static voxind_t *voxind_create(msg_tts_id id, char *rootdir) {
   return NULL;
 }
 
+/* voxind_load loads libvoxind in the process (direct mode); returns 0
+   or an errno, e.g. if the library is not installed or has not the
+   architecture of the process.
+   Only the eci engine is supported: libvoxind is built by this
+   repository, not the library of voxind-nve.
+   RTLD_DEEPBIND: the eci and vox symbols used by libvoxind and by the
+   engine must not be resolved by those of libvoxin.
+   The spawned voxind finds eci.ini in its working directory (rfsdir);
+   here, the current directory is the one of the application, so the
+   path is given by ECIINI (unless already set). */
+static int voxind_load(voxind_t *self, const char *rootdir, direct_app_cb app, void *data) {
+  char buf[MAXBUF];
+  size_t len;
+  direct_create_t create;
+  int err;
+
+  ENTER();
+
+  if (!self || !rootdir || !app)
+    return EINVAL;
+
+  if (self->id != MSG_TTS_ECI)
+    return ENOSYS;
+
+  len = snprintf(buf, sizeof(buf), "%s/%s", self->rfsdir, ECI_INI);
+  if (len >= sizeof(buf))
+    return EINVAL;
+  if (setenv(ECI_INI_ENV, buf, 0))
+    return errno;
+
+  // libibmeci is outside of the library path
+  len = snprintf(buf, sizeof(buf), "%s%s", rootdir, ECI_INSTALL_WITNESS);
+  if (len >= sizeof(buf))
+    return EINVAL;
+  self->engine_lib = dlopen(buf, RTLD_NOW | RTLD_LOCAL | RTLD_DEEPBIND);
+  if (!self->engine_lib) {
+    dbg("%s", dlerror());
+    return ENOENT;
+  }
+
+  len = snprintf(buf, sizeof(buf), "%s/%s", self->rfsdir, LIBVOXIND);
+  if (len >= sizeof(buf))
+    return EINVAL;
+
+  self->direct = dlopen(buf, RTLD_NOW | RTLD_LOCAL | RTLD_DEEPBIND);
+  if (!self->direct) {
+    dbg("%s", dlerror());
+    return ENOENT;
+  }
+
+  create = (direct_create_t)dlsym(self->direct, DIRECT_CREATE);
+  self->direct_call = (direct_call_t)dlsym(self->direct, DIRECT_CALL);
+  self->direct_delete = (direct_delete_t)dlsym(self->direct, DIRECT_DELETE);
+  if (!create || !self->direct_call || !self->direct_delete) {
+    dlclose(self->direct);
+    self->direct = NULL;
+    return ENOSYS;
+  }
+
+  err = create(app, data);
+  if (err) {
+    dlclose(self->direct);
+    self->direct = NULL;
+    return err;
+  }
+  dbg("%s loaded", buf);
+  return 0;
+}
+
+// voxind_call_direct processes msg in the process (direct mode)
+static int voxind_call_direct(voxind_t *self, struct msg_t *msg) {
+  size_t len = MSG_HEADER_LENGTH + msg->effective_data_length;
+  int res;
+
+  res = self->direct_call(msg, &len);
+  if (res)
+    return res;
+
+  if (!msg_string((enum msg_type)(msg->func))
+      || (len < MSG_HEADER_LENGTH + msg->effective_data_length)) {
+    res = EIO;
+  } else if (msg->func == MSG_UNDEFINED) {
+    dbg("recv msg undefined");
+    res = EIO;
+  } else {
+    dbg("recv msg '%s', length=%d, res=0x%x (#%d)",
+	msg_string((enum msg_type)(msg->func)),
+	msg->effective_data_length,
+	msg->res,
+	msg->count);
+  }
+  return res;
+}
+
 static voxind_t *libvoxin_get_voxind(libvoxin_t *self, msg_tts_id id) {
   voxind_t *res = NULL;
   if (self && (id > MSG_TTS_UNDEFINED) && (id < MSG_TTS_MAX)) {
     int i;
     for (i=0; i<MSG_TTS_MAX; i++) {
-      if (self->voxind[i]->id == id) {
+      if (self->voxind[i] && (self->voxind[i]->id == id)) {
 	res = self->voxind[i];
 	break;
       }
@@ -470,6 +813,65 @@ static voxind_t *libvoxin_get_voxind(libvoxin_t *self, msg_tts_id id) {
   return res;
 }
 
+// libvoxin_spawn returns a new voxind for the tts id: loaded in the
+// process (direct mode), a worker of the broker or a spawned voxind
+static voxind_t *libvoxin_spawn(libvoxin_t *self, msg_tts_id id) {
+  voxind_t *v = voxind_create(id, self->rootdir);
+  int err;
+
+  if (!v)
+    return NULL;
+
+  if (self->app) {
+    err = voxind_load(v, self->rootdir, self->app, self->app_data);
+    if (!err)
+      return v;
+    msg("%s: no direct mode (%s)", msg_tts_id_string(id), strerror(err));
+  }
+
+  if (self->broker) {
+    err = voxind_connect(v);
+    if (!err)
+      return v;
+    msg("%s: no broker (%s)", msg_tts_id_string(id), strerror(err));
+  }
+
+  if (voxind_start(v)) {
+    voxind_delete(v);
+    free(v);
+    v = NULL;
+  }
+  return v;
+}
+
+/* libvoxin_takeover replaces the failed voxind by its standby and
+   spawns a new standby; the engines of the failed voxind have to be
+   created again (ECHILD returned to the caller) */
+static int libvoxin_takeover(libvoxin_t *self, voxind_t *v) {
+  struct timespec t = {0};
+  int i;
+
+  msg_tts_id id = v->id;
+
+  libvoxinDebugElapsed(&t);
+  for (i=0; i<MSG_TTS_MAX; i++) {
+    if (self->voxind[i] == v)
+      break;
+  }
+  if (i == MSG_TTS_MAX)
+    return EINVAL;
+
+  msg("%s (pid=%d) failed, standby pid=%d", v->bin, v->child,
+      self->standby[i] ? self->standby[i]->child : 0);
+  voxind_kill(v);
+
+  self->voxind[i] = self->standby[i] ? self->standby[i] : libvoxin_spawn(self, id);
+  self->standby[i] = ((self->voxind[i] && self->voxind[i]->broker) || !self->standby_on) ? NULL : libvoxin_spawn(self, id);
+  msg("takeover in %ld us", libvoxinDebugElapsed(&t));
+
+  return self->voxind[i] ? ECHILD : EIO;
+}
+
 void libvoxin_delete(void *handle) {
   libvoxin_t **pself = NULL;
   libvoxin_t *self = NULL;
@@ -488,6 +890,9 @@ void libvoxin_delete(void *handle) {
   int i;
   for (i=0; i<MSG_TTS_MAX; i++) {
     voxind_delete(self->voxind[i]);
+    free(self->voxind[i]);
+    voxind_delete(self->standby[i]);
+    free(self->standby[i]);
   }
 
   memset(self, 0, sizeof(*self));
@@ -498,17 +903,12 @@ void libvoxin_delete(void *handle) {
 }
 
 void *libvoxin_create() {
-  static bool once = false;
   int err = 0;
   libvoxin_t *self = NULL;
+  struct timespec t = {0};
 
   ENTER();
 
-  if (once) {
-    err = EINVAL;
-    goto exit0;
-  }
-
   self = (libvoxin_t*)calloc(1, sizeof(libvoxin_t));
   if (!self) {
     err = errno;
@@ -517,28 +917,17 @@ void *libvoxin_create() {
 
   self->id = LIBVOXIN_ID;
 
+  libvoxinDebugElapsed(&t);
   err = get_root_dir(self->rootdir, sizeof(self->rootdir));
   if (err) {
     goto exit0;
   }
-  
-  int i;
-  int j;
-  for (i=0, j=0; i<MSG_TTS_MAX; i++) {
-    voxind_t *v = voxind_create(i, self->rootdir);
-    if (v) {
-      self->voxind[j] = v;
-      j++;
-      voxind_start(v);
-    }
-  }
+  msg("startup: root dir in %ld us", libvoxinDebugElapsed(&t));
   
  exit0:
   if (err) {
     libvoxin_delete(&self);
     err("%s",strerror(err));
-  } else {
-    once = true;
   }
 
   LEAVE();  
@@ -584,6 +973,7 @@ int libvoxin_call_eci(void* handle, struct msg_t *msg) {
   libvoxin_t *self = (libvoxin_t *)handle;
   size_t allocated_msg_length;
   size_t effective_msg_length;
+  uint32_t func;
 
   if (!self || !msg || !MSG_CHECK(msg->id)) {
     err("LEAVE, args error(%d)",0);
@@ -608,26 +998,36 @@ int libvoxin_call_eci(void* handle, struct msg_t *msg) {
   dbg("[To %s] send msg '%s', length=%d (#%d)",
       msg_tts_id_string(v->id),
       msg_string((enum msg_type)(msg->func)), msg->effective_data_length, msg->count);  
+
+  if (v->direct) {
+    res = voxind_call_direct(v, msg);
+    goto exit0;
+  }
+
   ssize_t s = effective_msg_length;
   res = voxind_write(v, msg, &s);
-  if (res)
+  if (res) {
+    res = libvoxin_takeover(self, v);
     goto exit0;
+  }
 
   effective_msg_length = allocated_msg_length;
+  func = msg->func;
   memset(msg, 0, MSG_HEADER_LENGTH);
   s = effective_msg_length;
-  res = voxind_read(v, msg, &s);
-  if (!res && (s >= 0)) {
+  res = voxind_wait(v, msg_may_block(func));
+  if (!res)
+    res = voxind_read(v, msg, &s);
+  if (res || (s == 0)) { // died (no more peer) or hung
+    res = libvoxin_takeover(self, v);
+  } else if (s > 0) {
     effective_msg_length = (size_t)s;
     if (!msg_string((enum msg_type)(msg->func))
 	|| (effective_msg_length < MSG_HEADER_LENGTH + msg->effective_data_length)) {
       res = EIO;
     } else if (msg->id == MSG_EXIT) {
       dbg("recv msg exit");
-      // if the child process exits then libvoxin currently exits too.
-      sleep(1);
-      exit(1);
-      //      res = ECHILD;
+      res = libvoxin_takeover(self, v);
     } else if (msg->func == MSG_UNDEFINED) {
       dbg("recv msg undefined");
       res = EIO;
@@ -646,6 +1046,60 @@ int libvoxin_call_eci(void* handle, struct msg_t *msg) {
   return res;
 }
 
+int libvoxin_set_direct(void *handle, direct_app_cb app, void *data) {
+  libvoxin_t *self = (libvoxin_t *)handle;
+
+  if (!self || !app)
+    return EINVAL;
+
+  self->app = app;
+  self->app_data = data;
+  return 0;
+}
+
+int libvoxin_set_standby(void *handle, bool on) {
+  libvoxin_t *self = (libvoxin_t *)handle;
+
+  if (!self)
+    return EINVAL;
+
+  self->standby_on = on;
+  return 0;
+}
+
+int libvoxin_start(void *handle, bool broker) {
+  libvoxin_t *self = (libvoxin_t *)handle;
+  struct timespec t = {0};
+  int i;
+  int j;
+
+  ENTER();
+
+  if (!self)
+    return EINVAL;
+
+  self->broker = broker;
+
+  libvoxinDebugElapsed(&t);
+  for (i=0, j=0; i<MSG_TTS_MAX; i++) {
+    voxind_t *v = libvoxin_spawn(self, i);
+    if (!v)
+      continue;
+    self->voxind[j] = v;
+    // no standby: nothing to spawn in direct mode, the broker forks
+    // a new worker in a connect
+    if (!v->direct && !v->broker && self->standby_on)
+      self->standby[j] = libvoxin_spawn(self, i);
+    j++;
+    msg("startup: %s %s in %ld us", v->bin,
+	v->direct ? "loaded" : (v->broker ? "connected" : "spawned"),
+	libvoxinDebugElapsed(&t));
+  }
+
+  LEAVE();
+  return 0;
+}
+
 const char *libvoxin_get_rootdir(void *handle) {
   char *rootdir = NULL;
   libvoxin_t *self = (libvoxin_t *)handle;
@@ -1,8 +1,10 @@
 #ifndef LIBVOXIN_H
 #define LIBVOXIN_H
 
+#include <stdbool.h>
 #include "pipe.h"
 #include "msg.h"
+#include "direct.h"
 
 #define LIBVOXIN_ID 0x010A0005
 
@@ -11,5 +13,18 @@ extern int libvoxin_list_tts(void *handle, msg_tts_id *id, size_t *len);
 extern int libvoxin_call_eci(void *handle, struct msg_t *msg);
 extern void libvoxin_delete(void *handle);
 extern const char *libvoxin_get_rootdir(void *handle);
+// libvoxin_set_direct requests to load in the process the eci engine
+// if it has the native architecture, instead of using voxind (see
+// direct.h); app
+// receives the callback messages. To call before libvoxin_start.
+extern int libvoxin_set_direct(void *handle, direct_app_cb app, void *data);
+// libvoxin_set_standby enables or disables (default) the spare
+// voxind spawned in advance for each tts. To call before
+// libvoxin_start.
+extern int libvoxin_set_standby(void *handle, bool on);
+// libvoxin_start provides a voxind for each installed tts: loaded in
+// the process (direct mode), a worker of the voxind broker of the
+// user (broker=true, see broker.h) or a spawned voxind
+extern int libvoxin_start(void *handle, bool broker);
 
 #endif
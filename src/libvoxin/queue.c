@@ -0,0 +1,301 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "queue.h"
+#include "debug.h"
+
+#define QUEUE_NB_PRIORITIES (voxPriorityNotification + 1)
+
+struct utterance_t {
+  char *text;
+  size_t offset; // sentences already spoken
+  voxPriority priority;
+  struct utterance_t *next;
+};
+
+struct queue_t {
+  void *handle; // engine
+  queue_preempt_cb preempt;
+  queue_split_cb split;
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  // utterances per priority (FIFO)
+  struct utterance_t *first[QUEUE_NB_PRIORITIES];
+  struct utterance_t *last[QUEUE_NB_PRIORITIES];
+  struct utterance_t *current; // utterance being spoken
+  bool preempted; // the synthesis of current is aborted
+  bool cancelled; // the next sentences of current are discarded
+  bool quit;
+  realtime_policy_t policy; // scheduling of the thread
+  int priority;
+};
+
+static void utterance_delete(struct utterance_t *self)
+{
+  if (self) {
+    free(self->text);
+    free(self);
+  }
+}
+
+// queue_insert adds the utterance at the end (or the beginning) of its priority
+static void queue_insert(queue_t *self, struct utterance_t *u, bool at_beginning)
+{
+  int p = u->priority;
+
+  if (at_beginning) {
+    u->next = self->first[p];
+    self->first[p] = u;
+    if (!self->last[p])
+      self->last[p] = u;
+  } else {
+    u->next = NULL;
+    if (self->last[p])
+      self->last[p]->next = u;
+    else
+      self->first[p] = u;
+    self->last[p] = u;
+  }
+}
+
+// queue_pop returns the next utterance to speak, NULL if none
+static struct utterance_t *queue_pop(queue_t *self)
+{
+  int p;
+
+  for (p=0; p<QUEUE_NB_PRIORITIES; p++) {
+    struct utterance_t *u = self->first[p];
+    if (u) {
+      self->first[p] = u->next;
+      if (!self->first[p])
+	self->last[p] = NULL;
+      u->next = NULL;
+      return u;
+    }
+  }
+  return NULL;
+}
+
+static void queue_clear_priority(queue_t *self, voxPriority priority)
+{
+  struct utterance_t *u = self->first[priority];
+
+  while (u) {
+    struct utterance_t *next = u->next;
+    utterance_delete(u);
+    u = next;
+  }
+  self->first[priority] = self->last[priority] = NULL;
+}
+
+// queue_is_pending returns true if an utterance is queued or spoken
+// (mutex locked)
+static bool queue_is_pending(queue_t *self)
+{
+  int p;
+
+  if (self->current)
+    return true;
+  for (p=0; p<QUEUE_NB_PRIORITIES; p++) {
+    if (self->first[p])
+      return true;
+  }
+  return false;
+}
+
+static void *queue_run(void *arg)
+{
+  queue_t *self = arg;
+
+  ENTER();
+
+  if (self->policy != REALTIME_NONE)
+    realtime_set_scheduling(self->policy, &self->priority);
+
+  pthread_mutex_lock(&self->mutex);
+  while (!self->quit) {
+    struct utterance_t *u = self->current;
+    char *text;
+    size_t len;
+    char c;
+    bool ok;
+
+    if (!u) {
+      u = queue_pop(self);
+      if (!u) {
+	pthread_cond_wait(&self->cond, &self->mutex);
+	continue;
+      }
+      self->current = u;
+      self->cancelled = false;
+    }
+    pthread_mutex_unlock(&self->mutex);
+
+    // one sentence at a time: a preempted message resumes at the
+    // sentence being spoken
+    text = u->text + u->offset;
+    len = self->split(u->text, u->offset);
+    c = text[len];
+    text[len] = 0;
+    dbg("speak priority=%d, text=%s", u->priority, text);
+    ok = (eciAddText(self->handle, text) == ECITrue)
+      && (eciSynthesize(self->handle) == ECITrue);
+    if (ok)
+      eciSynchronize(self->handle);
+    text[len] = c;
+
+    pthread_mutex_lock(&self->mutex);
+    if (self->preempted) {
+      self->preempted = false;
+      self->preempt(self->handle, false);
+      self->current = NULL;
+      if ((u->priority == voxPriorityMessage) && !self->quit) {
+	dbg("preempted message queued again (offset=%lu)", (long unsigned int)u->offset);
+	queue_insert(self, u, true);
+	u = NULL;
+      }
+    } else if (ok && c && !self->cancelled) {
+      u->offset += len;
+      u = NULL; // next sentence
+    } else {
+      self->current = NULL;
+    }
+    utterance_delete(u);
+    pthread_cond_broadcast(&self->cond);
+  }
+  pthread_mutex_unlock(&self->mutex);
+
+  LEAVE();
+  return NULL;
+}
+
+queue_t *queue_create(void *handle, queue_preempt_cb preempt, queue_split_cb split,
+		      realtime_policy_t policy, int priority)
+{
+  queue_t *self;
+
+  ENTER();
+
+  if (!handle || !preempt || !split)
+    return NULL;
+
+  self = calloc(1, sizeof(*self));
+  if (!self) {
+    err("mem error (%d)", errno);
+    return NULL;
+  }
+
+  self->handle = handle;
+  self->preempt = preempt;
+  self->split = split;
+  self->policy = policy;
+  self->priority = priority;
+  pthread_mutex_init(&self->mutex, NULL);
+  pthread_cond_init(&self->cond, NULL);
+  if (pthread_create(&self->thread, NULL, queue_run, self)) {
+    err("thread error (%d)", errno);
+    pthread_cond_destroy(&self->cond);
+    pthread_mutex_destroy(&self->mutex);
+    free(self);
+    return NULL;
+  }
+  return self;
+}
+
+void queue_delete(queue_t *self)
+{
+  int p;
+
+  ENTER();
+
+  if (!self)
+    return;
+
+  pthread_mutex_lock(&self->mutex);
+  self->quit = true;
+  for (p=0; p<QUEUE_NB_PRIORITIES; p++)
+    queue_clear_priority(self, p);
+  if (self->current) {
+    self->preempted = true;
+    self->preempt(self->handle, true);
+  }
+  pthread_cond_broadcast(&self->cond);
+  pthread_mutex_unlock(&self->mutex);
+
+  pthread_join(self->thread, NULL);
+  pthread_cond_destroy(&self->cond);
+  pthread_mutex_destroy(&self->mutex);
+  free(self);
+}
+
+int queue_push(queue_t *self, const char *text, voxPriority priority)
+{
+  struct utterance_t *u;
+
+  if (!self || !text || (priority < 0) || (priority >= QUEUE_NB_PRIORITIES))
+    return EINVAL;
+
+  pthread_mutex_lock(&self->mutex);
+
+  if (priority == voxPriorityNotification) {
+    if (queue_is_pending(self)) {
+      dbg("notification discarded");
+      pthread_mutex_unlock(&self->mutex);
+      return 0;
+    }
+  } else if (priority == voxPriorityProgress) {
+    // only the last progress is kept
+    queue_clear_priority(self, priority);
+  }
+
+  u = calloc(1, sizeof(*u));
+  if (u)
+    u->text = strdup(text);
+  if (!u || !u->text) {
+    free(u);
+    pthread_mutex_unlock(&self->mutex);
+    return ENOMEM;
+  }
+  u->priority = priority;
+  queue_insert(self, u, false);
+
+  if (self->current && !self->preempted && (priority < self->current->priority)) {
+    dbg("preempt priority=%d by %d", self->current->priority, priority);
+    self->preempted = true;
+    self->preempt(self->handle, true);
+  }
+
+  pthread_cond_broadcast(&self->cond);
+  pthread_mutex_unlock(&self->mutex);
+  return 0;
+}
+
+void queue_clear(queue_t *self)
+{
+  int p;
+
+  if (!self)
+    return;
+
+  pthread_mutex_lock(&self->mutex);
+  for (p=0; p<QUEUE_NB_PRIORITIES; p++)
+    queue_clear_priority(self, p);
+  if (self->current)
+    self->cancelled = true;
+  pthread_mutex_unlock(&self->mutex);
+}
+
+bool queue_is_busy(queue_t *self)
+{
+  bool busy;
+
+  if (!self)
+    return false;
+
+  pthread_mutex_lock(&self->mutex);
+  busy = queue_is_pending(self);
+  pthread_mutex_unlock(&self->mutex);
+  return busy;
+}
@@ -0,0 +1,51 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "voxin.h"
+#include "realtime.h"
+
+/*
+  Utterance queue of an engine (voxSpeak).
+
+  A thread speaks the queued utterances by priority with eciAddText,
+  eciSynthesize and eciSynchronize, one sentence at a time (see
+  split); the user callback is called from this thread.
+
+  An utterance of higher priority preempts the current one: preempt
+  is called to abort its synthesis at the next callback message. A
+  preempted message is resumed later at the sentence being spoken, a
+  preempted text, progress or notification is discarded.
+*/
+
+typedef struct queue_t queue_t;
+
+// queue_preempt_cb sets (on=true) or clears the preemption request of
+// the engine
+typedef void (*queue_preempt_cb)(void *handle, bool on);
+
+// queue_split_cb returns the length of the sentence of text starting
+// at offset (the rest of the text if it can't be split)
+typedef size_t (*queue_split_cb)(const char *text, size_t offset);
+
+// queue_create starts the thread with the scheduling policy and
+// priority (see realtime_set_scheduling)
+queue_t *queue_create(void *handle, queue_preempt_cb preempt, queue_split_cb split,
+		      realtime_policy_t policy, int priority);
+
+// queue_delete discards the utterances and waits for the end of the
+// thread
+void queue_delete(queue_t *self);
+
+// queue_push queues a copy of text; returns 0 on success or an errno
+int queue_push(queue_t *self, const char *text, voxPriority priority);
+
+// queue_clear discards the queued utterances and the next sentences
+// of the current one
+void queue_clear(queue_t *self);
+
+// queue_is_busy returns true if an utterance is queued or spoken
+bool queue_is_busy(queue_t *self);
+
+#endif
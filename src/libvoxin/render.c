@@ -0,0 +1,240 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "render.h"
+#include "debug.h"
+
+#define RENDER_WINDOW 2 // chunks synthesized or waiting for delivery, per job
+#define RENDER_BUFFER_SAMPLES 4096 // output buffer of the engine of a job
+
+struct chunk_t {
+  const char *text;
+  short *samples; // synthesized samples, freed once delivered
+  uint32_t nb;
+  uint32_t max;
+  bool done; // synthesis terminated
+};
+
+struct render_t;
+
+struct job_t {
+  struct render_t *render;
+  pthread_t thread;
+  struct chunk_t *chunk; // chunk being synthesized
+  short buffer[RENDER_BUFFER_SAMPLES];
+};
+
+struct render_t {
+  struct chunk_t *chunks;
+  size_t nb_chunks;
+  size_t next; // next chunk to synthesize
+  size_t delivered; // number of chunks supplied to the sink
+  size_t window; // chunks in progress at most
+  unsigned int running; // jobs not yet terminated
+  int error; // stops the rendering if non zero
+  render_create_cb create;
+  render_delete_cb delete;
+  void *data;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+};
+
+// render_fail stops the rendering (mutex locked)
+static void render_fail(struct render_t *self, int error)
+{
+  if (!self->error) {
+    err("error=%d", error);
+    self->error = error;
+  }
+  pthread_cond_broadcast(&self->cond);
+}
+
+// chunk_append copies the nb samples at the end of the chunk
+static int chunk_append(struct chunk_t *self, const short *samples, uint32_t nb)
+{
+  if (self->nb + nb > self->max) {
+    uint32_t max = self->max ? 2*self->max : RENDER_BUFFER_SAMPLES;
+    short *s;
+    while (max < self->nb + nb)
+      max *= 2;
+    s = realloc(self->samples, max*sizeof(*s));
+    if (!s)
+      return ENOMEM;
+    self->samples = s;
+    self->max = max;
+  }
+  memcpy(self->samples + self->nb, samples, nb*sizeof(*samples));
+  self->nb += nb;
+  return 0;
+}
+
+static enum ECICallbackReturn render_callback(ECIHand hEngine, enum ECIMessage Msg, long lParam, void *pData)
+{
+  struct job_t *job = pData;
+  struct render_t *self = job->render;
+  int error = 0;
+
+  if ((Msg == eciWaveformBuffer) && (lParam > 0))
+    error = chunk_append(job->chunk, job->buffer, lParam);
+
+  pthread_mutex_lock(&self->mutex);
+  if (error)
+    render_fail(self, error);
+  error = self->error;
+  pthread_mutex_unlock(&self->mutex);
+
+  return error ? eciDataAbort : eciDataProcessed;
+}
+
+static void *render_run(void *arg)
+{
+  struct job_t *job = arg;
+  struct render_t *self = job->render;
+  void *handle;
+
+  ENTER();
+
+  handle = self->create(self->data);
+  if (handle) {
+    eciRegisterCallback(handle, render_callback, job);
+    if (eciSetOutputBuffer(handle, RENDER_BUFFER_SAMPLES, job->buffer) == ECIFalse) {
+      self->delete(handle, self->data);
+      handle = NULL;
+    }
+  }
+  if (!handle)
+    err("no engine for this job");
+
+  pthread_mutex_lock(&self->mutex);
+  while (handle && !self->error && (self->next < self->nb_chunks)) {
+    struct chunk_t *c;
+    bool ok;
+
+    if (self->next >= self->delivered + self->window) {
+      pthread_cond_wait(&self->cond, &self->mutex);
+      continue;
+    }
+    c = job->chunk = self->chunks + self->next++;
+    pthread_mutex_unlock(&self->mutex);
+
+    dbg("chunk #%lu", (unsigned long)(c - self->chunks));
+    ok = (eciAddText(handle, (ECIInputText)c->text) == ECITrue)
+      && (eciSynthesize(handle) == ECITrue)
+      && (eciSynchronize(handle) == ECITrue);
+
+    pthread_mutex_lock(&self->mutex);
+    if (!ok)
+      render_fail(self, EIO);
+    c->done = true;
+    job->chunk = NULL;
+    pthread_cond_broadcast(&self->cond);
+  }
+  self->running--;
+  pthread_cond_broadcast(&self->cond);
+  pthread_mutex_unlock(&self->mutex);
+
+  if (handle)
+    self->delete(handle, self->data);
+
+  LEAVE();
+  return NULL;
+}
+
+// render_deliver supplies the chunks in order to the sink as they are
+// synthesized (mutex locked)
+static void render_deliver(struct render_t *self, voxRenderSink sink, void *sink_data)
+{
+  while (!self->error && (self->delivered < self->nb_chunks)) {
+    struct chunk_t *c = self->chunks + self->delivered;
+    int res = 0;
+
+    if (!c->done) {
+      if (!self->running)
+	render_fail(self, EIO); // no job left
+      else
+	pthread_cond_wait(&self->cond, &self->mutex);
+      continue;
+    }
+
+    pthread_mutex_unlock(&self->mutex);
+    if (c->nb)
+      res = sink(c->samples, c->nb, sink_data);
+    free(c->samples);
+    c->samples = NULL;
+    pthread_mutex_lock(&self->mutex);
+
+    if (res)
+      render_fail(self, ECANCELED);
+    self->delivered++;
+    pthread_cond_broadcast(&self->cond);
+  }
+}
+
+int render_document(const char **chunk, size_t nb, unsigned int jobs,
+		    render_create_cb create, render_delete_cb delete, void *data,
+		    voxRenderSink sink, void *sink_data)
+{
+  struct render_t self;
+  struct job_t *job = NULL;
+  unsigned int nb_jobs = 0;
+  size_t i;
+  int res = 0;
+
+  ENTER();
+
+  if (!chunk || !jobs || !create || !delete || !sink)
+    return EINVAL;
+  if (!nb)
+    return 0;
+
+  memset(&self, 0, sizeof(self));
+  self.nb_chunks = nb;
+  self.window = RENDER_WINDOW*jobs;
+  self.create = create;
+  self.delete = delete;
+  self.data = data;
+  self.chunks = calloc(nb, sizeof(*self.chunks));
+  job = calloc(jobs, sizeof(*job));
+  if (!self.chunks || !job) {
+    err("mem error (%d)", errno);
+    res = ENOMEM;
+    goto exit0;
+  }
+  for (i=0; i<nb; i++)
+    self.chunks[i].text = chunk[i];
+  pthread_mutex_init(&self.mutex, NULL);
+  pthread_cond_init(&self.cond, NULL);
+
+  pthread_mutex_lock(&self.mutex);
+  for (nb_jobs=0; nb_jobs<jobs; nb_jobs++) {
+    job[nb_jobs].render = &self;
+    if (pthread_create(&job[nb_jobs].thread, NULL, render_run, job + nb_jobs)) {
+      err("thread error (%d)", errno);
+      break;
+    }
+    self.running++;
+  }
+  dbg("chunks=%lu, jobs=%u", (unsigned long)nb, nb_jobs);
+
+  render_deliver(&self, sink, sink_data);
+  res = self.error;
+  pthread_mutex_unlock(&self.mutex);
+
+  for (i=0; i<nb_jobs; i++)
+    pthread_join(job[i].thread, NULL);
+  pthread_cond_destroy(&self.cond);
+  pthread_mutex_destroy(&self.mutex);
+
+ exit0:
+  if (self.chunks) {
+    for (i=0; i<nb; i++)
+      free(self.chunks[i].samples);
+    free(self.chunks);
+  }
+  free(job);
+  LEAVE();
+  return res;
+}
@@ -0,0 +1,35 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stddef.h>
+#include "voxin.h"
+
+/*
+  Parallel rendering of a document (voxRenderDocument).
+
+  The document is supplied as chunks of text (whole sentences). Each
+  job is a thread owning its engine: the jobs synthesize the next
+  chunks concurrently with eciAddText, eciSynthesize and
+  eciSynchronize, and the calling thread supplies the samples of
+  each chunk to the sink in the order of the document.
+
+  The memory is bounded: a job does not start a chunk more than
+  RENDER_WINDOW chunks per job ahead of the chunk being delivered.
+*/
+
+// render_create_cb returns a new engine for a job, NULL on error;
+// called from the thread of the job
+typedef void *(*render_create_cb)(void *data);
+
+// render_delete_cb deletes the engine of a job
+typedef void (*render_delete_cb)(void *handle, void *data);
+
+// render_document synthesizes the nb null terminated chunks with
+// jobs engines and supplies their samples in order to sink; returns 0
+// if the whole document has been supplied, ECANCELED if the sink
+// aborted, otherwise an errno
+int render_document(const char **chunk, size_t nb, unsigned int jobs,
+		    render_create_cb create, render_delete_cb delete, void *data,
+		    voxRenderSink sink, void *sink_data);
+
+#endif
@@ -0,0 +1,370 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#include "stretch.h"
+#include "debug.h"
+
+#define STRETCH_SEQUENCE_MS 40 // length of a sequence
+#define STRETCH_SEEK_MS 15 // offsets searched for the best overlap
+#define STRETCH_OVERLAP_MS 8 // cross-fade between two sequences
+#define STRETCH_BLOCK 8 // samples per vector
+#define STRETCH_SHIFT 8 // each product scaled down to sum them in 32 bits
+
+struct stretch_t {
+  uint32_t tempo; // percent
+  uint32_t sequence; // samples of a sequence
+  uint32_t seek; // number of offsets searched
+  uint32_t overlap; // samples cross-faded, multiple of STRETCH_BLOCK
+  uint32_t needed; // input samples needed to output a sequence
+  uint32_t skip; // fractional part of the input skip (1/100 sample)
+  uint32_t added; // input samples added since the start of the utterance
+  uint32_t done; // input samples whose output is in the output buffer
+  uint32_t supplied; // input samples whose output has been supplied to cb
+  int16_t *input;
+  uint32_t input_len;
+  uint32_t input_max;
+  int16_t *mid; // end of the previous sequence (overlap samples)
+  bool has_mid;
+  int16_t *fade; // cross-faded samples
+  int16_t *output;
+  uint32_t output_len;
+  uint32_t output_max;
+  stretch_cb cb;
+  void *data;
+};
+
+// stretch_correlate_c returns the correlation of a and b (nb samples)
+// and in energy the energy of b; each product is shifted before the
+// sum, the vectorized versions return the same values
+static int32_t stretch_correlate_c(const int16_t *a, const int16_t *b, uint32_t nb, int32_t *energy)
+{
+  int32_t c = 0;
+  int32_t e = 0;
+  uint32_t i;
+
+  for (i=0; i<nb; i++) {
+    c += (a[i]*b[i]) >> STRETCH_SHIFT;
+    e += (b[i]*b[i]) >> STRETCH_SHIFT;
+  }
+  *energy = e;
+  return c;
+}
+
+#if defined(__SSE2__)
+// stretch_madd adds to sum the products of a and b, each one shifted:
+// _mm_madd_epi16 would overflow on two products of -32768
+static inline __m128i stretch_madd(__m128i sum, __m128i a, __m128i b)
+{
+  __m128i lo = _mm_mullo_epi16(a, b);
+  __m128i hi = _mm_mulhi_epi16(a, b);
+  sum = _mm_add_epi32(sum, _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), STRETCH_SHIFT));
+  return _mm_add_epi32(sum, _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), STRETCH_SHIFT));
+}
+#endif
+
+// stretch_correlate returns the correlation of a and b (nb samples,
+// multiple of STRETCH_BLOCK) and in energy the energy of b
+static int32_t stretch_correlate(const int16_t *a, const int16_t *b, uint32_t nb, int32_t *energy)
+{
+#if defined(__SSE2__)
+  __m128i c = _mm_setzero_si128();
+  __m128i e = _mm_setzero_si128();
+  int32_t sum[4];
+  uint32_t i;
+
+  for (i=0; i<nb; i+=STRETCH_BLOCK) {
+    __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+    __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+    c = stretch_madd(c, va, vb);
+    e = stretch_madd(e, vb, vb);
+  }
+  _mm_storeu_si128((__m128i*)sum, e);
+  *energy = sum[0] + sum[1] + sum[2] + sum[3];
+  _mm_storeu_si128((__m128i*)sum, c);
+  return sum[0] + sum[1] + sum[2] + sum[3];
+#elif defined(__ARM_NEON)
+  int32x4_t c = vdupq_n_s32(0);
+  int32x4_t e = vdupq_n_s32(0);
+  uint32_t i;
+
+  for (i=0; i<nb; i+=STRETCH_BLOCK) {
+    int16x8_t va = vld1q_s16(a + i);
+    int16x8_t vb = vld1q_s16(b + i);
+    c = vsraq_n_s32(c, vmull_s16(vget_low_s16(va), vget_low_s16(vb)), STRETCH_SHIFT);
+    c = vsraq_n_s32(c, vmull_s16(vget_high_s16(va), vget_high_s16(vb)), STRETCH_SHIFT);
+    e = vsraq_n_s32(e, vmull_s16(vget_low_s16(vb), vget_low_s16(vb)), STRETCH_SHIFT);
+    e = vsraq_n_s32(e, vmull_s16(vget_high_s16(vb), vget_high_s16(vb)), STRETCH_SHIFT);
+  }
+  *energy = vgetq_lane_s32(e, 0) + vgetq_lane_s32(e, 1) + vgetq_lane_s32(e, 2) + vgetq_lane_s32(e, 3);
+  return vgetq_lane_s32(c, 0) + vgetq_lane_s32(c, 1) + vgetq_lane_s32(c, 2) + vgetq_lane_s32(c, 3);
+#else
+  return stretch_correlate_c(a, b, nb, energy);
+#endif
+}
+
+#ifdef DEBUG
+// stretch_check returns false if the vectorized correlation differs
+// from stretch_correlate_c on full scale samples
+static bool stretch_check()
+{
+  int16_t a[4*STRETCH_BLOCK];
+  int16_t b[4*STRETCH_BLOCK];
+  int32_t c, c_ref, e, e_ref;
+  uint32_t i;
+
+  for (i=0; i<4*STRETCH_BLOCK; i++) {
+    a[i] = (i < 2*STRETCH_BLOCK) ? INT16_MIN : (int16_t)(i*7919);
+    b[i] = (i < STRETCH_BLOCK) ? INT16_MIN : (i < 2*STRETCH_BLOCK) ? INT16_MAX : (int16_t)(i*104729);
+  }
+  c = stretch_correlate(a, b, 4*STRETCH_BLOCK, &e);
+  c_ref = stretch_correlate_c(a, b, 4*STRETCH_BLOCK, &e_ref);
+  if ((c != c_ref) || (e != e_ref)) {
+    err("correlation=%d (%d), energy=%d (%d)", c, c_ref, e, e_ref);
+    return false;
+  }
+  return true;
+}
+#endif
+
+// stretch_seek returns the offset in the input where the start of the
+// next sequence is the most similar to the end of the previous one
+static uint32_t stretch_seek(stretch_t *self)
+{
+  uint32_t best = 0;
+  double best_score = 0;
+  uint32_t i;
+
+  for (i=0; i<self->seek; i++) {
+    int32_t energy;
+    int32_t corr = stretch_correlate(self->mid, self->input + i, self->overlap, &energy);
+    // normalized correlation, squared to avoid sqrt
+    double score = (corr < 0 ? -1.0 : 1.0) * (double)corr * corr / (energy + 1.0);
+    if (!i || (score > best_score)) {
+      best = i;
+      best_score = score;
+    }
+  }
+  return best;
+}
+
+// stretch_fade cross-fades mid (fading out) with b (fading in)
+static void stretch_fade(stretch_t *self, const int16_t *b)
+{
+  int32_t n = self->overlap;
+  int32_t i;
+
+  for (i=0; i<n; i++)
+    self->fade[i] = (self->mid[i]*(n - i) + b[i]*i)/n;
+}
+
+// stretch_output supplies the output buffer to cb
+static int stretch_output(stretch_t *self)
+{
+  int res = 0;
+
+  if (self->output_len) {
+    self->supplied = self->done;
+    res = self->cb(self->output, self->output_len, self->data);
+    self->output_len = 0;
+  }
+  return res;
+}
+
+// stretch_emit appends nb samples to the output buffer, supplied to cb
+// once full
+static int stretch_emit(stretch_t *self, const int16_t *samples, uint32_t nb)
+{
+  int res = 0;
+
+  while (nb && !res) {
+    uint32_t n = self->output_max - self->output_len;
+    if (n > nb)
+      n = nb;
+    memcpy(self->output + self->output_len, samples, 2*n);
+    self->output_len += n;
+    samples += n;
+    nb -= n;
+    if (self->output_len == self->output_max)
+      res = stretch_output(self);
+  }
+  return res;
+}
+
+// stretch_run outputs the sequences while enough input is available
+static int stretch_run(stretch_t *self)
+{
+  int res = 0;
+
+  while (!res && (self->input_len >= self->needed)) {
+    uint32_t offset = 0;
+    uint32_t start = 0;
+    uint32_t end;
+    uint32_t n;
+
+    if (self->has_mid) {
+      offset = stretch_seek(self);
+      stretch_fade(self, self->input + offset);
+      res = stretch_emit(self, self->fade, self->overlap);
+      start = self->overlap;
+    }
+    if (!res)
+      res = stretch_emit(self, self->input + offset + start,
+			 self->sequence - self->overlap - start);
+    memcpy(self->mid, self->input + offset + self->sequence - self->overlap, 2*self->overlap);
+    self->has_mid = true;
+
+    // next nominal position
+    self->skip += self->tempo*(self->sequence - self->overlap);
+    n = self->skip/100;
+    self->skip %= 100;
+
+    // the skipped input (tempo above 100) is done too
+    end = offset + self->sequence - self->overlap;
+    self->done = self->added - self->input_len + ((n > end) ? n : end);
+    self->input_len -= n;
+    memmove(self->input, self->input + n, 2*self->input_len);
+  }
+  return res;
+}
+
+stretch_t *stretch_create(uint32_t rate, uint32_t tempo, uint32_t nb_max, stretch_cb cb, void *data)
+{
+  stretch_t *self;
+  uint32_t skip_max;
+
+  ENTER();
+
+  if (!rate || !tempo || !nb_max || !cb)
+    return NULL;
+#ifdef DEBUG
+  if (!stretch_check())
+    return NULL;
+#endif
+
+  self = calloc(1, sizeof(*self));
+  if (!self) {
+    err("mem error (%d)", errno);
+    return NULL;
+  }
+
+  self->tempo = tempo;
+  self->sequence = rate*STRETCH_SEQUENCE_MS/1000;
+  self->seek = rate*STRETCH_SEEK_MS/1000;
+  self->overlap = rate*STRETCH_OVERLAP_MS/1000;
+  self->overlap -= self->overlap % STRETCH_BLOCK;
+  if (self->overlap < STRETCH_BLOCK)
+    self->overlap = STRETCH_BLOCK;
+  if (self->sequence < 2*self->overlap)
+    self->sequence = 2*self->overlap;
+  if (!self->seek)
+    self->seek = 1;
+  skip_max = tempo*(self->sequence - self->overlap)/100 + 1;
+  self->needed = self->seek + self->sequence;
+  if (self->needed < skip_max)
+    self->needed = skip_max;
+  self->input_max = 2*self->needed;
+  self->output_max = nb_max;
+  self->cb = cb;
+  self->data = data;
+
+  self->input = malloc(2*self->input_max);
+  self->mid = malloc(2*self->overlap);
+  self->fade = malloc(2*self->overlap);
+  self->output = malloc(2*self->output_max);
+  if (!self->input || !self->mid || !self->fade || !self->output) {
+    err("mem error (%d)", errno);
+    stretch_delete(self);
+    return NULL;
+  }
+
+  dbg("rate=%u, tempo=%u, sequence=%u, seek=%u, overlap=%u",
+      rate, tempo, self->sequence, self->seek, self->overlap);
+  return self;
+}
+
+void stretch_delete(stretch_t *self)
+{
+  if (!self)
+    return;
+  free(self->input);
+  free(self->mid);
+  free(self->fade);
+  free(self->output);
+  free(self);
+}
+
+int stretch_process(stretch_t *self, const void *samples, uint32_t nb)
+{
+  const uint8_t *s = samples;
+  int res = 0;
+
+  if (!self || !samples)
+    return 0;
+
+  while (nb && !res) {
+    uint32_t n = self->input_max - self->input_len;
+    if (n > nb)
+      n = nb;
+    memcpy(self->input + self->input_len, s, 2*n);
+    self->input_len += n;
+    self->added += n;
+    s += 2*n;
+    nb -= n;
+    res = stretch_run(self);
+  }
+  if (!res)
+    res = stretch_output(self);
+  return res;
+}
+
+int stretch_flush(stretch_t *self)
+{
+  int res = 0;
+  uint32_t start = 0;
+
+  if (!self)
+    return 0;
+
+  if (self->has_mid) {
+    if (self->input_len >= self->overlap) {
+      stretch_fade(self, self->input);
+      start = self->overlap;
+    } else {
+      memcpy(self->fade, self->mid, 2*self->overlap);
+    }
+    res = stretch_emit(self, self->fade, self->overlap);
+  }
+  if (!res && (self->input_len > start))
+    res = stretch_emit(self, self->input + start, self->input_len - start);
+  self->done = self->added;
+  if (!res)
+    res = stretch_output(self);
+  stretch_reset(self);
+  return res;
+}
+
+uint32_t stretch_position(stretch_t *self, uint32_t *supplied)
+{
+  if (supplied)
+    *supplied = self ? self->supplied : 0;
+  return self ? self->added : 0;
+}
+
+void stretch_reset(stretch_t *self)
+{
+  if (!self)
+    return;
+  self->input_len = 0;
+  self->output_len = 0;
+  self->skip = 0;
+  self->added = 0;
+  self->done = 0;
+  self->supplied = 0;
+  self->has_mid = false;
+}
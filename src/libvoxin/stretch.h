@@ -0,0 +1,53 @@
+#ifndef STRETCH_H
+#define STRETCH_H
+
+#include <stdint.h>
+
+/*
+  Time-stretch of the engine samples (VOX_TEMPO): WSOLA (waveform
+  similarity overlap-add) changes the tempo without changing the
+  pitch.
+
+  The input is cut into sequences; each sequence is cross-faded with
+  the end of the previous one at the offset where both waveforms are
+  the most similar (correlation searched around the nominal position).
+  The nominal positions are spaced by tempo/100 times the output
+  length of a sequence.
+
+  The correlation uses SSE2 or NEON when available; the debug builds
+  check it against the scalar version when a stretch is created.
+*/
+
+typedef struct stretch_t stretch_t;
+
+// stretch_cb receives nb output samples; returns 0 to go on, otherwise
+// the processing is aborted
+typedef int (*stretch_cb)(const int16_t *samples, uint32_t nb, void *data);
+
+// stretch_create returns a time-stretch for samples at rate (Hz);
+// tempo in percent (e.g. 200: twice faster); the output is supplied
+// to cb by buffers of nb_max samples at most
+stretch_t *stretch_create(uint32_t rate, uint32_t tempo, uint32_t nb_max, stretch_cb cb, void *data);
+
+void stretch_delete(stretch_t *self);
+
+// stretch_process adds nb input samples (host order, unaligned
+// buffer allowed) and supplies the available output; returns the
+// value returned by cb if it aborts, 0 otherwise
+int stretch_process(stretch_t *self, const void *samples, uint32_t nb);
+
+// stretch_flush supplies the remaining samples (end of utterance) and
+// resets the stretch; returns as stretch_process
+int stretch_flush(stretch_t *self);
+
+// stretch_position returns the number of input samples added since
+// the start of the utterance, and in supplied the number of input
+// samples whose output has been supplied to cb (up to the current
+// call of cb): an event at an input position is heard once supplied
+// has reached it
+uint32_t stretch_position(stretch_t *self, uint32_t *supplied);
+
+// stretch_reset discards the pending samples
+void stretch_reset(stretch_t *self);
+
+#endif
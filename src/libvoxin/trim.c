@@ -0,0 +1,230 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdbool.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#include "trim.h"
+#include "debug.h"
+
+#define TRIM_MARGIN_MS 10 // silence kept before and after the loud samples
+#define TRIM_HOLD_MS 1000 // silence held back at most, supplied beyond
+#define TRIM_BLOCK 8 // samples per vector
+
+struct trim_t {
+  int16_t threshold;
+  uint32_t margin; // samples
+  bool leading; // no loud sample yet
+  int16_t *hold; // silence following the last loud sample (or end of the leading silence)
+  uint32_t hold_len;
+  uint32_t hold_max;
+  trim_cb cb;
+  void *data;
+};
+
+// trim_is_loud returns true if a sample of the block s exceeds the
+// threshold
+static inline bool trim_is_loud(const int16_t *s, int16_t threshold)
+{
+#if defined(__SSE2__)
+  __m128i v = _mm_loadu_si128((const __m128i*)s);
+  __m128i m = _mm_or_si128(_mm_cmpgt_epi16(v, _mm_set1_epi16(threshold)),
+			   _mm_cmplt_epi16(v, _mm_set1_epi16(-threshold)));
+  return _mm_movemask_epi8(m) != 0;
+#elif defined(__ARM_NEON)
+  int16x8_t v = vld1q_s16(s);
+  uint16x8_t m = vorrq_u16(vcgtq_s16(v, vdupq_n_s16(threshold)),
+			   vcltq_s16(v, vdupq_n_s16(-threshold)));
+  uint64x2_t m64 = vreinterpretq_u64_u16(m);
+  return (vgetq_lane_u64(m64, 0) | vgetq_lane_u64(m64, 1)) != 0;
+#else
+  int i;
+  for (i=0; i<TRIM_BLOCK; i++) {
+    if ((s[i] > threshold) || (s[i] < -threshold))
+      return true;
+  }
+  return false;
+#endif
+}
+
+// trim_first returns the index of the first loud sample, nb if none
+static uint32_t trim_first(trim_t *self, const int16_t *s, uint32_t nb)
+{
+  uint32_t i = 0;
+
+  while ((i + TRIM_BLOCK <= nb) && !trim_is_loud(s + i, self->threshold))
+    i += TRIM_BLOCK;
+  for (; i<nb; i++) {
+    if ((s[i] > self->threshold) || (s[i] < -self->threshold))
+      break;
+  }
+  return i;
+}
+
+// trim_last returns the index following the last loud sample, 0 if none
+static uint32_t trim_last(trim_t *self, const int16_t *s, uint32_t nb)
+{
+  uint32_t i = nb;
+
+  while ((i >= TRIM_BLOCK) && !trim_is_loud(s + i - TRIM_BLOCK, self->threshold))
+    i -= TRIM_BLOCK;
+  for (; i>0; i--) {
+    if ((s[i-1] > self->threshold) || (s[i-1] < -self->threshold))
+      break;
+  }
+  return i;
+}
+
+// trim_release supplies the held silence
+static int trim_release(trim_t *self)
+{
+  int res = 0;
+
+  if (self->hold_len)
+    res = self->cb(self->hold, self->hold_len, self->data);
+  self->hold_len = 0;
+  return res;
+}
+
+// trim_hold holds back the nb silent samples; the oldest ones are
+// supplied beyond hold_max
+static int trim_hold(trim_t *self, const int16_t *s, uint32_t nb)
+{
+  int res = 0;
+
+  if (nb >= self->hold_max) {
+    res = trim_release(self);
+    if (!res && (nb > self->hold_max))
+      res = self->cb(s, nb - self->hold_max, self->data);
+    s += nb - self->hold_max;
+    nb = self->hold_max;
+  } else if (self->hold_len + nb > self->hold_max) {
+    uint32_t n = self->hold_len + nb - self->hold_max;
+    res = self->cb(self->hold, n, self->data);
+    self->hold_len -= n;
+    memmove(self->hold, self->hold + n, 2*self->hold_len);
+  }
+  memcpy(self->hold + self->hold_len, s, 2*nb);
+  self->hold_len += nb;
+  return res;
+}
+
+// trim_keep_margin keeps in hold the last margin samples of the
+// leading silence, s being the nb next silent samples
+static void trim_keep_margin(trim_t *self, const int16_t *s, uint32_t nb)
+{
+  if (nb >= self->margin) {
+    s += nb - self->margin;
+    nb = self->margin;
+    self->hold_len = 0;
+  } else if (self->hold_len + nb > self->margin) {
+    uint32_t n = self->hold_len + nb - self->margin;
+    self->hold_len -= n;
+    memmove(self->hold, self->hold + n, 2*self->hold_len);
+  }
+  memcpy(self->hold + self->hold_len, s, 2*nb);
+  self->hold_len += nb;
+}
+
+trim_t *trim_create(uint32_t rate, uint32_t threshold, trim_cb cb, void *data)
+{
+  trim_t *self;
+
+  ENTER();
+
+  if (!rate || !threshold || (threshold > INT16_MAX) || !cb)
+    return NULL;
+
+  self = calloc(1, sizeof(*self));
+  if (!self) {
+    err("mem error (%d)", errno);
+    return NULL;
+  }
+
+  self->threshold = threshold;
+  self->margin = rate*TRIM_MARGIN_MS/1000;
+  self->leading = true;
+  self->hold_max = rate*TRIM_HOLD_MS/1000;
+  if (self->hold_max < self->margin)
+    self->hold_max = self->margin;
+  self->cb = cb;
+  self->data = data;
+  self->hold = malloc(2*self->hold_max);
+  if (!self->hold) {
+    err("mem error (%d)", errno);
+    free(self);
+    return NULL;
+  }
+
+  dbg("rate=%u, threshold=%u, margin=%u", rate, threshold, self->margin);
+  return self;
+}
+
+void trim_delete(trim_t *self)
+{
+  if (!self)
+    return;
+  free(self->hold);
+  free(self);
+}
+
+int trim_process(trim_t *self, const void *samples, uint32_t nb)
+{
+  const int16_t *s = samples;
+  uint32_t last;
+  int res;
+
+  if (!self || !samples || !nb)
+    return 0;
+
+  if (self->leading) {
+    uint32_t first = trim_first(self, s, nb);
+    // the margin may start in the previous samples
+    trim_keep_margin(self, s, first);
+    if (first == nb)
+      return 0;
+    dbg("leading silence: %u samples kept", self->hold_len);
+    s += first;
+    nb -= first;
+    self->leading = false;
+  }
+
+  last = trim_last(self, s, nb);
+  if (!last)
+    return trim_hold(self, s, nb);
+
+  res = trim_release(self);
+  if (!res)
+    res = self->cb(s, last, self->data);
+  if (!res && (last < nb))
+    res = trim_hold(self, s + last, nb - last);
+  return res;
+}
+
+int trim_flush(trim_t *self)
+{
+  int res = 0;
+
+  if (!self)
+    return 0;
+
+  if (self->hold_len && !self->leading) {
+    uint32_t n = (self->hold_len < self->margin) ? self->hold_len : self->margin;
+    dbg("%u trailing samples dropped", self->hold_len - n);
+    if (n)
+      res = self->cb(self->hold, n, self->data);
+  }
+  trim_reset(self);
+  return res;
+}
+
+void trim_reset(trim_t *self)
+{
+  if (!self)
+    return;
+  self->hold_len = 0;
+  self->leading = true;
+}
@@ -0,0 +1,44 @@
+#ifndef TRIM_H
+#define TRIM_H
+
+#include <stdint.h>
+
+/*
+  Trimming of the leading and trailing silence of an utterance
+  (VOX_TRIM_SILENCE): a sample is silent if its amplitude does not
+  exceed the threshold.
+
+  The silence before the first loud sample is dropped. A silence
+  following a loud sample is held back (up to a limit) until the next
+  loud sample, then supplied; at the end of the utterance, it is
+  dropped. A short margin is kept on each side.
+
+  The threshold is compared with SSE2 or NEON when available.
+*/
+
+typedef struct trim_t trim_t;
+
+// trim_cb receives nb output samples; returns 0 to go on, otherwise
+// the processing is aborted
+typedef int (*trim_cb)(const int16_t *samples, uint32_t nb, void *data);
+
+// trim_create returns a trimmer for samples at rate (Hz) and the
+// amplitude threshold
+trim_t *trim_create(uint32_t rate, uint32_t threshold, trim_cb cb, void *data);
+
+void trim_delete(trim_t *self);
+
+// trim_process supplies the nb samples (host order) to cb except the
+// silence to trim; returns the value returned by cb if it aborts, 0
+// otherwise
+int trim_process(trim_t *self, const void *samples, uint32_t nb);
+
+// trim_flush drops the trailing silence (end of utterance) and resets
+// the trimmer; returns as trim_process
+int trim_flush(trim_t *self);
+
+// trim_reset discards the held samples; the next samples start an
+// utterance
+void trim_reset(trim_t *self);
+
+#endif
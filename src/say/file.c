@@ -1,6 +1,9 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -8,8 +11,12 @@
 #include "errno.h"
 #include "debug.h"
 
-#define FILE_TEMPLATE "/tmp/voxin-say.XXXXXX"
-#define FILE_TEMPLATE_LENGTH 30
+#define FILE_TEMPLATE "voxin-say.XXXXXX"
+// directory of the spill files if TMPDIR is unset (usually on disk,
+// unlike /tmp)
+#define FILE_SPILL_DIR "/var/tmp"
+// data of a temporary file kept in memory, the next ones spill to disk
+#define FILE_MEMORY_MAX (32*1024*1024)
 
 #define MAX_CHAR 10240
 static char tempbuf[MAX_CHAR+10];
@@ -55,54 +62,70 @@ static int fileOpen(file_t *self, int mode) {
   return self->fd ? 0 : errno;
 }
 
+// fileGetSpillIn returns a descriptor to an unlinked file created in dir
+static int fileGetSpillIn(const char *dir) {
+  char *filename = NULL;
+  int fd;
+
+  fd = open(dir, O_TMPFILE|O_RDWR|O_EXCL, S_IRUSR|S_IWUSR);
+  if (fd != -1)
+	return fd;
+
+  // no O_TMPFILE support
+  if (asprintf(&filename, "%s/%s", dir, FILE_TEMPLATE) == -1)
+	return -1;
+  fd = mkstemp(filename);
+  if (fd != -1)
+	unlink(filename);
+  free(filename);
+  return fd;
+}
+
+// fileGetSpill returns a descriptor to an unlinked file on disk
+static int fileGetSpill() {
+  ENTER();
+  const char *dir[] = {getenv("TMPDIR"), FILE_SPILL_DIR, "/tmp"};
+  int i;
+  int fd = -1;
+
+  for (i=0; (fd == -1) && (i < sizeof(dir)/sizeof(*dir)); i++) {
+	if (dir[i] && *dir[i])
+	  fd = fileGetSpillIn(dir[i]);
+  }
+  return fd;
+}
+
+/* fileGetTemp creates the temporary file, anonymous: it can be used
+   by the forked processes without reopening it.
+   The data is written without stdio buffering. */
 static int fileGetTemp(file_t *self, int mode) {
   ENTER();
   int err = 0;
-  int fd = -1;
 
   if (!self)
 	return EINVAL;
   
-  if (self->fd) {
-	fclose(self->fd);
-	self->fd = NULL;	
-  }
-
-  if (self->filename) {
-	free(self->filename);
-	self->filename = NULL;
-  }
   self->read = self->written = 0;
   self->fifo = false;
   self->mode = mode;
-  self->unlink = true;
-	  
-  self->filename = malloc(FILE_TEMPLATE_LENGTH);
-  if (!self->filename) {
-	err = errno;
-	goto exit0;
-  }
-  strcpy(self->filename, FILE_TEMPLATE);
-  fd = mkstemp(self->filename);
-  if (fd == -1) {
+  self->unlink = false;
+
+  self->spill = fileGetSpill();
+  if (self->spill == -1) {
 	err = errno;
 	goto exit0;
   }
 
-  self->fd = fdopen(fd, "r+");
-  if (!self->fd) {
-	err = errno;
-	goto exit0;
+  self->memfd = memfd_create("voxin-say", MFD_CLOEXEC);
+  if (self->memfd == -1) {
+	msg("memfd_create: %s", strerror(errno));
+  } else {
+	self->memory_max = FILE_MEMORY_MAX;
   }
 
   return 0;
   
  exit0:
-  if (self->filename) {
-	free(self->filename);
-	self->filename = NULL;
-  }
-
   if (err) {
 	char *s = strerror(err);
 	err("%s", s);
@@ -119,6 +142,7 @@ file_t *fileCreate(const char *filename, int mode, bool fifo) {
 	return NULL;
 
   self->mode = mode;  
+  self->memfd = self->spill = -1;
 
   if (filename) {
 	self->filename = strdup(filename);
@@ -129,7 +153,7 @@ file_t *fileCreate(const char *filename, int mode, bool fifo) {
   } else if (fileGetTemp(self, mode))
 	goto exit0;
 
-  if (!self->fd) {
+  if (!self->fd && (self->spill == -1)) {
 	if (fileOpen(self, mode))
 	  goto exit0;
   }
@@ -143,24 +167,66 @@ file_t *fileCreate(const char *filename, int mode, bool fifo) {
 
 int fileDelete(file_t *self) {
   ENTER();
-  int res = -1;
   if (!self)
 	return 0;
+  fileClose(self);
   if (self->filename) {
 	if (self->unlink)
 	  unlink(self->filename);
 	free(self->filename);
 	self->filename = NULL;
-	free(self);
-	res = 0;
   }
-  return res;
+  if (self->memfd != -1)
+	close(self->memfd);
+  if (self->spill != -1)
+	close(self->spill);
+  free(self);
+  return 0;
+}
+
+// fileWriteFd writes len bytes to the descriptor
+static int fileWriteFd(int fd, const uint8_t *data, size_t len) {
+  while (len) {
+	ssize_t n = write(fd, data, len);
+	if (n < 0) {
+	  if (errno == EINTR)
+		continue;
+	  return errno;
+	}
+	data += n;
+	len -= n;
+  }
+  return 0;
+}
+
+static int fileWriteTemp(file_t *self, const uint8_t *data, size_t len) {
+  int err = 0;
+  if (self->written < self->memory_max) {
+	size_t l = self->memory_max - self->written;
+	if (l > len)
+	  l = len;
+	err = fileWriteFd(self->memfd, data, l);
+	if (err)
+	  return err;
+	self->written += l;
+	data += l;
+	len -= l;
+  }
+  if (len) {
+	err = fileWriteFd(self->spill, data, len);
+	if (!err)
+	  self->written += len;
+  }
+  return err;
 }
 
 int fileWrite(file_t *self, const uint8_t *data, size_t len) {
   int res = 0;
   size_t x = 0;
 
+  if (self && (self->spill != -1))
+	return fileWriteTemp(self, data, len);
+
   if (!self || !self->fd || !(self->mode & FILE_WRITABLE))
 	return EINVAL;
 
@@ -207,71 +273,174 @@ int fileFlush(file_t *self) {
   return res;
 }
 
+/* fileCopy appends len bytes of the descriptor from offset: without
+   copy to user space, using copy_file_range to a regular file or
+   splice to a pipe; otherwise through a buffer */
+static int fileCopy(file_t *self, int fd, off_t offset, size_t len) {
+  int out;
+  int err = 0;
+  bool kernel = true;
+  struct stat statbuf;
+
+  err = fileFlush(self);
+  if (err)
+	return err;
+
+  out = fileno(self->fd);
+  if (fstat(out, &statbuf) == -1)
+	return errno;
+
+  while (len) {
+	ssize_t n = -1;
+	if (kernel) {
+	  if (S_ISREG(statbuf.st_mode))
+		n = copy_file_range(fd, &offset, out, NULL, len, 0);
+	  else if (S_ISFIFO(statbuf.st_mode))
+		n = splice(fd, &offset, out, NULL, len, SPLICE_F_MORE);
+	  else
+		errno = EINVAL;
+	  if (n == -1) {
+		if ((errno == ENOSYS) || (errno == EXDEV) || (errno == EINVAL)
+			|| (errno == EOPNOTSUPP) || (errno == EBADF)) {
+		  dbg("fallback to read/write (%s)", strerror(errno));
+		  kernel = false;
+		  continue;
+		}
+	  }
+	} else {
+	  n = pread(fd, tempbuf, (len > MAX_CHAR) ? MAX_CHAR : len, offset);
+	  if (n > 0) {
+		err = fileWriteFd(out, tempbuf, n);
+		if (err)
+		  break;
+		offset += n;
+	  }
+	}
+	if (n == -1) {
+	  if (errno == EINTR)
+		continue;
+	  err = errno;
+	  break;
+	}
+	if (!n) {
+	  err = EIO;
+	  break;
+	}
+	len -= n;
+	self->written += n;
+  }
+
+  return err;
+}
+
+// fileCatTemp appends len bytes of the temporary file src from offset
+static int fileCatTemp(file_t *self, file_t *src, size_t offset, size_t len) {
+  int err = 0;
+  while (len && !err) {
+	size_t l = len;
+	if (offset < src->memory_max) {
+	  if (l > src->memory_max - offset)
+		l = src->memory_max - offset;
+	  err = fileCopy(self, src->memfd, offset, l);
+	} else {
+	  err = fileCopy(self, src->spill, offset - src->memory_max, l);
+	}
+	offset += l;
+	len -= l;
+  }
+  return err;
+}
+
+// fileOpenOutput opens self for appending data if needed
+static int fileOpenOutput(file_t *self) {
+  if (self->fd && !self->fifo && !(self->mode & FILE_WRITABLE)) {
+	fclose(self->fd);
+	self->fd = NULL;
+  }
+  return self->fd ? 0 : fileOpen(self, FILE_WRITABLE|FILE_APPEND);
+}
+
 int fileCat(file_t *self, file_t *src) {
   ENTER();
   int err=0;
-  FILE *fdout = NULL;
-  size_t size = 0;
+  long size = 0;
 
-  if (!self || !src) {
+  if (!self || !src || (src->spill == -1)) {
 	return EINVAL;
   }
 
-  if (src->fd)
-	fileClose(src);
-  
-  err = fileOpen(src, FILE_READABLE);
-  if (err)
+  size = fileGetSize(src);
+  if (size < 0) {
+	err = EIO;
 	goto exit0;
-
-  {
-	struct stat statbuf;
-	if (fstat(fileno(src->fd), &statbuf) == -1) {
-	  err = errno;
-	  goto exit0;
-	}
-	size = statbuf.st_size;
   }
 
-  if (self->fd && !self->fifo) {
-	if ((self->mode & (FILE_WRITABLE|FILE_APPEND)) != (FILE_WRITABLE|FILE_APPEND)) {
-	  fclose(self->fd);
-	  self->fd = NULL;
-	}
-  }
+  err = fileOpenOutput(self);
+  if (!err)
+	err = fileCatTemp(self, src, 0, size);
 
-  if (!self->fd) {
-	err = fileOpen(self, FILE_WRITABLE|FILE_APPEND);
-	if (err)
-	  goto exit0;
+ exit0:
+  if (err) {
+	err("%s", strerror(err));
   }
-  
-  while(size) {
-	size_t oldread = src->read;
-	size_t len = (size > MAX_CHAR) ? MAX_CHAR : size;
-	size -= len;
-	err = fileRead(src, tempbuf, len);
-	if (err)
-	  break;
-	err = fileWrite(self, tempbuf, src->read - oldread);
-	if (err)
-	  break;
+  return err;
+}
+
+/* fileCatRange appends len bytes of src from offset */
+int fileCatRange(file_t *self, file_t *src, size_t offset, size_t len) {
+  ENTER();
+  int err=0;
+
+  if (!self || !src || (src->spill == -1)) {
+	return EINVAL;
   }
-  fileClose(src);
 
- exit0:
+  err = fileOpenOutput(self);
+  if (!err)
+	err = fileCatTemp(self, src, offset, len);
+
   if (err) {
 	err("%s", strerror(err));
   }
   return err;
 }
 
-int fileGetSize(file_t *self) {
+int fileReserve(file_t *self, size_t size) {
   ENTER();
+  struct stat statbuf;
+  int fd;
+
+  if (!self || !self->fd || self->fifo)
+	return EINVAL;
+
+  fd = fileno(self->fd);
+  if ((fstat(fd, &statbuf) == -1) || !S_ISREG(statbuf.st_mode))
+	return EINVAL;
+
+  // keep the size: the file is then written from its beginning
+  if (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, size) == -1) {
+	int err = errno;
+	dbg("fallocate: %s", strerror(err));
+	return err;
+  }
+  return 0;
+}
 
-  int size = -1;
+long fileGetSize(file_t *self) {
+  ENTER();
+
+  long size = -1;
   struct stat statbuf;
 
+  if (self && (self->spill != -1)) {
+	size = 0;
+	if ((self->memfd != -1) && !fstat(self->memfd, &statbuf))
+	  size += statbuf.st_size;
+	if (!fstat(self->spill, &statbuf))
+	  size += statbuf.st_size;
+	return size;
+  }
+
   if (!self || !self->filename)
 	return -1;
 
@@ -17,6 +17,11 @@ typedef struct {
   bool fifo; // is the standard input (textfile) or the standard output (wavfile) redirected to a pipe.
   int mode; // FILE_READABLE or FILE_WRITABLE, FILE_APPEND
   bool unlink;
+  // temporary file (no filename): the first memory_max bytes are
+  // kept in memory, the next ones spill to an unlinked file on disk
+  int memfd; // -1 if unused
+  int spill; // -1 if the file is not temporary
+  size_t memory_max;
 } file_t;
 
 
@@ -26,7 +31,10 @@ int fileRead(file_t *handle, uint8_t *data, size_t len);
 int fileWrite(file_t *handle, const uint8_t *data, size_t len);
 int fileFlush(file_t *handle);
 int fileCat(file_t *self, file_t *src);
+int fileCatRange(file_t *self, file_t *src, size_t offset, size_t len);
 int fileClose(file_t *self);
-int fileGetSize(file_t *self);
+long fileGetSize(file_t *self);
+/* fileReserve preallocates size bytes to the regular file */
+int fileReserve(file_t *self, size_t size);
 
 #endif
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "manifest.h"
+#include "debug.h"
+
+#define MAX_FIELDS 4
+
+typedef struct {
+  FILE *fd;
+  char *line; // buffer allocated by getline
+  size_t max; // allocated length of line
+  unsigned long number; // number of the current line
+} manifest_t;
+
+void *manifestCreate(const char *filename) {
+  ENTER();
+  manifest_t *self;
+
+  if (!filename)
+	return NULL;
+
+  self = calloc(1, sizeof(*self));
+  if (!self)
+	return NULL;
+
+  self->fd = strcmp(filename, "-") ? fopen(filename, "r") : stdin;
+  if (!self->fd) {
+	err("%s: %s", filename, strerror(errno));
+	free(self);
+	return NULL;
+  }
+
+  return self;
+}
+
+int manifestDelete(void *handle) {
+  ENTER();
+  manifest_t *self = handle;
+
+  if (!self)
+	return 0;
+
+  if (self->fd && (self->fd != stdin))
+	fclose(self->fd);
+  if (self->line)
+	free(self->line);
+  free(self);
+  return 0;
+}
+
+int manifestGetNextLine(void *handle, const char **line, size_t *len, unsigned long *number) {
+  ENTER();
+  manifest_t *self = handle;
+  ssize_t n;
+
+  if (!self || !line || !len || !number)
+	return EINVAL;
+
+  *line = NULL;
+  *len = 0;
+
+  while ((n = getline(&self->line, &self->max, self->fd)) != -1) {
+	self->number++;
+	while (n && ((self->line[n-1] == '\n') || (self->line[n-1] == '\r')))
+	  self->line[--n] = 0;
+	if (!n || (*self->line == '#'))
+	  continue;
+	*line = self->line;
+	*len = n;
+	*number = self->number;
+	return 0;
+  }
+
+  return ferror(self->fd) ? EIO : 0;
+}
+
+int manifestParse(char *line, manifest_entry_t *entry) {
+  ENTER();
+  char *field[MAX_FIELDS];
+  int i;
+
+  if (!line || !entry)
+	return EINVAL;
+
+  memset(field, 0, sizeof(field));
+  for (i=0; line && (i<MAX_FIELDS); i++) {
+	field[i] = line;
+	line = strchr(line, '\t');
+	if (line)
+	  *line++ = 0;
+  }
+
+  if (!field[0] || !*field[0] || !field[1] || !*field[1]) {
+	err("input and output expected");
+	return EINVAL;
+  }
+
+  entry->input = (*field[0] == '=') ? NULL : field[0];
+  entry->text = (*field[0] == '=') ? field[0] + 1 : NULL;
+  entry->output = field[1];
+  entry->voiceName = (field[2] && *field[2]) ? field[2] : NULL;
+  entry->wordsPerMinute = (field[3] && *field[3]) ? atoi(field[3]) : -1;
+
+  if (entry->text && !*entry->text) {
+	err("empty text");
+	return EINVAL;
+  }
+
+  dbg("input=%s, text=%s, output=%s, voice=%s, speed=%d",
+	  entry->input ? entry->input : "", entry->text ? entry->text : "",
+	  entry->output, entry->voiceName ? entry->voiceName : "", entry->wordsPerMinute);
+  return 0;
+}
@@ -0,0 +1,41 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <stddef.h>
+
+/*
+The manifest lists the conversions to perform, one per line:
+
+INPUT<TAB>OUTPUT[<TAB>VOICE[<TAB>SPEED]]
+
+INPUT is the path of the UTF-8 text file to read, or if it begins
+with an equal sign, the text to say (without the equal sign).
+OUTPUT is the path of the wavfile to write.
+VOICE (voice or language name) and SPEED (words per minute) are
+optional; if empty, the values supplied on the command line are used.
+
+Empty lines and lines beginning with '#' are ignored.
+*/
+
+typedef struct {
+  const char *input; // text file, NULL if text is set
+  const char *text; // text to say, NULL if input is set
+  const char *output;
+  const char *voiceName; // NULL if unset
+  int wordsPerMinute; // -1 if unset
+} manifest_entry_t;
+
+/* manifestCreate opens the manifest; if filename is "-", the manifest
+   is read from the standard input */
+void *manifestCreate(const char *filename);
+int manifestDelete(void *handle);
+
+/* manifestGetNextLine supplies the next line to process (without the
+   end of line), valid up to the next call; *line is set to NULL at the
+   end of the manifest. *number is the line number in the manifest. */
+int manifestGetNextLine(void *handle, const char **line, size_t *len, unsigned long *number);
+
+/* manifestParse splits in place the line into the fields of entry */
+int manifestParse(char *line, manifest_entry_t *entry);
+
+#endif
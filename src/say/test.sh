@@ -287,6 +287,12 @@ if [ "$?" = "0" ]; then
 fi
 time ./voxin-say -l fr -s 500 -j 4 -f $FILE.fr | $PLAY
 
+echo "test 7"
+printf "$FILE.en.short\t$FILE.1.wav\n=hello world!\t$FILE.2.wav\t\t500\n$FILE.en.short\t$FILE.3.wav\n" > $FILE.tsv
+time ./voxin-say -j 2 --manifest $FILE.tsv
+for i in 1 2 3; do $PLAY $FILE.$i.wav; done
+rm $FILE.tsv $FILE.1.wav $FILE.2.wav $FILE.3.wav
+
 
 rm "$FILE" "$FILE.en" "$FILE.en.short" "$FILE.fr.short"
 
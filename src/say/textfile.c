@@ -1,6 +1,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -10,346 +12,297 @@
 #include "errno.h"
 #include "debug.h"
 
-#define FILE_TEMPLATE "/tmp/voxin-say.XXXXXXXXXX"
-#define FILE_TEMPLATE_LENGTH 30
 // below this size, do not create other parts
 #define MIN_PART_SIZE 256
+// minimal length of a batch of sentences returned by
+// textfileGetNextSentences (except at the end of a region)
+#define BATCH_LENGTH 10240
+// length of each read from a stream
+#define STREAM_CHUNK 4096
 
 typedef struct {
   long begin;
   long end;
 } region_t;
 
-typedef struct {
-  file_t *file;
-  region_t region;
-} input_t;
+/*
+  The input text is accessed in memory: either the mapping of the
+  input file or a copy of the sentence supplied on the command line.
+
+  The byte following each batch of sentences (a white space) is
+  replaced in place by a zero terminator so that the batch can be
+  passed as is to the tts. The mapping is private and writable for
+  this purpose; one extra byte is reserved after the end of the text.
 
+  If the standard input is a pipe, the text is a buffer filled as
+  data arrive; each batch returned is removed from the buffer at the
+  next call.
+*/
 typedef struct {
-  input_t **input;
-  size_t len; // usable number of elements in the input array
+  region_t *region; // one region per part
+  size_t len; // usable number of elements in the region array
   size_t max; // max number of elements allocated
+  char *text; // input text
+  long size; // length of the text (without the extra terminator)
+  size_t mapped; // length of the mapping, 0 if text is allocated
+  int stream; // descriptor of the pipe, -1 if the input is not a stream
+  size_t allocated; // allocated length of the stream buffer
+  long consumed; // length of the last batch taken from the stream buffer
+  bool eof; // end of stream reached
 } textfile_t;
 
-#define MAX_CHAR 10240
-static char tempbuf[MAX_CHAR+10];
+static region_t *textfileGetRegion(textfile_t *self, size_t part) {
+  return (!self || !self->region || (part >= self->len))
+	? NULL : self->region + part;
+}
 
-static int inputDelete(input_t *self) {
-  ENTER();
-  int err;
-  if (!self)
-	return 0;
+/* textfileSearchSpace returns the offset of the first white space at
+or after pos and before end (only after a period if period is true);
+otherwise end */
+static long textfileSearchSpace(textfile_t *self, long pos, long end, bool period) {
+  const char *t = self->text;
+  long i;
 
-  err = fileDelete(self->file);
-  if (err)
-	goto exit0;
-  
-  self->file = NULL;
-  free(self);
+  if (pos < 1)
+	pos = 1;
 
- exit0:
-  return err;
-}
-
-static input_t *inputCreate() {
-  ENTER();
-  input_t *self = calloc(1, sizeof(*self));
-  return self;
-}
+  for (i=pos; i<end; i++) {
+	if (isspace(t[i]) && (!period || (t[i-1] == '.')))
+	  return i;
+  }
 
-static input_t *textfileGetInput(textfile_t *self, size_t part) {
-  return (!self || !self->input || (part >= self->len))
-	? NULL : self->input[part];
+  return end;
 }
 
-static file_t *textfileGetFile(textfile_t *self, size_t part) {
-  input_t *input = textfileGetInput(self, part);
-  return  input ? input->file : NULL;
+/* textfileSentenceSearchNext returns the offset of the first sentence
+boundary at or after pos and before end.
+
+The boundary is the white space which follows a period within
+BATCH_LENGTH bytes (so that a batch starting BATCH_LENGTH bytes before
+pos does not exceed 2*BATCH_LENGTH, as for a stream); otherwise the
+first white space; otherwise end.
+*/
+static long textfileSentenceSearchNext(textfile_t *self, long pos, long end) {
+  long limit = (end - pos > BATCH_LENGTH) ? pos + BATCH_LENGTH : end;
+  long i = textfileSearchSpace(self, pos, limit, true);
+  return (i < limit) ? i : textfileSearchSpace(self, pos, end, false);
 }
 
-static int textfileSentenceSearchLast(long *length) {
+static int textfileMap(textfile_t *self, int fd, bool populate) {
+  ENTER();
   int err = 0;
-  
-  if (!length) {
-	return EINVAL;
-  }
-  
-  if (*length > 2) {
-	long length0 = *length;
-	int i;
-	int found=0;
-	for (i=*length-2; i>0; i--) {
-	  if ((tempbuf[i] == '.') && isspace(tempbuf[i+1])) {
-		found = 1;
-		length0 = i+1;
-		break;
-	  }
-	}
-	if (!found) {
-	  for (i=*length-2; i>0; i--) {
-		if (!isspace(tempbuf[i]) && isspace(tempbuf[i+1])) {
-		  length0 = i+1;
-		  break;
-		}
-	  }
-	}
-	*length = length0;
-  }
-  return err;
-}
+  struct stat statbuf;
+  size_t len;
+  char *base = MAP_FAILED;
 
-/* textfileSentenceRead copies the maximum number of full/unsplitted
-sentences from the concerned part of textfile to tempbuf.
+  if (fstat(fd, &statbuf) == -1)
+	return errno;
 
-length is updated with the number of bytes copied.
-
- */
-static int textfileReadSentences(textfile_t *self, size_t part, long *length) {
-  ENTER();
-  int err = 0;
-  long max, x;
-  file_t *f = textfileGetFile(self, part);
-  input_t *input = textfileGetInput(self, part);
-  region_t *r = NULL;
-  size_t a = 0;
-  
-  if (!f|| !length ) {
-	err = EINVAL;
-	goto exit0;
-  }
+  self->size = statbuf.st_size;
+  if (!self->size)
+	return 0;
 
-  r = &input->region;
-  *length = 0;
-  *tempbuf = 0;
-  
-  if (r->end <= r->begin) {
-	msg("empty region, part %ld: from=%ld to=%ld (length=%ld)", part, r->begin, r->end, *length);
+  // reserve the text + its terminator; if the file size is a
+  // multiple of the page size, the terminator is the first byte of
+  // an anonymous page
+  len = self->size + 1;
+  base = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED) {
+	err = errno;
 	goto exit0;
   }
-  x = r->end - r->begin;
-  max = (x < MAX_CHAR) ? x : MAX_CHAR;  
 
-  if (fseek(f->fd, r->begin, SEEK_SET) == -1) {
+  if (mmap(base, self->size, PROT_READ|PROT_WRITE,
+		   MAP_PRIVATE|MAP_FIXED|(populate ? MAP_POPULATE : 0), fd, 0) == MAP_FAILED) {
 	err = errno;
 	goto exit0;
   }
 
-  while(a < max) {
-	size_t b = fread(tempbuf+a, 1, max-a, f->fd);
-	a += b;
-	if (b < max-a) {
-	  if (feof(f->fd))
-		break;
-	  else if (ferror(f->fd)) {
-		err = EIO;
-		goto exit0;
-	  }
-	}
+  if (!populate && madvise(base, self->size, MADV_SEQUENTIAL)) {
+	dbg("madvise: %s", strerror(errno));
   }
-  *length = a;
-  
-  err = textfileSentenceSearchLast(length);
-  if (err)
-	goto exit0;
 
-  tempbuf[*length] = 0;
-  msg("part=%ld, read from=%ld to=%ld (length=%ld)", part, r->begin, r->end, *length);
+  self->text = base;
+  self->mapped = len;
+  msg("mapped %ld bytes (populate=%d)", self->size, populate);
+  return 0;
 
  exit0:
-  if (err)
-	err("%s",strerror(err));
+  if (base != MAP_FAILED)
+	munmap(base, len);
+  self->size = 0;
+  err("%s", strerror(err));
   return err;
 }
 
-/* textfileAdjustRegion adjusts the concerned region of text so that
-its last sentence is unsplitted */
-static int textfileAdjustRegion(textfile_t *self, unsigned int part) {
+static int textfileMapFile(textfile_t *self, const char *inputfile, bool populate) {
   ENTER();
-  int max = 0;
-  long range = 0;
-  int err = 0;
-  input_t *input = textfileGetInput(self, part);
-  region_t *r = NULL;
-  
-  if (!input) {
-	err = EINVAL;
-	goto exit0;
-  }
-
-  r = &(input->region);
-
-  // read the last bytes of the region
-  range = r->end - r->begin;
-  if (range < 0) {
-	err = EINVAL;
-	goto exit0;
-  }
-  
-  max = (range < MAX_CHAR) ? range : MAX_CHAR;
-
-  {	
-	long length = 0;
-	long begin0 = r->begin; 
-	r->begin = r->end - max;
-	err = textfileReadSentences(self, part, &length);
-	if (err)
-	  goto exit0;
-	r->end = r->begin + length;
-	r->begin = begin0;
-	msg("adjust region, part %d: from=%ld to=%ld", part, r->begin, r->end);	
-  }
-  
- exit0:
-  if (err) {
-	err("%s",strerror(err));
+  int err;
+  int fd = open(inputfile, O_RDONLY);
+  if (fd == -1) {
+	err = errno;
+	err("%s: %s", inputfile, strerror(err));
+	return err;
   }
+  err = textfileMap(self, fd, populate);
+  close(fd);
   return err;
 }
 
 static int textfileSetSentence(textfile_t *self, const char *sentence) {
   ENTER();
 
-  int err = 0;
-  input_t *input = textfileGetInput(self, 0);
-  
-  if (!input || !sentence || !*sentence)
+  if (!self || !sentence || !*sentence)
 	return EINVAL;
- 
-  input->file = fileCreate(NULL, FILE_READABLE|FILE_WRITABLE, false);
-  file_t *f = input->file;
-  if (f) {
-	err = fileWrite(f, sentence, strlen(sentence));
-	if (err) {
-	  fileDelete(f);
-	  input = NULL;
-	} else 
-	  err = fileFlush(f);
-  } else {
-	err = EIO;
+
+  self->text = strdup(sentence);
+  if (!self->text)
+	return errno;
+  self->size = strlen(self->text);
+  return 0;
+}
+
+/* textfileReadStream reads the pipe until the buffer holds a batch of
+sentences ending at a sentence boundary, or until the end of the
+stream; *end is set to the boundary.
+
+So that the batches do not depend on the size of the reads, the
+fallback on a white space is only taken once 2*BATCH_LENGTH bytes are
+available. */
+static int textfileReadStream(textfile_t *self, long *end) {
+  ENTER();
+  int err = 0;
+
+  if (self->consumed) { // drop the previous batch
+	self->size -= self->consumed;
+	memmove(self->text, self->text + self->consumed, self->size);
+	self->consumed = 0;
+  }
+
+  while (1) {
+	ssize_t n;
+	if (self->size > BATCH_LENGTH) {
+	  *end = textfileSearchSpace(self, BATCH_LENGTH, self->size, true);
+	  if (*end < self->size)
+		break;
+	  if (self->size > 2*BATCH_LENGTH) {
+		*end = textfileSearchSpace(self, BATCH_LENGTH, self->size, false);
+		if (*end < self->size)
+		  break;
+	  }
+	}
+	if (self->eof) {
+	  *end = self->size;
+	  break;
+	}
+	if (self->allocated < self->size + STREAM_CHUNK + 1) {
+	  size_t allocated = self->size + STREAM_CHUNK + 1;
+	  char *text = realloc(self->text, allocated);
+	  if (!text) {
+		err = errno;
+		break;
+	  }
+	  self->text = text;
+	  self->allocated = allocated;
+	}
+	n = read(self->stream, self->text + self->size, STREAM_CHUNK);
+	if (n > 0) {
+	  self->size += n;
+	} else if (!n) {
+	  self->eof = true;
+	} else if (errno != EINTR) {
+	  err = errno;
+	  break;
+	}
   }
+
+  if (err)
+	err("%s", strerror(err));
   return err;
 }
 
+/* textfileSetParts splits the text in self->len regions; each region
+ends at a sentence boundary found by scanning forward */
 static int textfileSetParts(textfile_t *self) {
   ENTER();
 
-  int err = EIO;
   int i;
-  input_t *input0 = textfileGetInput(self, 0);
-  file_t *f0 = textfileGetFile(self, 0);
-  region_t r = {0};
-  region_t r0;
+  long begin = 0;
   long partlen;
-  
-  if (!input0)
-	return EINVAL;
 
-  if (self->len <= 1)
-	return 0;
-  
-  for (i=1; i<self->len; i++) {
-  	input_t *input = textfileGetInput(self, i);
-  	input->file = fileCreate(f0->filename, FILE_READABLE, false);
-  	if (!input->file)
-  	  goto exit0;
-  }
+  if (!self || !self->region)
+	return EINVAL;
 
-  r0.begin = input0->region.begin;
-  r0.end = input0->region.end;
-  partlen = r0.end/self->len;
+  partlen = self->size/self->len;
 
-  //  adjust each region so that the last sentence is unsplitted
   for (i=0; i<self->len; i++) {
-	input_t *input = textfileGetInput(self, i);
-	r.begin = r.end;
+	region_t *r = textfileGetRegion(self, i);
+	r->begin = begin;
 	if (i == self->len-1) {
-	  r.end = r0.end;
-	  memcpy(&(input->region), &r, sizeof(input->region));
+	  r->end = self->size;
 	} else {
-	  r.end = r.begin + partlen;
-	  memcpy(&(input->region), &r, sizeof(input->region));
-	  if (textfileAdjustRegion(self, i) == -1)
-		goto exit0;
-	  r.end = input->region.end + 1; // skip the zero terminator
+	  long pos = begin + partlen;
+	  if (pos > self->size)
+		pos = self->size;
+	  r->end = textfileSentenceSearchNext(self, pos, self->size);
 	}
+	begin = (r->end < self->size) ? r->end + 1 : self->size; // skip the boundary
+	msg("part %d: from=%ld to=%ld", i, r->begin, r->end);
   }
-  err = 0;
-  
- exit0:
-  return err;
+
+  return 0;
 }
 
 
-void *textfileCreate(const char *inputfile, unsigned int *number_of_parts, const char *sentence) {
+void *textfileCreate(const char *inputfile, unsigned int *number_of_parts, const char *sentence, bool populate) {
   ENTER();
 
   textfile_t *self = calloc(1, sizeof(*self));
-  file_t *f = NULL;
-  input_t *input = NULL;
-  int i;
-  long partlen = 0;
+  int err = 0;
 
   if (!self)
 	goto exit0;
 
+  self->stream = -1;
+
   if (!number_of_parts || (*number_of_parts < 1))
 	goto exit0;
 
   self->max = self->len = *number_of_parts;
-  self->input = calloc(*number_of_parts, *number_of_parts*(sizeof(*self->input)));
-  if(!self->input)
+  self->region = calloc(self->max, sizeof(*self->region));
+  if (!self->region)
 	goto exit0;
 
-  for (i=0; i<self->len;i++) {
-	 self->input[i] = inputCreate();
-	 if (!self->input[i])
-	   goto exit0;
-  }
-  
-  input = self->input[0]; 
-  if (input) { // check input
+  { // check input
 	struct stat statbuf;
 	if (inputfile) {
-	  input->file = fileCreate(inputfile, FILE_READABLE, false);
+	  err = textfileMapFile(self, inputfile, populate);
 	} else if (sentence) {
-	  textfileSetSentence(self, sentence);
+	  err = textfileSetSentence(self, sentence);
 	} else if (fstat(STDIN_FILENO, &statbuf)) {
-	  // no action
+	  err = errno;
 	} else if (S_ISREG(statbuf.st_mode)) {
-	  inputfile = realpath("/proc/self/fd/0", NULL);
-	  if (inputfile) {
-		input->file = fileCreate(inputfile, FILE_READABLE, false);
-	  }
+	  err = textfileMap(self, STDIN_FILENO, populate);
 	} else if (S_ISFIFO(statbuf.st_mode)) {
-	  input->file = fileCreate(NULL, FILE_READABLE, true);
+	  self->stream = STDIN_FILENO; // the parts share the stream
+	  return self;
 	} else {
-	  textfileSetSentence(self, "Hello World!");
+	  err = textfileSetSentence(self, "Hello World!");
 	}
   }
 
-  if (!input || !input->file)
+  if (err)
 	goto exit0;
 
-  f = input->file;
-  
-  if (!f->fifo) {
-	struct stat statbuf;
-	if (fstat(fileno(f->fd), &statbuf) == -1) {
-	  goto exit0;	  
-	} else {
-	  input->region.begin = 0;
-	  input->region.end = statbuf.st_size;
-	}
-  }
-
-  if (input->region.end < MIN_PART_SIZE) {
+  if (self->size < MIN_PART_SIZE) {
 	self->len = *number_of_parts = 1;
+	self->region[0].end = self->size;
 	return self;
-  }	
+  }
 
   if (textfileSetParts(self))
 	goto exit0;
-   
+
   return self;
 
  exit0:
@@ -357,50 +310,71 @@ void *textfileCreate(const char *inputfile, unsigned int *number_of_parts, const
   return NULL;
 }
 
-int textfileDelete(void *handle) {  
+int textfileDelete(void *handle) {
   ENTER();
-  int err = 0;
-  int i;
   textfile_t *self = (textfile_t *)handle;
 
   if (!self)
 	return 0;
 
-  if (self->input) {
-	for (i=0; i<self->len; i++) {
-	  err = inputDelete(self->input[i]);
-	  if (err)
-		goto exit0;
-	  self->input[i] = NULL;
-	}
-	free(self->input);
-	self->input = NULL;
+  if (self->text) {
+	if (self->mapped)
+	  munmap(self->text, self->mapped);
+	else
+	  free(self->text);
+	self->text = NULL;
+  }
+  if (self->region) {
+	free(self->region);
+	self->region = NULL;
   }
   free(self);
   return 0;
+}
 
- exit0:
-  return -1;
+bool textfileIsStream(void *handle) {
+  textfile_t *self = (textfile_t*)handle;
+  return (self && (self->stream != -1));
 }
 
 int textfileGetNextSentences(void *handle, unsigned int part, long *length, const char **sentence) {
   ENTER();
   textfile_t *self = (textfile_t*)handle;
-  input_t *input = textfileGetInput(self, part);
+  region_t *r = textfileGetRegion(self, part);
+  long end;
 
-  if (!input || !length || !sentence)
+  if (!r || !length || !sentence)
 	return EINVAL;
 
   *sentence = NULL;
-  region_t *r = &input->region;
-  int err = textfileReadSentences(self, part, length);
+  *length = 0;
 
-  if (!err && *length) {
-	r->begin += *length + 1;
-	*sentence = tempbuf;
-	msg("new region, part %d: from=%ld to=%ld", part, r->begin, r->end);	
+  if (self->stream != -1) {
+	int err = textfileReadStream(self, &end);
+	if (err || !end)
+	  return err;
+	self->text[end] = 0;
+	*sentence = self->text;
+	*length = end;
+	self->consumed = (end < self->size) ? end + 1 : end;
+	msg("stream, part %d: length=%ld", part, *length);
+	return 0;
   }
 
-  return err;
-}
+  if (r->end <= r->begin) {
+	msg("empty region, part %d: from=%ld to=%ld", part, r->begin, r->end);
+	return 0;
+  }
+
+  end = r->begin + BATCH_LENGTH;
+  end = (end < r->end) ? textfileSentenceSearchNext(self, end, r->end) : r->end;
 
+  // the boundary is a white space or the end of the text
+  self->text[end] = 0;
+  *sentence = self->text + r->begin;
+  *length = end - r->begin;
+  r->begin = end + 1;
+  msg("new region, part %d: from=%ld to=%ld (length=%ld)", part, r->begin, r->end, *length);
+
+  return 0;
+}
@@ -1,8 +1,22 @@
 #ifndef TEXTFILE_H
 #define TEXTFILE_H
 
-void *textfileCreate(const char *inputfile, unsigned int *number_of_parts, const char *sentence);
+#include <stdbool.h>
+
+/* textfileCreate maps the input file in memory; if populate is true,
+   the whole file is prefaulted (MAP_POPULATE) otherwise it is read
+   sequentially on demand. */
+void *textfileCreate(const char *inputfile, unsigned int *number_of_parts, const char *sentence, bool populate);
 int textfileDelete(void *handle);
+
+/* textfileIsStream returns true if the input is a pipe; the text is
+   then not split in regions: each call to textfileGetNextSentences
+   returns the next batch read from the pipe whichever the part */
+bool textfileIsStream(void *handle);
+
+/* textfileGetNextSentences supplies the next batch of sentences of
+   the part, null terminated, without copy.
+   For a stream, the batch is valid up to the next call. */
 int textfileGetNextSentences(void *handle, unsigned int part, long *length, const char **sentence);
 
 #endif
@@ -15,20 +15,23 @@ typedef struct {
   unsigned int len; // effective number of elements in the voice array
 } voice_t;
 
+typedef struct tts_t tts_t;
+
 typedef struct {
+  void *wav;
+  int part;
+  tts_t *tts;
+} data_cb_t;
+
+struct tts_t {
   void *handle;
   short samples[MAX_SAMPLES];
   int speed; // SPEED_UNDEFINED if unset
   voice_t *voice;
   int id; // obtained by voiceGetId, used to retreive the features of a voice from the voice object
   char tempbuf[MAX_CHAR+10];
-} tts_t;
-
-typedef struct {
-  void *wav;
-  int part;
-  tts_t *tts;
-} data_cb_t;
+  data_cb_t data_cb; // output of the engine
+};
 
 static enum ECICallbackReturn my_client_callback(ECIHand hEngine, enum ECIMessage Msg, long lParam, void *pData) {
   data_cb_t *data_cb = (data_cb_t *)pData;
@@ -178,7 +181,7 @@ int ttsSetOutput(void *handle, void *wav, unsigned int part) {
   ENTER();
 
   tts_t *self = handle;
-  static data_cb_t data_cb;
+  data_cb_t *data_cb;
   int err = 0;
 
   if (!self || !wav) {
@@ -186,7 +189,12 @@ int ttsSetOutput(void *handle, void *wav, unsigned int part) {
 	goto exit0;
   }
 
-  if (self->handle)
+  data_cb = &self->data_cb;
+  data_cb->wav = wav;
+  data_cb->part = part;
+  data_cb->tts = self;
+
+  if (self->handle) // already initialized, only the output changes
 	return 0;
 
   self->handle = eciNew();
@@ -195,10 +203,6 @@ int ttsSetOutput(void *handle, void *wav, unsigned int part) {
 	return EIO;
   }
 
-  data_cb.wav = wav;
-  data_cb.part = part;
-  data_cb.tts = self;
-
   // enable dictionaries
   eciSetParam(self->handle, eciDictionary, 0);
 
@@ -218,7 +222,7 @@ int ttsSetOutput(void *handle, void *wav, unsigned int part) {
 	}
   }
 
-  eciRegisterCallback(self->handle, my_client_callback, &data_cb);
+  eciRegisterCallback(self->handle, my_client_callback, data_cb);
 
   if (!eciSetOutputBuffer(self->handle, MAX_SAMPLES, self->samples)) {
 	goto exit0;
@@ -237,6 +241,13 @@ int ttsSetOutput(void *handle, void *wav, unsigned int part) {
   return err;
 }
 
+bool ttsMatch(void *handle, const char *voiceName, int speed) {
+  ENTER();
+  tts_t *self = handle;
+
+  return (self && (self->speed == speed) && (self->id == voiceGetId(self->voice, voiceName)));
+}
+
 int ttsGetRate(void *handle) {
   ENTER();
   tts_t *self = handle;
@@ -2,6 +2,7 @@
 #define TTS_H
 
 #include <stdio.h>
+#include <stdbool.h>
 #include "wavfile.h"
 
 #define SPEED_UNDEFINED -1
@@ -10,7 +11,11 @@
 void *ttsCreate(const char *voiceName, int speed);
 void ttsDelete(void *handle);
 int ttsSetVoice(void *handle, unsigned int id);
+/* ttsSetOutput initializes the engine at the first call; the next
+   calls only redirect its output to the supplied wav part */
 int ttsSetOutput(void *handle, void *wav, unsigned int part);
+/* ttsMatch returns true if the tts was created with this voice and speed */
+bool ttsMatch(void *handle, const char *voiceName, int speed);
 int ttsGetRate(void *handle);
 int ttsSay(void *handle, const char *text);
 int ttsPrintList(void *handle);
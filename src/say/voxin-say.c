@@ -7,15 +7,20 @@
 #include <errno.h>
 #include <ctype.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
 #include "textfile.h"
+#include "manifest.h"
 #include "wavfile.h"
 #include "tts.h"
 #include "debug.h"
 
 #define MAX_JOBS 32
+// max number of tts engines kept by a worker in manifest mode
+#define MAX_ENGINES 4
 
 void usage()
 {
@@ -38,6 +43,10 @@ voxin-say \"Hello all\"\n\
   use 4 jobs to speed\n\
   up conversion\n\
 voxin-say -f file.txt -l fr -s 500 -j 4 -w audio.wav\n\
+# Convert the text piped by another command as it arrives:\n\
+some_command | voxin-say -j 4 -w audio.wav\n\
+# Convert the list of files described in list.tsv with 4 jobs:\n\
+voxin-say -j 4 --manifest list.tsv\n\
 \n\
 \n\
 OPTIONS :\n\
@@ -46,6 +55,13 @@ OPTIONS :\n\
             processes to speedup conversion. \n\
   -l NAME   select voice/language. \n\
   -L        list installed voices/languages. \n\
+  -m, --manifest FILE \n\
+            convert each line of FILE (- for the standard input): \n\
+            INPUT<TAB>OUTPUT[<TAB>VOICE[<TAB>SPEED]] \n\
+            INPUT is a text file or =text to say; OUTPUT the wavfile; \n\
+            VOICE and SPEED (words per minute) default to -l and -s. \n\
+            The jobs keep their engines from one line to the next. \n\
+  -p        prefault the whole input file in memory before reading it. \n\
   -s NUM    speed in words per minute (from 0 to 1297). \n\
   -S NUM    speed in units (from 0 to 250). \n\
   -w FILE   supply the output wavfile. \n\
@@ -61,9 +77,20 @@ typedef struct {
   int jobs;
   const char *voiceName;
   int speed;
+  const char *manifest; // NULL if unset
+  // workers (parent side)
+  int workers; // number of started workers
+  pid_t pid[MAX_JOBS];
+  int sd[MAX_JOBS]; // socket to the worker
+  bool busy[MAX_JOBS]; // waiting for the reply of the worker
+  size_t index[MAX_JOBS]; // index of the work handed to the worker
+  // tts engines of a worker (manifest mode), most recently used first
+  void *engine[MAX_ENGINES];
+  int engines;
 } obj_t;
 
 #define getSpeedUnits(i) ((i<0) ? 0 : ((i>250) ? 250 : i))
+#define getSpeedFromWordsPerMinute(i) getSpeedUnits(((i)*2-140)/10)
 
 /* voices returned by libvoxin, some values (name, quality) can be
    slightly modified:
@@ -108,6 +135,450 @@ static int objSayText(obj_t *self, int job) {
   return err;
 }
 
+/*
+  Worker processes: the parent process hands the work to do to an
+  idle worker through a socket (a message made of a 32 bits length
+  followed by the data); the worker answers with a reply which
+  depends on the kind of work.
+*/
+typedef int (*worker_t)(obj_t *self, int job, int sd);
+
+static int writeAll(int fd, const void *buf, size_t len) {
+  const uint8_t *b = buf;
+  while (len) {
+	ssize_t n = send(fd, b, len, MSG_NOSIGNAL); // EPIPE if the worker died
+	if (n < 0) {
+	  if (errno == EINTR)
+		continue;
+	  return errno;
+	}
+	b += n;
+	len -= n;
+  }
+  return 0;
+}
+
+static int readAll(int fd, void *buf, size_t len) {
+  uint8_t *b = buf;
+  while (len) {
+	ssize_t n = read(fd, b, len);
+	if (!n)
+	  return EPIPE;
+	if (n < 0) {
+	  if (errno == EINTR)
+		continue;
+	  return errno;
+	}
+	b += n;
+	len -= n;
+  }
+  return 0;
+}
+
+static int sendMessage(int sd, const char *data, size_t len) {
+  uint32_t l = len;
+  int err = writeAll(sd, &l, sizeof(l));
+  return err ? err : writeAll(sd, data, len);
+}
+
+/* readMessage reads the next message in *buf (null terminated),
+   reallocated if needed; EPIPE if there is no more message */
+static int readMessage(int sd, char **buf, uint32_t *max, uint32_t *len) {
+  int err = readAll(sd, len, sizeof(*len));
+  if (err)
+	return err;
+
+  if (*len >= *max) {
+	char *t = realloc(*buf, *len + 1);
+	if (!t)
+	  return errno;
+	*buf = t;
+	*max = *len + 1;
+  }
+  err = readAll(sd, *buf, *len);
+  if (!err)
+	(*buf)[*len] = 0;
+  return err;
+}
+
+static int objStopWorkers(obj_t *self) {
+  ENTER();
+  int i;
+  int err = 0;
+
+  // end of file for the workers
+  for (i=0; i<self->workers; i++) {
+	close(self->sd[i]);
+  }
+
+  for (i=0; i<self->workers; i++) {
+	int status;
+	int e = EINTR;
+	waitpid(self->pid[i], &status, 0);
+	if (WIFEXITED(status)) {
+	  e = WEXITSTATUS(status);
+	}
+	if (e && !err) {
+	  err = e;
+	}
+  }
+  self->workers = 0;
+  return err;
+}
+
+static int objStartWorkers(obj_t *self, worker_t worker) {
+  ENTER();
+  int i;
+  int err = 0;
+
+  self->workers = 0;
+  for (i=0; i<self->jobs; i++) {
+	int sv[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) {
+	  err = errno;
+	  goto exit0;
+	}
+	self->pid[i] = fork();
+	if (self->pid[i] == -1) {
+	  err = errno;
+	  close(sv[0]);
+	  close(sv[1]);
+	  goto exit0;
+	}
+	if (!self->pid[i]) {
+	  int j;
+	  // the worker must not keep the sockets of the other workers
+	  // opened, otherwise they would never get their end of file
+	  for (j=0; j<i; j++)
+		close(self->sd[j]);
+	  close(sv[0]);
+	  err = worker(self, i, sv[1]);
+	  exit(err);
+	}
+	close(sv[1]);
+	self->sd[i] = sv[0];
+	self->busy[i] = false;
+	self->workers++;
+	msg("child pid=%d, job=%d", self->pid[i], i);
+  }
+  return 0;
+
+ exit0:
+  objStopWorkers(self);
+  return err;
+}
+
+/* objWaitWorker returns in *job a busy worker which has replied */
+static int objWaitWorker(obj_t *self, int *job) {
+  struct pollfd fds[MAX_JOBS];
+  int i;
+
+  for (i=0; i<self->workers; i++) {
+	fds[i].fd = self->busy[i] ? self->sd[i] : -1;
+	fds[i].events = POLLIN;
+	fds[i].revents = 0;
+  }
+
+  while (poll(fds, self->workers, -1) == -1) {
+	if (errno != EINTR)
+	  return errno;
+  }
+
+  for (i=0; i<self->workers; i++) {
+	if (fds[i].revents) {
+	  *job = i;
+	  return 0;
+	}
+  }
+  return EIO;
+}
+
+/*
+  Piped standard input: the parent process reads the batches of
+  sentences as they arrive and hands each of them to an idle worker.
+  The worker answers with the length of the audio data appended to its
+  part; the parent records it as the segment of the batch so that the
+  wavfile is finally output in the order of the text.
+*/
+typedef struct {
+  uint64_t length; // audio data produced for the batch
+  uint32_t rate;
+} batch_reply_t;
+
+static int objSayBatches(obj_t *self, int job, int sd) {
+  ENTER();
+  char *text = NULL;
+  uint32_t max = 0;
+  uint32_t length;
+  int err = 0;
+
+  self->tts = ttsCreate(self->voiceName, self->speed);
+  if (!self->tts) {
+	err = EIO;
+	goto exit0;
+  }
+
+  err = ttsSetOutput(self->tts, self->wav, job);
+  if (err)
+	goto exit0;
+
+  while (!readMessage(sd, &text, &max, &length)) {
+	batch_reply_t reply;
+	long written = wavfileGetPartLength(self->wav, job);
+	ttsSay(self->tts, text);
+	reply.length = wavfileGetPartLength(self->wav, job) - written;
+	reply.rate = ttsGetRate(self->tts);
+	err = writeAll(sd, &reply, sizeof(reply));
+	if (err)
+	  goto exit0;
+  }
+
+ exit0:
+  if (text)
+	free(text);
+  return err;
+}
+
+// objGetBatchReply collects the reply of the worker and records its segment
+static int objGetBatchReply(obj_t *self, int job, uint32_t *rate) {
+  batch_reply_t reply;
+  int err = readAll(self->sd[job], &reply, sizeof(reply));
+  if (err)
+	return err;
+  self->busy[job] = false;
+  *rate = reply.rate;
+  dbg("batch %lu: job=%d, length=%lu", (unsigned long)self->index[job], job, (unsigned long)reply.length);
+  return wavfileSetSegment(self->wav, self->index[job], job, reply.length);
+}
+
+static int objSayStream(obj_t *self) {
+  ENTER();
+  size_t index = 0;
+  uint32_t rate = 0;
+  int i;
+  int err;
+
+  err = objStartWorkers(self, objSayBatches);
+  if (err)
+	return err;
+
+  while (!err) {
+	long length = 0;
+	const char *sentence = NULL;
+
+	err = textfileGetNextSentences(self->text, 0, &length, &sentence);
+	if (err || !length)
+	  break;
+
+	// look for an idle worker
+	for (i=0; (i<self->workers) && self->busy[i]; i++);
+	if (i == self->workers) {
+	  err = objWaitWorker(self, &i);
+	  if (!err)
+		err = objGetBatchReply(self, i, &rate);
+	  if (err)
+		break;
+	}
+
+	err = sendMessage(self->sd[i], sentence, length);
+	self->index[i] = index++;
+	self->busy[i] = true;
+  }
+
+  for (i=0; i<self->workers; i++) {
+	if (self->busy[i] && !err) {
+	  err = objGetBatchReply(self, i, &rate);
+	}
+  }
+
+  i = objStopWorkers(self);
+  if (!err)
+	err = i;
+
+  if (!err) {
+	wavfileSetRate(self->wav, rate);
+	err = wavfileFlush(self->wav);
+  }
+
+  return err;
+}
+
+/*
+  Manifest: each worker keeps its tts engines alive from one entry to
+  the next; an engine is reused if the voice and speed of the entry
+  match.  The least recently used engine is deleted if there are
+  already MAX_ENGINES.
+*/
+static void *objGetEngine(obj_t *self, const char *voiceName, int speed) {
+  ENTER();
+  void *tts = NULL;
+  int i;
+
+  for (i=0; i<self->engines; i++) {
+	if (ttsMatch(self->engine[i], voiceName, speed)) {
+	  tts = self->engine[i];
+	  break;
+	}
+  }
+
+  if (!tts) {
+	tts = ttsCreate(voiceName, speed);
+	if (!tts)
+	  return NULL;
+	if (self->engines == MAX_ENGINES) {
+	  ttsDelete(self->engine[--self->engines]);
+	}
+	i = self->engines++;
+	msg("new engine: voice=%s, speed=%d", voiceName ? voiceName : "", speed);
+  }
+
+  // most recently used first
+  memmove(self->engine + 1, self->engine, i*sizeof(*self->engine));
+  self->engine[0] = tts;
+  return tts;
+}
+
+static int objSayEntry(obj_t *self, manifest_entry_t *entry) {
+  ENTER();
+  unsigned int parts = 1;
+  const char *voiceName = entry->voiceName ? entry->voiceName : self->voiceName;
+  int speed = (entry->wordsPerMinute < 0) ? self->speed : getSpeedFromWordsPerMinute(entry->wordsPerMinute);
+  void *text = NULL;
+  void *wav = NULL;
+  void *tts = NULL;
+  long length = 0;
+  int err = EIO;
+
+  text = textfileCreate(entry->input, &parts, entry->text, false);
+  if (!text)
+	goto exit0;
+
+  wav = wavfileCreate(entry->output, 1);
+  if (!wav)
+	goto exit0;
+
+  tts = objGetEngine(self, voiceName, speed);
+  if (!tts)
+	goto exit0;
+
+  err = ttsSetOutput(tts, wav, 0);
+  if (err)
+	goto exit0;
+
+  do {
+	const char *sentence = NULL;
+	err = textfileGetNextSentences(text, 0, &length, &sentence);
+	if (err)
+	  goto exit0;
+	if (length)
+	  ttsSay(tts, sentence);
+  } while(length);
+
+  wavfileSetRate(wav, ttsGetRate(tts));
+  err = wavfileFlush(wav);
+
+ exit0:
+  textfileDelete(text);
+  wavfileDelete(wav);
+  return err;
+}
+
+static int objSayEntries(obj_t *self, int job, int sd) {
+  ENTER();
+  char *line = NULL;
+  uint32_t max = 0;
+  uint32_t length;
+  int err = 0;
+
+  while (!readMessage(sd, &line, &max, &length)) {
+	manifest_entry_t entry;
+	int32_t res = manifestParse(line, &entry);
+	if (!res)
+	  res = objSayEntry(self, &entry);
+	err = writeAll(sd, &res, sizeof(res));
+	if (err)
+	  break;
+  }
+
+  while (self->engines) {
+	ttsDelete(self->engine[--self->engines]);
+  }
+  if (line)
+	free(line);
+  return err;
+}
+
+// objGetEntryReply collects the status of the entry converted by the worker
+static int objGetEntryReply(obj_t *self, int job, int *failures) {
+  int32_t res;
+  int err = readAll(self->sd[job], &res, sizeof(res));
+  if (err)
+	return err;
+  self->busy[job] = false;
+  if (res) {
+	(*failures)++;
+	fprintf(stderr, "Error: manifest line %lu: %s\n", (unsigned long)self->index[job], strerror(res));
+  }
+  return 0;
+}
+
+static int objSayManifest(obj_t *self) {
+  ENTER();
+  void *manifest = NULL;
+  int failures = 0;
+  int i;
+  int err;
+
+  err = objStartWorkers(self, objSayEntries);
+  if (err)
+	return err;
+
+  // opened after the fork, only read by the parent
+  manifest = manifestCreate(self->manifest);
+  if (!manifest)
+	err = ENOENT;
+
+  while (!err) {
+	const char *line;
+	size_t len;
+	unsigned long number;
+
+	err = manifestGetNextLine(manifest, &line, &len, &number);
+	if (err || !line)
+	  break;
+
+	// look for an idle worker
+	for (i=0; (i<self->workers) && self->busy[i]; i++);
+	if (i == self->workers) {
+	  err = objWaitWorker(self, &i);
+	  if (!err)
+		err = objGetEntryReply(self, i, &failures);
+	  if (err)
+		break;
+	}
+
+	err = sendMessage(self->sd[i], line, len);
+	self->index[i] = number;
+	self->busy[i] = true;
+  }
+
+  for (i=0; i<self->workers; i++) {
+	if (self->busy[i] && !err) {
+	  err = objGetEntryReply(self, i, &failures);
+	}
+  }
+
+  i = objStopWorkers(self);
+  if (!err)
+	err = i;
+
+  if (!err && failures)
+	err = EIO;
+
+  manifestDelete(manifest);
+  return err;
+}
+
 static int objSay(obj_t *self) {
   long partlen = 0;
   pid_t pid[MAX_JOBS];
@@ -118,6 +589,11 @@ static int objSay(obj_t *self) {
 	err = EINVAL;
 	goto exit0;
   }
+
+  if (textfileIsStream(self->text) && (self->jobs > 1)) {
+	err = objSayStream(self);
+	goto exit0;
+  }
 	
   for (i=1; i<self->jobs; i++) {
 	pid[i] = fork();
@@ -160,10 +636,12 @@ static void objDelete(obj_t *self) {
   wavfileDelete(self->wav);
   if (self->voiceName)
 	free((char*)self->voiceName);
+  if (self->manifest)
+	free((char*)self->manifest);
   free(self);
 }
 
-static obj_t *objCreate(const char *input, const char *output, int jobs, const char *voiceName, int speed, const char *sentence) {
+static obj_t *objCreate(const char *input, const char *output, int jobs, const char *voiceName, int speed, const char *sentence, bool populate, const char *manifest) {
   ENTER();
 
   obj_t *self = calloc(1, sizeof(*self));
@@ -172,7 +650,16 @@ static obj_t *objCreate(const char *input, const char *output, int jobs, const c
 
   self->voiceName = voiceName ? strdup(voiceName) : NULL;
   self->speed = speed;
-  self->text = textfileCreate(input, &jobs, sentence);
+
+  if (manifest) { // the input and output are supplied by the manifest
+	self->manifest = strdup(manifest);
+	if (!self->manifest)
+	  goto exit0;
+	self->jobs = jobs;
+	return self;
+  }
+
+  self->text = textfileCreate(input, &jobs, sentence, populate);
   if (!self->text)
 	goto exit0;
 
@@ -193,6 +680,7 @@ int main(int argc, char *argv[])
   int help = 0;
   char *inputfile = NULL;
   char *outputfile = NULL;
+  char *manifest = NULL;
   int jobs = 1;
   int speed = SPEED_UNDEFINED;
   int opt;
@@ -200,13 +688,19 @@ int main(int argc, char *argv[])
   int fifo = 0;
   int err = 0;
   int list = 0;
+  bool populate = false;
   char *voiceName = NULL;
   char *sentence = NULL;  
   obj_t *self = NULL;
 	
   ENTER();
 
-  while ((opt = getopt(argc, argv, "df:hj:l:Ls:S:w:")) != -1) {
+  static const struct option options[] = {
+	{"manifest", required_argument, NULL, 'm'},
+	{NULL, 0, NULL, 0}
+  };
+
+  while ((opt = getopt_long(argc, argv, "df:hj:l:Lm:ps:S:w:", options, NULL)) != -1) {
     switch (opt) {
     case 'w':
 	  if (outputfile) {
@@ -241,16 +735,23 @@ int main(int argc, char *argv[])
 	  list = 1;	  
       break;
 
+    case 'm':
+	  if (manifest) {
+		free(manifest);
+	  }
+	  manifest = strdup(optarg);
+      break;
+
+    case 'p':
+	  populate = true;
+      break;
+
     case 'S':
 	  speed = getSpeedUnits(atoi(optarg));
       break;
 
     case 's':
-	  {
-		int i = atoi(optarg);
-		i = (i*2-140)/10;
-		speed = getSpeedUnits(i);
-	  }
+	  speed = getSpeedFromWordsPerMinute(atoi(optarg));
       break;
 
     case 'd':
@@ -285,7 +786,7 @@ int main(int argc, char *argv[])
 	goto exit0;
   }
 
-  self = objCreate(inputfile, outputfile, jobs, voiceName, speed, sentence);
+  self = objCreate(inputfile, outputfile, jobs, voiceName, speed, sentence, populate, manifest);
   if (!self) {
 	usage();
 	goto exit0;
@@ -301,7 +802,10 @@ int main(int argc, char *argv[])
 	goto exit0;
   }
   
-  objSay(self);
+  if (self->manifest)
+	err = objSayManifest(self);
+  else
+	objSay(self);
   
  exit0:
   objDelete(self);
@@ -312,6 +816,9 @@ int main(int argc, char *argv[])
   if (outputfile)
 	free(outputfile);
 
+  if (manifest)
+	free(manifest);
+
   if (voiceName)
 	free(voiceName);
 
@@ -29,11 +29,19 @@ typedef struct __attribute__((__packed__)) {
   uint32_t subChunk2Size;
 } wav_header_t;
 
+typedef struct {
+  unsigned int part;
+  size_t length;
+} segment_t;
+
 typedef struct {
   file_t **part;
   size_t number_of_parts; // number of elements in the part array
   wav_header_t header;
   file_t *output;
+  segment_t *segment; // optional, output order of the parts data
+  size_t number_of_segments; // usable number of elements in the segment array
+  size_t max_segments; // max number of elements allocated
 } wavfile_t;
 
 #define MAX_CHAR 10240
@@ -104,6 +112,11 @@ int wavfileDelete(void *handle) {
 	self->part = NULL;
   }
   self->number_of_parts = 0;
+  if (self->segment) {
+	free(self->segment);
+	self->segment = NULL;
+  }
+  self->number_of_segments = self->max_segments = 0;
   free(self);
   
   return 0;
@@ -176,6 +189,64 @@ int wavfileWriteData(void *handle, unsigned int part, uint8_t *data, size_t len)
 }
 
 
+long wavfileGetPartLength(void *handle, unsigned int part) {
+  wavfile_t *self = handle;
+
+  if(!self || (part >= self->number_of_parts))
+	return -1;
+
+  return self->part[part]->written;
+}
+
+int wavfileSetSegment(void *handle, size_t index, unsigned int part, size_t length) {
+  wavfile_t *self = handle;
+
+  if(!self || (part >= self->number_of_parts))
+	return EINVAL;
+
+  if (index >= self->max_segments) {
+	size_t max = 2*index + 16;
+	segment_t *s = realloc(self->segment, max*sizeof(*s));
+	if (!s)
+	  return errno;
+	memset(s + self->max_segments, 0, (max - self->max_segments)*sizeof(*s));
+	self->segment = s;
+	self->max_segments = max;
+  }
+
+  self->segment[index].part = part;
+  self->segment[index].length = length;
+  if (index >= self->number_of_segments)
+	self->number_of_segments = index + 1;
+  return 0;
+}
+
+static int wavfileFlushSegments(wavfile_t *self) {
+  int err = 0;
+  size_t *offset;
+  int i;
+
+  offset = calloc(self->number_of_parts, sizeof(*offset));
+  if (!offset)
+	return errno;
+
+  for (i=0; i<self->number_of_segments; i++) {
+	segment_t *s = self->segment + i;
+	if (!s->length)
+	  continue;
+	err = fileCatRange(self->output, self->part[s->part], offset[s->part], s->length);
+	if (err)
+	  break;
+	offset[s->part] += s->length;
+  }
+
+  for (i=0; i<self->number_of_parts; i++) {
+	fileClose(self->part[i]);
+  }
+  free(offset);
+  return err;
+}
+
 int wavfileFlush(void *handle) {
   wavfile_t *self = handle;
   size_t size = 0;
@@ -187,7 +258,7 @@ int wavfileFlush(void *handle) {
   
   for (i=0; i<self->number_of_parts; i++) {
 	fileClose(self->part[i]);
-	int s = fileGetSize(self->part[i]);
+	long s = fileGetSize(self->part[i]);
 	if (s < 0) {
 	  return EIO;
 	}
@@ -196,16 +267,25 @@ int wavfileFlush(void *handle) {
 
   updateHeader(self, (uint32_t)size);
 
+  // optional: avoid the fragmentation of a large output
+  fileReserve(self->output, sizeof(self->header) + size);
+
   if (fileWrite(self->output, (uint8_t *)&self->header, sizeof(self->header))) {
 	return EIO;	
   }
-  
-  for (i=0; i<self->number_of_parts; i++) {
-	if (fileCat(self->output, self->part[i])) {
-	  return EIO;	
+
+  if (self->number_of_segments) {
+	if (wavfileFlushSegments(self))
+	  return EIO;
+  } else {
+	for (i=0; i<self->number_of_parts; i++) {
+	  if (fileCat(self->output, self->part[i])) {
+		return EIO;	
+	  }
 	}
   }
   fileClose(self->output);
+  return 0;
 }
 
 
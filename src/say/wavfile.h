@@ -32,6 +32,18 @@ int wavfileWriteData(void *handle, unsigned int part, uint8_t *data, size_t len)
 
 int wavfileSetRate(void *handle, uint32_t rate);
 
+/* wavfileGetPartLength returns the number of bytes written to the part */
+long wavfileGetPartLength(void *handle, unsigned int part);
+
+/* wavfileSetSegment declares that the segment number index of the
+   output is the next length bytes written to the part.
+
+   If segments are declared, wavfileFlush outputs them in the order of
+   their index (the segments of a same part being expected in the
+   order they were written); otherwise the parts are output one after
+   the other. */
+int wavfileSetSegment(void *handle, size_t index, unsigned int part, size_t length);
+
 /* wavfileFlush writes the header + data to the output */
 int wavfileFlush(void *handle);
 
@@ -0,0 +1,46 @@
+/*
+  Engine churn: create and delete engines many more times than the
+  number of engines voxind can hold simultaneously
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "eci.h"
+
+#define TEST_DBG "/tmp/test_libvoxin.dbg"
+#define MAX_ITERATIONS 1000
+#define MAX_ENGINES 4
+
+int main(int argc, char** argv)
+{
+  ECIHand handle[MAX_ENGINES];
+  int i, j;
+
+  {
+    struct stat buf;
+    while (!stat(TEST_DBG, &buf)) {
+      sleep(1);
+    }
+  }
+
+  for (i=0; i<MAX_ITERATIONS; i++) {
+    for (j=0; j<MAX_ENGINES; j++) {
+      handle[j] = eciNew();
+      if (!handle[j])
+	return __LINE__;
+    }
+
+    if (eciAddText(handle[i%MAX_ENGINES], "hello") == ECIFalse)
+      return __LINE__;
+
+    for (j=0; j<MAX_ENGINES; j++) {
+      if (eciDelete(handle[j]) != NULL)
+	return __LINE__;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,63 @@
+/*
+  Engine pool: idle engines prepared in advance for eciNew and for a
+  language; check that an engine from the pool speaks and that its
+  parameters are reset
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "voxin.h"
+
+#define TEST_DBG "/tmp/test_libvoxin.dbg"
+#define MAX_ITERATIONS 100
+#define MAX_ENGINES 2
+
+int main(int argc, char** argv)
+{
+  ECIHand handle[MAX_ENGINES];
+  int i, j;
+
+  {
+    struct stat buf;
+    while (!stat(TEST_DBG, &buf)) {
+      sleep(1);
+    }
+  }
+
+  if (voxSetEnginePool(0, MAX_ENGINES))
+    return __LINE__;
+
+  if (!voxSetEnginePool(0x12345678, 1)) // unknown language
+    return __LINE__;
+
+  sleep(1); // let voxind create the idle engines
+
+  for (i=0; i<MAX_ITERATIONS; i++) {
+    for (j=0; j<MAX_ENGINES; j++) {
+      handle[j] = eciNew();
+      if (!handle[j])
+	return __LINE__;
+      if (eciGetVoiceParam(handle[j], 0, eciSpeed) == 99)
+	return __LINE__;
+      eciSetVoiceParam(handle[j], 0, eciSpeed, 99);
+    }
+
+    if (eciAddText(handle[i%MAX_ENGINES], "hello") == ECIFalse)
+      return __LINE__;
+    if (eciSynchronize(handle[i%MAX_ENGINES]) == ECIFalse)
+      return __LINE__;
+
+    for (j=0; j<MAX_ENGINES; j++) {
+      if (eciDelete(handle[j]) != NULL)
+	return __LINE__;
+    }
+  }
+
+  if (voxSetEnginePool(0, 0))
+    return __LINE__;
+
+  return 0;
+}
@@ -0,0 +1,93 @@
+/*
+  First chunk: the first audio buffer of each utterance has the size
+  set by VOX_FIRST_CHUNK, the next ones grow up to the output buffer;
+  check that the same number of samples is received
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "voxin.h"
+
+#define TEST_DBG "/tmp/test_libvoxin.dbg"
+#define MAX_SAMPLES 8192
+#define FIRST_CHUNK 256
+#define TEXT "Hello world. This is a long enough sentence to get several buffers."
+
+static short samples[MAX_SAMPLES];
+static long total;
+static long first; // number of samples of the first buffer
+static long nb_buffers;
+
+static enum ECICallbackReturn my_callback(ECIHand hEngine, enum ECIMessage Msg, long lParam, void *pData)
+{
+  if (Msg == eciWaveformBuffer) {
+    if (!nb_buffers)
+      first = lParam;
+    nb_buffers++;
+    total += lParam;
+  }
+  return eciDataProcessed;
+}
+
+static int speak(ECIHand handle)
+{
+  total = first = nb_buffers = 0;
+  if (eciAddText(handle, TEXT) == ECIFalse)
+    return __LINE__;
+  if (eciSynthesize(handle) == ECIFalse)
+    return __LINE__;
+  if (eciSynchronize(handle) == ECIFalse)
+    return __LINE__;
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  ECIHand handle;
+  long total_ref;
+  long nb_buffers_ref;
+
+  {
+    struct stat buf;
+    while (!stat(TEST_DBG, &buf)) {
+      sleep(1);
+    }
+  }
+
+  handle = eciNew();
+  if (!handle)
+    return __LINE__;
+
+  eciRegisterCallback(handle, my_callback, NULL);
+  if (eciSetOutputBuffer(handle, MAX_SAMPLES, samples) == ECIFalse)
+    return __LINE__;
+
+  if (speak(handle))
+    return __LINE__;
+  total_ref = total;
+  nb_buffers_ref = nb_buffers;
+
+  if (voxSetParam(handle, VOX_FIRST_CHUNK, FIRST_CHUNK) == -1)
+    return __LINE__;
+
+  // twice: the first chunk applies to each utterance
+  int i;
+  for (i=0; i<2; i++) {
+    if (speak(handle))
+      return __LINE__;
+    if (total != total_ref)
+      return __LINE__;
+    if ((total > FIRST_CHUNK) && (first > FIRST_CHUNK))
+      return __LINE__;
+    if (nb_buffers < nb_buffers_ref)
+      return __LINE__;
+  }
+
+  if (eciDelete(handle) != NULL)
+    return __LINE__;
+
+  return 0;
+}
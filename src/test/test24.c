@@ -0,0 +1,125 @@
+/*
+  Prefetch: the text supplied to voxPrefetch and then spoken gives
+  the same audio, supplied by the prefetch (hit, see the timeline); a
+  different text or a stop is synthesized as usual
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "voxin.h"
+
+#define TEST_DBG "/tmp/test_libvoxin.dbg"
+#define MAX_SAMPLES 1024
+#define TEXT "Hello world. This is a long enough sentence to get several buffers."
+#define OTHER_TEXT "Another sentence."
+
+static short samples[MAX_SAMPLES];
+static long total;
+static uint32_t sum;
+
+static enum ECICallbackReturn my_callback(ECIHand hEngine, enum ECIMessage Msg, long lParam, void *pData)
+{
+  if (Msg == eciWaveformBuffer) {
+    int i;
+    for (i=0; i<lParam; i++)
+      sum = 31*sum + (uint16_t)samples[i];
+    total += lParam;
+  }
+  return eciDataProcessed;
+}
+
+static int speak(ECIHand handle, const char *text)
+{
+  total = sum = 0;
+  if (eciAddText(handle, text) == ECIFalse)
+    return __LINE__;
+  if (eciSynthesize(handle) == ECIFalse)
+    return __LINE__;
+  if (eciSynchronize(handle) == ECIFalse)
+    return __LINE__;
+  return 0;
+}
+
+// is_hit returns true if the last utterance was supplied by the
+// prefetch
+static int is_hit(ECIHand handle)
+{
+  voxUtteranceTimeline t;
+  if (voxGetUtteranceTimeline(handle, &t) != VOX_OK)
+    return 0;
+  return t.prefetched;
+}
+
+int main(int argc, char** argv)
+{
+  ECIHand handle;
+  long total_ref;
+  uint32_t sum_ref;
+
+  {
+    struct stat buf;
+    while (!stat(TEST_DBG, &buf)) {
+      sleep(1);
+    }
+  }
+
+  handle = eciNew();
+  if (!handle)
+    return __LINE__;
+
+  eciRegisterCallback(handle, my_callback, NULL);
+  if (eciSetOutputBuffer(handle, MAX_SAMPLES, samples) == ECIFalse)
+    return __LINE__;
+
+  if (speak(handle, TEXT))
+    return __LINE__;
+  total_ref = total;
+  sum_ref = sum;
+
+  if (is_hit(handle))
+    return __LINE__;
+
+  // prefetched text
+  if (voxPrefetch(handle, TEXT) != VOX_OK)
+    return __LINE__;
+  if (speak(handle, TEXT))
+    return __LINE__;
+  if ((total != total_ref) || (sum != sum_ref))
+    return __LINE__;
+  if (!is_hit(handle))
+    return __LINE__;
+
+  // other text spoken first: the prefetch is kept
+  if (voxPrefetch(handle, TEXT) != VOX_OK)
+    return __LINE__;
+  if (speak(handle, OTHER_TEXT))
+    return __LINE__;
+  if (is_hit(handle))
+    return __LINE__;
+  if (speak(handle, TEXT))
+    return __LINE__;
+  if ((total != total_ref) || (sum != sum_ref))
+    return __LINE__;
+  if (!is_hit(handle))
+    return __LINE__;
+
+  // the prefetch is cancelled by eciStop
+  if (voxPrefetch(handle, TEXT) != VOX_OK)
+    return __LINE__;
+  if (eciStop(handle) == ECIFalse)
+    return __LINE__;
+  if (speak(handle, TEXT))
+    return __LINE__;
+  if ((total != total_ref) || (sum != sum_ref))
+    return __LINE__;
+  if (is_hit(handle))
+    return __LINE__;
+
+  if (eciDelete(handle) != NULL)
+    return __LINE__;
+
+  return 0;
+}
@@ -0,0 +1,153 @@
+/*
+  Priority queue: an important utterance preempts a text (discarded)
+  or a message (resumed at the interrupted sentence); a notification
+  is discarded if the engine is busy
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "voxin.h"
+
+#define TEST_DBG "/tmp/test_libvoxin.dbg"
+#define MAX_SAMPLES 1024
+#define LONG_TEXT "Hello world. This is a long enough sentence to get several buffers. And here is another one, to be sure that the preemption occurs before its end."
+#define SHORT_TEXT "Important."
+#define FIRST_SENTENCE "This first sentence is long enough to be spoken in several buffers, even with a slow voice and a small output buffer. "
+#define SECOND_SENTENCE "And this second sentence is interrupted shortly after its beginning, then resumed from its start."
+
+static short samples[MAX_SAMPLES];
+static volatile long total;
+
+static enum ECICallbackReturn my_callback(ECIHand hEngine, enum ECIMessage Msg, long lParam, void *pData)
+{
+  if (Msg == eciWaveformBuffer) {
+    total += lParam;
+    usleep(2000); // audio playback
+  }
+  return eciDataProcessed;
+}
+
+static void wait_for_samples(ECIHand handle)
+{
+  while (!total && eciSpeaking(handle))
+    usleep(1000);
+}
+
+static void wait_for_end(ECIHand handle)
+{
+  while (eciSpeaking(handle))
+    usleep(10000);
+}
+
+int main(int argc, char** argv)
+{
+  ECIHand handle;
+  long long_ref;
+  long short_ref;
+  long first_ref;
+  long two_ref;
+
+  {
+    struct stat buf;
+    while (!stat(TEST_DBG, &buf)) {
+      sleep(1);
+    }
+  }
+
+  handle = eciNew();
+  if (!handle)
+    return __LINE__;
+
+  eciRegisterCallback(handle, my_callback, NULL);
+  if (eciSetOutputBuffer(handle, MAX_SAMPLES, samples) == ECIFalse)
+    return __LINE__;
+
+  total = 0;
+  if (voxSpeak(handle, LONG_TEXT, voxPriorityText) != VOX_OK)
+    return __LINE__;
+  wait_for_end(handle);
+  long_ref = total;
+
+  total = 0;
+  if (voxSpeak(handle, SHORT_TEXT, voxPriorityText) != VOX_OK)
+    return __LINE__;
+  wait_for_end(handle);
+  short_ref = total;
+  if (!long_ref || !short_ref)
+    return __LINE__;
+
+  total = 0;
+  if (voxSpeak(handle, FIRST_SENTENCE, voxPriorityText) != VOX_OK)
+    return __LINE__;
+  wait_for_end(handle);
+  first_ref = total;
+  total = 0;
+  if (voxSpeak(handle, FIRST_SENTENCE SECOND_SENTENCE, voxPriorityText) != VOX_OK)
+    return __LINE__;
+  wait_for_end(handle);
+  two_ref = total;
+  if (!first_ref || (two_ref <= first_ref))
+    return __LINE__;
+
+  // preempted text: discarded
+  total = 0;
+  if (voxSpeak(handle, LONG_TEXT, voxPriorityText) != VOX_OK)
+    return __LINE__;
+  wait_for_samples(handle);
+  if (voxSpeak(handle, SHORT_TEXT, voxPriorityImportant) != VOX_OK)
+    return __LINE__;
+  wait_for_end(handle);
+  if ((total >= long_ref + short_ref) || (total < short_ref))
+    return __LINE__;
+
+  // preempted message: spoken again
+  total = 0;
+  if (voxSpeak(handle, LONG_TEXT, voxPriorityMessage) != VOX_OK)
+    return __LINE__;
+  wait_for_samples(handle);
+  if (voxSpeak(handle, SHORT_TEXT, voxPriorityImportant) != VOX_OK)
+    return __LINE__;
+  wait_for_end(handle);
+  if (total < long_ref + short_ref)
+    return __LINE__;
+
+  // message preempted in its second sentence: the first one is not
+  // spoken again
+  total = 0;
+  if (voxSpeak(handle, FIRST_SENTENCE SECOND_SENTENCE, voxPriorityMessage) != VOX_OK)
+    return __LINE__;
+  while ((total <= first_ref) && eciSpeaking(handle))
+    usleep(1000);
+  if (voxSpeak(handle, SHORT_TEXT, voxPriorityImportant) != VOX_OK)
+    return __LINE__;
+  wait_for_end(handle);
+  if ((total < two_ref + short_ref) || (total >= two_ref + short_ref + first_ref))
+    return __LINE__;
+
+  // notification: discarded since the engine is busy
+  total = 0;
+  if (voxSpeak(handle, LONG_TEXT, voxPriorityText) != VOX_OK)
+    return __LINE__;
+  if (voxSpeak(handle, SHORT_TEXT, voxPriorityNotification) != VOX_OK)
+    return __LINE__;
+  wait_for_end(handle);
+  if (total != long_ref)
+    return __LINE__;
+
+  // eciStop discards the queue
+  if (voxSpeak(handle, LONG_TEXT, voxPriorityText) != VOX_OK)
+    return __LINE__;
+  if (voxSpeak(handle, LONG_TEXT, voxPriorityText) != VOX_OK)
+    return __LINE__;
+  if (eciStop(handle) == ECIFalse)
+    return __LINE__;
+  wait_for_end(handle);
+
+  if (eciDelete(handle) != NULL)
+    return __LINE__;
+
+  return 0;
+}
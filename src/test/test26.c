@@ -0,0 +1,100 @@
+/*
+  eciSpeaking: answered without voxind before the synthesis and once
+  the callbacks are delivered; true during the synthesis
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "voxin.h"
+
+#define TEST_DBG "/tmp/test_libvoxin.dbg"
+#define MAX_SAMPLES 1024
+#define TEXT "Hello world. This is a long enough sentence to get several buffers."
+#define NB_POLLS 100000
+#define MAX_POLLING_DURATION_NS 500000000 // for NB_POLLS
+
+static short samples[MAX_SAMPLES];
+static long total;
+
+static enum ECICallbackReturn my_callback(ECIHand hEngine, enum ECIMessage Msg, long lParam, void *pData)
+{
+  if (Msg == eciWaveformBuffer)
+    total += lParam;
+  return eciDataProcessed;
+}
+
+// poll_speaking returns the duration in ns of NB_POLLS calls to eciSpeaking,
+// -1 if one of them returns true
+static long poll_speaking(ECIHand handle)
+{
+  struct timespec t0, t1;
+  int i;
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (i=0; i<NB_POLLS; i++) {
+    if (eciSpeaking(handle) == ECITrue)
+      return -1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  return (t1.tv_sec - t0.tv_sec)*1000000000 + t1.tv_nsec - t0.tv_nsec;
+}
+
+int main(int argc, char** argv)
+{
+  ECIHand handle;
+  long duration;
+
+  {
+    struct stat buf;
+    while (!stat(TEST_DBG, &buf)) {
+      sleep(1);
+    }
+  }
+
+  handle = eciNew();
+  if (!handle)
+    return __LINE__;
+
+  eciRegisterCallback(handle, my_callback, NULL);
+  if (eciSetOutputBuffer(handle, MAX_SAMPLES, samples) == ECIFalse)
+    return __LINE__;
+
+  // idle
+  duration = poll_speaking(handle);
+  if ((duration < 0) || (duration > MAX_POLLING_DURATION_NS))
+    return __LINE__;
+
+  // the callbacks are delivered by eciSpeaking
+  if (eciAddText(handle, TEXT) == ECIFalse)
+    return __LINE__;
+  if (eciSynthesize(handle) == ECIFalse)
+    return __LINE__;
+  while (eciSpeaking(handle) == ECITrue)
+    usleep(1000);
+  if (!total)
+    return __LINE__;
+
+  // drained
+  duration = poll_speaking(handle);
+  if ((duration < 0) || (duration > MAX_POLLING_DURATION_NS))
+    return __LINE__;
+
+  // stopped
+  if (eciAddText(handle, TEXT) == ECIFalse)
+    return __LINE__;
+  if (eciSynthesize(handle) == ECIFalse)
+    return __LINE__;
+  if (eciStop(handle) == ECIFalse)
+    return __LINE__;
+  if (poll_speaking(handle) < 0)
+    return __LINE__;
+
+  if (eciDelete(handle) != NULL)
+    return __LINE__;
+
+  return 0;
+}
@@ -0,0 +1,108 @@
+/*
+  Parameters: the values set are read back before and after the
+  synthesis, whether they are sent immediately or deferred; the voice
+  params follow the change of units (eciRealWorldUnits)
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "voxin.h"
+
+#define TEST_DBG "/tmp/test_libvoxin.dbg"
+#define MAX_SAMPLES 1024
+#define TEXT "Hello world."
+
+static short samples[MAX_SAMPLES];
+
+static int speak(ECIHand handle)
+{
+  if (eciAddText(handle, TEXT) == ECIFalse)
+    return __LINE__;
+  if (eciSynthesize(handle) == ECIFalse)
+    return __LINE__;
+  if (eciSynchronize(handle) == ECIFalse)
+    return __LINE__;
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  ECIHand handle;
+  int speed, volume;
+  int i;
+
+  {
+    struct stat buf;
+    while (!stat(TEST_DBG, &buf)) {
+      sleep(1);
+    }
+  }
+
+  handle = eciNew();
+  if (!handle)
+    return __LINE__;
+
+  if (eciSetOutputBuffer(handle, MAX_SAMPLES, samples) == ECIFalse)
+    return __LINE__;
+
+  speed = eciGetVoiceParam(handle, 0, eciSpeed);
+  volume = eciGetVoiceParam(handle, 0, eciVolume);
+  if ((speed < 0) || (volume < 0))
+    return __LINE__;
+
+  // the previous value is returned
+  for (i=0; i<3; i++) {
+    if (eciSetVoiceParam(handle, 0, eciSpeed, 60 + 10*i) != speed)
+      return __LINE__;
+    speed = 60 + 10*i;
+    if (eciSetVoiceParam(handle, 0, eciVolume, 70 + i) != volume)
+      return __LINE__;
+    volume = 70 + i;
+    if (eciGetVoiceParam(handle, 0, eciSpeed) != speed)
+      return __LINE__;
+    if (speak(handle))
+      return __LINE__;
+    if (eciGetVoiceParam(handle, 0, eciVolume) != volume)
+      return __LINE__;
+  }
+
+  // same value set twice
+  if (eciSetVoiceParam(handle, 0, eciSpeed, speed) != speed)
+    return __LINE__;
+
+  if (eciSetParam(handle, eciTextMode, 1) < 0)
+    return __LINE__;
+  if (eciGetParam(handle, eciTextMode) != 1)
+    return __LINE__;
+  if (eciSetParam(handle, eciTextMode, 1) != 1)
+    return __LINE__;
+  if (speak(handle))
+    return __LINE__;
+  if (eciGetParam(handle, eciTextMode) != 1)
+    return __LINE__;
+
+  // pitch baseline in Hertz, above the range in ECI units
+  if (eciGetVoiceParam(handle, 0, eciPitchBaseline) < 0)
+    return __LINE__;
+  if (eciSetParam(handle, eciRealWorldUnits, 1) < 0)
+    return __LINE__;
+  if (eciSetVoiceParam(handle, 0, eciPitchBaseline, 200) < 0)
+    return __LINE__;
+  if (eciGetVoiceParam(handle, 0, eciPitchBaseline) != 200)
+    return __LINE__;
+  if (speak(handle))
+    return __LINE__;
+  if (eciSetParam(handle, eciRealWorldUnits, 0) != 1)
+    return __LINE__;
+  i = eciGetVoiceParam(handle, 0, eciPitchBaseline);
+  if ((i < 0) || (i > 100))
+    return __LINE__;
+
+  if (eciDelete(handle) != NULL)
+    return __LINE__;
+
+  return 0;
+}
@@ -0,0 +1,96 @@
+/*
+  Utterance timeline: the steps of a synthesis are dated in order,
+  the samples are counted and eciStop is acknowledged
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "voxin.h"
+
+#define TEST_DBG "/tmp/test_libvoxin.dbg"
+#define MAX_SAMPLES 1024
+#define TEXT "Hello world. This is a long enough sentence to get several buffers."
+
+static short samples[MAX_SAMPLES];
+static long total;
+
+static enum ECICallbackReturn my_callback(ECIHand hEngine, enum ECIMessage Msg, long lParam, void *pData)
+{
+  if (Msg == eciWaveformBuffer)
+    total += lParam;
+  return eciDataProcessed;
+}
+
+int main(int argc, char** argv)
+{
+  ECIHand handle;
+  voxUtteranceTimeline t;
+
+  {
+    struct stat buf;
+    while (!stat(TEST_DBG, &buf)) {
+      sleep(1);
+    }
+  }
+
+  handle = eciNew();
+  if (!handle)
+    return __LINE__;
+
+  eciRegisterCallback(handle, my_callback, NULL);
+  if (eciSetOutputBuffer(handle, MAX_SAMPLES, samples) == ECIFalse)
+    return __LINE__;
+
+  if (voxGetUtteranceTimeline(handle, NULL) == VOX_OK)
+    return __LINE__;
+
+  if (eciAddText(handle, TEXT) == ECIFalse)
+    return __LINE__;
+  if (eciSynthesize(handle) == ECIFalse)
+    return __LINE__;
+  if (eciSynchronize(handle) == ECIFalse)
+    return __LINE__;
+
+  if (voxGetUtteranceTimeline(handle, &t) != VOX_OK)
+    return __LINE__;
+  if (!t.text_submitted
+      || (t.first_tlv_sent < t.text_submitted)
+      || (t.synthesize < t.first_tlv_sent)
+      || (t.first_audio < t.synthesize)
+      || (t.last_audio < t.first_audio)
+      || (t.end < t.last_audio))
+    return __LINE__;
+  if ((t.nb_samples != total) || !t.sample_rate || !t.nb_messages)
+    return __LINE__;
+  if (!t.ttfa || (t.rtf <= 0) || t.stop_requested || t.stop_latency)
+    return __LINE__;
+  printf("ttfa=%u us, rtf=%.3f, wait=%llu us (max %llu), callback=%llu us (max %llu)\n",
+	 t.ttfa, t.rtf,
+	 (unsigned long long)t.wait_duration, (unsigned long long)t.wait_max,
+	 (unsigned long long)t.callback_duration, (unsigned long long)t.callback_max);
+
+  // new utterance, stopped
+  if (eciAddText(handle, TEXT) == ECIFalse)
+    return __LINE__;
+  if (voxGetUtteranceTimeline(handle, &t) != VOX_OK)
+    return __LINE__;
+  if (t.synthesize || t.nb_samples)
+    return __LINE__;
+  if (eciSynthesize(handle) == ECIFalse)
+    return __LINE__;
+  if (eciStop(handle) == ECIFalse)
+    return __LINE__;
+  if (voxGetUtteranceTimeline(handle, &t) != VOX_OK)
+    return __LINE__;
+  if (!t.stop_requested || (t.stop_honored < t.stop_requested))
+    return __LINE__;
+  printf("stop latency=%u us\n", t.stop_latency);
+
+  if (eciDelete(handle) != NULL)
+    return __LINE__;
+
+  return 0;
+}
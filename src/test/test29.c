@@ -0,0 +1,163 @@
+/*
+  Direct mode (directMode=yes): the eci engine is loaded in the
+  process, no voxind is spawned (voxind-nve may be), the path of
+  eci.ini is given to the engine and the API behaves as with voxind
+  (samples, index, eciSpeaking, eciStop).
+  Requires libvoxind.so installed for the native engine.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "voxin.h"
+
+#define TEST_DBG "/tmp/test_libvoxin.dbg"
+#define TEST_HOME "/tmp/test29"
+#define MAX_SAMPLES 1024
+#define TEXT "Hello world. This is a long enough sentence to get several buffers."
+#define INDEX 29
+
+static short samples[MAX_SAMPLES];
+static long total;
+static long index_reply;
+
+static enum ECICallbackReturn my_callback(ECIHand hEngine, enum ECIMessage Msg, long lParam, void *pData)
+{
+  if (Msg == eciWaveformBuffer)
+    total += lParam;
+  else if (Msg == eciIndexReply)
+    index_reply = lParam;
+  return eciDataProcessed;
+}
+
+// set_config writes a user config enabling the direct mode
+static int set_config()
+{
+  FILE *fd;
+
+  if (setenv("HOME", TEST_HOME, 1))
+    return __LINE__;
+  mkdir(TEST_HOME, 0700);
+  mkdir(TEST_HOME "/.config", 0700);
+  mkdir(TEST_HOME "/.config/voxin", 0700);
+  fd = fopen(TEST_HOME "/.config/voxin/voxin.ini", "w");
+  if (!fd)
+    return __LINE__;
+  fprintf(fd, "[general]\ndirectMode=yes\n");
+  fclose(fd);
+  return 0;
+}
+
+// get_nb_children returns the number of child processes named voxind
+static int get_nb_children()
+{
+  char path[64];
+  char buf[256] = {0};
+  char comm[32];
+  FILE *fd;
+  int nb = 0;
+  char *s;
+
+  snprintf(path, sizeof(path), "/proc/self/task/%d/children", getpid());
+  fd = fopen(path, "r");
+  if (!fd)
+    return -1;
+  if (fgets(buf, sizeof(buf), fd)) {
+    for (s = strtok(buf, " \n"); s; s = strtok(NULL, " \n")) {
+      FILE *fc;
+      snprintf(path, sizeof(path), "/proc/%s/comm", s);
+      fc = fopen(path, "r");
+      if (!fc)
+	continue;
+      if (fgets(comm, sizeof(comm), fc) && !strcmp(comm, "voxind\n"))
+	nb++;
+      fclose(fc);
+    }
+  }
+  fclose(fd);
+  return nb;
+}
+
+int main(int argc, char** argv)
+{
+  ECIHand handle;
+  long ref;
+  int res;
+
+  {
+    struct stat buf;
+    while (!stat(TEST_DBG, &buf)) {
+      sleep(1);
+    }
+  }
+
+  res = set_config();
+  if (res)
+    return res;
+
+  handle = eciNew();
+  if (!handle)
+    return __LINE__;
+
+  if (get_nb_children() != 0)
+    return __LINE__;
+  if (!getenv("ECIINI") || !strstr(getenv("ECIINI"), "/eci.ini"))
+    return __LINE__;
+
+  eciRegisterCallback(handle, my_callback, NULL);
+  if (eciSetOutputBuffer(handle, MAX_SAMPLES, samples) == ECIFalse)
+    return __LINE__;
+
+  if (eciSetVoiceParam(handle, 0, eciSpeed, 70) < 0)
+    return __LINE__;
+  if (eciGetVoiceParam(handle, 0, eciSpeed) != 70)
+    return __LINE__;
+
+  // synchronize
+  if (eciAddText(handle, TEXT) == ECIFalse)
+    return __LINE__;
+  if (eciInsertIndex(handle, INDEX) == ECIFalse)
+    return __LINE__;
+  if (eciSynthesize(handle) == ECIFalse)
+    return __LINE__;
+  if (eciSynchronize(handle) == ECIFalse)
+    return __LINE__;
+  if (!total || (index_reply != INDEX))
+    return __LINE__;
+  ref = total;
+
+  // polling with eciSpeaking
+  total = 0;
+  if (eciAddText(handle, TEXT) == ECIFalse)
+    return __LINE__;
+  if (eciSynthesize(handle) == ECIFalse)
+    return __LINE__;
+  while (eciSpeaking(handle))
+    usleep(1000);
+  if (total != ref)
+    return __LINE__;
+
+  // stop
+  total = 0;
+  if (eciAddText(handle, TEXT) == ECIFalse)
+    return __LINE__;
+  if (eciSynthesize(handle) == ECIFalse)
+    return __LINE__;
+  if (eciStop(handle) == ECIFalse)
+    return __LINE__;
+  if (eciSpeaking(handle))
+    return __LINE__;
+
+  if (eciDelete(handle) != NULL)
+    return __LINE__;
+
+  if (get_nb_children() != 0)
+    return __LINE__;
+  if (!getenv("ECIINI") || !strstr(getenv("ECIINI"), "/eci.ini"))
+    return __LINE__;
+
+  return 0;
+}
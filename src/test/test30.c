@@ -0,0 +1,148 @@
+/*
+  voxind broker (broker=yes): two processes speak at the same time,
+  each one served by its own worker of the broker (no voxind spawned
+  by the processes)
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "voxin.h"
+
+#define TEST_DBG "/tmp/test_libvoxin.dbg"
+#define TEST_HOME "/tmp/test30"
+#define MAX_SAMPLES 1024
+#define TEXT "Hello world. This is a long enough sentence to get several buffers."
+#define INDEX 30
+
+static short samples[MAX_SAMPLES];
+static long total;
+static long index_reply;
+
+static enum ECICallbackReturn my_callback(ECIHand hEngine, enum ECIMessage Msg, long lParam, void *pData)
+{
+  if (Msg == eciWaveformBuffer)
+    total += lParam;
+  else if (Msg == eciIndexReply)
+    index_reply = lParam;
+  return eciDataProcessed;
+}
+
+// set_config writes a user config enabling the broker
+static int set_config()
+{
+  FILE *fd;
+
+  if (setenv("HOME", TEST_HOME, 1))
+    return __LINE__;
+  mkdir(TEST_HOME, 0700);
+  mkdir(TEST_HOME "/.config", 0700);
+  mkdir(TEST_HOME "/.config/voxin", 0700);
+  fd = fopen(TEST_HOME "/.config/voxin/voxin.ini", "w");
+  if (!fd)
+    return __LINE__;
+  fprintf(fd, "[general]\nbroker=yes\n");
+  fclose(fd);
+  return 0;
+}
+
+// get_nb_children returns the number of child processes
+static int get_nb_children()
+{
+  char path[64];
+  char buf[256] = {0};
+  FILE *fd;
+  int nb = 0;
+  char *s;
+
+  snprintf(path, sizeof(path), "/proc/self/task/%d/children", getpid());
+  fd = fopen(path, "r");
+  if (!fd)
+    return -1;
+  if (fgets(buf, sizeof(buf), fd)) {
+    for (s = strtok(buf, " \n"); s; s = strtok(NULL, " \n"))
+      nb++;
+  }
+  fclose(fd);
+  return nb;
+}
+
+// speak returns 0 or the line of the error; nb_children: expected
+// number of child processes
+static int speak(int nb_children)
+{
+  ECIHand handle;
+  long ref;
+  int i;
+
+  handle = eciNew();
+  if (!handle)
+    return __LINE__;
+
+  if (get_nb_children() != nb_children)
+    return __LINE__;
+
+  eciRegisterCallback(handle, my_callback, NULL);
+  if (eciSetOutputBuffer(handle, MAX_SAMPLES, samples) == ECIFalse)
+    return __LINE__;
+
+  for (i=0; i<10; i++) {
+    total = 0;
+    index_reply = 0;
+    if (eciAddText(handle, TEXT) == ECIFalse)
+      return __LINE__;
+    if (eciInsertIndex(handle, INDEX) == ECIFalse)
+      return __LINE__;
+    if (eciSynthesize(handle) == ECIFalse)
+      return __LINE__;
+    if (eciSynchronize(handle) == ECIFalse)
+      return __LINE__;
+    if (!total || (index_reply != INDEX))
+      return __LINE__;
+    if (!i)
+      ref = total;
+    else if (total != ref)
+      return __LINE__;
+  }
+
+  if (eciDelete(handle) != NULL)
+    return __LINE__;
+
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  pid_t pid;
+  int status;
+  int res;
+
+  {
+    struct stat buf;
+    while (!stat(TEST_DBG, &buf)) {
+      sleep(1);
+    }
+  }
+
+  res = set_config();
+  if (res)
+    return res;
+
+  pid = fork();
+  if (pid == -1)
+    return __LINE__;
+  if (!pid)
+    exit(speak(0));
+
+  res = speak(1);
+  if (res)
+    return res;
+
+  if ((waitpid(pid, &status, 0) != pid) || !WIFEXITED(status))
+    return __LINE__;
+  return WEXITSTATUS(status);
+}
@@ -0,0 +1,140 @@
+/*
+  Tempo: with VOX_TEMPO=200, about half the samples are supplied to
+  the callback, by buffers not exceeding the output buffer, and the
+  index is still received, not before the samples preceding it; a
+  buffer not processed by the callback is supplied again; 100
+  restores the initial number of samples.
+  The debug builds check the vectorized correlation (SSE2, NEON) of
+  the time-stretch on full scale samples: VOX_TEMPO has no effect if
+  it fails.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "voxin.h"
+
+#define TEST_DBG "/tmp/test_libvoxin.dbg"
+#define MAX_SAMPLES 1024
+#define TEXT "Hello world. This is a long enough sentence to get several buffers."
+#define INDEX 31
+#define SLACK 128 // samples, cross-fade of the time-stretch
+
+static short samples[MAX_SAMPLES];
+static long total;
+static long max_buffer; // greatest number of samples of a buffer
+static long index_reply;
+static long index_at; // samples received before the index
+static int busy; // each buffer is first not processed
+static int refused;
+
+static enum ECICallbackReturn my_callback(ECIHand hEngine, enum ECIMessage Msg, long lParam, void *pData)
+{
+  if (Msg == eciWaveformBuffer) {
+    if (busy && !refused) {
+      refused = 1;
+      return eciDataNotProcessed;
+    }
+    refused = 0;
+    total += lParam;
+    if (lParam > max_buffer)
+      max_buffer = lParam;
+  } else if (Msg == eciIndexReply) {
+    index_reply = lParam;
+    index_at = total;
+  }
+  return eciDataProcessed;
+}
+
+static int speak(ECIHand handle)
+{
+  total = max_buffer = index_reply = index_at = 0;
+  if (eciAddText(handle, TEXT) == ECIFalse)
+    return __LINE__;
+  if (eciInsertIndex(handle, INDEX) == ECIFalse)
+    return __LINE__;
+  if (eciAddText(handle, TEXT) == ECIFalse)
+    return __LINE__;
+  if (eciSynthesize(handle) == ECIFalse)
+    return __LINE__;
+  if (eciSynchronize(handle) == ECIFalse)
+    return __LINE__;
+  if (index_reply != INDEX)
+    return __LINE__;
+  if (max_buffer > MAX_SAMPLES)
+    return __LINE__;
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  ECIHand handle;
+  long total_ref;
+  long index_ref;
+  long total_tempo;
+  int res;
+
+  {
+    struct stat buf;
+    while (!stat(TEST_DBG, &buf)) {
+      sleep(1);
+    }
+  }
+
+  handle = eciNew();
+  if (!handle)
+    return __LINE__;
+
+  eciRegisterCallback(handle, my_callback, NULL);
+  if (eciSetOutputBuffer(handle, MAX_SAMPLES, samples) == ECIFalse)
+    return __LINE__;
+
+  res = speak(handle);
+  if (res)
+    return res;
+  total_ref = total;
+  index_ref = index_at;
+  if (!total_ref || !index_ref)
+    return __LINE__;
+
+  if (voxSetParam(handle, VOX_TEMPO, VOX_TEMPO_MAX + 1) != VOX_PARAM_OUT_OF_RANGE)
+    return __LINE__;
+  if (voxSetParam(handle, VOX_TEMPO, 200) != VOX_TEMPO_DEFAULT)
+    return __LINE__;
+
+  res = speak(handle);
+  if (res)
+    return res;
+  if ((total < 4*total_ref/10) || (total > 6*total_ref/10))
+    return __LINE__;
+  // same relative position as without tempo, at most one buffer late
+  if ((index_at*total_ref < index_ref*total - SLACK*total_ref)
+      || (index_at*total_ref > index_ref*total + (MAX_SAMPLES + SLACK)*total_ref))
+    return __LINE__;
+  total_tempo = total;
+
+  // the buffers not processed are not lost
+  busy = 1;
+  res = speak(handle);
+  busy = 0;
+  if (res)
+    return res;
+  if (total != total_tempo)
+    return __LINE__;
+
+  if (voxSetParam(handle, VOX_TEMPO, VOX_TEMPO_DEFAULT) != 200)
+    return __LINE__;
+
+  res = speak(handle);
+  if (res)
+    return res;
+  if (total != total_ref)
+    return __LINE__;
+
+  if (eciDelete(handle) != NULL)
+    return __LINE__;
+
+  return 0;
+}
@@ -0,0 +1,165 @@
+/*
+  Silence trimming: with VOX_TRIM_SILENCE, the leading and trailing
+  silence is shortened (fewer samples, first buffer not silent), a
+  margin is kept even if the leading silence spans several buffers,
+  the index is still received, a buffer not processed by the
+  callback is supplied again; 0 restores the initial number of
+  samples
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "voxin.h"
+
+#define TEST_DBG "/tmp/test_libvoxin.dbg"
+#define MAX_SAMPLES 1024
+#define TEXT "Hello world. This is a long enough sentence to get several buffers."
+#define INDEX 32
+#define THRESHOLD 64
+#define MARGIN 1024 // silent samples accepted at the beginning
+#define MARGIN_MS 10 // silence kept at the beginning
+#define SMALL_SAMPLES 64 // output buffer shorter than the leading silence
+
+static short samples[MAX_SAMPLES];
+static const long rate[] = {8000, 11025, 22050}; // eciSampleRate
+static long total;
+static long leading; // silent samples before the first loud one
+static int loud; // a loud sample has been received
+static long index_reply;
+static int busy; // each buffer is first not processed
+static int refused;
+
+static enum ECICallbackReturn my_callback(ECIHand hEngine, enum ECIMessage Msg, long lParam, void *pData)
+{
+  if (Msg == eciWaveformBuffer) {
+    int i;
+    if (busy && !refused) {
+      refused = 1;
+      return eciDataNotProcessed;
+    }
+    refused = 0;
+    for (i=0; (i<lParam) && !loud; i++) {
+      if ((samples[i] > THRESHOLD) || (samples[i] < -THRESHOLD))
+	loud = 1;
+      else
+	leading++;
+    }
+    total += lParam;
+  } else if (Msg == eciIndexReply) {
+    index_reply = lParam;
+  }
+  return eciDataProcessed;
+}
+
+static int speak(ECIHand handle)
+{
+  total = leading = loud = index_reply = 0;
+  if (eciAddText(handle, TEXT) == ECIFalse)
+    return __LINE__;
+  if (eciInsertIndex(handle, INDEX) == ECIFalse)
+    return __LINE__;
+  if (eciAddText(handle, TEXT) == ECIFalse)
+    return __LINE__;
+  if (eciSynthesize(handle) == ECIFalse)
+    return __LINE__;
+  if (eciSynchronize(handle) == ECIFalse)
+    return __LINE__;
+  if (index_reply != INDEX)
+    return __LINE__;
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  ECIHand handle;
+  long total_ref;
+  long total_trim;
+  long margin;
+  int res;
+
+  {
+    struct stat buf;
+    while (!stat(TEST_DBG, &buf)) {
+      sleep(1);
+    }
+  }
+
+  handle = eciNew();
+  if (!handle)
+    return __LINE__;
+
+  eciRegisterCallback(handle, my_callback, NULL);
+  if (eciSetOutputBuffer(handle, MAX_SAMPLES, samples) == ECIFalse)
+    return __LINE__;
+
+  res = speak(handle);
+  if (res)
+    return res;
+  total_ref = total;
+  if (!total_ref)
+    return __LINE__;
+
+  if (voxSetParam(handle, VOX_TRIM_SILENCE, -1) != VOX_PARAM_OUT_OF_RANGE)
+    return __LINE__;
+  if (voxSetParam(handle, VOX_TRIM_SILENCE, THRESHOLD) != 0)
+    return __LINE__;
+
+  res = speak(handle);
+  if (res)
+    return res;
+  if (!total || (total > total_ref) || (leading > MARGIN))
+    return __LINE__;
+  total_trim = total;
+
+  // the buffers not processed are not lost
+  busy = 1;
+  res = speak(handle);
+  busy = 0;
+  if (res)
+    return res;
+  if (total != total_trim)
+    return __LINE__;
+
+  // leading silence over several buffers
+  res = eciGetParam(handle, eciSampleRate);
+  if ((res < 0) || (res > 2))
+    return __LINE__;
+  margin = rate[res]*MARGIN_MS/1000;
+  if (eciSetOutputBuffer(handle, SMALL_SAMPLES, samples) == ECIFalse)
+    return __LINE__;
+  res = speak(handle);
+  if (res)
+    return res;
+  if ((leading < margin) || (leading > MARGIN))
+    return __LINE__;
+  if (eciSetOutputBuffer(handle, MAX_SAMPLES, samples) == ECIFalse)
+    return __LINE__;
+
+  // trimmed then time-stretched
+  if (voxSetParam(handle, VOX_TEMPO, 200) == VOX_PARAM_OUT_OF_RANGE)
+    return __LINE__;
+  res = speak(handle);
+  if (res)
+    return res;
+  if (!total || (total > 6*total_ref/10))
+    return __LINE__;
+  if (voxSetParam(handle, VOX_TEMPO, VOX_TEMPO_DEFAULT) == VOX_PARAM_OUT_OF_RANGE)
+    return __LINE__;
+
+  if (voxSetParam(handle, VOX_TRIM_SILENCE, 0) != THRESHOLD)
+    return __LINE__;
+
+  res = speak(handle);
+  if (res)
+    return res;
+  if (total != total_ref)
+    return __LINE__;
+
+  if (eciDelete(handle) != NULL)
+    return __LINE__;
+
+  return 0;
+}
@@ -0,0 +1,172 @@
+/*
+  Incremental synthesis (VOX_INCREMENTAL=1): a text of several
+  sentences with indices is synthesized sentence by sentence; the
+  indices are received in order (eciSynchronize and eciSpeaking); a
+  callback returning eciDataAbort discards the sentences not yet
+  synthesized, as eciStop
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "voxin.h"
+
+#define TEST_DBG "/tmp/test_libvoxin.dbg"
+#define MAX_SAMPLES 1024
+#define TEXT1 "Hello world. This is the first paragraph, with two sentences. "
+#define TEXT2 "And a second paragraph! Is it the last one? Yes, it is."
+#define MAX_INDEX 8
+
+static short samples[MAX_SAMPLES];
+static long total;
+static int nb_buffers;
+static int index_reply[MAX_INDEX];
+static int nb_index;
+static int abort_at_first_buffer;
+
+static enum ECICallbackReturn my_callback(ECIHand hEngine, enum ECIMessage Msg, long lParam, void *pData)
+{
+  if (Msg == eciWaveformBuffer) {
+    total += lParam;
+    nb_buffers++;
+    if (abort_at_first_buffer)
+      return eciDataAbort;
+  } else if ((Msg == eciIndexReply) && (nb_index < MAX_INDEX)) {
+    index_reply[nb_index++] = lParam;
+  }
+  return eciDataProcessed;
+}
+
+static int add_input(ECIHand handle)
+{
+  total = nb_buffers = nb_index = 0;
+  if (eciInsertIndex(handle, 1) == ECIFalse)
+    return __LINE__;
+  if (eciAddText(handle, TEXT1) == ECIFalse)
+    return __LINE__;
+  if (eciInsertIndex(handle, 2) == ECIFalse)
+    return __LINE__;
+  if (eciAddText(handle, TEXT2) == ECIFalse)
+    return __LINE__;
+  if (eciInsertIndex(handle, 3) == ECIFalse)
+    return __LINE__;
+  if (eciSynthesize(handle) == ECIFalse)
+    return __LINE__;
+  return 0;
+}
+
+static int check_index()
+{
+  int i;
+  if (nb_index != 3)
+    return __LINE__;
+  for (i=0; i<nb_index; i++) {
+    if (index_reply[i] != i+1)
+      return __LINE__;
+  }
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  ECIHand handle;
+  long total_ref;
+  int res;
+
+  {
+    struct stat buf;
+    while (!stat(TEST_DBG, &buf)) {
+      sleep(1);
+    }
+  }
+
+  handle = eciNew();
+  if (!handle)
+    return __LINE__;
+
+  eciRegisterCallback(handle, my_callback, NULL);
+  if (eciSetOutputBuffer(handle, MAX_SAMPLES, samples) == ECIFalse)
+    return __LINE__;
+
+  // reference
+  res = add_input(handle);
+  if (res)
+    return res;
+  if (eciSynchronize(handle) == ECIFalse)
+    return __LINE__;
+  res = check_index();
+  if (res)
+    return res;
+  total_ref = total;
+
+  if (voxSetParam(handle, VOX_INCREMENTAL, 2) != VOX_PARAM_OUT_OF_RANGE)
+    return __LINE__;
+  if (voxSetParam(handle, VOX_INCREMENTAL, 1) != 0)
+    return __LINE__;
+
+  // synchronize
+  res = add_input(handle);
+  if (res)
+    return res;
+  if (eciSynchronize(handle) == ECIFalse)
+    return __LINE__;
+  res = check_index();
+  if (res)
+    return res;
+  if (!total)
+    return __LINE__;
+  total_ref = total;
+
+  // polling with eciSpeaking
+  res = add_input(handle);
+  if (res)
+    return res;
+  while (eciSpeaking(handle))
+    usleep(1000);
+  res = check_index();
+  if (res)
+    return res;
+  if (total != total_ref)
+    return __LINE__;
+
+  // aborted utterance: the next sentences are discarded
+  abort_at_first_buffer = 1;
+  res = add_input(handle);
+  if (res)
+    return res;
+  if (eciSynchronize(handle) == ECIFalse)
+    return __LINE__;
+  abort_at_first_buffer = 0;
+  if (nb_buffers != 1)
+    return __LINE__;
+  if (eciSpeaking(handle))
+    return __LINE__;
+  if (nb_index == 3)
+    return __LINE__;
+
+  // stopped utterance
+  res = add_input(handle);
+  if (res)
+    return res;
+  if (eciStop(handle) == ECIFalse)
+    return __LINE__;
+  if (eciSpeaking(handle))
+    return __LINE__;
+
+  // index and text after the stop
+  res = add_input(handle);
+  if (res)
+    return res;
+  if (eciSynchronize(handle) == ECIFalse)
+    return __LINE__;
+  res = check_index();
+  if (res)
+    return res;
+
+  if (eciDelete(handle) != NULL)
+    return __LINE__;
+
+  return 0;
+}
@@ -0,0 +1,165 @@
+/*
+  Parallel rendering (voxRenderDocument): a document of several
+  chunks rendered with 1 and 4 jobs supplies the same samples in the
+  same order, about as many as eciAddText, eciSynthesize and
+  eciSynchronize; a document with ECI annotations is not split (same
+  samples); the params are applied to each engine; the sink aborts
+  the rendering
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "voxin.h"
+
+#define TEST_DBG "/tmp/test_libvoxin.dbg"
+#define NB_SENTENCES 120
+#define TEXT_MAX (NB_SENTENCES*64)
+#define MAX_SAMPLES 1024
+#define ANNOTATION "`vs50 "
+
+static char text[TEXT_MAX];
+static short samples[MAX_SAMPLES];
+
+struct result_t {
+  long total;
+  uint32_t sum; // depends on the order of the samples
+  int calls;
+  int abort_at; // call aborting the rendering, 0 = none
+};
+
+static int my_sink(const short *samples, unsigned int nb, void *data)
+{
+  struct result_t *r = data;
+  unsigned int i;
+
+  for (i=0; i<nb; i++)
+    r->sum = 31*r->sum + (uint16_t)samples[i];
+  r->total += nb;
+  r->calls++;
+  return (r->calls == r->abort_at);
+}
+
+static int render(struct result_t *r, const int *params, unsigned int jobs)
+{
+  int abort_at = r->abort_at;
+  memset(r, 0, sizeof(*r));
+  r->abort_at = abort_at;
+  return voxRenderDocument(text, strlen(text), 0, params, my_sink, r, jobs);
+}
+
+static enum ECICallbackReturn my_callback(ECIHand hEngine, enum ECIMessage Msg, long lParam, void *pData)
+{
+  if (Msg == eciWaveformBuffer)
+    my_sink(samples, lParam, pData);
+  return eciDataProcessed;
+}
+
+// render_plain synthesizes the whole text with a single engine
+static int render_plain(struct result_t *r)
+{
+  ECIHand handle;
+
+  memset(r, 0, sizeof(*r));
+  handle = eciNew();
+  if (!handle)
+    return __LINE__;
+  eciRegisterCallback(handle, my_callback, r);
+  if (eciSetOutputBuffer(handle, MAX_SAMPLES, samples) == ECIFalse)
+    return __LINE__;
+  if ((eciAddText(handle, text) == ECIFalse)
+      || (eciSynthesize(handle) == ECIFalse)
+      || (eciSynchronize(handle) == ECIFalse))
+    return __LINE__;
+  if (eciDelete(handle) != NULL)
+    return __LINE__;
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  struct result_t ref, r, plain;
+  int params[VOX_NUM_PARAMS];
+  size_t len = 0;
+  int i;
+  int res;
+
+  {
+    struct stat buf;
+    while (!stat(TEST_DBG, &buf)) {
+      sleep(1);
+    }
+  }
+
+  for (i=0; i<NB_SENTENCES; i++) {
+    len += snprintf(text + len, TEXT_MAX - len,
+		    "This is the sentence number %d of the document. ", i);
+  }
+
+  if (voxRenderDocument(text, len, 0, NULL, NULL, NULL, 1) != VOX_PARAM_OUT_OF_RANGE)
+    return __LINE__;
+
+  memset(&ref, 0, sizeof(ref));
+  if (render(&ref, NULL, 1) != VOX_OK)
+    return __LINE__;
+  if (!ref.total || (ref.calls < 2))
+    return __LINE__;
+
+  memset(&r, 0, sizeof(r));
+  if (render(&r, NULL, 4) != VOX_OK)
+    return __LINE__;
+  if ((r.total != ref.total) || (r.sum != ref.sum) || (r.calls != ref.calls))
+    return __LINE__;
+
+  // the pauses may differ between the chunks of the document
+  res = render_plain(&plain);
+  if (res)
+    return res;
+  if (!plain.total || (labs(ref.total - plain.total) > plain.total/20))
+    return __LINE__;
+
+  // number of processors
+  if (render(&r, NULL, 0) != VOX_OK)
+    return __LINE__;
+  if ((r.total != ref.total) || (r.sum != ref.sum))
+    return __LINE__;
+
+  // params
+  for (i=0; i<VOX_NUM_PARAMS; i++)
+    params[i] = -1;
+  params[VOX_TEMPO] = 200;
+  if (render(&r, params, 4) != VOX_OK)
+    return __LINE__;
+  if (!r.total || (r.total > 6*ref.total/10))
+    return __LINE__;
+
+  // aborted by the sink
+  r.abort_at = 1;
+  if (render(&r, NULL, 4) != VOX_PARAM_OUT_OF_RANGE)
+    return __LINE__;
+  if (r.calls != 1)
+    return __LINE__;
+
+  // annotated document: a single chunk
+  r.abort_at = 0;
+  memcpy(text, ANNOTATION, strlen(ANNOTATION));
+  res = render_plain(&plain);
+  if (res)
+    return res;
+  if (render(&r, NULL, 4) != VOX_OK)
+    return __LINE__;
+  if ((r.total != plain.total) || (r.sum != plain.sum))
+    return __LINE__;
+
+  // empty document
+  *text = 0;
+  if (render(&r, NULL, 4) != VOX_OK)
+    return __LINE__;
+  if (r.calls)
+    return __LINE__;
+
+  return 0;
+}
@@ -0,0 +1,84 @@
+/*
+  Memory accounting (voxGetMemory): an idle engine takes a few bytes
+  in libvoxin and voxind; the buffers of voxind are counted once the
+  engine synthesizes; a second engine adds to the totals
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "voxin.h"
+
+#define TEST_DBG "/tmp/test_libvoxin.dbg"
+#define MAX_SAMPLES 1024
+#define TEXT "Hello world."
+#define IDLE_MAX 4096 // bytes of an idle engine
+
+static short samples[MAX_SAMPLES];
+
+static enum ECICallbackReturn my_callback(ECIHand hEngine, enum ECIMessage Msg, long lParam, void *pData)
+{
+  return eciDataProcessed;
+}
+
+int main(int argc, char** argv)
+{
+  ECIHand handle, handle2;
+  voxMemory idle, m;
+
+  {
+    struct stat buf;
+    while (!stat(TEST_DBG, &buf)) {
+      sleep(1);
+    }
+  }
+
+  handle = eciNew();
+  if (!handle)
+    return __LINE__;
+
+  eciRegisterCallback(handle, my_callback, NULL);
+  if (eciSetOutputBuffer(handle, MAX_SAMPLES, samples) == ECIFalse)
+    return __LINE__;
+
+  if (voxGetMemory(handle, NULL) == VOX_OK)
+    return __LINE__;
+  if (voxGetMemory(handle, &idle) != VOX_OK)
+    return __LINE__;
+  if (!idle.libvoxin || (idle.libvoxin > IDLE_MAX)
+      || !idle.voxind || (idle.voxind > IDLE_MAX))
+    return __LINE__;
+  if ((idle.libvoxin_engines < idle.libvoxin) || (idle.voxind_engines < idle.voxind))
+    return __LINE__;
+
+  // the output buffers of voxind are allocated by the synthesis
+  if (eciAddText(handle, TEXT) == ECIFalse)
+    return __LINE__;
+  if (eciSynthesize(handle) == ECIFalse)
+    return __LINE__;
+  if (eciSynchronize(handle) == ECIFalse)
+    return __LINE__;
+  if (voxGetMemory(handle, &m) != VOX_OK)
+    return __LINE__;
+  if ((m.voxind < idle.voxind + 2*MAX_SAMPLES) || (m.voxind_engines < m.voxind))
+    return __LINE__;
+
+  // a second engine
+  handle2 = eciNew();
+  if (!handle2)
+    return __LINE__;
+  if (voxGetMemory(handle2, &idle) != VOX_OK)
+    return __LINE__;
+  if ((idle.voxind_engines < m.voxind + idle.voxind)
+      || (idle.libvoxin_engines < m.libvoxin + idle.libvoxin))
+    return __LINE__;
+
+  if (eciDelete(handle2) != NULL)
+    return __LINE__;
+  if (eciDelete(handle) != NULL)
+    return __LINE__;
+
+  return 0;
+}
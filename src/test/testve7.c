@@ -0,0 +1,104 @@
+// switch many times between an IBM TTS voice and a Vocalizer Embedded
+// voice; the voice parameters, including those of a preset voice,
+// must follow the switches
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include "voxin.h"
+
+#define TEST_DBG "/tmp/test_libvoxin.dbg"
+#define MAX_SAMPLES 1024
+#define MAX_SWITCHES 20
+
+static short my_samples[MAX_SAMPLES];
+
+enum ECICallbackReturn my_client_callback(ECIHand hEngine, enum ECIMessage Msg, long lParam, void *pData)
+{
+  int *fd = (int *)pData;
+
+  if (fd && (Msg == eciWaveformBuffer))
+    {
+	  write(*fd, my_samples, 2*lParam);
+    }
+  return eciDataProcessed;
+}
+
+int main(int argc, char** argv)
+{
+  enum {NB_VOICES=30};
+  vox_t list[NB_VOICES];
+  unsigned int nbVoices = NB_VOICES;
+  uint32_t id_eci = 0;
+  uint32_t id_nve = 0;
+  int fd;
+  int i;
+
+  {
+    struct stat buf;
+    while (!stat(TEST_DBG, &buf)) {
+      sleep(1);
+    }
+  }
+
+  if (voxGetVoices(list, &nbVoices))
+    return __LINE__;
+
+  for (i=0; i<nbVoices; i++) {
+	vox_t *v = list+i;
+	if (strcmp(v->lang, "en"))
+	  continue;
+	if (v->id <= VOX_LAST_ECI_VOICE)
+	  id_eci = v->id;
+	else
+	  id_nve = v->id;
+  }
+
+  if (!id_eci || !id_nve)
+	return __LINE__;
+
+  fd = creat(PATHNAME_RAW_DATA, S_IRUSR|S_IWUSR);
+  if (fd == -1)
+    return __LINE__;
+
+  ECIHand handle = eciNewEx(id_eci);
+  if (!handle)
+	return __LINE__;
+
+  eciRegisterCallback(handle, my_client_callback, &fd);
+  if (eciSetOutputBuffer(handle, MAX_SAMPLES, my_samples) == ECIFalse)
+    return __LINE__;
+
+  eciSetVoiceParam(handle, 0, eciSpeed, 80);
+  eciSetVoiceParam(handle, 1, eciPitchBaseline, 60);
+
+  for (i=0; i<MAX_SWITCHES; i++) {
+	int speed = 50 + i;
+	if (voxSetParam(handle, VOX_LANGUAGE_DIALECT, (i&1) ? id_nve : id_eci) < 0)
+	  return __LINE__;
+	if (eciGetParam(handle, eciLanguageDialect) != ((i&1) ? id_nve : id_eci))
+	  return __LINE__;
+	if (eciGetVoiceParam(handle, 0, eciSpeed) != (i ? speed - 1 : 80))
+	  return __LINE__;
+	if (eciGetVoiceParam(handle, 1, eciPitchBaseline) != (i ? 60 + i - 1 : 60))
+	  return __LINE__;
+	eciSetVoiceParam(handle, 1, eciPitchBaseline, 60 + i);
+	eciSetVoiceParam(handle, 0, eciSpeed, speed);
+	if (eciAddText(handle, "hello world") == ECIFalse)
+	  return __LINE__;
+	if (eciSynthesize(handle) == ECIFalse)
+	  return __LINE__;
+	if (eciSynchronize(handle) == ECIFalse)
+	  return __LINE__;
+  }
+
+  if (eciDelete(handle) != NULL)
+	return __LINE__;
+
+  close(fd);
+  return 0;
+}
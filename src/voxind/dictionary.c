@@ -0,0 +1,222 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "debug.h"
+#include "dictionary.h"
+
+#define DICTIONARY_VOLUMES 4
+
+// file name of each volume (enum ECIDictVolume)
+static const char *dictionary_files[DICTIONARY_VOLUMES] = {
+  "main.dct",
+  "root.dct",
+  "abbreviation.dct",
+  "extension.dct"
+};
+
+struct entry_t {
+  char *key;
+  char *value; // in the allocation of key
+};
+
+struct volume_t {
+  bool cached; // the entries of the file are cached
+  struct timespec mtime;
+  off_t size;
+  ino_t ino;
+  struct entry_t *entry;
+  size_t nb; // number of entries
+  size_t max; // number of allocated entries
+};
+
+struct dictionary_t {
+  char *dir;
+  struct volume_t volume[DICTIONARY_VOLUMES];
+  struct dictionary_t *next;
+};
+
+static struct dictionary_t *dictionaries;
+
+static void volume_clear(struct volume_t *self)
+{
+  int i;
+  for (i=0; i<self->nb; i++) {
+    free(self->entry[i].key);
+  }
+  free(self->entry);
+  memset(self, 0, sizeof(*self));
+}
+
+static bool volume_is_modified(struct volume_t *self, struct stat *buf)
+{
+  return (!self->cached
+	  || (self->size != buf->st_size)
+	  || (self->ino != buf->st_ino)
+	  || (self->mtime.tv_sec != buf->st_mtim.tv_sec)
+	  || (self->mtime.tv_nsec != buf->st_mtim.tv_nsec));
+}
+
+static int volume_add(struct volume_t *self, const char *key, const char *value)
+{
+  struct entry_t *e;
+  size_t key_len = strlen(key) + 1;
+  size_t value_len = strlen(value) + 1;
+
+  if (self->nb >= self->max) {
+    size_t max = 2*self->max + 64;
+    e = realloc(self->entry, max*sizeof(*e));
+    if (!e)
+      return ENOMEM;
+    self->entry = e;
+    self->max = max;
+  }
+
+  e = self->entry + self->nb;
+  e->key = malloc(key_len + value_len);
+  if (!e->key)
+    return ENOMEM;
+  e->value = e->key + key_len;
+  memcpy(e->key, key, key_len);
+  memcpy(e->value, value, value_len);
+  self->nb++;
+  return 0;
+}
+
+// volume_read caches the entries of the volume loaded in dict
+static void volume_read(struct volume_t *self, ECIHand handle, ECIDictHand dict, enum ECIDictVolume vol, struct stat *buf)
+{
+  ECIInputText key = NULL;
+  ECIInputText value = NULL;
+  enum ECIDictError res;
+
+  volume_clear(self);
+  res = eciDictFindFirst(handle, dict, vol, &key, &value);
+  while (res == DictNoError) {
+    if (volume_add(self, key, value)) {
+      err("mem error");
+      volume_clear(self);
+      return;
+    }
+    res = eciDictFindNext(handle, dict, vol, &key, &value);
+  }
+
+  self->cached = true;
+  self->mtime = buf->st_mtim;
+  self->size = buf->st_size;
+  self->ino = buf->st_ino;
+  dbg("volume=%d, entries=%lu", vol, (long unsigned int)self->nb);
+}
+
+// volume_copy adds the cached entries to dict
+static enum ECIDictError volume_copy(struct volume_t *self, ECIHand handle, ECIDictHand dict, enum ECIDictVolume vol)
+{
+  enum ECIDictError res = DictNoError;
+  int i;
+
+  for (i=0; (i<self->nb) && (res == DictNoError); i++) {
+    res = eciUpdateDict(handle, dict, vol, self->entry[i].key, self->entry[i].value);
+  }
+  dbg("volume=%d, entries=%d, res=%d", vol, i, res);
+  return res;
+}
+
+// dictionary_get returns the cache of this directory, created if needed
+static struct dictionary_t *dictionary_get(const char *dir)
+{
+  struct dictionary_t *self;
+
+  for (self = dictionaries; self; self = self->next) {
+    if (!strcmp(self->dir, dir))
+      return self;
+  }
+
+  self = calloc(1, sizeof(*self));
+  if (!self)
+    return NULL;
+  self->dir = strdup(dir);
+  if (!self->dir) {
+    free(self);
+    return NULL;
+  }
+  self->next = dictionaries;
+  dictionaries = self;
+  return self;
+}
+
+enum ECIDictError dictionary_load(ECIHand handle, const char *dir)
+{
+  struct dictionary_t *self;
+  ECIDictHand dict = NULL_DICT_HAND;
+  ECIDictHand old_dict = NULL_DICT_HAND;
+  enum ECIDictError res = DictNoError;
+  char *pathname = NULL;
+  bool loaded = false;
+  int i;
+
+  ENTER();
+
+  if (!handle || !dir || !*dir)
+    return DictFileNotFound;
+
+  self = dictionary_get(dir);
+  if (!self)
+    return DictOutOfMemory;
+
+  dict = eciNewDict(handle);
+  if (!dict)
+    return DictOutOfMemory;
+
+  for (i=0; i<DICTIONARY_VOLUMES; i++) {
+    struct volume_t *v = self->volume + i;
+    struct stat buf;
+
+    if (asprintf(&pathname, "%s/%s", dir, dictionary_files[i]) == -1) {
+      res = DictOutOfMemory;
+      goto exit0;
+    }
+
+    if (stat(pathname, &buf) || !S_ISREG(buf.st_mode)) {
+      if (v->cached) {
+	dbg("removed: %s", pathname);
+	volume_clear(v);
+      }
+    } else if (volume_is_modified(v, &buf)) {
+      // parse the file and cache its entries
+      volume_clear(v);
+      if (eciLoadDict(handle, dict, i, pathname) == DictNoError) {
+	volume_read(v, handle, dict, i, &buf);
+	loaded = true;
+      } else {
+	err("load error: %s", pathname);
+      }
+    } else if (v->nb && (volume_copy(v, handle, dict, i) == DictNoError)) {
+      loaded = true;
+    }
+
+    free(pathname);
+    pathname = NULL;
+  }
+
+  if (!loaded) {
+    res = DictFileNotFound;
+    goto exit0;
+  }
+
+  old_dict = eciGetDict(handle);
+  res = eciSetDict(handle, dict);
+  if (res == DictNoError) {
+    dict = NULL_DICT_HAND;
+    if (old_dict)
+      eciDeleteDict(handle, old_dict);
+  }
+
+ exit0:
+  if (dict)
+    eciDeleteDict(handle, dict);
+  dbg("LEAVE, dir=%s, res=%d", dir, res);
+  return res;
+}
@@ -0,0 +1,21 @@
+#ifndef DICTIONARY_H
+#define DICTIONARY_H
+
+#include "eci.h"
+
+/*
+  User dictionaries of a directory: main.dct, root.dct,
+  abbreviation.dct, extension.dct.
+
+  The files of a directory are parsed once by voxind: their entries
+  are cached and copied to the dictionary of each new engine. The
+  cache of a file is refreshed if the file is modified (mtime, size
+  or inode).
+*/
+
+/* dictionary_load creates the dictionary of the engine from the
+   files of dir and sets it as the active dictionary; returns
+   DictNoError on success, DictFileNotFound if no file is found */
+enum ECIDictError dictionary_load(ECIHand handle, const char *dir);
+
+#endif
@@ -1,32 +1,51 @@
 #define _GNU_SOURCE
 #include <endian.h>
 #include <errno.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
+#include "broker.h"
 #include "debug.h"
+#include "dictionary.h"
+#include "direct.h"
 #include "inote.h"
 #include "msg.h"
 #include "pipe.h"
+#include "realtime.h"
 #include "voxin.h"
 
 #define VOXIND_ID 0x05000A01 
 #define ENGINE_ID 0x15000A01 
 #define READ_TIMEOUT_IN_MS 0
+#define REALTIME_LATENCY_SLEEPS 20 // to measure the scheduling latency
+#define BROKER_POLL_IN_MS 1000 // the broker reaps its workers at least at this period
+#define ENGINE_POOL_DELAY_IN_MS 100 // idle time before refilling the engine pools
 #define INDEX_CAPITAL  MSG_PREPEND_CAPITAL
 #define INDEX_CAPITALS MSG_PREPEND_CAPITALS
+// hash of the input of an engine (FNV-1a)
+#define INPUT_HASH_INIT  0xcbf29ce484222325ULL
+#define INPUT_HASH_PRIME 0x100000001b3ULL
 struct voxind_t {
   uint32_t id;
   struct pipe_t *pipe_command;
   struct msg_t *msg;
   size_t msg_length;
+  bool lock_memory; // mlock the message buffers (MSG_VOX_SET_REALTIME)
+  direct_app_cb app; // direct mode: callback messages passed to libvoxin
+  void *app_data;
 };
 
 static struct voxind_t *my_voxind = NULL;
 
+struct prefetch_t;
+
 struct engine_t {
   uint32_t id;
   ECIHand handle;
@@ -34,8 +53,7 @@ struct engine_t {
   size_t cb_msg_length;
   inote_charset_t charset; // current charset
   inote_cb_t cb;
-  uint8_t tlv_message_buffer[TLV_MESSAGE_LENGTH_MAX]; // tlv internal buffer
-  inote_slice_t tlv_message;
+  inote_slice_t tlv_message; // data of MSG_ADD_TLV
 
   // capital_mode
   // Set by voxSetParam(VOX_CAPITALS, value)
@@ -55,13 +73,141 @@ struct engine_t {
   // Set to FALSE at init or after the completion of eciSynchronize.
   int audio_sample_received;
 
+  // language:
+  // language requested at creation (0 for eciNew), identifies the
+  // engine pool where the ECI engine may return on delete.
+  uint32_t language;
+
+  // dictionary_dir:
+  // directory of the dictionaries to load before the next synthesis
+  // (MSG_VOX_LOAD_DICTIONARIES deferred), NULL otherwise.
+  char *dictionary_dir;
+
+  // dictionary_loaded:
+  // directory of the active dictionary if loaded by
+  // MSG_VOX_LOAD_DICTIONARIES, NULL otherwise.
+  char *dictionary_loaded;
+
+  // events:
+  // events queued until the next buffer message (see msg_event_t).
+  struct msg_event_t events[MSG_EVENT_MAX];
+  uint32_t nb_events;
+
+  // first_chunk:
+  // Set by voxSetParam(VOX_FIRST_CHUNK, value), 0 if disabled.
+  // If set, the engine fills chunk (first_chunk samples) and the
+  // samples are staged in cb_msg: the first waveform message of an
+  // utterance is sent after first_chunk samples, the size of the
+  // next ones doubles up to nb_samples.
+  uint32_t first_chunk;
+  int16_t *chunk; // output buffer of the engine, NULL if disabled
+  uint32_t chunk_length; // number of samples of chunk
+  uint32_t nb_samples; // output buffer size set by the application
+  uint32_t chunk_size; // number of samples of the next waveform message
+  uint32_t nb_staged; // number of samples staged in cb_msg
+
+  // input:
+  // hash of the text and indices added since the last eciSynthesize.
+  uint64_t input;
+
+  bool callback; // callback registered by the application
+  bool speaking; // eciSynthesize called, not yet synchronized
+
+  // prefetch:
+  // speculative synthesis of the next text (voxPrefetch), NULL otherwise.
+  struct prefetch_t *prefetch;
+
+  // memory:
+  // bytes allocated for the engine by voxind (engine_t, callback
+  // message, chunk, prefetch), see engine_account.
+  size_t memory;
+};
+
+/*
+  Prefetch: synthesis of a text supplied in advance by voxPrefetch.
+
+  A second ECI engine with the parameters, voice and dictionaries of
+  the engine synthesizes the text when no message is pending; its
+  callbacks are recorded in a bounded buffer. If the next
+  eciSynthesize of the engine has the same input and parameters, the
+  recorded callbacks are supplied to the application instead (the
+  remaining ones are forwarded as they come).
+
+  Once PREFETCH_MAX is recorded, the prefetch engine is paused (the
+  callback replies eciDataNotProcessed): the recorded lookahead is
+  kept and the synthesis resumes when the prefetch is played.
+
+  A new prefetch replaces the previous one; eciStop, eciReset or a
+  change of the dictionaries cancels it. There is no prefetch under a
+  real-time policy (SCHED_FIFO, SCHED_RR): its background synthesis
+  would keep a cpu busy.
+*/
+#define PREFETCH_SAMPLES 4096
+#define PREFETCH_MAX (1024*1024) // max size of the recorded callbacks
+enum prefetch_state {PREFETCH_RUNNING, PREFETCH_DONE, PREFETCH_FULL};
+struct prefetch_record_t {
+  uint32_t msg; // enum ECIMessage
+  uint32_t lParam; // followed by the samples or phonemes
+};
+struct prefetch_t {
+  struct engine_t *owner;
+  struct engine_t *engine; // prefetch engine
+  enum prefetch_state state;
+  bool playing; // supplied to the callback of the owner
+  uint8_t *record; // recorded callbacks (struct prefetch_record_t + data)
+  size_t length;
+  size_t max; // allocated size
+  size_t pos; // next record to play
+  int16_t samples[PREFETCH_SAMPLES]; // output buffer of the prefetch engine
 };
+static bool prefetch_disabled; // real-time policy of the idle tasks
 
+/*
+  Engine handles returned to libvoxin:
+  ENGINE_INDEX + (generation << ENGINE_SLOT_BITS) + slot
+
+  A slot released by MSG_DELETE is pushed on the free list and its
+  generation incremented: a stale handle (deleted engine) does not
+  match the generation of the slot and is rejected.
+*/
 #define ENGINE_INDEX 0xEA61AE00 
 #define ENGINE_MAX_NB VOX_ECI_VOICES
-static struct engine_t *engines[ENGINE_MAX_NB]; // array of created engines (not contiguous due to potential deletes)
+#define ENGINE_SLOT_BITS 8
+#define ENGINE_SLOT_MASK ((1<<ENGINE_SLOT_BITS)-1)
+struct engine_slot_t {
+  struct engine_t *engine; // NULL if the slot is free
+  uint32_t generation;
+  int next_free; // next slot of the free list (-1 = end)
+};
+static struct engine_slot_t engine_slots[ENGINE_MAX_NB];
+static int engine_free = -1; // first slot of the free list
+static size_t engine_top; // slots above have never been used
 static size_t engine_number; // number of created engines (and not yet deleted)
 
+/*
+  Engine pools: idle ECI engines created in advance so that MSG_NEW
+  and MSG_NEW_EX do not wait for the construction of the engine.
+
+  A pool is identified by the language supplied to eciNewEx, or 0 for
+  eciNew; it is only created if its nb_max is not 0. The pools are
+  refilled once no message has been received for
+  ENGINE_POOL_DELAY_IN_MS, one engine at a time, so that a burst of
+  requests is not delayed by eciNew; a deleted engine returns to its
+  pool after eciReset if the pool is not full.
+*/
+#define ENGINE_POOL_MAX 4 // max number of idle engines per language
+struct engine_pool_t {
+  uint32_t language;
+  uint32_t nb_max; // number of idle engines to keep
+  uint32_t nb; // number of idle engines
+  ECIHand idle[ENGINE_POOL_MAX];
+};
+static struct engine_pool_t engine_pools[VOX_ECI_VOICES + 1]; // +1 for eciNew
+static size_t engine_pool_number;
+static uint32_t engine_pool_default; // nb_max of a new pool
+static bool engine_pool_give(uint32_t language, ECIHand handle);
+static void prefetch_delete(struct engine_t *engine);
+
 // eciLocale, eciLocales from speech-dispatcher (ibmtts.c)
 typedef struct _eciLocale {
   char *name;
@@ -100,6 +246,18 @@ static eciLocale eciLocales[] = { // +1 for a null element
 #define MAX_NB_OF_LANGUAGES (sizeof(eciLocales)/sizeof(eciLocales[0]) - 1)
 #define ALLOCATED_MSG_LENGTH PIPE_MAX_BLOCK
 
+// input_hash adds an element of the input (text or index) to the hash
+static uint64_t input_hash(uint64_t hash, uint8_t type, const void *data, size_t len)
+{
+  const uint8_t *b = data;
+  size_t i;
+
+  hash = (hash ^ type) * INPUT_HASH_PRIME;
+  for (i=0; i<len; i++)
+    hash = (hash ^ b[i]) * INPUT_HASH_PRIME;
+  return hash;
+}
+
 static inote_error add_text(inote_tlv_t *tlv, void *user_data) {
   ENTER();
   
@@ -114,6 +272,7 @@ static inote_error add_text(inote_tlv_t *tlv, void *user_data) {
     dbgText(t, tlv->length);
     Boolean eci_res = (uint32_t)eciAddText(self->handle, t);
     ret = (eci_res == ECITrue) ? INOTE_OK : INOTE_IO_ERROR;	
+    self->input = input_hash(self->input, 'T', t, tlv->length);
     t[tlv->length] = x;
     self->tlv_number++;
     dbg("tlv_number=%d", self->tlv_number);
@@ -143,6 +302,7 @@ static inote_error add_capital(inote_tlv_t *tlv, bool capitals, void *user_data)
       if (!res) {
 	dbg("error insert index");
       }
+      self->input = input_hash(self->input, 'I', &index, sizeof(index));
     }
     ret = add_text(tlv, user_data);
   }
@@ -150,10 +310,21 @@ static inote_error add_capital(inote_tlv_t *tlv, bool capitals, void *user_data)
   return ret;
 }
 
+static size_t engine_memory; // bytes allocated for all the engines
+
+// engine_account adds delta bytes to the memory allocated for the engine
+static void engine_account(struct engine_t *engine, long delta)
+{
+  engine->memory += delta;
+  engine_memory += delta;
+  dbg("engine=%p, memory=%lu bytes (engines: %lu bytes)", engine,
+      (long unsigned int)engine->memory, (long unsigned int)engine_memory);
+}
+
 static void engine_init_buffers(struct engine_t *self) {
   if (self) {
-    self->tlv_message.buffer = self->tlv_message_buffer;
-    self->tlv_message.end_of_buffer = self->tlv_message_buffer + sizeof(self->tlv_message_buffer);	  
+    self->tlv_message.buffer = NULL;
+    self->tlv_message.end_of_buffer = NULL;
     self->tlv_message.length = 0;
     self->cb.add_annotation = add_text;
     self->cb.add_charset = add_text;
@@ -177,7 +348,9 @@ static struct engine_t *engine_create(void *handle)
   if (self) {
     self->id = ENGINE_ID;
     self->handle = handle;
+    self->input = INPUT_HASH_INIT;
     engine_init_buffers(self);
+    engine_account(self, sizeof(*self));
   } else {
     err("mem error (%d)", errno);
   }
@@ -186,6 +359,345 @@ static struct engine_t *engine_create(void *handle)
   return self;
 }
 
+static void engine_delete(struct engine_t *self)
+{
+  ENTER();
+
+  if (!self)
+    return;
+
+  prefetch_delete(self);
+  if (self->handle) {
+    if (!engine_pool_give(self->language, self->handle))
+      eciDelete(self->handle);
+    self->handle = NULL;
+  }
+  if (self->chunk) {
+    free(self->chunk);
+    self->chunk = NULL;
+  }
+  if (self->cb_msg) {
+    free(self->cb_msg);
+    self->cb_msg = NULL;
+  }
+  engine_memory -= self->memory;
+  if (self->dictionary_dir) {
+    free(self->dictionary_dir);
+    self->dictionary_dir = NULL;
+  }
+  if (self->dictionary_loaded) {
+    free(self->dictionary_loaded);
+    self->dictionary_loaded = NULL;
+  }
+  self->id = 0;
+  free(self);
+}
+
+static uint32_t engine_slot_get_handle(int slot)
+{
+  return ENGINE_INDEX + (engine_slots[slot].generation << ENGINE_SLOT_BITS) + slot;
+}
+
+static bool engine_slot_is_available()
+{
+  return (engine_free != -1) || (engine_top < ENGINE_MAX_NB);
+}
+
+// engine_slot_new stores the engine and returns its handle (0 if error)
+static uint32_t engine_slot_new(struct engine_t *engine)
+{
+  int slot;
+
+  ENTER();
+
+  if (!engine)
+    return 0;
+
+  if (!engine_slot_is_available()) {
+    err("error: max number of engines allocated");
+    return 0;
+  }
+
+  if (engine_free != -1) {
+    slot = engine_free;
+    engine_free = engine_slots[slot].next_free;
+  } else {
+    slot = engine_top++;
+  }
+
+  engine_slots[slot].engine = engine;
+  engine_slots[slot].next_free = -1;
+  engine_number++;
+  dbg("slot=%d, generation=%u, engine_number=%lu", slot, engine_slots[slot].generation, (long unsigned int)engine_number);
+  return engine_slot_get_handle(slot);
+}
+
+// engine_slot_get returns the engine of this handle or NULL if the handle is unknown or stale
+static struct engine_t *engine_slot_get(uint32_t handle)
+{
+  uint32_t slot;
+
+  if (!handle)
+    return NULL;
+
+  handle -= ENGINE_INDEX;
+  slot = handle & ENGINE_SLOT_MASK;
+  if ((slot >= engine_top)
+      || !engine_slots[slot].engine
+      || (engine_slots[slot].generation != (handle >> ENGINE_SLOT_BITS)))
+    return NULL;
+
+  return engine_slots[slot].engine;
+}
+
+// engine_slot_delete releases the slot of this handle
+static void engine_slot_delete(uint32_t handle)
+{
+  struct engine_slot_t *s;
+  int slot;
+
+  ENTER();
+
+  if (!engine_slot_get(handle))
+    return;
+
+  slot = (handle - ENGINE_INDEX) & ENGINE_SLOT_MASK;
+  s = engine_slots + slot;
+  s->engine = NULL;
+  do { // a handle equals to 0 would be considered as an error
+    s->generation = (s->generation + 1) & (0xFFFFFFFF >> ENGINE_SLOT_BITS);
+  } while (!engine_slot_get_handle(slot));
+  s->next_free = engine_free;
+  engine_free = slot;
+  engine_number--;
+  dbg("slot=%d, engine_number=%lu", slot, (long unsigned int)engine_number);
+}
+
+// engine_is_optional returns true if func can be called without engine
+static bool engine_is_optional(uint32_t func)
+{
+  switch(func) {
+  case MSG_GET_AVAILABLE_LANGUAGES:
+  case MSG_GET_DEFAULT_PARAM:
+  case MSG_NEW:
+  case MSG_NEW_EX:
+  case MSG_SET_DEFAULT_PARAM:
+  case MSG_VERSION:
+  case MSG_GET_VERSIONS:
+  case MSG_VOX_GET_VOICES:
+  case MSG_VOX_SET_ENGINE_POOL:
+  case MSG_VOX_SET_REALTIME:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// engine_pool_get returns the pool of this language; if create is
+// true, the missing pool is created
+static struct engine_pool_t *engine_pool_get(uint32_t language, bool create)
+{
+  struct engine_pool_t *pool;
+  int i;
+
+  for (i=0; i<engine_pool_number; i++) {
+    if (engine_pools[i].language == language)
+      return engine_pools + i;
+  }
+
+  if (!create)
+    return NULL;
+
+  if (engine_pool_number >= sizeof(engine_pools)/sizeof(*engine_pools)) {
+    err("error: max number of pools");
+    return NULL;
+  }
+
+  pool = engine_pools + engine_pool_number++;
+  pool->language = language;
+  pool->nb_max = engine_pool_default;
+  pool->nb = 0;
+  dbg("new pool: language=0x%x, nb_max=%d", language, pool->nb_max);
+  return pool;
+}
+
+static void engine_pool_set(uint32_t language, uint32_t nb_max)
+{
+  int i;
+
+  ENTER();
+
+  if (nb_max > ENGINE_POOL_MAX)
+    nb_max = ENGINE_POOL_MAX;
+
+  if (language == MSG_ENGINE_POOL_ANY) {
+    engine_pool_default = nb_max;
+    for (i=0; i<engine_pool_number; i++) {
+      engine_pools[i].nb_max = nb_max;
+    }
+  } else {
+    struct engine_pool_t *pool = engine_pool_get(language, nb_max != 0);
+    if (pool)
+      pool->nb_max = nb_max;
+  }
+
+  // the surplus is deleted (the refill is done in idle time)
+  for (i=0; i<engine_pool_number; i++) {
+    struct engine_pool_t *pool = engine_pools + i;
+    while (pool->nb > pool->nb_max) {
+      eciDelete(pool->idle[--pool->nb]);
+    }
+  }
+  msg("language=0x%x, nb_max=%d", language, nb_max);
+}
+
+// engine_pool_take returns an idle engine of this language or NULL_ECI_HAND
+static ECIHand engine_pool_take(uint32_t language)
+{
+  struct engine_pool_t *pool = engine_pool_get(language, engine_pool_default != 0);
+
+  if (!pool || !pool->nb)
+    return NULL_ECI_HAND;
+
+  dbg("language=0x%x, nb=%d", language, pool->nb - 1);
+  return pool->idle[--pool->nb];
+}
+
+// engine_pool_give resets the engine and returns it to its pool if
+// there is room; otherwise returns false
+static bool engine_pool_give(uint32_t language, ECIHand handle)
+{
+  struct engine_pool_t *pool = engine_pool_get(language, engine_pool_default != 0);
+  ECIDictHand dict;
+
+  if (!pool || (pool->nb >= pool->nb_max) || !handle)
+    return false;
+
+  eciRegisterCallback(handle, NULL, NULL);
+  eciReset(handle);
+  dict = eciGetDict(handle);
+  if (dict) {
+    eciSetDict(handle, NULL_DICT_HAND);
+    eciDeleteDict(handle, dict);
+  }
+  if (language)
+    eciSetParam(handle, eciLanguageDialect, language);
+
+  pool->idle[pool->nb++] = handle;
+  dbg("language=0x%x, nb=%d", language, pool->nb);
+  return true;
+}
+
+// engine_pool_refill creates one idle engine; returns false if the
+// pools are full
+static bool engine_pool_refill()
+{
+  int i;
+
+  for (i=0; i<engine_pool_number; i++) {
+    struct engine_pool_t *pool = engine_pools + i;
+    if (pool->nb < pool->nb_max) {
+      ECIHand handle = pool->language ? eciNewEx(pool->language) : eciNew();
+      if (!handle) {
+	err("error: engine creation, language=0x%x", pool->language);
+	pool->nb_max = pool->nb; // do not retry
+	continue;
+      }
+      pool->idle[pool->nb++] = handle;
+      dbg("language=0x%x, nb=%d", pool->language, pool->nb);
+      return true;
+    }
+  }
+  return false;
+}
+
+// engine_new returns a new engine, from its pool if possible
+static struct engine_t *engine_new(uint32_t language)
+{
+  struct engine_t *engine;
+  ECIHand handle = engine_pool_take(language);
+
+  if (!handle)
+    handle = language ? eciNewEx(language) : eciNew();
+
+  engine = engine_create(handle);
+  if (engine) {
+    engine->language = language;
+  } else if (handle) {
+    eciDelete(handle);
+  }
+  return engine;
+}
+
+// engine_dictionaries_changed is called if the active dictionary may
+// differ from dictionary_loaded
+static void engine_dictionaries_changed(struct engine_t *engine)
+{
+  if (engine->dictionary_loaded) {
+    free(engine->dictionary_loaded);
+    engine->dictionary_loaded = NULL;
+  }
+  prefetch_delete(engine);
+}
+
+// engine_load_dir loads the dictionaries of dir
+static enum ECIDictError engine_load_dir(struct engine_t *engine, const char *dir)
+{
+  enum ECIDictError res = dictionary_load(engine->handle, dir);
+
+  engine_dictionaries_changed(engine);
+  if (res == DictNoError)
+    engine->dictionary_loaded = strdup(dir);
+  return res;
+}
+
+// engine_load_dictionaries loads the deferred dictionaries of the engine
+static void engine_load_dictionaries(struct engine_t *engine)
+{
+  if (!engine || !engine->dictionary_dir)
+    return;
+
+  engine_load_dir(engine, engine->dictionary_dir);
+  free(engine->dictionary_dir);
+  engine->dictionary_dir = NULL;
+}
+
+// engine_load_next_dictionaries loads the deferred dictionaries of one
+// engine; returns false if there is none
+static bool engine_load_next_dictionaries()
+{
+  int i;
+
+  for (i=0; i<engine_top; i++) {
+    struct engine_t *engine = engine_slots[i].engine;
+    if (engine && engine->dictionary_dir) {
+      engine_load_dictionaries(engine);
+      return true;
+    }
+  }
+  return false;
+}
+
+// engine_uses_dictionaries returns true if the dictionaries must be
+// loaded before processing func
+static bool engine_uses_dictionaries(uint32_t func)
+{
+  switch(func) {
+  case MSG_ADD_TEXT:
+  case MSG_ADD_TLV:
+  case MSG_SYNTHESIZE:
+  case MSG_DELETE_DICT:
+  case MSG_GET_DICT:
+  case MSG_LOAD_DICT:
+  case MSG_SET_DICT:
+  case MSG_VOX_PREFETCH:
+    return true;
+  default:
+    return false;
+  }
+}
+
+#ifndef VOXIND_DIRECT
 static void my_exit()
 {
   struct msg_t msg;
@@ -210,24 +722,166 @@ static void sighandler(int sig) {
   err("signal=%s (%d)", strsignal(sig), sig);
   exit(EXIT_FAILURE);
 }
+#endif
 
-static enum ECICallbackReturn my_callback(ECIHand hEngine, enum ECIMessage Msg, long lParam, void *pData)
+// engine_call_app sends the callback message m to libvoxin and
+// returns the value returned by the user callback
+static enum ECICallbackReturn engine_call_app(struct engine_t *engine, struct msg_t *m)
 {
-  size_t effective_msg_length = 0;
-  size_t allocated_msg_length = 0;
+  size_t effective_msg_length = MSG_HEADER_LENGTH + m->effective_data_length;
   int res;
   uint32_t func_sav;
+
+  m->id = MSG_TO_APP_ID;
+  m->count = ++engine->cb_msg->count;
+  m->res = 0;
+  dbg("send cb msg '%s', length=%d, lParam=%08x, nb_events=%d, engine=%p (#%d)",
+      msg_string(m->func),
+      m->effective_data_length,
+      m->args.cb.lParam,
+      m->args.cb.nb_events,
+      engine,
+      m->count);
+  if (my_voxind->app) {
+    m->res = my_voxind->app(m, my_voxind->app_data);
+    dbg("res=%d (#%d)", m->res, m->count);
+    return m->res;
+  }
+
+  res = pipe_write(my_voxind->pipe_command, m, &effective_msg_length);
+  if (res) {
+    err("LEAVE, write error (%d)", res);
+    return eciDataAbort;
+  }
+
+  effective_msg_length = MIN_MSG_SIZE;
+  func_sav = m->func;
+  res = pipe_read(my_voxind->pipe_command, m, &effective_msg_length);
+  if (res) {
+    err("LEAVE, read error (%d)",res);  
+    return eciDataAbort;
+  }
+
+  if (m->func != func_sav) {
+    err("LEAVE, received func error (%d, expected=%d)", m->func, func_sav);
+    return eciDataAbort;
+  }  
+
+  dbg("recv msg '%s', length=%d, res=%d (#%d)", msg_string(m->func),
+      m->effective_data_length, m->res, m->count);
+  return m->res;
+}
+
+// engine_send_buffer sends len bytes of data of cb_msg followed by
+// the queued events
+static enum ECICallbackReturn engine_send_buffer(struct engine_t *engine, enum ECIMessage Msg, size_t len)
+{
+  size_t events_len = engine->nb_events*sizeof(*engine->events);
+  enum ECICallbackReturn res;
+
+  if (MSG_HEADER_LENGTH + len + events_len > engine->cb_msg_length) {
+    err("LEAVE, samples size error (%ld > %ld)", (long int)(MSG_HEADER_LENGTH + len + events_len), (long int)engine->cb_msg_length);
+    return eciDataAbort;
+  }
+
+  memcpy(engine->cb_msg->data + len, engine->events, events_len);
+  engine->cb_msg->effective_data_length = len + events_len;
+  engine->cb_msg->args.cb.nb_events = engine->nb_events;
+  engine->cb_msg->func = MSG_CB_WAVEFORM_BUFFER + Msg - eciWaveformBuffer;
+  res = engine_call_app(engine, engine->cb_msg);
+  engine->cb_msg->args.cb.lParam = 0;
+  if (res != eciDataNotProcessed) // otherwise sent again with the data
+    engine->nb_events = 0;
+  return res;
+}
+
+// engine_send_staged sends the staged samples; the size of the next
+// message is doubled
+static enum ECICallbackReturn engine_send_staged(struct engine_t *engine)
+{
+  enum ECICallbackReturn res = engine_send_buffer(engine, eciWaveformBuffer, 2*engine->nb_staged);
+  if (res != eciDataNotProcessed) {
+    engine->nb_staged = 0;
+    engine->chunk_size = (2*engine->chunk_size < engine->nb_samples) ? 2*engine->chunk_size : engine->nb_samples;
+  }
+  return res;
+}
+
+// engine_stage_samples appends the nb samples of chunk to cb_msg and
+// sends them once chunk_size is reached
+static enum ECICallbackReturn engine_stage_samples(struct engine_t *engine, uint32_t nb)
+{
+  enum ECICallbackReturn res = eciDataProcessed;
+
+  if (engine->nb_staged + nb > engine->nb_samples) {
+    res = engine_send_staged(engine);
+    if (res != eciDataProcessed)
+      return res; // eciDataNotProcessed: the engine supplies the chunk again
+  }
+
+  memcpy((int16_t*)engine->cb_msg->data + engine->nb_staged, engine->chunk, 2*nb);
+  engine->nb_staged += nb;
+  if (engine->nb_staged >= engine->chunk_size) {
+    res = engine_send_staged(engine);
+    if (res == eciDataNotProcessed)
+      engine->nb_staged -= nb;
+  }
+  return res;
+}
+
+// engine_flush_events sends the staged samples and the queued events
+// (end of synthesis or full queue); without staging, in a message
+// without samples (the output buffer may be partially filled by the
+// engine)
+static enum ECICallbackReturn engine_flush_events(struct engine_t *engine)
+{
+  static uint8_t buf[MSG_HEADER_LENGTH + sizeof(engine->events)] __attribute__ ((aligned (16)));
+  struct msg_t *m = (struct msg_t *)buf;
+  size_t len = engine->nb_events*sizeof(*engine->events);
+
+  if (!engine->cb_msg)
+    return eciDataProcessed;
+
+  if (engine->chunk) {
+    if (!engine->nb_staged && !engine->nb_events)
+      return eciDataProcessed;
+    return engine_send_staged(engine);
+  }
+
+  if (!engine->nb_events)
+    return eciDataProcessed;
+
+  memset(m, 0, MSG_HEADER_LENGTH);
+  m->func = MSG_CB_WAVEFORM_BUFFER;
+  m->args.cb.nb_events = engine->nb_events;
+  m->effective_data_length = len;
+  memcpy(m->data, engine->events, len);
+  engine->nb_events = 0;
+  return engine_call_app(engine, m);
+}
+
+// engine_queue_event adds an event to the next buffer message
+static enum ECICallbackReturn engine_queue_event(struct engine_t *engine, enum ECIMessage Msg, uint32_t lParam)
+{
+  enum ECICallbackReturn res = eciDataProcessed;
+  struct msg_event_t *e;
+
+  if (engine->nb_events == MSG_EVENT_MAX)
+    res = engine_flush_events(engine);
+
+  e = engine->events + engine->nb_events++;
+  e->msg = Msg;
+  e->lParam = lParam;
+  e->offset = engine->chunk ? engine->nb_staged : 0;
+  dbg("event msg=%d, lParam=0x%x, offset=%d", Msg, lParam, e->offset);
+  return res;
+}
+
+static enum ECICallbackReturn my_callback(ECIHand hEngine, enum ECIMessage Msg, long lParam, void *pData)
+{
+  enum ECICallbackReturn res;
   struct engine_t *engine = (struct engine_t*)pData;
-  static const char* msgString[] = {
-    "eciWaveformBuffer",
-    "eciPhonemeBuffer",
-    "eciIndexReply",
-    "eciPhonemeIndexReply",
-    "eciWordIndexReply",
-    "eciStringIndexReply",
-    "eciAudioIndexReply",
-    "eciSynthesisBreak"};
-  const char *msgType;
+  size_t len = 0;
 
   ENTER();
   
@@ -236,11 +890,9 @@ static enum ECICallbackReturn my_callback(ECIHand hEngine, enum ECIMessage Msg,
     return eciDataAbort;
   }
 
-  engine->cb_msg->args.cb.lParam = 0;
   switch(Msg) {
   case eciWaveformBuffer:
     if (!engine->audio_sample_received) {
-      size_t speech_len = 2*lParam;
       engine->audio_sample_received = 1;
       dbg("audio_sample_received=%d, first_tlv_type: 0x%02x",
 	  engine->audio_sample_received,
@@ -253,100 +905,142 @@ static enum ECICallbackReturn my_callback(ECIHand hEngine, enum ECIMessage Msg,
 	}
       }
     }
-    engine->cb_msg->effective_data_length = 2*lParam;  
+    if (engine->chunk) {
+      res = engine_stage_samples(engine, lParam);
+      LEAVE();
+      return res;
+    }
+    len = 2*lParam;  
     break;
   case eciPhonemeBuffer:
-    engine->cb_msg->effective_data_length = lParam;  
+    len = lParam;  
     break;
   case eciIndexReply:
     {
-      engine->cb_msg->effective_data_length = sizeof(uint32_t);
-      engine->cb_msg->args.cb.lParam = htole32(lParam);
-      uint32_t index = engine->cb_msg->args.cb.lParam;
+      uint32_t index = htole32(lParam);
       dbg("index=0x%02x", index);
       if (index & (INDEX_CAPITAL|INDEX_CAPITALS)) {
 	if (engine->capital_mode == voxCapitalSoundIcon) {
 	  bool is_capitals = !((index & INDEX_CAPITALS)^INDEX_CAPITALS);
-	  Msg = eciWaveformBuffer;
-	  engine->cb_msg->effective_data_length = lParam = 0;
-	  engine->cb_msg->args.cb.lParam = is_capitals ? MSG_PREPEND_CAPITALS : MSG_PREPEND_CAPITAL;
+	  res = engine_queue_event(engine, eciWaveformBuffer, is_capitals ? MSG_PREPEND_CAPITALS : MSG_PREPEND_CAPITAL);
 	} else {
 	  dbg("LEAVE, data processed (mode=%d)", engine->capital_mode);
 	  return eciDataProcessed;
 	}
+      } else {
+	res = engine_queue_event(engine, Msg, index);
       }
+      LEAVE();
+      return res;
     }
-    break;
   case eciPhonemeIndexReply:
   case eciWordIndexReply:
   case eciStringIndexReply:
   case eciSynthesisBreak:
-    engine->cb_msg->effective_data_length = sizeof(uint32_t);
-    engine->cb_msg->args.cb.lParam = htole32(lParam);
-    break;
+    res = engine_queue_event(engine, Msg, htole32(lParam));
+    LEAVE();
+    return res;
   default:
     err("LEAVE, unknown eci message (%d)", Msg);
     return eciDataAbort;	
   }
 
-  msgType = msgString[Msg];
-  effective_msg_length = MSG_HEADER_LENGTH + engine->cb_msg->effective_data_length;
-  allocated_msg_length = engine->cb_msg_length;
+  // the queued events follow the data
+  res = engine_send_buffer(engine, Msg, len);
 
-  if (effective_msg_length > allocated_msg_length) {
-    err("LEAVE, %s samples size error (%ld > %ld)", msgType, (long int)effective_msg_length, (long int)allocated_msg_length);
-    return eciDataAbort;
-  }
-  
-  engine->cb_msg->func = MSG_CB_WAVEFORM_BUFFER + Msg - eciWaveformBuffer;
-  if (!msg_string(engine->cb_msg->func)) {
-    err("LEAVE, unknown function (%d)", engine->cb_msg->func);
-    return eciDataAbort;
+  LEAVE();
+  return res;
+}
+
+
+// engine_set_eci_buffer supplies the output buffer to the engine:
+// the samples of cb_msg or, if the first chunk is smaller, the chunk
+// buffer
+static Boolean engine_set_eci_buffer(struct engine_t *engine)
+{
+  if (engine->chunk) {
+    realtime_unlock(engine->chunk, 2*engine->chunk_length);
+    free(engine->chunk);
+    engine->chunk = NULL;
+    engine_account(engine, -2*(long)engine->chunk_length);
   }
-  engine->cb_msg->id = MSG_TO_APP_ID;
-  ++engine->cb_msg->count;
-    
-  engine->cb_msg->res = 0;
-  dbg("%s send cb msg '%s', length=%d, lParam=%08x, engine=%p (#%d)",
-      msgType,
-      msg_string(engine->cb_msg->func),
-      engine->cb_msg->effective_data_length,
-      engine->cb_msg->args.cb.lParam,
-      engine,
-      engine->cb_msg->count);
-  res = pipe_write(my_voxind->pipe_command, engine->cb_msg, &effective_msg_length);
-  if (res) {
-    err("LEAVE, write error (%d)", res);
-    return eciDataAbort;
+  engine->nb_staged = 0;
+  engine->chunk_size = engine->first_chunk;
+
+  if (engine->first_chunk && (engine->first_chunk < engine->nb_samples)) {
+    engine->chunk = malloc(2*engine->first_chunk);
+    if (engine->chunk) {
+      engine->chunk_length = engine->first_chunk;
+      engine_account(engine, 2*engine->chunk_length);
+      if (my_voxind->lock_memory)
+	realtime_lock(engine->chunk, 2*engine->chunk_length);
+      dbg("first chunk=%d, nb_samples=%d", engine->first_chunk, engine->nb_samples);
+      return eciSetOutputBuffer(engine->handle, engine->first_chunk, engine->chunk);
+    }
   }
+  return eciSetOutputBuffer(engine->handle, engine->nb_samples, (short*)engine->cb_msg->data);
+}
 
-  effective_msg_length = MIN_MSG_SIZE;
-  func_sav = engine->cb_msg->func;
-  res = pipe_read(my_voxind->pipe_command, engine->cb_msg, &effective_msg_length);
-  if (res) {
-    err("LEAVE, read error (%d)",res);  
-    return eciDataAbort;
+// engine_free_output_buffer frees the callback message and the chunk
+static void engine_free_output_buffer(struct engine_t *engine)
+{
+  if (engine->chunk) {
+    realtime_unlock(engine->chunk, 2*engine->chunk_length);
+    free(engine->chunk);
+    engine->chunk = NULL;
+    engine_account(engine, -2*(long)engine->chunk_length);
+  }
+  if (engine->cb_msg) {
+    realtime_unlock(engine->cb_msg, engine->cb_msg_length);
+    free(engine->cb_msg);
+    engine->cb_msg = NULL;
+    engine_account(engine, -(long)engine->cb_msg_length);
   }
+}
 
-  if (engine->cb_msg->func != func_sav) {
-    err("LEAVE, received func error (%d, expected=%d)", engine->cb_msg->func, func_sav);
-    return eciDataAbort;
-  }  
+// engine_set_output_buffer checks the size of the output buffer; the
+// buffer is allocated before the first synthesis (most engines may be
+// kept idle)
+static Boolean engine_set_output_buffer(struct engine_t *engine, uint32_t nb_samples)
+{
+  size_t len = 0;
 
-  dbg("recv msg '%s', length=%d, res=%d (#%d)", msg_string(engine->cb_msg->func),
-      engine->cb_msg->effective_data_length, engine->cb_msg->res, engine->cb_msg->count);
+  ENTER();
 
-  LEAVE();
-  return engine->cb_msg->res;
+  // room for the queued events after the samples
+  len = MSG_HEADER_LENGTH + 2*nb_samples + sizeof(engine->events);
+  if (len > PIPE_MAX_BLOCK) {
+    err("LEAVE, args error(%d)",1);
+    return ECIFalse;
+  }
+
+  engine_free_output_buffer(engine);
+  engine->cb_msg_length = len;
+  engine->nb_samples = nb_samples;
+  return ECITrue;
 }
 
+// engine_alloc_output_buffer allocates the callback message including
+// the samples buffer, if needed
+static Boolean engine_alloc_output_buffer(struct engine_t *engine)
+{
+  if (engine->cb_msg || !engine->nb_samples)
+    return ECITrue;
+
+  engine->cb_msg = calloc(1, engine->cb_msg_length);
+  if (!engine->cb_msg) {
+    err("LEAVE, sys error(%d)", errno);
+    return ECIFalse;
+  }
+  engine_account(engine, engine->cb_msg_length);
+  if (my_voxind->lock_memory)
+    realtime_lock(engine->cb_msg, engine->cb_msg_length);
+  dbg("create cb msg, data=%p, nb_samples=%d", engine->cb_msg->data, engine->nb_samples);
+  return engine_set_eci_buffer(engine);
+}
 
 static void set_output_buffer(struct voxind_t *v, struct engine_t *engine, struct msg_t *msg)
 {
-  size_t len = 0;
-  size_t data_len = 0;
-  int res;
-  
   ENTER();
 
   if (!v || !msg) {
@@ -355,28 +1049,349 @@ static void set_output_buffer(struct voxind_t *v, struct engine_t *engine, struc
   }
 
   msg->effective_data_length = 0;
-  
-  data_len = 2*msg->args.sob.nb_samples;
-  len = MSG_HEADER_LENGTH + data_len;
-  if (len > PIPE_MAX_BLOCK) {
+  msg->res = (uint32_t)engine_set_output_buffer(engine, msg->args.sob.nb_samples);
+}
+
+// set_realtime applies the scheduling to the command loop and locks
+// the message buffers, already allocated or not.
+// In direct mode, the scheduling of the threads of the application is
+// left to libvoxin.
+static void set_realtime(struct voxind_t *v, struct msg_t *msg)
+{
+  struct msg_set_realtime_t *rt = &msg->args.rt;
+  int priority = rt->priority;
+  int i;
+
+  ENTER();
+
+  msg->effective_data_length = 0;
+  if (v->app) {
+    rt->policy = REALTIME_NONE;
+    priority = 0;
+  } else {
+    rt->policy = realtime_set_scheduling(rt->policy, &priority);
+    prefetch_disabled = (rt->policy == REALTIME_RR) || (rt->policy == REALTIME_FIFO);
+  }
+  rt->priority = priority;
+
+  if (rt->lock_memory && !v->lock_memory) {
+    v->lock_memory = !v->msg || !realtime_lock(v->msg, v->msg_length);
+    for (i=0; v->lock_memory && (i<engine_top); i++) {
+      struct engine_t *engine = engine_slots[i].engine;
+      if (!engine)
+	continue;
+      if (engine->cb_msg)
+	realtime_lock(engine->cb_msg, engine->cb_msg_length);
+      if (engine->chunk)
+	realtime_lock(engine->chunk, 2*engine->chunk_length);
+    }
+  }
+  rt->lock_memory = v->lock_memory;
+
+  msg->res = realtime_measure_latency(REALTIME_LATENCY_SLEEPS);
+  msg("policy=%d, priority=%d, lock_memory=%d, latency=%d us",
+      rt->policy, rt->priority, rt->lock_memory, msg->res);
+}
+
+// set_state applies the engine state supplied in a single message
+// (msg->data is null terminated by unserialize)
+static void set_state(struct engine_t *engine, struct msg_t *msg, size_t len)
+{
+  struct msg_vox_set_state_t *state = (struct msg_vox_set_state_t *)msg->data;
+  Boolean res = ECITrue;
+  int i;
+
+  ENTER();
+
+  if (len < sizeof(*state)) {
+    err("LEAVE, args error");
     msg->res = ECIFalse;
-    err("LEAVE, args error(%d)",1);
     return;
   }
 
-  if (engine->cb_msg)
-    free(engine->cb_msg);
+  if (state->flags & MSG_STATE_OUTPUT_FILENAME) {
+    if (eciSetOutputFilename(engine->handle, state->filename) == ECIFalse)
+      res = ECIFalse;
+  }
 
-  engine->cb_msg = calloc(1, len);
-  if (!engine->cb_msg) {
-    msg->res = ECIFalse;
-    err("LEAVE, sys error(%d)", errno);
+  if (state->flags & MSG_STATE_OUTPUT_BUFFER) {
+    if (engine_set_output_buffer(engine, state->nb_samples) == ECIFalse)
+      res = ECIFalse;
+  }
+
+  if (state->flags & MSG_STATE_CALLBACK) {
+    eciRegisterCallback(engine->handle, state->callback ? my_callback : NULL, engine);
+    engine->callback = (state->callback != 0);
+  }
+
+  for (i=0; (i<MSG_STATE_VOICE_PARAM_MAX) && (i<eciNumVoiceParams); i++) {
+    if ((state->voice_param_mask & (1<<i))
+	&& (eciSetVoiceParam(engine->handle, 0, i, state->voice_param[i]) < 0))
+      res = ECIFalse;
+  }
+
+  dbg("flags=0x%x, voice_param_mask=0x%x, res=%d", state->flags, state->voice_param_mask, res);
+  msg->res = res;
+}
+
+// prefetch_delete cancels the prefetch of the engine
+static void prefetch_delete(struct engine_t *engine)
+{
+  struct prefetch_t *p = engine->prefetch;
+
+  if (!p)
     return;
+
+  dbg("state=%d, length=%lu", p->state, (long unsigned int)p->length);
+  if (p->engine) {
+    eciStop(p->engine->handle);
+    engine_delete(p->engine);
   }
+  engine_account(engine, -(long)(sizeof(*p) + p->max));
+  free(p->record);
+  free(p);
+  engine->prefetch = NULL;
+}
 
-  engine->cb_msg_length = len;
-  dbg("create cb msg, data=%p, effective_data_length=%ld", engine->cb_msg->data, (long int)data_len);
-  msg->res = (uint32_t)eciSetOutputBuffer(engine->handle, msg->args.sob.nb_samples, (short*)engine->cb_msg->data);  
+// prefetch_forward supplies a callback of the prefetch engine to the
+// callback of the engine; the samples are split according to its
+// output buffer
+static enum ECICallbackReturn prefetch_forward(struct engine_t *engine, enum ECIMessage Msg, uint32_t lParam, const uint8_t *data)
+{
+  enum ECICallbackReturn res = eciDataProcessed;
+
+  if (Msg == eciWaveformBuffer) {
+    uint32_t max = engine->chunk ? engine->chunk_length : engine->nb_samples;
+    int16_t *buf = engine->chunk ? engine->chunk : (int16_t*)engine->cb_msg->data;
+    while (lParam) {
+      uint32_t n = (lParam < max) ? lParam : max;
+      memcpy(buf, data, 2*n);
+      res = my_callback(engine->handle, Msg, n, engine);
+      if (res == eciDataAbort)
+	break;
+      if (res == eciDataNotProcessed)
+	continue;
+      data += 2*n;
+      lParam -= n;
+    }
+    return res;
+  }
+
+  if (Msg == eciPhonemeBuffer) {
+    if (lParam > 2*engine->nb_samples)
+      lParam = 2*engine->nb_samples;
+    memcpy(engine->cb_msg->data, data, lParam);
+  }
+  do {
+    res = my_callback(engine->handle, Msg, lParam, engine);
+  } while (res == eciDataNotProcessed);
+  return res;
+}
+
+// prefetch_play supplies the recorded callbacks to the engine
+static enum ECICallbackReturn prefetch_play(struct engine_t *engine)
+{
+  struct prefetch_t *p = engine->prefetch;
+  enum ECICallbackReturn res = eciDataProcessed;
+
+  while ((p->pos < p->length) && (res != eciDataAbort)) {
+    struct prefetch_record_t r;
+    memcpy(&r, p->record + p->pos, sizeof(r));
+    p->pos += sizeof(r);
+    res = prefetch_forward(engine, r.msg, r.lParam, p->record + p->pos);
+    if (r.msg == eciWaveformBuffer)
+      p->pos += 2*r.lParam;
+    else if (r.msg == eciPhonemeBuffer)
+      p->pos += r.lParam;
+  }
+  return res;
+}
+
+// prefetch_callback records the callbacks of the prefetch engine or
+// forwards them once the prefetch is played
+static enum ECICallbackReturn prefetch_callback(ECIHand hEngine, enum ECIMessage Msg, long lParam, void *pData)
+{
+  struct prefetch_t *p = pData;
+  struct prefetch_record_t r;
+  size_t len = 0;
+
+  if (p->playing) {
+    enum ECICallbackReturn res = prefetch_play(p->owner);
+    if (res == eciDataAbort)
+      return res;
+    return prefetch_forward(p->owner, Msg, lParam, (uint8_t*)p->samples);
+  }
+
+  if (Msg == eciWaveformBuffer)
+    len = 2*lParam;
+  else if (Msg == eciPhonemeBuffer)
+    len = lParam;
+
+  if (p->length + sizeof(r) + len > p->max) {
+    size_t max = p->max ? 2*p->max : 2*sizeof(p->samples);
+    uint8_t *record;
+    while (max < p->length + sizeof(r) + len)
+      max *= 2;
+    if (max > PREFETCH_MAX)
+      max = PREFETCH_MAX;
+    record = (max >= p->length + sizeof(r) + len) ? realloc(p->record, max) : NULL;
+    if (!record) {
+      // this buffer is supplied again once the prefetch is played
+      msg("prefetch paused (length=%lu)", (long unsigned int)p->length);
+      p->state = PREFETCH_FULL;
+      return eciDataNotProcessed;
+    }
+    engine_account(p->owner, max - p->max);
+    p->record = record;
+    p->max = max;
+  }
+
+  r.msg = Msg;
+  r.lParam = lParam;
+  memcpy(p->record + p->length, &r, sizeof(r));
+  memcpy(p->record + p->length + sizeof(r), p->samples, len);
+  p->length += sizeof(r) + len;
+  return eciDataProcessed;
+}
+
+// prefetch_start starts the synthesis of the tlv message by a new
+// prefetch engine (same parameters, voice and dictionaries)
+static Boolean prefetch_start(struct engine_t *engine, uint8_t *tlv, size_t len)
+{
+  struct prefetch_t *p;
+  ECIHand handle;
+  inote_slice_t t;
+  bool dict = (eciGetDict(engine->handle) != NULL_DICT_HAND);
+  int i;
+
+  ENTER();
+
+  prefetch_delete(engine);
+
+  // the audio is supplied to the callback only; a dictionary set by
+  // the application can't be copied
+  if (prefetch_disabled || !engine->callback || !engine->nb_samples
+      || (dict && !engine->dictionary_loaded) || (len > TLV_MESSAGE_LENGTH_MAX)) {
+    dbg("LEAVE, no prefetch");
+    return ECIFalse;
+  }
+
+  p = calloc(1, sizeof(*p));
+  if (!p) {
+    err("LEAVE, mem error (%d)", errno);
+    return ECIFalse;
+  }
+  engine_account(engine, sizeof(*p));
+  engine->prefetch = p;
+  p->owner = engine;
+  p->engine = engine_new(engine->language);
+  if (!p->engine)
+    goto exit0;
+
+  handle = p->engine->handle;
+  // the language first: it resets the voice
+  eciSetParam(handle, eciLanguageDialect, eciGetParam(engine->handle, eciLanguageDialect));
+  for (i=0; i<eciNumParams; i++) {
+    int value = eciGetParam(engine->handle, i);
+    if ((i != eciLanguageDialect) && (value >= 0))
+      eciSetParam(handle, i, value);
+  }
+  for (i=0; i<eciNumVoiceParams; i++) {
+    eciSetVoiceParam(handle, 0, i, eciGetVoiceParam(engine->handle, 0, i));
+  }
+  if (dict && (dictionary_load(handle, engine->dictionary_loaded) != DictNoError))
+    goto exit0;
+
+  p->engine->capital_mode = engine->capital_mode;
+  eciRegisterCallback(handle, prefetch_callback, p);
+  if (eciSetOutputBuffer(handle, PREFETCH_SAMPLES, p->samples) == ECIFalse)
+    goto exit0;
+
+  t.buffer = tlv;
+  t.length = len;
+  t.charset = INOTE_CHARSET_UTF_8;
+  t.end_of_buffer = tlv + len;
+  if (inote_convert_tlv_to_text(&t, &p->engine->cb)
+      || (eciSynthesize(handle) == ECIFalse))
+    goto exit0;
+
+  p->state = PREFETCH_RUNNING;
+  dbg("LEAVE, input=%016llx", (long long unsigned int)p->engine->input);
+  return ECITrue;
+
+ exit0:
+  err("LEAVE, prefetch error");
+  prefetch_delete(engine);
+  return ECIFalse;
+}
+
+// prefetch_match returns true if the input and parameters of the
+// engine are those of its prefetch
+static bool prefetch_match(struct engine_t *engine)
+{
+  struct prefetch_t *p = engine->prefetch;
+  int i;
+
+  if (!p || p->playing || engine->speaking
+      || !engine->callback || !engine->cb_msg
+      || (engine->input != p->engine->input)
+      || (engine->capital_mode != p->engine->capital_mode))
+    return false;
+
+  for (i=0; i<eciNumParams; i++) {
+    if (eciGetParam(engine->handle, i) != eciGetParam(p->engine->handle, i))
+      return false;
+  }
+  for (i=0; i<eciNumVoiceParams; i++) {
+    if (eciGetVoiceParam(engine->handle, 0, i) != eciGetVoiceParam(p->engine->handle, 0, i))
+      return false;
+  }
+  return true;
+}
+
+// prefetch_speaking plays the recorded callbacks and lets the
+// prefetch engine go on; returns ECIFalse once the prefetch is over
+static Boolean prefetch_speaking(struct engine_t *engine)
+{
+  struct prefetch_t *p = engine->prefetch;
+
+  if ((prefetch_play(engine) != eciDataAbort)
+      && (p->state != PREFETCH_DONE)
+      && eciSpeaking(p->engine->handle))
+    return ECITrue;
+
+  prefetch_delete(engine);
+  return ECIFalse;
+}
+
+// prefetch_synchronize plays the whole prefetch
+static void prefetch_synchronize(struct engine_t *engine)
+{
+  struct prefetch_t *p = engine->prefetch;
+
+  if ((prefetch_play(engine) != eciDataAbort)
+      && (p->state != PREFETCH_DONE))
+    eciSynchronize(p->engine->handle);
+
+  prefetch_delete(engine);
+}
+
+// prefetch_run_next lets a prefetch engine synthesize; returns false
+// if there is none
+static bool prefetch_run_next()
+{
+  int i;
+
+  for (i=0; i<engine_top; i++) {
+    struct engine_t *engine = engine_slots[i].engine;
+    struct prefetch_t *p = engine ? engine->prefetch : NULL;
+    if (!p || p->playing || (p->state != PREFETCH_RUNNING))
+      continue;
+    if (!eciSpeaking(p->engine->handle) && (p->state == PREFETCH_RUNNING))
+      p->state = PREFETCH_DONE;
+    return true;
+  }
+  return false;
 }
 
 static int check_engine(struct engine_t *engine)
@@ -397,6 +1412,14 @@ int voxSetParam(void *handle, voxParam param, int value)
     ret = engine->capital_mode;
     engine->capital_mode = value;
     dbg("capital_mode=%d", value);
+  } else if (param == VOX_FIRST_CHUNK) {
+    if (value < 0)
+      return -1;
+    ret = engine->first_chunk;
+    engine->first_chunk = value;
+    dbg("first_chunk=%d", value);
+    if (engine->cb_msg && !engine_set_eci_buffer(engine))
+      ret = -1;
   } else {
     ret = eciSetParam(engine->handle, param, value);
   }
@@ -416,16 +1439,7 @@ static int unserialize(struct msg_t *msg, size_t *msg_length)
     return EINVAL;
   }
 
-  engine_index = msg->engine;
-  if (engine_index) {
-    engine_index -= ENGINE_INDEX;
-    if (engine_index >= ENGINE_MAX_NB) {
-      msg("recv erroneous engine"); 
-      return 0;
-    }
-  }
-
-  engine = engines[engine_index];
+  engine = engine_slot_get(msg->engine);
   {
     int err = 0;
     if (*msg_length < MIN_MSG_SIZE) {
@@ -443,6 +1457,9 @@ static int unserialize(struct msg_t *msg, size_t *msg_length)
     } else if (engine && !check_engine(engine)) {
       msg("id=0x%x, h=0x%x",engine->id, (unsigned int)engine->handle);
       err=5;
+    } else if (!engine && !engine_is_optional(msg->func)) {
+      msg("unknown or deleted engine=0x%x", msg->engine);
+      err=6;
     }
 
     if (err) {
@@ -468,6 +1485,9 @@ static int unserialize(struct msg_t *msg, size_t *msg_length)
 
   msg->effective_data_length = 0; 
 
+  if (engine && engine->dictionary_dir && engine_uses_dictionaries(msg->func))
+    engine_load_dictionaries(engine);
+
   switch(msg->func) {
   case MSG_ADD_TLV: {
     if (!engine || (length > TLV_MESSAGE_LENGTH_MAX)) {
@@ -496,6 +1516,7 @@ static int unserialize(struct msg_t *msg, size_t *msg_length)
   case MSG_ADD_TEXT:
     dbg("text=%s", (char*)msg->data);
     msg->res = (uint32_t)eciAddText(engine->handle, msg->data);
+    engine->input = input_hash(engine->input, 'T', msg->data, length);
     break;
 
   case MSG_CLEAR_ERRORS:
@@ -504,6 +1525,7 @@ static int unserialize(struct msg_t *msg, size_t *msg_length)
 
   case MSG_CLEAR_INPUT:
     eciClearInput(engine->handle);
+    engine->input = INPUT_HASH_INIT;
     break;
 
   case MSG_COPY_VOICE:
@@ -512,6 +1534,7 @@ static int unserialize(struct msg_t *msg, size_t *msg_length)
 
   case MSG_DELETE_DICT:
     msg->res = (uint32_t)eciDeleteDict(engine->handle, (char*)NULL + msg->args.dd.hDict);
+    engine_dictionaries_changed(engine);
     break;
 
   case MSG_ERROR_MESSAGE:
@@ -549,22 +1572,32 @@ static int unserialize(struct msg_t *msg, size_t *msg_length)
 
   case MSG_INSERT_INDEX:
     msg->res = (uint32_t)eciInsertIndex(engine->handle, msg->args.ii.iIndex);
+    engine->input = input_hash(engine->input, 'I', &msg->args.ii.iIndex, sizeof(msg->args.ii.iIndex));
     break;
 
   case MSG_LOAD_DICT:
     dbg("hDict=%p, DictVol=0x%x, filename=%s", (char*)NULL + msg->args.ld.hDict, msg->args.ld.DictVol, msg->data);
     msg->res = eciLoadDict(engine->handle, (char*)NULL + msg->args.ld.hDict, msg->args.ld.DictVol, msg->data);
+    engine_dictionaries_changed(engine);
+    break;
+
+  case MSG_DELETE:
+    engine_delete(engine);
+    engine_slot_delete(msg->engine);
+    msg->res = (uint32_t)NULL_ECI_HAND;
     break;
 
   case MSG_NEW:
-    if (engine_number >= ENGINE_MAX_NB) {
+    if (!engine_slot_is_available()) {
       err("error: max number of engines allocated");
-      return 0;
+      msg->res = 0;
+      break;
     }
-    engines[engine_number] = engine_create(eciNew());
-    // return index + ENGINE_INDEX (0 considered as error)
-    engine_index = engines[engine_number] ? ENGINE_INDEX + engine_number: 0;
-    engine_number++;
+    engine = engine_new(0);
+    // return the handle (0 considered as error)
+    engine_index = engine_slot_new(engine);
+    if (!engine_index)
+      engine_delete(engine);
     msg->res = engine_index;	
     break;
 	
@@ -573,14 +1606,16 @@ static int unserialize(struct msg_t *msg, size_t *msg_length)
     break;
 
   case MSG_NEW_EX:
-    if (engine_number >= ENGINE_MAX_NB) {
+    if (!engine_slot_is_available()) {
       err("error: max number of engines allocated");
-      return 0;
+      msg->res = 0;
+      break;
     }
-    engines[engine_number] = engine_create(eciNewEx(msg->args.ne.Value));
-    // return index + ENGINE_INDEX (0 considered as error)
-    engine_index = engines[engine_number] ? ENGINE_INDEX + engine_number: 0;
-    engine_number++;
+    engine = engine_new(msg->args.ne.Value);
+    // return the handle (0 considered as error)
+    engine_index = engine_slot_new(engine);
+    if (!engine_index)
+      engine_delete(engine);
     msg->res = engine_index;
     break;
     
@@ -598,11 +1633,15 @@ static int unserialize(struct msg_t *msg, size_t *msg_length)
       cb = my_callback;
     dbg("engine=%p, handle=%p, cb=%p", engine, engine->handle, cb);
     eciRegisterCallback(engine->handle, cb, engine);
+    engine->callback = (cb != NULL);
   }
     break;
     
   case MSG_RESET:
+    prefetch_delete(engine);
     eciReset(engine->handle);
+    engine->input = INPUT_HASH_INIT;
+    engine->speaking = false;
     break;
     
   case MSG_SET_DEFAULT_PARAM:
@@ -611,6 +1650,7 @@ static int unserialize(struct msg_t *msg, size_t *msg_length)
 
   case MSG_SET_DICT:
     msg->res = (uint32_t)eciSetDict(engine->handle, (char*)NULL + msg->args.sd.hDict);
+    engine_dictionaries_changed(engine);
     break;
 
   case MSG_SET_OUTPUT_DEVICE:
@@ -638,12 +1678,58 @@ static int unserialize(struct msg_t *msg, size_t *msg_length)
     msg->res = (uint32_t)eciSetOutputFilename(engine->handle, msg->data);
     break;
 
+  case MSG_VOX_LOAD_DICTIONARIES:
+    if (engine->dictionary_dir) {
+      free(engine->dictionary_dir);
+      engine->dictionary_dir = NULL;
+    }
+    if (msg->args.lds.deferred) {
+      engine->dictionary_dir = strdup((char*)msg->data);
+      msg->res = engine->dictionary_dir ? DictNoError : DictOutOfMemory;
+    } else {
+      msg->res = engine_load_dir(engine, (char*)msg->data);
+    }
+    break;
+
+  case MSG_VOX_PREFETCH:
+    msg->res = (uint32_t)prefetch_start(engine, msg->data, length);
+    break;
+
+  case MSG_VOX_SET_STATE:
+    set_state(engine, msg, length);
+    break;
+
+  case MSG_VOX_GET_MEMORY:
+    msg->args.gm.engine = engine->memory;
+    msg->args.gm.engines = engine_memory;
+    msg->res = ECITrue;
+    break;
+
   case MSG_SYNTHESIZE:
-    msg->res = (uint32_t)eciSynthesize(engine->handle);
+    msg->args.sy.prefetched = 0;
+    if (!engine_alloc_output_buffer(engine)) {
+      msg->res = ECIFalse;
+    } else if (prefetch_match(engine)) {
+      // the prefetched synthesis replaces the input
+      dbg("prefetch hit, input=%016llx", (long long unsigned int)engine->input);
+      eciClearInput(engine->handle);
+      engine->prefetch->playing = true;
+      msg->args.sy.prefetched = 1;
+      msg->res = ECITrue;
+    } else {
+      msg->res = (uint32_t)eciSynthesize(engine->handle);
+      engine->speaking = true;
+    }
+    engine->input = INPUT_HASH_INIT;
     break;
 
   case MSG_SYNCHRONIZE:
+    if (engine->prefetch && engine->prefetch->playing)
+      prefetch_synchronize(engine);
     msg->res = (uint32_t)eciSynchronize(engine->handle);
+    engine_flush_events(engine);
+    engine->speaking = false;
+    engine->chunk_size = engine->first_chunk;
     engine->tlv_number = 0;
     engine->first_tlv_type = INOTE_TYPE_UNDEFINED;
     engine->audio_sample_received = 0;
@@ -654,11 +1740,23 @@ static int unserialize(struct msg_t *msg, size_t *msg_length)
     break;
 
   case MSG_SPEAKING:
-    msg->res = (uint32_t)eciSpeaking(engine->handle);
+    if (engine->prefetch && engine->prefetch->playing && prefetch_speaking(engine)) {
+      msg->res = ECITrue;
+    } else {
+      msg->res = (uint32_t)eciSpeaking(engine->handle);
+      engine->speaking = msg->res;
+    }
+    engine_flush_events(engine);
     break;
 
   case MSG_STOP:
+    prefetch_delete(engine);
     msg->res = (uint32_t)eciStop(engine->handle);
+    engine->input = INPUT_HASH_INIT;
+    engine->speaking = false;
+    engine->nb_events = 0;
+    engine->nb_staged = 0;
+    engine->chunk_size = engine->first_chunk;
     break;
 
   case MSG_VERSION:
@@ -757,6 +1855,15 @@ static int unserialize(struct msg_t *msg, size_t *msg_length)
   }
     break;
 
+  case MSG_VOX_SET_ENGINE_POOL:
+    engine_pool_set(msg->args.ep.Value, msg->args.ep.nb);
+    msg->res = ECITrue;
+    break;
+
+  case MSG_VOX_SET_REALTIME:
+    set_realtime(my_voxind, msg);
+    break;
+
   default:
     msg->res = ECIFalse;
     break;
@@ -771,6 +1878,247 @@ static int unserialize(struct msg_t *msg, size_t *msg_length)
 }
 
 
+#ifdef VOXIND_DIRECT
+
+// direct mode: libvoxind.so loaded by libvoxin (see direct.h). The
+// idle time tasks of the command loop are run by the idle thread,
+// exclusively with the calls: the deferred dictionaries are loaded and
+// the prefetches progress between the calls.
+static pthread_mutex_t direct_mutex = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP; // a user callback may call the api
+static pthread_cond_t direct_cond = PTHREAD_COND_INITIALIZER; // signaled after each call
+static pthread_t direct_thread;
+static bool direct_quit;
+static uint32_t direct_calls; // number of processed calls
+static uint32_t direct_waiting; // calls waiting for the mutex
+
+// direct_idle runs the idle time tasks while no call is processed
+static void *direct_idle(void *arg)
+{
+  struct sched_param param;
+  int policy;
+
+  ENTER();
+  // scheduling inherited from the thread of the application
+  if (!pthread_getschedparam(pthread_self(), &policy, &param))
+    prefetch_disabled = (policy == SCHED_FIFO) || (policy == SCHED_RR);
+  pthread_mutex_lock(&direct_mutex);
+  while (!direct_quit) {
+    uint32_t calls = direct_calls;
+    struct timespec t;
+
+    if (__atomic_load_n(&direct_waiting, __ATOMIC_SEQ_CST)) {
+      pthread_cond_wait(&direct_cond, &direct_mutex);
+      continue;
+    }
+
+    if (engine_load_next_dictionaries() || prefetch_run_next())
+      continue;
+
+    clock_gettime(CLOCK_REALTIME, &t);
+    t.tv_nsec += ENGINE_POOL_DELAY_IN_MS*1000000L;
+    if (t.tv_nsec >= 1000000000L) {
+      t.tv_sec++;
+      t.tv_nsec -= 1000000000L;
+    }
+    if (!pthread_cond_timedwait(&direct_cond, &direct_mutex, &t)
+	|| direct_quit || (calls != direct_calls))
+      continue; // not idle
+
+    if (!engine_pool_refill())
+      pthread_cond_wait(&direct_cond, &direct_mutex); // until the next call
+  }
+  pthread_mutex_unlock(&direct_mutex);
+  LEAVE();
+  return NULL;
+}
+
+int voxind_direct_create(direct_app_cb app, void *data)
+{
+  static char tag[8];
+  int res;
+
+  // distinct from the log of libvoxin, e.g. /tmp/libvoxin.log.<tid>.eci
+  snprintf(tag, sizeof(tag), ".%s", msg_tts_id_string(MSG_TTS(MSG_TO_ECI_ID)));
+  libvoxinDebugSetTag(tag);
+  ENTER();
+  BUILD_ASSERT(PIPE_MAX_BLOCK > MIN_MSG_SIZE);
+  BUILD_ASSERT(PIPE_MAX_BLOCK > TLV_MESSAGE_LENGTH_MAX);
+
+  if (!app)
+    return EINVAL;
+  if (my_voxind)
+    return EEXIST;
+
+  my_voxind = calloc(1, sizeof(struct voxind_t));
+  if (!my_voxind)
+    return errno;
+
+  my_voxind->app = app;
+  my_voxind->app_data = data;
+
+  direct_quit = false;
+  res = pthread_create(&direct_thread, NULL, direct_idle, NULL);
+  if (res) {
+    err("thread error (%d)", res);
+    free(my_voxind);
+    my_voxind = NULL;
+    return res;
+  }
+  return 0;
+}
+
+int voxind_direct_call(struct msg_t *msg, size_t *msg_length)
+{
+  int res;
+
+  if (!my_voxind)
+    return EINVAL;
+
+  __atomic_add_fetch(&direct_waiting, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_lock(&direct_mutex);
+  __atomic_sub_fetch(&direct_waiting, 1, __ATOMIC_SEQ_CST);
+  res = unserialize(msg, msg_length);
+  direct_calls++;
+  pthread_cond_broadcast(&direct_cond);
+  pthread_mutex_unlock(&direct_mutex);
+  return res;
+}
+
+void voxind_direct_delete()
+{
+  int i;
+
+  ENTER();
+
+  if (!my_voxind)
+    return;
+
+  pthread_mutex_lock(&direct_mutex);
+  direct_quit = true;
+  pthread_cond_broadcast(&direct_cond);
+  pthread_mutex_unlock(&direct_mutex);
+  pthread_join(direct_thread, NULL);
+
+  engine_pool_set(MSG_ENGINE_POOL_ANY, 0);
+  for (i=0; i<engine_top; i++) {
+    struct engine_t *engine = engine_slots[i].engine;
+    if (engine) {
+      engine_slot_delete(engine_slot_get_handle(i));
+      engine_delete(engine);
+    }
+  }
+  free(my_voxind);
+  my_voxind = NULL;
+}
+
+#else
+
+// voxind_is_idle returns true if no message is received within
+// timeout_in_ms
+static bool voxind_is_idle(struct voxind_t *v, int timeout_in_ms)
+{
+  struct pollfd pfd;
+  struct pipe_t *p = v->pipe_command;
+
+  pfd.fd = p->sv[p->ind];
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  return (poll(&pfd, 1, timeout_in_ms) == 0);
+}
+
+// broker_run listens on path and forks a worker for each client; only
+// returns in a worker, its command pipe connected to the client
+static int broker_run(struct voxind_t *v, const char *path)
+{
+  struct broker_hello_t hello;
+  int listen_fd = -1;
+  int nb_workers = 0;
+  int idle_ms = 0;
+  ssize_t len;
+  pid_t pid;
+  int res;
+  int i;
+
+  ENTER();
+
+  res = broker_listen(path, &listen_fd);
+  if (res) // e.g. EADDRINUSE: a broker is already running
+    return res;
+
+  // the client which started the broker waits for the end of this
+  // process: the socket is ready
+  pid = fork();
+  if (pid == -1) {
+    res = errno;
+    broker_close(path, listen_fd);
+    return res;
+  }
+  if (pid)
+    _exit(0);
+
+  // an idle engine initialized once and inherited by the workers
+  engine_pool_set(0, 1);
+  while (engine_pool_refill());
+  msg("broker ready: %s", path);
+
+  while (1) {
+    struct pollfd pfd;
+    int fd;
+
+    while (waitpid(-1, NULL, WNOHANG) > 0)
+      nb_workers--;
+
+    pfd.fd = listen_fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    res = poll(&pfd, 1, BROKER_POLL_IN_MS);
+    if ((res == -1) && (errno != EINTR)) {
+      res = errno;
+      break;
+    }
+    if (res <= 0) {
+      idle_ms = nb_workers ? 0 : idle_ms + BROKER_POLL_IN_MS;
+      if (idle_ms >= BROKER_LINGER_IN_MS) {
+	res = 0;
+	break;
+      }
+      continue;
+    }
+    idle_ms = 0;
+
+    if (broker_accept(listen_fd, &fd))
+      continue;
+
+    pid = fork();
+    if (!pid) {
+      close(listen_fd);
+      libvoxinDebugFinish(); // log file of the worker
+      // the inherited engine is kept, the worker does not refill
+      for (i=0; i<engine_pool_number; i++)
+	engine_pools[i].nb_max = engine_pool_default;
+      res = pipe_restore(&v->pipe_command, fd, READ_TIMEOUT_IN_MS);
+      if (res)
+	_exit(EXIT_FAILURE);
+      hello.pid = getpid();
+      len = sizeof(hello);
+      if (pipe_write(v->pipe_command, &hello, &len))
+	_exit(EXIT_FAILURE);
+      msg("worker of %s", path);
+      return 0;
+    }
+    if (pid == -1) {
+      err("fork error (%d)", errno);
+    } else {
+      nb_workers++;
+    }
+    close(fd);
+  }
+
+  msg("broker exits (%d)", res);
+  broker_close(path, listen_fd);
+  exit(res ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
 #ifdef DEBUG
 #define VOXIND_DBG "/tmp/test_voxind"
 #endif
@@ -817,8 +2165,11 @@ int main(int argc, char **argv)
     goto exit0;
   }
   my_voxind->msg_length = PIPE_MAX_BLOCK;
-  
-  res = pipe_restore(&my_voxind->pipe_command, PIPE_COMMAND_FILENO, READ_TIMEOUT_IN_MS);
+
+  if ((argc == 3) && !strcmp(argv[1], BROKER_ARG))
+    res = broker_run(my_voxind, argv[2]);
+  else
+    res = pipe_restore(&my_voxind->pipe_command, PIPE_COMMAND_FILENO, READ_TIMEOUT_IN_MS);
   if (res)
     goto exit0;
 
@@ -826,8 +2177,11 @@ int main(int argc, char **argv)
   
   do {
     size_t msg_length = my_voxind->msg_length;
-    if(pipe_read(my_voxind->pipe_command, my_voxind->msg, &msg_length))
-      goto exit0;
+    while (voxind_is_idle(my_voxind, 0)
+	   && (engine_load_next_dictionaries() || prefetch_run_next()
+	       || (voxind_is_idle(my_voxind, ENGINE_POOL_DELAY_IN_MS) && engine_pool_refill())));
+    if(pipe_read(my_voxind->pipe_command, my_voxind->msg, &msg_length) || !msg_length)
+      goto exit0; // error or no more client
     if (unserialize(my_voxind->msg, &msg_length))
       goto exit0;
     pipe_write(my_voxind->pipe_command, my_voxind->msg, &msg_length);    
@@ -838,6 +2192,8 @@ int main(int argc, char **argv)
   return res;
 }
 
+#endif
+
 /* local variables: */
 /* c-basic-offset: 2 */
 /* end: */